@@ -0,0 +1,97 @@
+/**
+ * @file benchmarks/benchmark_menu.cpp
+ * @brief Menu construction at various widths and depths.
+ */
+// standard includes
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "benchmarks/fake_daemon.h"
+#include "benchmarks/menu_builder.h"
+#include "src/tray.h"
+
+namespace {
+  void menuShapes(benchmark::internal::Benchmark *b) {
+    for (int width : {4, 16, 64}) {
+      for (int depth : {1, 3}) {
+        b->Args({width, depth});
+      }
+    }
+    b->ArgNames({"width", "depth"});
+  }
+}  // namespace
+
+static void BM_MenuFileLoad(benchmark::State &state) {
+  MenuBuilder builder(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+  std::string path = "tray-benchmark-menu.json";
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << builder.json();
+
+  for (auto _ : state) {
+    struct tray_menu *menu = tray_menu_load(path.c_str());
+    benchmark::DoNotOptimize(menu);
+    tray_menu_free(menu);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * builder.count()));
+  std::remove(path.c_str());
+}
+
+BENCHMARK(BM_MenuFileLoad)->Apply(menuShapes);
+
+#if TRAY_DAEMON_CLIENT
+/**
+ * @brief Full menu rebuilds: every update changes the menu shape.
+ */
+static void BM_DaemonMenuReplace(benchmark::State &state) {
+  FakeDaemon daemon;
+  MenuBuilder a(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+  MenuBuilder b(static_cast<int>(state.range(0)) + 1, static_cast<int>(state.range(1)));
+  struct tray tray = {.icon = "icon", .tooltip = "benchmark", .menu = a.menu()};
+  tray_set_backend("daemon");
+  if (tray_init(&tray) != 0) {
+    state.SkipWithError("tray_init() failed");
+    return;
+  }
+
+  bool flip = false;
+  for (auto _ : state) {
+    tray.menu = (flip = !flip) ? b.menu() : a.menu();
+    tray_update(&tray);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * a.count()));
+  tray_exit();
+  tray_loop(0);
+  tray_set_backend(nullptr);
+}
+
+BENCHMARK(BM_DaemonMenuReplace)->Apply(menuShapes);
+
+/**
+ * @brief Incremental updates: every update toggles one checkbox.
+ */
+static void BM_DaemonMenuItemUpdate(benchmark::State &state) {
+  FakeDaemon daemon;
+  MenuBuilder builder(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+  struct tray tray = {.icon = "icon", .tooltip = "benchmark", .menu = builder.menu()};
+  tray_set_backend("daemon");
+  if (tray_init(&tray) != 0) {
+    state.SkipWithError("tray_init() failed");
+    return;
+  }
+
+  struct tray_menu *last = &tray.menu[state.range(0) - 1];
+  for (auto _ : state) {
+    last->checked = !last->checked;
+    tray_update(&tray);
+  }
+  tray_exit();
+  tray_loop(0);
+  tray_set_backend(nullptr);
+}
+
+BENCHMARK(BM_DaemonMenuItemUpdate)->Apply(menuShapes);
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file benchmarks/benchmark_support.cpp
+ * @brief Icon cache lookups and log formatting.
+ */
+// standard includes
+#include <string>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_icon_cache.h"
+#include "src/tray_internal.h"
+
+namespace {
+  std::vector<std::string> iconPaths(size_t count) {
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < count; ++i) {
+      paths.push_back("/usr/share/icons/hicolor/32x32/apps/application-" + std::to_string(i) + ".png");
+    }
+    return paths;
+  }
+
+  void discard(enum tray_log_level, const char *message) {
+    benchmark::DoNotOptimize(message);
+  }
+}  // namespace
+
+static void BM_IconCacheHit(benchmark::State &state) {
+  std::vector<std::string> paths = iconPaths(static_cast<size_t>(state.range(0)));
+  struct tray_icon_cache cache;
+  tray_icon_cache_init(&cache, nullptr);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    tray_icon_cache_insert(&cache, paths[i].c_str(), &paths[i]);
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tray_icon_cache_find(&cache, paths[i].c_str()));
+    i = i + 1 < paths.size() ? i + 1 : 0;
+  }
+  tray_icon_cache_clear(&cache);
+}
+
+BENCHMARK(BM_IconCacheHit)->RangeMultiplier(8)->Range(1, 512);
+
+static void BM_IconCacheMiss(benchmark::State &state) {
+  std::vector<std::string> paths = iconPaths(static_cast<size_t>(state.range(0)));
+  struct tray_icon_cache cache;
+  tray_icon_cache_init(&cache, nullptr);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    tray_icon_cache_insert(&cache, paths[i].c_str(), &paths[i]);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tray_icon_cache_find(&cache, "/usr/share/icons/not-cached.png"));
+  }
+  tray_icon_cache_clear(&cache);
+}
+
+BENCHMARK(BM_IconCacheMiss)->RangeMultiplier(8)->Range(1, 512);
+
+static void BM_LogFormat(benchmark::State &state) {
+  tray_set_log_callback(discard);
+  for (auto _ : state) {
+    tray_log(TRAY_LOG_WARNING, "Shell_NotifyIcon(%s) failed: %lu (attempt %d)", "NIM_ADD", 1460UL, 3);
+  }
+  tray_set_log_callback(nullptr);
+}
+
+BENCHMARK(BM_LogFormat);
+
+// Cost on the logging thread when records are queued for another thread to deliver
+static void BM_LogAsync(benchmark::State &state) {
+  tray_set_log_callback(discard);
+  tray_set_log_mode(TRAY_LOG_ASYNC_MANUAL);
+  int queued = 0;
+  for (auto _ : state) {
+    tray_log(TRAY_LOG_WARNING, "Shell_NotifyIcon(%s) failed: %lu (attempt %d)", "NIM_ADD", 1460UL, 3);
+    if (++queued == 64) {
+      state.PauseTiming();
+      tray_log_drain();
+      queued = 0;
+      state.ResumeTiming();
+    }
+  }
+  tray_set_log_mode(TRAY_LOG_SYNC);
+  tray_set_log_callback(nullptr);
+}
+
+BENCHMARK(BM_LogAsync);
+
+static void BM_LogWithoutCallback(benchmark::State &state) {
+  tray_set_log_callback(nullptr);
+  for (auto _ : state) {
+    tray_log(TRAY_LOG_DEBUG, "Shell_NotifyIcon(%s) failed: %lu (attempt %d)", "NIM_ADD", 1460UL, 3);
+  }
+}
+
+BENCHMARK(BM_LogWithoutCallback);
@@ -0,0 +1,103 @@
+/**
+ * @file benchmarks/benchmark_update.cpp
+ * @brief Cross-thread tray_update() throughput and latency, and notification dispatch.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "benchmarks/fake_daemon.h"
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  // Shared by the producer threads of one BM_CrossThreadUpdate run
+  struct tray updateTray = {.icon = "icon", .tooltip = "benchmark"};
+  std::thread updateLoop;
+  std::atomic<bool> updateLoopReady {false};
+
+  double percentile(std::vector<double> &samples, double fraction) {
+    if (samples.empty()) {
+      return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(index), samples.end());
+    return samples[index];
+  }
+}  // namespace
+
+/**
+ * @brief tray_update() from 1..N producer threads against one loop thread.
+ *
+ * Each call blocks until the loop thread has applied it, so items_per_second
+ * is the update throughput and p50_us/p99_us the latency seen by a producer.
+ */
+static void BM_CrossThreadUpdate(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    // The loop thread initializes the tray so that it owns the loop from the start
+    tray_set_backend("headless");
+    updateLoopReady = false;
+    updateLoop = std::thread([]() {
+      int result = tray_init(&updateTray);
+      updateLoopReady = true;
+      while (result == 0 && tray_loop(1) == 0) {}
+    });
+    while (!updateLoopReady) {
+      std::this_thread::yield();
+    }
+  }
+
+  std::vector<double> latencies;
+  latencies.reserve(1 << 16);
+  for (auto _ : state) {
+    unsigned long long start = tray_now_us();
+    tray_update(&updateTray);
+    latencies.push_back(static_cast<double>(tray_now_us() - start));
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["p50_us"] = benchmark::Counter(percentile(latencies, 0.50), benchmark::Counter::kAvgThreads);
+  state.counters["p99_us"] = benchmark::Counter(percentile(latencies, 0.99), benchmark::Counter::kAvgThreads);
+
+  if (state.thread_index() == 0) {
+    tray_exit();
+    updateLoop.join();
+    tray_set_backend(nullptr);
+  }
+}
+
+BENCHMARK(BM_CrossThreadUpdate)->ThreadRange(1, 16)->UseRealTime();
+
+#if TRAY_DAEMON_CLIENT
+/**
+ * @brief Cost of posting a notification through tray_update().
+ */
+static void BM_NotificationDispatch(benchmark::State &state) {
+  FakeDaemon daemon;
+  struct tray tray = {.icon = "icon", .tooltip = "benchmark"};
+  tray_set_backend("daemon");
+  if (tray_init(&tray) != 0) {
+    state.SkipWithError("tray_init() failed");
+    return;
+  }
+
+  tray.notification_title = "Benchmark";
+  tray.notification_text = "A notification with a realistic amount of text in it";
+  tray.notification_icon = "icon";
+  for (auto _ : state) {
+    tray_update(&tray);
+  }
+  tray_exit();
+  tray_loop(0);
+  tray_set_backend(nullptr);
+}
+
+BENCHMARK(BM_NotificationDispatch);
+#endif
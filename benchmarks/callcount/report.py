@@ -0,0 +1,67 @@
+# standard imports
+import argparse
+import collections
+import csv
+import statistics
+
+
+def percentile(values: list, fraction: float) -> float:
+    """
+    Nearest-rank percentile of a non-empty list.
+    """
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def load(path: str):
+    """
+    Read a tray_callcount.tsv file into {update: {function: (calls, ns)}}.
+    """
+    updates = collections.defaultdict(dict)
+    with open(path, newline='') as f:
+        for row in csv.DictReader(f, delimiter='\t'):
+            updates[int(row['update'])][row['function']] = (int(row['calls']), int(row['ns']))
+    return updates
+
+
+def main():
+    """
+    Main entry point.
+    """
+    parser = argparse.ArgumentParser(description='Summarize the toolkit calls recorded by tray_callcount.')
+    parser.add_argument('path', nargs='?', default='tray_callcount.tsv', help='file written by tray_callcount')
+    args = parser.parse_args()
+
+    updates = load(args.path)
+    outside = updates.pop(0, {})
+    if not updates:
+        print('No tray_update() calls were recorded')
+        return
+
+    update_ns = [calls['tray_update'][1] for calls in updates.values()]
+    print(f'{len(updates)} updates, tray_update() p50 {percentile(update_ns, 0.50) / 1000:.1f} us, '
+          f'p99 {percentile(update_ns, 0.99) / 1000:.1f} us, mean {statistics.mean(update_ns) / 1000:.1f} us')
+    print()
+
+    totals = collections.defaultdict(lambda: [0, 0])
+    for calls in updates.values():
+        for function, (count, ns) in calls.items():
+            if function != 'tray_update':
+                totals[function][0] += count
+                totals[function][1] += ns
+
+    print(f'{"function":<40} {"calls/update":>12} {"us/update":>10} {"ns/call":>8} {"share":>6}')
+    total_update_ns = sum(update_ns)
+    for function, (count, ns) in sorted(totals.items(), key=lambda item: -item[1][1]):
+        print(f'{function:<40} {count / len(updates):>12.1f} {ns / len(updates) / 1000:>10.1f} '
+              f'{ns / count:>8.0f} {100 * ns / total_update_ns:>5.1f}%')
+
+    if outside:
+        print()
+        print('Outside of tray_update(), e.g. the first update after tray_init():')
+        for function, (count, ns) in sorted(outside.items(), key=lambda item: -item[1][1]):
+            print(f'{function:<40} {count:>12} calls {ns / 1000:>10.1f} us')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,187 @@
+/**
+ * @file benchmarks/callcount/tray_callcount.c
+ * @brief Counts and times the toolkit calls of the Linux backend, per tray_update().
+ *
+ * Link an application with the tray_callcount CMake target: it passes
+ * -Wl,--wrap=<function> for tray_update() and every toolkit function listed
+ * below, so the calls made by the tray sources land here first. Calls are
+ * attributed to the tray_update() in progress, wherever they run; updates that
+ * overlap in time, e.g. from several threads, are reported as one. Calls made
+ * outside of any tray_update(), like the deferred first update, are reported
+ * as update 0.
+ *
+ * At exit the counters are written to TRAY_CALLCOUNT_OUT (tray_callcount.tsv by
+ * default), one line per update and function, for benchmarks/callcount/report.py.
+ *
+ * TRAY_DLOPEN builds call AppIndicator and libnotify through function pointers,
+ * which cannot be wrapped.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// lib includes
+#ifdef TRAY_AYATANA_APPINDICATOR
+  #include <libayatana-appindicator/app-indicator.h>
+#elif TRAY_LEGACY_APPINDICATOR
+  #include <libappindicator/app-indicator.h>
+#endif
+#include <libnotify/notify.h>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_thread.h"
+
+// Keep in sync with TRAY_CALLCOUNT_WRAPPED in benchmarks/CMakeLists.txt
+#define TRAY_CALLCOUNT_FUNCTIONS(X) \
+  X(GtkWidget *, gtk_menu_new, (void), ()) \
+  X(GtkWidget *, gtk_menu_item_new_with_label, (const gchar *label), (label)) \
+  X(GtkWidget *, gtk_check_menu_item_new_with_label, (const gchar *label), (label)) \
+  X(GtkWidget *, gtk_separator_menu_item_new, (void), ()) \
+  X(gulong, g_signal_connect_data, (gpointer instance, const gchar *signal, GCallback handler, gpointer data, GClosureNotify destroy, GConnectFlags flags), (instance, signal, handler, data, destroy, flags)) \
+  X(NotifyNotification *, notify_notification_new, (const char *summary, const char *body, const char *icon), (summary, body, icon)) \
+  X(gboolean, notify_notification_show, (NotifyNotification *notification, GError **error), (notification, error)) \
+  X(gboolean, notify_notification_close, (NotifyNotification *notification, GError **error), (notification, error))
+#define TRAY_CALLCOUNT_VOID_FUNCTIONS(X) \
+  X(gtk_menu_shell_append, (GtkMenuShell *shell, GtkWidget *child), (shell, child)) \
+  X(gtk_menu_item_set_submenu, (GtkMenuItem *item, GtkWidget *submenu), (item, submenu)) \
+  X(gtk_check_menu_item_set_active, (GtkCheckMenuItem *item, gboolean active), (item, active)) \
+  X(gtk_widget_set_sensitive, (GtkWidget *widget, gboolean sensitive), (widget, sensitive)) \
+  X(gtk_widget_show, (GtkWidget *widget), (widget)) \
+  X(gtk_widget_destroy, (GtkWidget *widget), (widget)) \
+  X(app_indicator_set_icon_full, (AppIndicator *indicator, const gchar *icon, const gchar *description), (indicator, icon, description)) \
+  X(app_indicator_set_menu, (AppIndicator *indicator, GtkMenu *menu), (indicator, menu))
+
+#define TRAY_CALLCOUNT_ID(ret, name, params, args) CALL_##name,
+#define TRAY_CALLCOUNT_VOID_ID(name, params, args) CALL_##name,
+#define TRAY_CALLCOUNT_NAME(ret, name, params, args) #name,
+#define TRAY_CALLCOUNT_VOID_NAME(name, params, args) #name,
+
+enum call_id {
+  TRAY_CALLCOUNT_FUNCTIONS(TRAY_CALLCOUNT_ID)
+  TRAY_CALLCOUNT_VOID_FUNCTIONS(TRAY_CALLCOUNT_VOID_ID)
+  CALL_COUNT
+};
+
+static const char *call_names[CALL_COUNT] = {
+  TRAY_CALLCOUNT_FUNCTIONS(TRAY_CALLCOUNT_NAME)
+  TRAY_CALLCOUNT_VOID_FUNCTIONS(TRAY_CALLCOUNT_VOID_NAME)
+};
+
+/**
+ * @brief Counters of one update.
+ */
+struct update_record {
+  unsigned long long update_ns;  ///< Time spent in tray_update(), 0 for update 0.
+  unsigned long long calls[CALL_COUNT];  ///< Calls by call_id.
+  unsigned long long ns[CALL_COUNT];  ///< Time spent in the calls by call_id.
+};
+
+static tray_mutex_t callcount_mutex = TRAY_MUTEX_INITIALIZER;
+static struct update_record outside;  // calls outside of any tray_update()
+static struct update_record current;  // calls of the tray_update() calls in progress
+static unsigned int active_updates = 0;
+static unsigned long long current_start_ns = 0;
+static struct update_record *records = NULL;  // finished updates, written at exit
+static size_t record_count = 0;
+static size_t record_capacity = 0;
+static bool report_registered = false;
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static void write_report(void) {
+  const char *path = getenv("TRAY_CALLCOUNT_OUT");
+  FILE *out = fopen(path != NULL && path[0] != '\0' ? path : "tray_callcount.tsv", "w");
+  if (out == NULL) {
+    perror("tray_callcount");
+    return;
+  }
+  fprintf(out, "update\tfunction\tcalls\tns\n");
+  tray_mutex_lock(&callcount_mutex);
+  for (size_t i = 0; i <= record_count; ++i) {
+    const struct update_record *record = i == 0 ? &outside : &records[i - 1];
+    if (i > 0) {
+      fprintf(out, "%zu\ttray_update\t1\t%llu\n", i, record->update_ns);
+    }
+    for (int call = 0; call < CALL_COUNT; ++call) {
+      if (record->calls[call] > 0) {
+        fprintf(out, "%zu\t%s\t%llu\t%llu\n", i, call_names[call], record->calls[call], record->ns[call]);
+      }
+    }
+  }
+  tray_mutex_unlock(&callcount_mutex);
+  fclose(out);
+}
+
+static void record_call(enum call_id call, unsigned long long start_ns) {
+  unsigned long long ns = now_ns() - start_ns;
+  tray_mutex_lock(&callcount_mutex);
+  struct update_record *record = active_updates > 0 ? &current : &outside;
+  ++record->calls[call];
+  record->ns[call] += ns;
+  if (!report_registered) {
+    report_registered = true;
+    atexit(write_report);
+  }
+  tray_mutex_unlock(&callcount_mutex);
+}
+
+#define TRAY_CALLCOUNT_WRAP(ret, name, params, args) \
+  ret __real_##name params; \
+  ret __wrap_##name params { \
+    unsigned long long start_ns = now_ns(); \
+    ret result = __real_##name args; \
+    record_call(CALL_##name, start_ns); \
+    return result; \
+  }
+#define TRAY_CALLCOUNT_WRAP_VOID(name, params, args) \
+  void __real_##name params; \
+  void __wrap_##name params { \
+    unsigned long long start_ns = now_ns(); \
+    __real_##name args; \
+    record_call(CALL_##name, start_ns); \
+  }
+
+TRAY_CALLCOUNT_FUNCTIONS(TRAY_CALLCOUNT_WRAP)
+TRAY_CALLCOUNT_VOID_FUNCTIONS(TRAY_CALLCOUNT_WRAP_VOID)
+
+void __real_tray_update(struct tray *tray);
+
+void __wrap_tray_update(struct tray *tray) {
+  tray_mutex_lock(&callcount_mutex);
+  if (active_updates++ == 0) {
+    memset(&current, 0, sizeof(current));
+    current_start_ns = now_ns();
+  }
+  tray_mutex_unlock(&callcount_mutex);
+
+  __real_tray_update(tray);
+
+  tray_mutex_lock(&callcount_mutex);
+  if (--active_updates == 0) {
+    current.update_ns = now_ns() - current_start_ns;
+    if (record_count == record_capacity) {
+      size_t capacity = record_capacity != 0 ? record_capacity * 2 : 256;
+      struct update_record *grown = realloc(records, capacity * sizeof(*records));
+      if (grown != NULL) {
+        records = grown;
+        record_capacity = capacity;
+      }
+    }
+    if (record_count < record_capacity) {
+      records[record_count++] = current;
+    }
+  }
+  if (!report_registered) {
+    report_registered = true;
+    atexit(write_report);
+  }
+  tray_mutex_unlock(&callcount_mutex);
+}
@@ -0,0 +1,342 @@
+/**
+ * @file benchmarks/click_latency.cpp
+ * @brief Time from a menu item activation on D-Bus until its callback runs, on Linux.
+ *
+ * The process plays both sides: the tray runs on its own loop thread, and a
+ * minimal org.kde.StatusNotifierWatcher on a second bus connection accepts its
+ * registration. Clicks are sent the way a tray host sends them, as dbusmenu
+ * "clicked" events, optionally while another thread keeps calling tray_update().
+ *
+ * It needs an X server and a session bus; benchmarks/run_click_benchmark.sh
+ * starts private ones.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+#include <gio/gio.h>
+
+// local includes
+#include "benchmarks/menu_builder.h"
+#include "src/tray.h"
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  constexpr auto clickTimeout = std::chrono::milliseconds(500);  ///< A click without a callback by then is counted as lost.
+  constexpr auto registerTimeout = std::chrono::seconds(10);
+
+  const char *watcherXml =
+    "<node>"
+    "  <interface name='org.kde.StatusNotifierWatcher'>"
+    "    <method name='RegisterStatusNotifierItem'><arg name='service' type='s' direction='in'/></method>"
+    "    <method name='RegisterStatusNotifierHost'><arg name='service' type='s' direction='in'/></method>"
+    "    <property name='RegisteredStatusNotifierItems' type='as' access='read'/>"
+    "    <property name='IsStatusNotifierHostRegistered' type='b' access='read'/>"
+    "    <property name='ProtocolVersion' type='i' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+  /**
+   * @brief The smallest StatusNotifier host a tray will register with.
+   */
+  class StubWatcher {
+  public:
+    StubWatcher() {
+      thread = std::thread([this]() {
+        run();
+      });
+    }
+
+    ~StubWatcher() {
+      if (loop != nullptr) {
+        g_main_context_invoke(context, [](gpointer data) -> gboolean {
+          g_main_loop_quit(static_cast<GMainLoop *>(data));
+          return G_SOURCE_REMOVE;
+        }, loop);
+      }
+      thread.join();
+    }
+
+    /**
+     * @brief Wait for a tray to register and look up its menu.
+     * @return true once busName and menuPath are set.
+     */
+    bool waitForItem() {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (!cv.wait_for(lock, registerTimeout, [this]() { return !itemBus.empty() || failed; }) || failed) {
+        return false;
+      }
+      GError *error = nullptr;
+      GVariant *reply = g_dbus_connection_call_sync(
+        connection, itemBus.c_str(), itemPath.c_str(), "org.freedesktop.DBus.Properties", "Get",
+        g_variant_new("(ss)", "org.kde.StatusNotifierItem", "Menu"), G_VARIANT_TYPE("(v)"),
+        G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &error
+      );
+      if (reply == nullptr) {
+        std::cerr << "Reading the Menu property failed: " << error->message << std::endl;
+        g_clear_error(&error);
+        return false;
+      }
+      GVariant *value = nullptr;
+      g_variant_get(reply, "(v)", &value);
+      menuPath = g_variant_get_string(value, nullptr);
+      g_variant_unref(value);
+      g_variant_unref(reply);
+      return true;
+    }
+
+    /**
+     * @brief Find the dbusmenu id of a top-level item by its label.
+     * @return The id, or -1 if there is no such item.
+     */
+    int findItem(const char *label) {
+      GVariant *reply = g_dbus_connection_call_sync(
+        connection, itemBus.c_str(), menuPath.c_str(), "com.canonical.dbusmenu", "GetLayout",
+        g_variant_new("(ii@as)", 0, 1, g_variant_new_strv(nullptr, 0)), G_VARIANT_TYPE("(u(ia{sv}av))"),
+        G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr
+      );
+      if (reply == nullptr) {
+        return -1;
+      }
+      int found = -1;
+      GVariant *layout = g_variant_get_child_value(reply, 1);
+      GVariant *children = g_variant_get_child_value(layout, 2);
+      for (gsize i = 0; found < 0 && i < g_variant_n_children(children); ++i) {
+        GVariant *child = g_variant_get_child_value(children, i);
+        GVariant *item = g_variant_get_variant(child);
+        gint32 id = 0;
+        GVariant *properties = nullptr;
+        g_variant_get(item, "(i@a{sv}av)", &id, &properties, nullptr);
+        const gchar *text = nullptr;
+        if (g_variant_lookup(properties, "label", "&s", &text) && g_strcmp0(text, label) == 0) {
+          found = id;
+        }
+        g_variant_unref(properties);
+        g_variant_unref(item);
+        g_variant_unref(child);
+      }
+      g_variant_unref(children);
+      g_variant_unref(layout);
+      g_variant_unref(reply);
+      return found;
+    }
+
+    /**
+     * @brief Send a dbusmenu "clicked" event without waiting for the reply.
+     */
+    void click(int id) {
+      g_dbus_connection_call(
+        connection, itemBus.c_str(), menuPath.c_str(), "com.canonical.dbusmenu", "Event",
+        g_variant_new("(isvu)", id, "clicked", g_variant_new_int32(0), 0u), nullptr,
+        G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr, nullptr
+      );
+    }
+
+  private:
+    void run() {
+      context = g_main_context_new();
+      g_main_context_push_thread_default(context);
+
+      // A connection of our own, the tray uses the shared session bus connection
+      GError *error = nullptr;
+      gchar *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, nullptr, &error);
+      if (address != nullptr) {
+        connection = g_dbus_connection_new_for_address_sync(
+          address, static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+          nullptr, nullptr, &error
+        );
+        g_free(address);
+      }
+      GDBusNodeInfo *node = g_dbus_node_info_new_for_xml(watcherXml, nullptr);
+      static const GDBusInterfaceVTable vtable = {handleMethod, handleProperty, nullptr, {}};
+      if (connection == nullptr || g_dbus_connection_register_object(connection, "/StatusNotifierWatcher", node->interfaces[0], &vtable, this, nullptr, &error) == 0) {
+        std::cerr << "Cannot host a StatusNotifierWatcher: " << (error != nullptr ? error->message : "no session bus") << std::endl;
+        g_clear_error(&error);
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+        cv.notify_all();
+      } else {
+        guint owner = g_bus_own_name_on_connection(connection, "org.kde.StatusNotifierWatcher", G_BUS_NAME_OWNER_FLAGS_NONE, nullptr, nullptr, nullptr, nullptr);
+        loop = g_main_loop_new(context, FALSE);
+        g_main_loop_run(loop);
+        g_bus_unown_name(owner);
+        g_main_loop_unref(loop);
+      }
+      g_dbus_node_info_unref(node);
+      g_clear_object(&connection);
+      g_main_context_pop_thread_default(context);
+      g_main_context_unref(context);
+    }
+
+    static void handleMethod(GDBusConnection *, const gchar *sender, const gchar *, const gchar *, const gchar *method, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer data) {
+      auto *self = static_cast<StubWatcher *>(data);
+      if (g_strcmp0(method, "RegisterStatusNotifierItem") == 0) {
+        const gchar *service = nullptr;
+        g_variant_get(parameters, "(&s)", &service);
+        std::lock_guard<std::mutex> lock(self->mutex);
+        // Items register either an object path on their own connection or a bus name
+        self->itemBus = service[0] == '/' ? sender : service;
+        self->itemPath = service[0] == '/' ? service : "/StatusNotifierItem";
+        self->cv.notify_all();
+      }
+      g_dbus_method_invocation_return_value(invocation, nullptr);
+    }
+
+    static GVariant *handleProperty(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *property, GError **, gpointer) {
+      if (g_strcmp0(property, "IsStatusNotifierHostRegistered") == 0) {
+        return g_variant_new_boolean(TRUE);
+      }
+      if (g_strcmp0(property, "ProtocolVersion") == 0) {
+        return g_variant_new_int32(0);
+      }
+      return g_variant_new_strv(nullptr, 0);
+    }
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    GMainContext *context = nullptr;
+    GMainLoop *loop = nullptr;
+    GDBusConnection *connection = nullptr;
+    std::string itemBus;
+    std::string itemPath;
+    std::string menuPath;
+    bool failed = false;
+  };
+
+  StubWatcher *watcher = nullptr;
+  struct tray clickTray = {.icon = "mail-message-new", .tooltip = "Click latency benchmark"};
+
+  std::mutex clickMutex;
+  std::condition_variable clickCv;
+  Clock::time_point clickedAt;
+  bool clicked = false;
+
+  void click_cb(struct tray_menu *) {
+    std::lock_guard<std::mutex> lock(clickMutex);
+    clickedAt = Clock::now();
+    clicked = true;
+    clickCv.notify_all();
+  }
+
+  double percentile(std::vector<double> &samples, double fraction) {
+    if (samples.empty()) {
+      return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(index), samples.end());
+    return samples[index];
+  }
+}  // namespace
+
+/**
+ * @brief dbusmenu "clicked" event to tray_menu callback, with background tray_update() traffic.
+ */
+static void BM_ClickToCallback(benchmark::State &state) {
+  const int width = static_cast<int>(state.range(0));
+  const int updateHz = static_cast<int>(state.range(1));
+  MenuBuilder builder(width, 1);
+  struct tray_menu *items = builder.menu();
+  for (int i = 0; i < width; ++i) {
+    items[i].cb = click_cb;
+  }
+  const char *target = items[width - 1].text;
+  clickTray.menu = items;
+  tray_update(&clickTray);
+
+  std::atomic<bool> stop {false};
+  std::thread traffic;
+  if (updateHz > 0) {
+    traffic = std::thread([&stop, items, updateHz]() {
+      while (!stop) {
+        items[0].checked = !items[0].checked;
+        tray_update(&clickTray);
+        std::this_thread::sleep_for(std::chrono::microseconds(1000000 / updateHz));
+      }
+    });
+  }
+
+  std::vector<double> latencies;
+  long lost = 0;
+  for (auto _ : state) {
+    // Updates rebuild the menu, so ids are looked up right before each click
+    int id = watcher->findItem(target);
+    std::unique_lock<std::mutex> lock(clickMutex);
+    clicked = false;
+    Clock::time_point start = Clock::now();
+    if (id >= 0) {
+      watcher->click(id);
+    }
+    if (id >= 0 && clickCv.wait_for(lock, clickTimeout, []() { return clicked; })) {
+      double seconds = std::chrono::duration<double>(clickedAt - start).count();
+      latencies.push_back(seconds * 1e6);
+      state.SetIterationTime(seconds);
+    } else {
+      ++lost;
+      state.SetIterationTime(std::chrono::duration<double>(clickTimeout).count());
+    }
+  }
+
+  stop = true;
+  if (traffic.joinable()) {
+    traffic.join();
+  }
+  state.counters["p50_us"] = percentile(latencies, 0.50);
+  state.counters["p99_us"] = percentile(latencies, 0.99);
+  state.counters["lost"] = static_cast<double>(lost);
+}
+
+BENCHMARK(BM_ClickToCallback)
+  ->ArgsProduct({{4, 16, 64}, {0, 100}})
+  ->ArgNames({"width", "update_hz"})
+  ->Iterations(200)
+  ->UseManualTime()
+  ->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+  if (std::getenv("DISPLAY") == nullptr || std::getenv("DBUS_SESSION_BUS_ADDRESS") == nullptr) {
+    std::cerr << "Needs DISPLAY and a session bus, run it through benchmarks/run_click_benchmark.sh" << std::endl;
+    return 1;
+  }
+
+  StubWatcher stub;
+  watcher = &stub;
+  tray_set_backend("appindicator");
+  std::atomic<int> initResult {1};
+  std::thread loop([&initResult]() {
+    initResult = tray_init(&clickTray);
+    if (initResult == 0) {
+      while (tray_loop(1) == 0) {}
+    }
+  });
+  while (initResult == 1) {
+    std::this_thread::yield();
+  }
+  if (initResult != 0 || !stub.waitForItem()) {
+    std::cerr << "The tray did not register with the stub StatusNotifierWatcher" << std::endl;
+    if (initResult == 0) {
+      tray_exit();
+    }
+    loop.join();
+    return 1;
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  tray_exit();
+  loop.join();
+  return 0;
+}
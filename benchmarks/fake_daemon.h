@@ -0,0 +1,71 @@
+/**
+ * @file benchmarks/fake_daemon.h
+ * @brief A tray daemon stand-in that accepts one client and discards everything it sends.
+ *
+ * Lets the "daemon" backend run its complete update path (snapshot, diff,
+ * encoding and send) without a desktop session.
+ */
+#pragma once
+
+#if TRAY_DAEMON_CLIENT
+  // standard includes
+  #include <atomic>
+  #include <cstdlib>
+  #include <string>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <thread>
+  #include <unistd.h>
+
+/**
+ * @brief Listens on a temporary socket and drains the connected client.
+ */
+class FakeDaemon {
+public:
+  FakeDaemon() {
+    path = "/tmp/tray-benchmark-" + std::to_string(getpid()) + ".sock";
+    unlink(path.c_str());
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 1) != 0) {
+      return;
+    }
+    setenv("TRAY_DAEMON_SOCKET", path.c_str(), 1);
+    drain = std::thread([this]() {
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        return;
+      }
+      char buffer[65536];
+      ssize_t received;
+      while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        bytes += static_cast<unsigned long long>(received);
+      }
+      close(fd);
+    });
+  }
+
+  ~FakeDaemon() {
+    // Unblocks accept() if no client ever connected
+    shutdown(listen_fd, SHUT_RDWR);
+    if (drain.joinable()) {
+      drain.join();
+    }
+    close(listen_fd);
+    unlink(path.c_str());
+    unsetenv("TRAY_DAEMON_SOCKET");
+  }
+
+  FakeDaemon(const FakeDaemon &) = delete;
+  FakeDaemon &operator=(const FakeDaemon &) = delete;
+
+  std::atomic<unsigned long long> bytes {0};  ///< Bytes received from the client.
+
+private:
+  std::string path;
+  int listen_fd = -1;
+  std::thread drain;
+};
+#endif
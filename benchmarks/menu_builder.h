@@ -0,0 +1,85 @@
+/**
+ * @file benchmarks/menu_builder.h
+ * @brief Generates menus of a given width and depth for the benchmarks.
+ */
+#pragma once
+
+// standard includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+
+/**
+ * @brief Owns a generated menu tree.
+ *
+ * Every level has `width` items; the first item of every level but the last
+ * opens a submenu, so the tree is `depth` levels deep.
+ */
+class MenuBuilder {
+public:
+  MenuBuilder(int width, int depth) {
+    root = build(width, depth);
+  }
+
+  struct tray_menu *menu() {
+    return root;
+  }
+
+  /**
+   * @brief Count all items, excluding terminators.
+   */
+  size_t count() const {
+    size_t total = 0;
+    for (const auto &level : levels) {
+      total += level.size() - 1;
+    }
+    return total;
+  }
+
+  /**
+   * @brief Describe the same menu in the JSON menu file format.
+   */
+  std::string json() const {
+    return "{\"menu\": " + json(root) + "}";
+  }
+
+private:
+  struct tray_menu *build(int width, int depth) {
+    levels.emplace_back(static_cast<size_t>(width) + 1);
+    std::vector<struct tray_menu> &level = levels.back();
+    for (int i = 0; i < width; ++i) {
+      texts.push_back(std::make_unique<std::string>("Item " + std::to_string(depth) + "." + std::to_string(i)));
+      level[i].text = texts.back()->c_str();
+      level[i].checkbox = i % 2;
+      level[i].cb = noop;
+    }
+    level[width].text = nullptr;
+    struct tray_menu *items = level.data();  // `level` dangles once recursion grows `levels`, its buffer does not
+    if (depth > 1 && width > 0) {
+      items[0].cb = nullptr;
+      items[0].submenu = build(width, depth - 1);
+    }
+    return items;
+  }
+
+  static std::string json(const struct tray_menu *items) {
+    std::string out = "[";
+    for (const struct tray_menu *item = items; item->text != nullptr; ++item) {
+      out += item == items ? "" : ",";
+      out += "{\"text\": \"" + std::string(item->text) + "\"";
+      out += item->checkbox ? ", \"checkbox\": true" : "";
+      out += item->submenu != nullptr ? ", \"submenu\": " + json(item->submenu) : "";
+      out += "}";
+    }
+    return out + "]";
+  }
+
+  static void noop(struct tray_menu *) {}
+
+  std::vector<std::vector<struct tray_menu>> levels;  // moving the outer vector keeps the inner buffers in place
+  std::vector<std::unique_ptr<std::string>> texts;
+  struct tray_menu *root;
+};
@@ -0,0 +1,218 @@
+/**
+ * @file benchmarks/replay.c
+ * @brief Replays a recording made with tray_record_start() or TRAY_RECORD against any backend.
+ *
+ * Usage: tray_replay [--backend NAME] [--speed FACTOR] [--repeat N] FILE
+ *
+ * Calls are replayed at their recorded times divided by FACTOR; a FACTOR of 0
+ * replays them back to back. The loop runs between calls, like in the recorded
+ * application. Prints a single JSON object with the time spent in the replayed
+ * calls, so results can be compared across library changes.
+ */
+// standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+#endif
+
+// local includes
+#include "tray.h"
+#include "tray_internal.h"
+#include "tray_record.h"
+
+#define MAX_EXIT_LOOP_ITERATIONS 100  ///< Loop iterations allowed for a backend to shut down after tray_exit().
+
+/**
+ * @brief Durations of the replayed calls of one kind.
+ */
+struct call_times {
+  unsigned long long *us;  ///< Duration of each call.
+  size_t count;  ///< Number of calls.
+  size_t capacity;  ///< Allocated durations.
+};
+
+static void sleep_us(unsigned long long us) {
+#ifdef _WIN32
+  Sleep((DWORD) ((us + 999) / 1000));
+#else
+  struct timespec ts = {(time_t) (us / 1000000), (long) (us % 1000000) * 1000L};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static void add_time(struct call_times *times, unsigned long long us) {
+  if (times->count == times->capacity) {
+    size_t capacity = times->capacity != 0 ? times->capacity * 2 : 1024;
+    unsigned long long *grown = realloc(times->us, capacity * sizeof(*grown));
+    if (grown == NULL) {
+      return;
+    }
+    times->us = grown;
+    times->capacity = capacity;
+  }
+  times->us[times->count++] = us;
+}
+
+static int compare_us(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned long long percentile(const struct call_times *times, double fraction) {
+  if (times->count == 0) {
+    return 0;
+  }
+  size_t index = (size_t) (fraction * (double) times->count);
+  return times->us[index < times->count ? index : times->count - 1];
+}
+
+static void print_times(const char *name, struct call_times *times) {
+  unsigned long long total = 0;
+  for (size_t i = 0; i < times->count; ++i) {
+    total += times->us[i];
+  }
+  qsort(times->us, times->count, sizeof(*times->us), compare_us);
+  printf(
+    "\"%s\": {\"calls\": %zu, \"total_us\": %llu, \"p50_us\": %llu, \"p99_us\": %llu, \"max_us\": %llu}",
+    name,
+    times->count,
+    total,
+    percentile(times, 0.50),
+    percentile(times, 0.99),
+    times->count != 0 ? times->us[times->count - 1] : 0
+  );
+}
+
+static void drain_loop(void) {
+  for (int i = 0; i < MAX_EXIT_LOOP_ITERATIONS && tray_loop(0) == 0; ++i) {}
+}
+
+/**
+ * @brief Replay one pass over a recording.
+ * @return 0 on success, 1 on error.
+ */
+static int replay(const char *path, double speed, struct call_times *init_times, struct call_times *update_times) {
+  struct tray_record_reader reader;
+  if (tray_record_open(&reader, path) != 0) {
+    fprintf(stderr, "%s is not a tray recording\n", path);
+    return 1;
+  }
+
+  int result = 0;
+  int running = 0;
+  unsigned long long start_us = tray_now_us();
+  struct tray_record_event event;
+  int read;
+  while ((read = tray_record_next(&reader, &event)) == 1) {
+    // Run the loop until the call is due, as the recorded application would have
+    if (speed > 0) {
+      unsigned long long due_us = start_us + (unsigned long long) ((double) event.time_us / speed);
+      for (unsigned long long now = tray_now_us(); now < due_us; now = tray_now_us()) {
+        if (running) {
+          tray_loop(0);
+        }
+        unsigned long long left = due_us - now;
+        sleep_us(left < 1000 ? left : 1000);
+      }
+    } else if (running) {
+      tray_loop(0);
+    }
+
+    unsigned long long call_start_us = tray_now_us();
+    switch (event.type) {
+      case TRAY_RECORD_INIT:
+        if (tray_init(event.tray) != 0) {
+          fprintf(stderr, "tray_init() failed on backend %s\n", tray_get_backend() != NULL ? tray_get_backend() : "(none)");
+          result = 1;
+          goto done;
+        }
+        add_time(init_times, tray_now_us() - call_start_us);
+        running = 1;
+        break;
+      case TRAY_RECORD_UPDATE:
+        if (running) {
+          tray_update(event.tray);
+          add_time(update_times, tray_now_us() - call_start_us);
+        }
+        break;
+      case TRAY_RECORD_EXIT:
+        if (running) {
+          tray_exit();
+          drain_loop();
+          running = 0;
+        }
+        break;
+    }
+  }
+  if (read < 0) {
+    fprintf(stderr, "%s is malformed\n", path);
+    result = 1;
+  }
+
+done:
+  // Recordings of applications that were still running end without tray_exit()
+  if (running) {
+    tray_exit();
+    drain_loop();
+  }
+  tray_record_close(&reader);
+  return result;
+}
+
+static int usage(void) {
+  fprintf(stderr, "usage: tray_replay [--backend NAME] [--speed FACTOR] [--repeat N] FILE\n");
+  return 2;
+}
+
+/**
+ * @brief Main entry point.
+ * @return 0 on success, 1 on error, 2 on a usage error.
+ */
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  double speed = 1.0;
+  long repeat = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+      if (tray_set_backend(argv[++i]) != 0) {
+        fprintf(stderr, "backend %s is not available\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtol(argv[++i], NULL, 10);
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      return usage();
+    }
+  }
+  if (path == NULL || speed < 0 || repeat < 1) {
+    return usage();
+  }
+
+  struct call_times init_times = {0};
+  struct call_times update_times = {0};
+  unsigned long long start_us = tray_now_us();
+  int result = 0;
+  for (long i = 0; i < repeat && result == 0; ++i) {
+    result = replay(path, speed, &init_times, &update_times);
+  }
+  unsigned long long wall_us = tray_now_us() - start_us;
+
+  printf("{\"backend\": \"%s\", \"speed\": %g, \"repeat\": %ld, \"wall_us\": %llu, ", tray_get_backend() != NULL ? tray_get_backend() : "", speed, repeat, wall_us);
+  print_times("tray_init", &init_times);
+  printf(", ");
+  print_times("tray_update", &update_times);
+  printf("}\n");
+
+  free(init_times.us);
+  free(update_times.us);
+  return result;
+}
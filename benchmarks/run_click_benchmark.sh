@@ -0,0 +1,26 @@
+#!/bin/sh
+# Runs tray_click_benchmark against a private X server and session bus, so it
+# neither needs nor disturbs a desktop session.
+#
+# usage: run_click_benchmark.sh path/to/tray_click_benchmark [benchmark options]
+set -e
+
+benchmark="$1"
+shift
+
+# Xvfb picks a free display and writes its number to fd 3
+display_file=$(mktemp)
+Xvfb -displayfd 3 -screen 0 1024x768x24 -nolisten tcp 3>"$display_file" &
+xvfb_pid=$!
+trap 'kill "$xvfb_pid" 2>/dev/null; rm -f "$display_file"' EXIT INT TERM
+
+for _ in $(seq 50); do
+  [ -s "$display_file" ] && break
+  sleep 0.1
+done
+if [ ! -s "$display_file" ]; then
+  echo "Xvfb did not start" >&2
+  exit 1
+fi
+
+DISPLAY=":$(cat "$display_file")" dbus-run-session -- "$benchmark" "$@"
@@ -0,0 +1,83 @@
+/**
+ * @file benchmarks/startup.c
+ * @brief Measures time-to-first-icon and time-to-first-menu of tray_init().
+ *
+ * Prints a single JSON object so results can be collected by CI and compared
+ * across runs.
+ */
+// standard includes
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+  #define TRAY_WINAPI 1  ///< Use WinAPI.
+#elif defined(__linux__) || defined(linux) || defined(__linux)
+  #define TRAY_APPINDICATOR 1
+#elif defined(__APPLE__) || defined(__MACH__)
+  #define TRAY_APPKIT 1
+#endif
+
+// local includes
+#include "tray.h"
+
+#if TRAY_APPINDICATOR
+  #define TRAY_ICON "mail-message-new"
+#elif TRAY_APPKIT
+  #define TRAY_ICON "icon.png"
+#elif TRAY_WINAPI
+  #define TRAY_ICON "icon.ico"  ///< Path to the icon.
+#endif
+
+#define MAX_LOOP_ITERATIONS 1000  ///< Give up waiting for the deferred menu after this many iterations.
+
+static void noop_cb(struct tray_menu *item) {
+  (void) item;
+}
+
+static struct tray tray = {
+  .icon = TRAY_ICON,
+  .tooltip = "Startup benchmark",
+  .menu =
+    (struct tray_menu[]) {
+      {.text = "First", .cb = noop_cb},
+      {.text = "Second", .checkbox = 1, .cb = noop_cb},
+      {.text = "-"},
+      {.text = "Sub",
+       .submenu =
+         (struct tray_menu[]) {
+           {.text = "A", .cb = noop_cb},
+           {.text = "B", .cb = noop_cb},
+           {.text = NULL}
+         }},
+      {.text = "Quit", .cb = noop_cb},
+      {.text = NULL}
+    },
+};
+
+/**
+ * @brief Main entry point.
+ * @return 0 on success, 1 on error.
+ */
+int main() {
+  if (tray_init(&tray) < 0) {
+    fprintf(stderr, "failed to create tray\n");
+    return 1;
+  }
+
+  struct tray_stats stats;
+  int iterations = 0;
+  for (tray_get_stats(&stats); stats.first_menu_us == 0 && iterations < MAX_LOOP_ITERATIONS; tray_get_stats(&stats)) {
+    tray_loop(0);
+    ++iterations;
+  }
+
+  printf(
+    "{\"init_us\": %llu, \"first_icon_us\": %llu, \"first_menu_us\": %llu, \"loop_iterations\": %d}\n",
+    stats.init_us,
+    stats.first_icon_us,
+    stats.first_menu_us,
+    iterations
+  );
+  tray_exit();
+  return stats.first_menu_us == 0 ? 1 : 0;
+}
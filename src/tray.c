@@ -0,0 +1,1068 @@
+/**
+ * @file src/tray.c
+ * @brief Backend selection and the parts of the tray API shared by all backends.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_icon_cache.h"
+#include "tray_internal.h"
+#include "tray_record.h"
+#include "tray_thread.h"
+
+#define TRAY_MAX_BACKENDS 8  ///< Built-in plus registered backends.
+#define TRAY_EXIT_SIGNAL_TIMEOUT_MS 1000  ///< Deadline of the exit requested by tray_exit_from_signal().
+#define TRAY_PART_CRITICAL (1u << 4)  ///< Flag next to the tray_update_part pieces: the notification goes out while the session is away.
+
+static const struct tray_backend *backends[TRAY_MAX_BACKENDS] = {
+#if TRAY_DAEMON_CLIENT
+  // A running tray daemon is preferred, it saves every client from loading a toolkit
+  &tray_client_backend,
+#endif
+#if TRAY_APPINDICATOR
+  &tray_linux_backend,
+#endif
+#if TRAY_WINAPI
+  &tray_windows_backend,
+#endif
+#if TRAY_APPKIT
+  &tray_darwin_backend,
+#endif
+  &tray_headless_backend,
+};
+
+static const struct tray_backend *selected_backend = NULL;  // set by tray_set_backend()
+static const struct tray_backend *active_backend = NULL;  // backend of the last tray_init(), see tray_active_backend()
+static struct tray *applied_tray = NULL;  // tray last handed to the backend, on the loop thread
+
+static unsigned long long init_start_us = 0;
+static struct tray_stats stats;
+static unsigned long long host_lost_us = 0;  // when the tray host went away; 0 while it has the icon
+
+static struct tray_capacity capacity;  // set by tray_set_capacity()
+static bool capacity_set = false;
+
+// Input from the tray host, all on the loop thread
+static tray_scroll_callback scroll_cb = NULL;
+static void (*secondary_activate_cb)(void) = NULL;
+static unsigned int click_debounce_ms = 0;  // set by tray_set_click_debounce()
+static const void *burst_source = NULL;  // what the current burst of clicks is on, NULL if none
+static unsigned long long burst_last_us = 0;  // time of the last click of the burst
+static int scroll_dx = 0;  // steps added since the last tray_input_flush()
+static int scroll_dy = 0;
+
+static void tray_icon_variants_free(void *data);
+
+// Icon variants, all on the loop thread
+static struct tray_icon_cache icon_variants = {.destroy = tray_icon_variants_free};  // struct tray_icon_variants by icon, strings owned
+static enum tray_color_scheme color_scheme = TRAY_COLOR_SCHEME_DEFAULT;
+
+// Session suspension, all on the loop thread
+static bool session_suspend = false;  // set by tray_set_session_suspend()
+static enum tray_session_state session_state = TRAY_SESSION_ACTIVE;
+static unsigned int held_parts = 0;  // tray_update_part pieces held back while the session is away
+
+// Battery limits, all on the loop thread
+static struct tray_power_limits power_limits;  // set by tray_set_power_limits()
+static bool power_limits_set = false;
+static enum tray_power_source power_source = TRAY_POWER_AC;
+static const unsigned int throttle_parts[] = {TRAY_PART_ICON, TRAY_PART_MENU, TRAY_PART_NOTIFICATION};  // pieces the limits apply to
+static unsigned long long throttle_applied_us[3];  // when each of throttle_parts was last applied on battery
+static unsigned int throttled_parts = 0;  // tray_update_part pieces held back by the limits
+
+// Copy of the newest tray while pieces of it are held back, by the session or the
+// battery limits, as those are applied after the caller's tray_update() returned
+static struct tray parked_tray;  // strings point into parked_strings, the menu and callback are the caller's
+static char *parked_strings[5];  // icon, tooltip, notification icon, text and title; grown, never shrunk
+static size_t parked_sizes[5];
+
+// Cross-thread tray_update() hand-off. Concurrent callers are combined: each
+// takes a ticket, at most one flush is queued on the loop thread, and a flush
+// applies the newest tray and releases every caller whose ticket it covers.
+static tray_mutex_t update_mutex = TRAY_MUTEX_INITIALIZER;
+static tray_cond_t update_cv = TRAY_COND_INITIALIZER;
+static struct tray *update_tray = NULL;  // tray passed to the newest tray_update()
+static unsigned long long update_requested = 0;  // ticket of the newest tray_update()
+static unsigned long long update_applied = 0;  // every ticket up to this one has been applied
+static bool update_scheduled = false;  // a flush is queued on the loop thread
+static bool update_closed = false;  // set by tray_exit(), later tray_update() calls are dropped
+static unsigned long long update_cancelled = 0;  // tickets up to this one are released unapplied, see tray_exit_timeout()
+static unsigned long long update_applying = 0;  // ticket of the flush applying an update right now, 0 if none
+static unsigned int update_parts = 0;  // tray_update_part pieces requested since the last flush
+
+// tray_exit_from_signal() hand-off: the signal handler only writes to the pipe,
+// or sets the event on Windows, and a helper thread wakes the loop from there.
+static tray_atomic_t exit_signalled = 0;  // set by the helper thread, taken by tray_loop()
+#ifdef _WIN32
+static void *exit_signal_event = NULL;  // HANDLE, swapped atomically
+#else
+static tray_atomic_t exit_signal_fd = -1;  // write end of the pipe
+static int exit_signal_read_fd = -1;
+#endif
+static tray_thread_t exit_signal_thread;
+
+#if TRAY_DELAY_POINTS
+void (*tray_delay_hook)(const char *point) = NULL;
+#endif
+
+unsigned long long tray_now_us(void) {
+#ifdef _WIN32
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&freq);
+  return (unsigned long long) (now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000ULL + (unsigned long long) ts.tv_nsec / 1000ULL;
+#endif
+}
+
+void tray_stats_mark_first_icon(void) {
+  if (stats.first_icon_us == 0) {
+    stats.first_icon_us = tray_now_us() - init_start_us;
+  }
+}
+
+void tray_stats_mark_first_menu(void) {
+  if (stats.first_menu_us == 0) {
+    stats.first_menu_us = tray_now_us() - init_start_us;
+  }
+}
+
+void tray_stats_mark_host_lost(void) {
+  if (host_lost_us == 0) {
+    host_lost_us = tray_now_us();
+  }
+}
+
+void tray_stats_mark_host_recovered(void) {
+  if (host_lost_us != 0) {
+    ++stats.host_recoveries;
+    stats.last_recovery_us = tray_now_us() - host_lost_us;
+    host_lost_us = 0;
+  }
+}
+
+void tray_stats_object_created(enum tray_object_type type) {
+  ++stats.live_objects[type];
+}
+
+void tray_stats_object_destroyed(enum tray_object_type type) {
+  --stats.live_objects[type];
+}
+
+void tray_get_stats(struct tray_stats *out) {
+  if (out != NULL) {
+    *out = stats;
+    tray_alloc_get_bytes(out->allocated_bytes);
+    out->log_dropped = tray_log_dropped();
+    out->power_source = power_source;
+    if (power_limits_set && power_source == TRAY_POWER_BATTERY) {
+      out->power_limits = power_limits;
+    }
+  }
+}
+
+int tray_set_capacity(const struct tray_capacity *value) {
+  if (value == NULL) {
+    capacity_set = false;
+    return 0;
+  }
+  if (value->max_items < 0 || value->notification_slots < 0) {
+    return -1;
+  }
+  capacity = *value;
+  capacity_set = true;
+  return 0;
+}
+
+const struct tray_capacity *tray_get_capacity(void) {
+  return capacity_set ? &capacity : NULL;
+}
+
+int tray_register_backend(const struct tray_backend *backend) {
+  if (backend == NULL || backend->name == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < TRAY_MAX_BACKENDS; ++i) {
+    if (backends[i] == NULL || strcmp(backends[i]->name, backend->name) == 0) {
+      backends[i] = backend;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int tray_backend_available(const struct tray_backend *backend) {
+  return backend->available == NULL || backend->available();
+}
+
+static const struct tray_backend *tray_find_backend(const char *name) {
+  for (int i = 0; i < TRAY_MAX_BACKENDS && backends[i] != NULL; ++i) {
+    if (strcmp(backends[i]->name, name) == 0) {
+      return tray_backend_available(backends[i]) ? backends[i] : NULL;
+    }
+  }
+  return NULL;
+}
+
+static const struct tray_backend *tray_select_backend(void) {
+  if (selected_backend != NULL) {
+    return selected_backend;
+  }
+
+  const char *name = getenv("TRAY_BACKEND");
+  if (name != NULL && name[0] != '\0') {
+    const struct tray_backend *backend = tray_find_backend(name);
+    if (backend == NULL) {
+      tray_log(TRAY_LOG_WARNING, "TRAY_BACKEND=%s is not available, selecting automatically", name);
+    } else {
+      return backend;
+    }
+  }
+
+  // Backends that show nothing (e.g. headless) are only used when asked for by name
+  for (int i = 0; i < TRAY_MAX_BACKENDS && backends[i] != NULL; ++i) {
+    if ((backends[i]->capabilities & TRAY_CAPABILITY_ICON) && tray_backend_available(backends[i])) {
+      return backends[i];
+    }
+  }
+  return NULL;
+}
+
+int tray_set_backend(const char *name) {
+  if (name == NULL) {
+    selected_backend = NULL;
+    return 0;
+  }
+  const struct tray_backend *backend = tray_find_backend(name);
+  if (backend == NULL) {
+    tray_log(TRAY_LOG_WARNING, "Tray backend '%s' is not available", name);
+    return -1;
+  }
+  selected_backend = backend;
+  return 0;
+}
+
+// Written by tray_init() on the loop thread, read from the threads that update or wake up the tray
+static const struct tray_backend *tray_active_backend(void) {
+  return tray_atomic_load_ptr((void **) &active_backend);
+}
+
+const char *tray_get_backend(void) {
+  return active_backend != NULL ? active_backend->name : NULL;
+}
+
+unsigned int tray_get_capabilities(void) {
+  return active_backend != NULL ? active_backend->capabilities : 0;
+}
+
+static void tray_exit_signal_start(void);
+static void tray_park_free(void);
+static void tray_apply(const struct tray_backend *backend, struct tray *tray, unsigned int parts);
+static void tray_power_apply_due(void);
+
+int tray_init(struct tray *tray) {
+  init_start_us = tray_now_us();
+  // Only the timings start over, objects from a previous tray_init() may still be alive
+  long live_objects[TRAY_OBJECT_TYPES];
+  memcpy(live_objects, stats.live_objects, sizeof(live_objects));
+  memset(&stats, 0, sizeof(stats));
+  memcpy(stats.live_objects, live_objects, sizeof(live_objects));
+  host_lost_us = 0;
+  burst_source = NULL;
+  scroll_dx = 0;
+  scroll_dy = 0;
+  held_parts = 0;
+  throttled_parts = 0;
+  tray_park_free();
+  memset(throttle_applied_us, 0, sizeof(throttle_applied_us));
+
+  // A flush left queued by a previous loop is never coming
+  tray_mutex_lock(&update_mutex);
+  update_applied = update_requested;
+  update_scheduled = false;
+  update_closed = false;
+  update_cancelled = 0;
+  update_parts = 0;
+  tray_cond_broadcast(&update_cv);
+  tray_mutex_unlock(&update_mutex);
+  tray_atomic_store(&exit_signalled, 0);
+
+  const struct tray_backend *backend = tray_select_backend();
+  tray_atomic_store_ptr((void **) &active_backend, (void *) backend);
+  if (backend == NULL) {
+    tray_log(TRAY_LOG_ERROR, "No tray backend is available");
+    return -2;
+  }
+  // Only once there is a loop for it to wake up
+  tray_exit_signal_start();
+  if (power_limits_set) {
+    tray_power_watch_start();
+    enum tray_power_source source;
+    if (tray_power_watch_poll(&source)) {
+      tray_set_power_source(source);
+    }
+  } else {
+    tray_power_watch_stop();
+  }
+  tray_record_start_from_env();
+  tray_record_call(TRAY_RECORD_INIT, tray);
+  // Set once init() returned, so a color scheme read during init() is not applied to a half-made icon
+  applied_tray = NULL;
+  int result = active_backend->init(tray);
+  applied_tray = tray;
+  stats.init_us = tray_now_us() - init_start_us;
+  return result;
+}
+
+int tray_loop(int blocking) {
+  if (active_backend == NULL) {
+    return -1;
+  }
+  struct tray *reloaded = tray_menu_watch_apply();
+  if (reloaded != NULL) {
+    tray_record_call(TRAY_RECORD_UPDATE, reloaded);
+    // A menu file only describes the menu, the icon and any notification stay as they are
+    tray_apply(active_backend, reloaded, TRAY_PART_MENU);
+  }
+  int result = active_backend->loop(blocking);
+  if (tray_atomic_exchange(&exit_signalled, 0) != 0) {
+    // On the loop thread, which every backend can exit from
+    tray_exit_timeout(TRAY_EXIT_SIGNAL_TIMEOUT_MS);
+    return -1;
+  }
+  // Everything scrolled during this iteration goes out as one callback
+  tray_input_flush();
+  tray_power_apply_due();
+  return result;
+}
+
+static void tray_apply_parts(const struct tray_backend *backend, struct tray *tray, unsigned int parts) {
+  if (parts == TRAY_PARTS_ALL || backend->update_parts == NULL) {
+    backend->update(tray);
+  } else {
+    backend->update_parts(tray, parts);
+  }
+}
+
+static bool tray_session_away(void) {
+  return session_suspend && session_state != TRAY_SESSION_ACTIVE;
+}
+
+static bool tray_power_limited(void) {
+  return power_limits_set && power_source == TRAY_POWER_BATTERY;
+}
+
+static unsigned int tray_power_interval_ms(size_t i) {
+  const unsigned int intervals[] = {power_limits.icon_interval_ms, power_limits.menu_interval_ms, power_limits.notification_interval_ms};
+  return intervals[i];
+}
+
+// When the ith of throttle_parts may be applied again
+static unsigned long long tray_power_next_us(size_t i) {
+  return throttle_applied_us[i] + tray_power_interval_ms(i) * 1000ULL;
+}
+
+// Takes the pieces applied too recently for the battery limits out of parts,
+// and has the loop woken up when the first of them is due
+static unsigned int tray_power_throttle(unsigned int parts) {
+  if (!tray_power_limited()) {
+    return parts;
+  }
+  unsigned long long now_us = tray_now_us();
+  unsigned long long due_us = 0;
+  unsigned int held = 0;
+  for (size_t i = 0; i < sizeof(throttle_parts) / sizeof(throttle_parts[0]); ++i) {
+    if (!(parts & throttle_parts[i])) {
+      continue;
+    }
+    unsigned long long next_us = tray_power_next_us(i);
+    if (throttle_applied_us[i] != 0 && now_us < next_us) {
+      held |= throttle_parts[i];
+      due_us = due_us == 0 || next_us < due_us ? next_us : due_us;
+    } else {
+      throttle_applied_us[i] = now_us;
+    }
+  }
+  throttled_parts = (throttled_parts & ~parts) | held;
+  if (held != 0) {
+    stats.throttled_updates++;
+    tray_power_watch_wake_at(due_us);
+  }
+  return parts & ~held;
+}
+
+// Copies the strings of the tray into parked_tray, reusing its buffers
+static void tray_park(const struct tray *tray) {
+  const char *values[5] = {tray->icon, tray->tooltip, tray->notification_icon, tray->notification_text, tray->notification_title};
+  const char **fields[5] = {&parked_tray.icon, &parked_tray.tooltip, &parked_tray.notification_icon, &parked_tray.notification_text, &parked_tray.notification_title};
+  for (size_t i = 0; i < 5; ++i) {
+    *fields[i] = NULL;
+    if (values[i] == NULL) {
+      continue;
+    }
+    size_t size = strlen(values[i]) + 1;
+    if (size > parked_sizes[i]) {
+      char *grown = tray_realloc(TRAY_MEMORY_BUFFERS, parked_strings[i], size);
+      if (grown == NULL) {
+        TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to keep a held back update, it is applied without its text");
+        continue;
+      }
+      parked_strings[i] = grown;
+      parked_sizes[i] = size;
+    }
+    memcpy(parked_strings[i], values[i], size);
+    *fields[i] = parked_strings[i];
+  }
+  parked_tray.notification_cb = tray->notification_cb;
+  parked_tray.menu = tray->menu;
+}
+
+// From tray_init(), as the loop may still apply held pieces after tray_exit() returned
+static void tray_park_free(void) {
+  for (size_t i = 0; i < 5; ++i) {
+    tray_free(parked_strings[i]);
+    parked_strings[i] = NULL;
+    parked_sizes[i] = 0;
+  }
+  parked_tray.icon = NULL;
+  parked_tray.tooltip = NULL;
+  parked_tray.notification_icon = NULL;
+  parked_tray.notification_text = NULL;
+  parked_tray.notification_title = NULL;
+  parked_tray.notification_cb = NULL;
+  parked_tray.menu = NULL;
+}
+
+static void tray_apply(const struct tray_backend *backend, struct tray *tray, unsigned int parts) {
+  bool critical = (parts & TRAY_PART_CRITICAL) != 0;
+  parts &= TRAY_PARTS_ALL;
+  if (tray != &parked_tray) {
+    applied_tray = tray;
+  }
+  if (tray_session_away()) {
+    // Nobody sees the tray: only critical notifications go out, the rest waits
+    // for the newest state to be applied when the user is back
+    if ((parts & TRAY_PART_NOTIFICATION) && critical) {
+      tray_apply_parts(backend, tray, TRAY_PART_NOTIFICATION);
+      parts &= ~(unsigned int) TRAY_PART_NOTIFICATION;
+    }
+    if (parts != 0) {
+      held_parts |= parts;
+      stats.deferred_updates++;
+    }
+  } else {
+    parts = tray_power_throttle(parts);
+    if (parts != 0) {
+      tray_apply_parts(backend, tray, parts);
+    }
+  }
+  // The caller may free or reuse its strings once tray_update() returned
+  if ((held_parts | throttled_parts) != 0 && tray != &parked_tray) {
+    tray_park(tray);
+  }
+}
+
+static void tray_flush_update(void) {
+  tray_mutex_lock(&update_mutex);
+  struct tray *tray = update_tray;
+  unsigned long long ticket = update_requested;
+  bool pending = ticket != update_applied && ticket > update_cancelled;
+  unsigned int parts = update_parts;
+  update_parts = 0;
+  update_scheduled = false;
+  if (pending) {
+    update_applying = ticket;
+  }
+  tray_mutex_unlock(&update_mutex);
+
+  TRAY_DELAY_POINT("flush-apply");
+  if (pending && active_backend != NULL) {
+    // Calls combined into this flush apply the newest tray, with every piece any of them asked for
+    tray_apply(active_backend, tray, parts);
+  }
+  TRAY_DELAY_POINT("flush-release");
+
+  tray_mutex_lock(&update_mutex);
+  update_applying = 0;
+  if (ticket > update_applied) {
+    update_applied = ticket;
+  }
+  tray_cond_broadcast(&update_cv);
+  tray_mutex_unlock(&update_mutex);
+}
+
+// Whether the caller holding ticket may return; update_mutex must be held
+static bool tray_update_done(unsigned long long ticket) {
+  // A cancelled update is only done early if no flush is reading its tray
+  return update_applied >= ticket || (ticket <= update_cancelled && ticket > update_applying);
+}
+
+static void tray_wait_for_update(unsigned long long ticket) {
+  tray_mutex_lock(&update_mutex);
+  while (!tray_update_done(ticket)) {
+    tray_cond_wait(&update_cv, &update_mutex);
+  }
+  tray_mutex_unlock(&update_mutex);
+}
+
+static void tray_request_update(struct tray *tray, unsigned int parts) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL) {
+    return;
+  }
+  tray_record_call(TRAY_RECORD_UPDATE, tray);
+  if (backend->invoke == NULL) {
+    tray_apply(backend, tray, parts);
+    return;
+  }
+
+  // Block until a flush covering this call has run, so none of the strings
+  // in the tray struct go out of scope while the loop thread reads them.
+  tray_mutex_lock(&update_mutex);
+  if (update_closed) {
+    // The loop may already be gone, nothing would ever apply this
+    tray_mutex_unlock(&update_mutex);
+    return;
+  }
+  update_tray = tray;
+  update_parts |= parts;
+  unsigned long long ticket = ++update_requested;
+  bool schedule = !update_scheduled;
+  update_scheduled = true;
+  tray_mutex_unlock(&update_mutex);
+
+  TRAY_DELAY_POINT("update-schedule");
+  if (schedule) {
+    backend->invoke(tray_flush_update);
+  }
+  tray_wait_for_update(ticket);
+}
+
+void tray_update(struct tray *tray) {
+  tray_request_update(tray, TRAY_PARTS_ALL);
+}
+
+void tray_update_icon(struct tray *tray) {
+  tray_request_update(tray, TRAY_PART_ICON);
+}
+
+void tray_update_tooltip(struct tray *tray) {
+  tray_request_update(tray, TRAY_PART_TOOLTIP);
+}
+
+void tray_update_menu(struct tray *tray) {
+  tray_request_update(tray, TRAY_PART_MENU);
+}
+
+void tray_notify(struct tray *tray) {
+  tray_request_update(tray, TRAY_PART_NOTIFICATION);
+}
+
+void tray_notify_critical(struct tray *tray) {
+  tray_request_update(tray, TRAY_PART_NOTIFICATION | TRAY_PART_CRITICAL);
+}
+
+void tray_apply_deferred(struct tray *tray, unsigned int parts) {
+  if (active_backend != NULL && tray != NULL) {
+    tray_apply(active_backend, tray, parts);
+  }
+}
+
+void tray_wakeup(void) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend != NULL && backend->wakeup != NULL) {
+    backend->wakeup();
+  }
+}
+
+void tray_exit(void) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL) {
+    return;
+  }
+  tray_record_call(TRAY_RECORD_EXIT, NULL);
+  if (backend->invoke != NULL) {
+    // Let in-flight tray_update() calls finish before the loop shuts down,
+    // and refuse new ones from then on
+    tray_mutex_lock(&update_mutex);
+    update_closed = true;
+    unsigned long long ticket = update_requested;
+    bool pending = ticket != update_applied;
+    tray_mutex_unlock(&update_mutex);
+    TRAY_DELAY_POINT("exit-flush");
+    if (pending) {
+      backend->invoke(tray_flush_update);
+      tray_wait_for_update(ticket);
+    }
+  } else {
+    // Keeps color scheme changes away from the backend that is shutting down
+    tray_mutex_lock(&update_mutex);
+    update_closed = true;
+    tray_mutex_unlock(&update_mutex);
+  }
+  tray_power_watch_stop();
+  backend->exit();
+}
+
+int tray_exit_timeout(unsigned int timeout_ms) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL) {
+    return 0;
+  }
+  tray_record_call(TRAY_RECORD_EXIT, NULL);
+  int result = 0;
+  if (backend->invoke != NULL) {
+    tray_mutex_lock(&update_mutex);
+    update_closed = true;
+    update_cancelled = update_requested;
+    tray_cond_broadcast(&update_cv);
+    // Only an update being applied holds up the exit, and not for longer than the deadline
+    unsigned long long deadline_us = tray_now_us() + (unsigned long long) timeout_ms * 1000;
+    while (update_applying != 0) {
+      unsigned long long now_us = tray_now_us();
+      if (now_us >= deadline_us) {
+        result = -1;
+        break;
+      }
+      tray_cond_timedwait(&update_cv, &update_mutex, (unsigned int) ((deadline_us - now_us + 999) / 1000));
+    }
+    tray_mutex_unlock(&update_mutex);
+  } else {
+    tray_mutex_lock(&update_mutex);
+    update_closed = true;
+    tray_mutex_unlock(&update_mutex);
+  }
+  tray_power_watch_stop();
+  backend->exit();
+  return result;
+}
+
+static TRAY_THREAD_FUNC(tray_exit_signal_main) {
+  (void) arg;
+  for (;;) {
+#ifdef _WIN32
+    if (WaitForSingleObject((HANDLE) tray_atomic_load_ptr(&exit_signal_event), INFINITE) != WAIT_OBJECT_0) {
+      break;
+    }
+#else
+    char drain[16];
+    ssize_t got = read(exit_signal_read_fd, drain, sizeof(drain));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+#endif
+    tray_atomic_store(&exit_signalled, 1);
+    tray_wakeup();
+  }
+  return TRAY_THREAD_RETURN;
+}
+
+// Sets up what tray_exit_from_signal() needs, once; the helper thread then lives as long as the process
+static void tray_exit_signal_start(void) {
+#ifdef _WIN32
+  if (tray_atomic_load_ptr(&exit_signal_event) != NULL) {
+    return;
+  }
+  HANDLE event = CreateEventA(NULL, FALSE, FALSE, NULL);
+  if (event == NULL) {
+    tray_log(TRAY_LOG_WARNING, "CreateEventA() failed, tray_exit_from_signal() is disabled");
+    return;
+  }
+  tray_atomic_store_ptr(&exit_signal_event, event);
+  if (tray_thread_create(&exit_signal_thread, tray_exit_signal_main, NULL) != 0) {
+    tray_log(TRAY_LOG_WARNING, "Failed to start the exit signal thread, tray_exit_from_signal() is disabled");
+    tray_atomic_store_ptr(&exit_signal_event, NULL);
+    CloseHandle(event);
+  }
+#else
+  if (exit_signal_read_fd >= 0) {
+    return;
+  }
+  int fds[2];
+  if (pipe(fds) != 0) {
+    tray_log(TRAY_LOG_WARNING, "pipe() failed, tray_exit_from_signal() is disabled");
+    return;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  // A signal handler must never block on a full pipe, which has an exit pending anyway
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  exit_signal_read_fd = fds[0];
+  if (tray_thread_create(&exit_signal_thread, tray_exit_signal_main, NULL) != 0) {
+    tray_log(TRAY_LOG_WARNING, "Failed to start the exit signal thread, tray_exit_from_signal() is disabled");
+    close(fds[0]);
+    close(fds[1]);
+    exit_signal_read_fd = -1;
+    return;
+  }
+  tray_atomic_store(&exit_signal_fd, fds[1]);
+#endif
+}
+
+void tray_exit_from_signal(void) {
+#ifdef _WIN32
+  HANDLE event = (HANDLE) tray_atomic_load_ptr(&exit_signal_event);
+  if (event != NULL) {
+    SetEvent(event);
+  }
+#else
+  int fd = (int) tray_atomic_load(&exit_signal_fd);
+  if (fd >= 0) {
+    int saved_errno = errno;
+    ssize_t written = write(fd, "", 1);
+    (void) written;
+    errno = saved_errno;
+  }
+#endif
+}
+
+void tray_set_scroll_callback(tray_scroll_callback cb) {
+  scroll_cb = cb;
+}
+
+void tray_set_secondary_activate_callback(void (*cb)(void)) {
+  secondary_activate_cb = cb;
+}
+
+void tray_set_click_debounce(unsigned int window_ms) {
+  click_debounce_ms = window_ms;
+  burst_source = NULL;
+}
+
+int tray_input_debounce(const void *source) {
+  unsigned long long now = tray_now_us();
+  bool repeat = click_debounce_ms != 0 && source == burst_source && now - burst_last_us < (unsigned long long) click_debounce_ms * 1000;
+  burst_source = source;
+  burst_last_us = now;
+  return !repeat;
+}
+
+void tray_input_scroll(int dx, int dy) {
+  scroll_dx += dx;
+  scroll_dy += dy;
+}
+
+void tray_input_flush(void) {
+  int dx = scroll_dx;
+  int dy = scroll_dy;
+  if (dx == 0 && dy == 0) {
+    return;
+  }
+  scroll_dx = 0;
+  scroll_dy = 0;
+  if (scroll_cb != NULL) {
+    scroll_cb(dx, dy);
+  }
+}
+
+void tray_input_secondary_activate(void) {
+  // Debounced apart from the menu items, which never share this address
+  if (tray_input_debounce(&secondary_activate_cb) && secondary_activate_cb != NULL) {
+    secondary_activate_cb();
+  }
+}
+
+static void tray_icon_variants_clear(struct tray_icon_variants *variants) {
+  tray_free((void *) variants->light);
+  tray_free((void *) variants->dark);
+  tray_free((void *) variants->symbolic);
+  memset(variants, 0, sizeof(*variants));
+}
+
+static void tray_icon_variants_free(void *data) {
+  tray_icon_variants_clear(data);
+  tray_free(data);
+}
+
+static const char *tray_icon_variant_copy(const char *path, bool *failed) {
+  if (path == NULL) {
+    return NULL;
+  }
+  char *copy = tray_strdup(TRAY_MEMORY_ICONS, path);
+  if (copy == NULL) {
+    *failed = true;
+  }
+  return copy;
+}
+
+// The tray applied last, or NULL if it may be gone along with the loop
+static struct tray *tray_applied_live(void) {
+  if (active_backend == NULL || applied_tray == NULL) {
+    return NULL;
+  }
+  tray_mutex_lock(&update_mutex);
+  bool closed = update_closed;
+  tray_mutex_unlock(&update_mutex);
+  return closed ? NULL : applied_tray;
+}
+
+// Shows the variant of the applied icon for the current color scheme, if it has
+// variants and, with a non-NULL icon, is that icon
+static void tray_icon_reapply(const char *icon) {
+  struct tray *tray = tray_applied_live();
+  if (tray == NULL || tray->icon == NULL || tray_icon_cache_find(&icon_variants, tray->icon) == NULL || (icon != NULL && strcmp(tray->icon, icon) != 0)) {
+    return;
+  }
+  tray_apply(active_backend, tray, TRAY_PART_ICON);
+}
+
+int tray_set_icon_variants(const char *icon, const struct tray_icon_variants *variants) {
+  if (icon == NULL) {
+    return -1;
+  }
+  struct tray_icon_variants copy = {NULL, NULL, NULL};
+  bool failed = false;
+  if (variants != NULL) {
+    copy.light = tray_icon_variant_copy(variants->light, &failed);
+    copy.dark = tray_icon_variant_copy(variants->dark, &failed);
+    copy.symbolic = tray_icon_variant_copy(variants->symbolic, &failed);
+  }
+  // An icon is never removed, its variants are only emptied
+  struct tray_icon_variants *entry = tray_icon_cache_find(&icon_variants, icon);
+  if (!failed && entry == NULL && variants != NULL) {
+    entry = tray_calloc(TRAY_MEMORY_ICONS, 1, sizeof(*entry));
+    if (entry == NULL || tray_icon_cache_insert(&icon_variants, icon, entry) != 0) {
+      tray_free(entry);
+      failed = true;
+    }
+  }
+  if (failed) {
+    tray_icon_variants_clear(&copy);
+    return -1;
+  }
+  if (entry == NULL) {
+    return 0;
+  }
+  tray_icon_variants_clear(entry);
+  *entry = copy;
+  tray_icon_reapply(icon);
+  return 0;
+}
+
+void tray_set_color_scheme(enum tray_color_scheme scheme) {
+  if (scheme == color_scheme) {
+    return;
+  }
+  color_scheme = scheme;
+  tray_icon_reapply(NULL);
+}
+
+enum tray_color_scheme tray_get_color_scheme(void) {
+  return color_scheme;
+}
+
+const char *tray_icon_for_scheme(const char *icon) {
+  const struct tray_icon_variants *variants = tray_icon_cache_find(&icon_variants, icon);
+  if (variants == NULL) {
+    return icon;
+  }
+  const char *preferred = color_scheme == TRAY_COLOR_SCHEME_DARK ? variants->dark : variants->light;
+  if (preferred != NULL) {
+    return preferred;
+  }
+  return variants->symbolic != NULL ? variants->symbolic : icon;
+}
+
+size_t tray_icon_variants(const char *icon, const char *paths[3]) {
+  const struct tray_icon_variants *variants = tray_icon_cache_find(&icon_variants, icon);
+  size_t count = 0;
+  if (variants != NULL) {
+    const char *all[3] = {variants->light, variants->dark, variants->symbolic};
+    for (size_t i = 0; i < 3; ++i) {
+      if (all[i] != NULL) {
+        paths[count++] = all[i];
+      }
+    }
+  }
+  return count;
+}
+
+// Applies what was held back while the session was away, as one update of the newest tray
+static void tray_apply_held(void) {
+  unsigned int parts = held_parts;
+  held_parts = 0;
+  if (parts != 0 && tray_applied_live() != NULL) {
+    tray_apply_parts(active_backend, &parked_tray, parts);
+  }
+}
+
+void tray_set_session_suspend(int enabled) {
+  session_suspend = enabled != 0;
+  if (!tray_session_away()) {
+    tray_apply_held();
+  }
+}
+
+int tray_session_suspend_enabled(void) {
+  return session_suspend;
+}
+
+void tray_set_session_state(enum tray_session_state state) {
+  if (state == session_state) {
+    return;
+  }
+  tray_log(TRAY_LOG_DEBUG, "Session is %s", state == TRAY_SESSION_LOCKED ? "locked" : (state == TRAY_SESSION_IDLE ? "idle" : "active"));
+  session_state = state;
+  if (!tray_session_away()) {
+    tray_apply_held();
+  }
+}
+
+enum tray_session_state tray_get_session_state(void) {
+  return session_state;
+}
+
+// Applies the pieces held back by the battery limits, those that are due or, with all set, every one
+static void tray_power_apply_throttled(bool all) {
+  unsigned long long now_us = tray_now_us();
+  unsigned long long due_us = 0;
+  unsigned int parts = 0;
+  for (size_t i = 0; i < sizeof(throttle_parts) / sizeof(throttle_parts[0]); ++i) {
+    if (!(throttled_parts & throttle_parts[i])) {
+      continue;
+    }
+    unsigned long long next_us = tray_power_next_us(i);
+    if (all || now_us >= next_us) {
+      parts |= throttle_parts[i];
+    } else {
+      due_us = due_us == 0 || next_us < due_us ? next_us : due_us;
+    }
+  }
+  throttled_parts &= ~parts;
+  if (due_us != 0) {
+    tray_power_watch_wake_at(due_us);
+  }
+  if (parts != 0 && tray_applied_live() != NULL) {
+    // Through tray_apply(), so that a locked session still holds them back
+    tray_apply(active_backend, &parked_tray, parts);
+  }
+}
+
+static void tray_power_apply_due(void) {
+  enum tray_power_source source;
+  if (tray_power_watch_poll(&source)) {
+    tray_set_power_source(source);
+  }
+  if (throttled_parts != 0) {
+    tray_power_apply_throttled(false);
+  }
+}
+
+void tray_set_power_limits(const struct tray_power_limits *limits) {
+  power_limits_set = limits != NULL;
+  if (limits != NULL) {
+    power_limits = *limits;
+  }
+  if (!tray_power_limited()) {
+    tray_power_apply_throttled(true);
+  }
+}
+
+void tray_set_power_source(enum tray_power_source source) {
+  if (source == power_source) {
+    return;
+  }
+  tray_log(TRAY_LOG_DEBUG, "Running on %s", source == TRAY_POWER_BATTERY ? "battery" : "AC power");
+  power_source = source;
+  if (!tray_power_limited()) {
+    tray_power_apply_throttled(true);
+  }
+}
+
+enum tray_power_source tray_get_power_source(void) {
+  return power_source;
+}
+
+int tray_test_activate(const char *path) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL || backend->inject == NULL || applied_tray == NULL || path == NULL) {
+    return -1;
+  }
+  struct tray_test_target target;
+  memset(&target, 0, sizeof(target));
+  struct tray_menu *menu = applied_tray->menu;
+  for (const char *segment = path;;) {
+    const char *end = strchr(segment, '/');
+    size_t len = end != NULL ? (size_t) (end - segment) : strlen(segment);
+    if (target.depth == TRAY_TEST_MAX_DEPTH) {
+      return -1;
+    }
+    unsigned int index = 0;
+    struct tray_menu *item = menu;
+    for (; item != NULL && item->text != NULL; item++, index++) {
+      if (strncmp(item->text, segment, len) == 0 && item->text[len] == '\0') {
+        break;
+      }
+    }
+    if (item == NULL || item->text == NULL) {
+      return -1;
+    }
+    target.item = item;
+    target.path[target.depth++] = index;
+    if (end == NULL) {
+      break;
+    }
+    menu = item->submenu;
+    segment = end + 1;
+  }
+  // A tray host offers no way to click these either
+  if (target.item->disabled || target.item->submenu != NULL || strcmp(target.item->text, "-") == 0) {
+    return -1;
+  }
+  return backend->inject(TRAY_TEST_ACTIVATE, &target);
+}
+
+int tray_test_notification_click(void) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL || backend->inject == NULL) {
+    return -1;
+  }
+  return backend->inject(TRAY_TEST_NOTIFICATION_CLICK, NULL);
+}
+
+int tray_test_host_restart(void) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL || backend->inject == NULL) {
+    return -1;
+  }
+  return backend->inject(TRAY_TEST_HOST_RESTART, NULL);
+}
+
+int tray_test_scroll(int dx, int dy) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL || backend->inject == NULL) {
+    return -1;
+  }
+  struct tray_test_target target;
+  memset(&target, 0, sizeof(target));
+  target.scroll_dx = dx;
+  target.scroll_dy = dy;
+  return backend->inject(TRAY_TEST_SCROLL, &target);
+}
+
+int tray_test_secondary_activate(void) {
+  const struct tray_backend *backend = tray_active_backend();
+  if (backend == NULL || backend->inject == NULL) {
+    return -1;
+  }
+  return backend->inject(TRAY_TEST_SECONDARY_ACTIVATE, NULL);
+}
@@ -5,6 +5,9 @@
 #ifndef TRAY_H
 #define TRAY_H
 
+// standard includes
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,9 +28,39 @@ extern "C" {
 
   /**
    * @brief Set log callback for tray backend messages.
+   *
+   * May be called from any thread; a message already being delivered can still reach the previous callback.
    */
   void tray_set_log_callback(tray_log_callback cb);
 
+  /**
+   * @brief How log messages reach the log callback.
+   */
+  enum tray_log_mode {
+    TRAY_LOG_SYNC,  ///< The callback runs on the thread that logs; the default.
+    TRAY_LOG_ASYNC,  ///< Messages are queued and a background thread runs the callback.
+    TRAY_LOG_ASYNC_MANUAL  ///< Messages are queued until the application calls tray_log_drain().
+  };
+
+  /**
+   * @brief Choose how log messages are delivered.
+   *
+   * In the async modes logging never waits for the callback. Each message is
+   * copied into a fixed-size record of a lock-free queue, cut to 511 bytes, or
+   * counted in tray_stats::log_dropped if the queue is full. Switching back to
+   * TRAY_LOG_SYNC stops the background thread and delivers what is still queued.
+   *
+   * @param mode The delivery mode.
+   * @return 0 on success, -1 if the mode is unknown or the background thread cannot be started.
+   */
+  int tray_set_log_mode(enum tray_log_mode mode);
+
+  /**
+   * @brief Deliver queued log messages to the callback on the calling thread.
+   * @return Number of messages delivered.
+   */
+  size_t tray_log_drain(void);
+
   /**
    * @brief Tray menu item.
    */
@@ -61,12 +94,159 @@ extern "C" {
     void *context;  ///< Context to pass to the callback.
 
     struct tray_menu *submenu;  ///< Submenu items.
+    const char *icon;  ///< Icon shown next to the text, a path like tray::icon; NULL for none. Decoded once per path and shared by all items.
+  };
+
+  /**
+   * @brief Kinds of toolkit objects a backend creates.
+   */
+  enum tray_object_type {
+    TRAY_OBJECT_ICON,  ///< Tray icon or indicator, and decoded icon images.
+    TRAY_OBJECT_MENU,  ///< Top-level menus; submenus live and die with them.
+    TRAY_OBJECT_NOTIFICATION,  ///< Notifications.
+    TRAY_OBJECT_TYPES  ///< Number of object types.
+  };
+
+  /**
+   * @brief Kinds of heap memory the library owns.
+   */
+  enum tray_memory_category {
+    TRAY_MEMORY_ICONS,  ///< Icon cache and decoded icon bookkeeping.
+    TRAY_MEMORY_MENUS,  ///< Menu files, registered actions and copies of menus and strings.
+    TRAY_MEMORY_BUFFERS,  ///< Encode, receive and file buffers of the daemon protocol and recordings, and held back strings.
+    TRAY_MEMORY_CATEGORIES  ///< Number of memory categories.
+  };
+
+  /**
+   * @brief Where the machine draws power from, see tray_set_power_limits().
+   */
+  enum tray_power_source {
+    TRAY_POWER_AC,  ///< Mains power, or nothing is known; the default.
+    TRAY_POWER_BATTERY  ///< Running on battery.
+  };
+
+  /**
+   * @brief How far apart updates are applied while on battery, see tray_set_power_limits().
+   */
+  struct tray_power_limits {
+    unsigned int icon_interval_ms;  ///< Shortest time between two icon changes, which caps the frame rate of animated icons; 0 for no limit.
+    unsigned int menu_interval_ms;  ///< Shortest time between two menu applies; 0 for no limit.
+    unsigned int notification_interval_ms;  ///< Notifications closer together than this are batched and the newest is shown; 0 shows each.
   };
 
+  /**
+   * @brief Tray statistics: startup timings, live toolkit objects, memory use,
+   * dropped log messages, host recoveries, held back updates, and the power
+   * source and limits in force.
+   *
+   * The startup durations are measured from the start of the most recent
+   * tray_init() call and are 0 until the corresponding milestone has been reached.
+   */
+  struct tray_stats {
+    unsigned long long init_us;  ///< Time spent inside tray_init() before it returned.
+    unsigned long long first_icon_us;  ///< Time until the icon was registered with the tray host.
+    unsigned long long first_menu_us;  ///< Time until the first menu was applied.
+    long live_objects[TRAY_OBJECT_TYPES];  ///< Toolkit objects currently alive, by tray_object_type; kept across tray_init().
+    size_t allocated_bytes[TRAY_MEMORY_CATEGORIES];  ///< Bytes the library currently holds, by tray_memory_category; kept across tray_init().
+    unsigned long long log_dropped;  ///< Log messages dropped because the async log queue was full; kept across tray_init().
+    unsigned int host_recoveries;  ///< Times the icon was registered again after the tray host restarted.
+    unsigned long long last_recovery_us;  ///< Time from losing the tray host to the icon being registered again, for the last recovery.
+    unsigned long long deferred_updates;  ///< Updates held back while the session was locked or idle, see tray_set_session_suspend().
+    unsigned long long throttled_updates;  ///< Updates delayed or merged by the battery limits, see tray_set_power_limits().
+    enum tray_power_source power_source;  ///< Power source the limits follow right now.
+    struct tray_power_limits power_limits;  ///< Limits in force right now; all 0 unless on battery.
+  };
+
+  /**
+   * @brief Get the tray statistics.
+   * @param stats Receives the current statistics.
+   */
+  void tray_get_stats(struct tray_stats *stats);
+
+  /**
+   * @brief Route the library's own heap allocations through an application allocator.
+   *
+   * Memory allocated before the call is still freed by the allocator it came
+   * from, so it may be called at any time. Toolkits (GTK, AppKit, the Windows
+   * shell) keep using their own allocators.
+   *
+   * @param malloc_fn Allocates size bytes, like malloc().
+   * @param realloc_fn Resizes a block from malloc_fn or realloc_fn, like realloc().
+   * @param free_fn Frees a block, like free(); never called with NULL.
+   * @param ctx Passed to each function.
+   * @return 0 on success, -1 if only some functions are set or too many allocators were installed.
+   *         Passing NULL for all three restores malloc(), realloc() and free().
+   */
+  int tray_set_allocator(void *(*malloc_fn)(size_t size, void *ctx), void *(*realloc_fn)(void *ptr, size_t size, void *ctx), void (*free_fn)(void *ptr, void *ctx), void *ctx);
+
+  /**
+   * @brief Sizes reserved up front by tray_set_capacity().
+   */
+  struct tray_capacity {
+    int max_items;  ///< Menu items, counting the items of every submenu.
+    size_t max_label_bytes;  ///< Bytes of all item texts, the icon, tooltip and notification strings together, terminators included.
+    int notification_slots;  ///< Notifications kept for reuse instead of created for each one; backends show one at a time.
+  };
+
+  /**
+   * @brief Reserve buffers and keep toolkit objects for reuse, so that updates stop allocating.
+   *
+   * Takes effect at the next tray_init(). Backends then reserve their buffers for a
+   * menu of this size, and a tray_update() whose menu has the shape of the last one
+   * (the same items, separators, checkboxes and submenus, with any texts and states)
+   * updates the existing menu widgets in place. Once every icon has been shown,
+   * such updates make no library allocations; bigger menus still work, they grow
+   * the buffers instead.
+   *
+   * @param capacity The sizes to reserve; NULL turns reservation and reuse off.
+   * @return 0 on success, -1 if a size is negative.
+   */
+  int tray_set_capacity(const struct tray_capacity *capacity);
+
+  /**
+   * @brief Features a tray backend supports.
+   */
+  enum tray_capability {
+    TRAY_CAPABILITY_ICON = 1 << 0,  ///< Shows an icon to the user.
+    TRAY_CAPABILITY_MENU = 1 << 1,  ///< Shows the menu.
+    TRAY_CAPABILITY_TOOLTIP = 1 << 2,  ///< Shows the tooltip.
+    TRAY_CAPABILITY_NOTIFICATIONS = 1 << 3,  ///< Shows notifications.
+    TRAY_CAPABILITY_CROSS_THREAD_UPDATE = 1 << 4,  ///< tray_update() may be called from any thread.
+    TRAY_CAPABILITY_SCROLL = 1 << 5,  ///< Reports scrolling over the icon, see tray_set_scroll_callback().
+    TRAY_CAPABILITY_SECONDARY_ACTIVATE = 1 << 6  ///< Reports middle clicks on the icon, see tray_set_secondary_activate_callback().
+  };
+
+  /**
+   * @brief Select the backend used by the next tray_init().
+   *
+   * Without a selection the TRAY_BACKEND environment variable is used, and
+   * without that the first available backend that shows an icon.
+   *
+   * @param name Backend name, e.g. "appindicator", "winapi", "appkit", "daemon" or "headless"; NULL restores automatic selection.
+   * @return 0 on success, -1 if no backend with that name is available.
+   */
+  int tray_set_backend(const char *name);
+
+  /**
+   * @brief Get the name of the active backend.
+   * @return The backend name, or NULL before tray_init().
+   */
+  const char *tray_get_backend(void);
+
+  /**
+   * @brief Get the features of the active backend.
+   * @return A combination of tray_capability flags, or 0 before tray_init().
+   */
+  unsigned int tray_get_capabilities(void);
+
   /**
    * @brief Create tray icon.
+   *
+   * Only the icon is registered before this returns. The menu, notification support
+   * and icon cache prewarming are deferred to the first iterations of tray_loop().
+   *
    * @param tray The tray to initialize.
-   * @return 0 on success, -1 on error.
+   * @return 0 on success, -1 on error, -2 if no tray host is available.
    */
   int tray_init(struct tray *tray);
 
@@ -83,11 +263,340 @@ extern "C" {
    */
   void tray_update(struct tray *tray);
 
+  /**
+   * @brief Apply a change of tray::icon only, leaving the rest of the tray alone.
+   *
+   * Like tray_update(), it may be called from any thread with
+   * TRAY_CAPABILITY_CROSS_THREAD_UPDATE and returns once the change is applied.
+   *
+   * @param tray The tray, whose other fields are remembered for later updates.
+   */
+  void tray_update_icon(struct tray *tray);
+
+  /**
+   * @brief Apply a change of tray::tooltip only, see tray_update_icon().
+   * @param tray The tray.
+   */
+  void tray_update_tooltip(struct tray *tray);
+
+  /**
+   * @brief Apply a change of tray::menu only, see tray_update_icon().
+   * @param tray The tray.
+   */
+  void tray_update_menu(struct tray *tray);
+
+  /**
+   * @brief Show the notification described by the tray, without touching the icon, tooltip or menu.
+   * @param tray The tray; see tray_update_icon().
+   */
+  void tray_notify(struct tray *tray);
+
+  /**
+   * @brief Show the notification described by the tray like tray_notify(), even while updates are held back.
+   * @param tray The tray; see tray_set_session_suspend().
+   */
+  void tray_notify_critical(struct tray *tray);
+
   /**
    * @brief Terminate UI loop.
    */
   void tray_exit(void);
 
+  /**
+   * @brief Terminate UI loop without waiting on anything for longer than a deadline.
+   *
+   * Unlike tray_exit(), tray_update() calls that the loop has not started to apply
+   * are cancelled and return right away. The backend does not wait on the tray host
+   * while shutting down, e.g. notifications are closed asynchronously.
+   *
+   * @param timeout_ms Longest time to wait for an update the loop is applying.
+   * @return 0 on success, -1 if the deadline passed first; the loop still exits once that update is done.
+   */
+  int tray_exit_timeout(unsigned int timeout_ms);
+
+  /**
+   * @brief Request tray_exit_timeout() from a signal handler.
+   *
+   * This is async-signal-safe: it only writes to a pipe set up by the first
+   * tray_init(). A helper thread reading it wakes the loop, and the next
+   * tray_loop() performs the exit and returns -1.
+   */
+  void tray_exit_from_signal(void);
+
+  /**
+   * @brief Callback signature for scrolling over the tray icon.
+   * @param dx Steps scrolled to the right; negative to the left.
+   * @param dy Steps scrolled up, away from the user; negative down.
+   */
+  typedef void (*tray_scroll_callback)(int dx, int dy);
+
+  /**
+   * @brief Set the callback for scrolling over the tray icon, e.g. to change the volume.
+   *
+   * Scroll events are summed up and reported once per tray_loop() iteration, so
+   * a fast wheel spin costs one callback with the total. Backends without
+   * TRAY_CAPABILITY_SCROLL never call it. Call it from the loop thread.
+   *
+   * @param cb The callback; NULL to ignore scrolling.
+   */
+  void tray_set_scroll_callback(tray_scroll_callback cb);
+
+  /**
+   * @brief Set the callback for a middle click on the tray icon.
+   *
+   * Repeated clicks are debounced like menu items, see tray_set_click_debounce().
+   * Backends without TRAY_CAPABILITY_SECONDARY_ACTIVATE never call it. Call it from the loop thread.
+   *
+   * @param cb The callback; NULL to ignore middle clicks.
+   */
+  void tray_set_secondary_activate_callback(void (*cb)(void));
+
+  /**
+   * @brief Call back once per burst of clicks on the same menu item.
+   *
+   * A click on the item that was clicked last, less than window_ms after the
+   * previous click, belongs to the same burst and is dropped, so a burst lasts
+   * as long as the clicks keep coming. A checkbox item keeps the state it had
+   * after the first click. Call it from the loop thread.
+   *
+   * @param window_ms Longest gap between clicks of a burst; 0, the default, calls back on every click.
+   */
+  void tray_set_click_debounce(unsigned int window_ms);
+
+  /**
+   * @brief Desktop color schemes; the values of the org.freedesktop.appearance color-scheme setting.
+   */
+  enum tray_color_scheme {
+    TRAY_COLOR_SCHEME_DEFAULT = 0,  ///< No preference is known; light variants are shown.
+    TRAY_COLOR_SCHEME_DARK = 1,  ///< Dark panels.
+    TRAY_COLOR_SCHEME_LIGHT = 2  ///< Light panels.
+  };
+
+  /**
+   * @brief Variants of an icon, see tray_set_icon_variants().
+   */
+  struct tray_icon_variants {
+    const char *light;  ///< Shown with a light or unknown color scheme; NULL for none.
+    const char *dark;  ///< Shown with a dark color scheme; NULL for none.
+    const char *symbolic;  ///< Monochrome icon that suits either scheme, shown when the variant for the scheme is missing; NULL for none.
+  };
+
+  /**
+   * @brief Show variants of an icon that follow the desktop color scheme.
+   *
+   * Wherever tray::icon is icon, the variant for the current color scheme is
+   * shown instead. Backends decode every variant when the icon is first shown,
+   * and a change of the color scheme swaps the icon with an icon-only update,
+   * without the app calling tray_update(). Call it from the loop thread.
+   *
+   * @param icon The icon as set in tray::icon.
+   * @param variants The variants, which are copied; NULL shows icon itself again.
+   * @return 0 on success, -1 on error.
+   */
+  int tray_set_icon_variants(const char *icon, const struct tray_icon_variants *variants);
+
+  /**
+   * @brief Set the color scheme icon variants are chosen for.
+   *
+   * The library follows the desktop setting where it can read it: the
+   * org.freedesktop.appearance color-scheme of the settings portal on Linux,
+   * the taskbar theme on Windows and the menu bar appearance on macOS. Apps
+   * using another backend, e.g. tray_daemon, report the scheme with this.
+   * Call it from the loop thread.
+   *
+   * @param scheme The color scheme.
+   */
+  void tray_set_color_scheme(enum tray_color_scheme scheme);
+
+  /**
+   * @brief Get the color scheme icon variants are chosen for.
+   * @return The scheme last read from the desktop or set with tray_set_color_scheme().
+   */
+  enum tray_color_scheme tray_get_color_scheme(void);
+
+  /**
+   * @brief Whether someone can see the tray, see tray_set_session_suspend().
+   */
+  enum tray_session_state {
+    TRAY_SESSION_ACTIVE,  ///< The user is at the screen; the default.
+    TRAY_SESSION_IDLE,  ///< The session is idle, e.g. the screen is blanked.
+    TRAY_SESSION_LOCKED  ///< The screen is locked.
+  };
+
+  /**
+   * @brief Hold back updates while the session is locked or idle.
+   *
+   * While nobody can see the tray, updates are not applied: the pieces they
+   * change are remembered, and the newest state of the tray is applied in one
+   * go when the user comes back. Notifications wait as well, except those
+   * shown with tray_notify_critical(). Each held back update is counted in
+   * tray_stats::deferred_updates. The strings of the newest tray are copied,
+   * so they may change once the update returned; tray::menu is not, and must
+   * stay valid as for tray_update(). The session is watched from the next
+   * tray_init(): logind and the screensaver over D-Bus on Linux, session lock
+   * notifications on Windows and screen lock notifications on macOS.
+   * Call it from the loop thread.
+   *
+   * @param enabled Non-zero to hold back updates; 0, the default, applies them right away.
+   */
+  void tray_set_session_suspend(int enabled);
+
+  /**
+   * @brief Set the state of the session, for backends that cannot watch it, e.g. tray_daemon clients.
+   *
+   * Backends that watch the session call it themselves. Returning to
+   * TRAY_SESSION_ACTIVE applies the updates held back. Call it from the loop thread.
+   *
+   * @param state The session state.
+   */
+  void tray_set_session_state(enum tray_session_state state);
+
+  /**
+   * @brief Get the state of the session.
+   * @return The state last reported by the backend or set with tray_set_session_state().
+   */
+  enum tray_session_state tray_get_session_state(void);
+
+  /**
+   * @brief Apply updates further apart while the machine runs on battery.
+   *
+   * On battery, an icon, menu or notification update that comes sooner after
+   * the previous one than its interval allows is not applied right away: the
+   * newest state of that piece is applied once the interval has passed, and
+   * each such update is counted in tray_stats::throttled_updates. Held back
+   * pieces are kept like tray_set_session_suspend() keeps them. Tooltips are
+   * never held back. The power source is read from the next tray_init() on,
+   * every few seconds: from /sys/class/power_supply on Linux, or the directory
+   * in the TRAY_POWER_SUPPLY_ROOT environment variable, and from the system
+   * power status on Windows. Call it from the loop thread.
+   *
+   * @param limits The limits to apply on battery; NULL, the default, applies updates as they come whatever the power source.
+   */
+  void tray_set_power_limits(const struct tray_power_limits *limits);
+
+  /**
+   * @brief Set the power source, where the library cannot read it, e.g. on macOS.
+   *
+   * Returning to TRAY_POWER_AC applies the updates held back. Call it from the loop thread.
+   *
+   * @param source The power source.
+   */
+  void tray_set_power_source(enum tray_power_source source);
+
+  /**
+   * @brief Get the power source.
+   * @return The source last read or set with tray_set_power_source().
+   */
+  enum tray_power_source tray_get_power_source(void);
+
+  /**
+   * @brief Register a callback that menu files can refer to by name.
+   *
+   * Actions are resolved when a menu file is loaded, so register them first.
+   *
+   * @param name Action name used in the "action" field of menu items.
+   * @param cb Callback to invoke when the item is clicked.
+   * @param context Stored in the item's context field.
+   * @return 0 on success, -1 on error.
+   */
+  int tray_register_action(const char *name, void (*cb)(struct tray_menu *), void *context);
+
+  /**
+   * @brief Load a menu from a JSON file.
+   *
+   * The file holds an array of items, or an object with such an array in "menu".
+   * Items have the fields "text" ("-" for a separator), "action", "disabled",
+   * "checked", "checkbox", "icon" and "submenu" (an array of items).
+   *
+   * @param path Path of the menu file.
+   * @return A menu owned by the library, to be freed with tray_menu_free(), or NULL on error.
+   */
+  struct tray_menu *tray_menu_load(const char *path);
+
+  /**
+   * @brief Free a menu returned by tray_menu_load().
+   * @param menu The menu; NULL is ignored.
+   */
+  void tray_menu_free(struct tray_menu *menu);
+
+  /**
+   * @brief Load tray->menu from a JSON file and reload it whenever the file changes.
+   *
+   * Call it before tray_init(), or call tray_update() afterwards. Changed files are
+   * parsed on a background thread and applied by the next tray_loop(); runtime
+   * checkbox states survive a reload unless the file changes them. Items of a
+   * watched menu are replaced on every reload, so do not keep pointers to them.
+   *
+   * @param tray The tray whose menu is replaced.
+   * @param path Path of the menu file; NULL stops watching and leaves the current
+   *             menu to the caller, to be freed with tray_menu_free().
+   * @return 0 on success, -1 if the file could not be loaded.
+   */
+  int tray_menu_watch(struct tray *tray, const char *path);
+
+  /**
+   * @brief Simulate a click on a menu item, for tests.
+   *
+   * The click goes through the same backend code as a click in the tray host,
+   * so tests and benchmarks see the real dispatch cost. Call it from the loop thread.
+   *
+   * @param path Texts of the item and its parents separated by '/', e.g. "Options/Dark mode";
+   *             the first item with a matching text is used.
+   * @return 0 on success, -1 if there is no such enabled item without a submenu, or the backend cannot inject clicks.
+   */
+  int tray_test_activate(const char *path);
+
+  /**
+   * @brief Simulate a click on the last notification, for tests. Call it from the loop thread.
+   * @return 0 on success, -1 if there is no clickable notification, or the backend cannot inject clicks.
+   */
+  int tray_test_notification_click(void);
+
+  /**
+   * @brief Simulate a restart of the tray host (Explorer, the StatusNotifierWatcher), for tests.
+   *
+   * The backend goes through the same recovery as after a real restart, e.g.
+   * registering the icon again. Call it from the loop thread.
+   *
+   * @return 0 on success, -1 if the backend has no recovery path to exercise.
+   */
+  int tray_test_host_restart(void);
+
+  /**
+   * @brief Simulate scrolling over the icon, for tests. Call it from the loop thread.
+   *
+   * The steps reach the scroll callback with the next tray_loop(), like real ones.
+   *
+   * @param dx Steps to the right.
+   * @param dy Steps up.
+   * @return 0 on success, -1 if the backend cannot inject scrolling.
+   */
+  int tray_test_scroll(int dx, int dy);
+
+  /**
+   * @brief Simulate a middle click on the icon, for tests. Call it from the loop thread.
+   * @return 0 on success, -1 if the backend cannot inject it.
+   */
+  int tray_test_secondary_activate(void);
+
+  /**
+   * @brief Record the tray_init(), tray_update() and tray_exit() calls to a file.
+   *
+   * Each call is written with its time and a snapshot of the tray and menu, to be
+   * replayed against any backend by the tray_replay benchmark tool. Setting the
+   * TRAY_RECORD environment variable to a file name starts a recording at the
+   * first tray_init() instead.
+   *
+   * @param path File to write; an existing file is replaced.
+   * @return 0 on success, -1 if the file cannot be created.
+   */
+  int tray_record_start(const char *path);
+
+  /**
+   * @brief Stop recording and close the file.
+   */
+  void tray_record_stop(void);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
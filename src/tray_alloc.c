@@ -0,0 +1,184 @@
+/**
+ * @file src/tray_alloc.c
+ * @brief Heap allocation of library-owned memory, through the allocator set with tray_set_allocator().
+ */
+// standard includes
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_thread.h"
+
+#define TRAY_MAX_ALLOCATORS 8  ///< Distinct allocators that can be installed over the life of the process.
+
+/**
+ * @brief An installed allocator; never changes once installed, blocks refer to it.
+ */
+struct tray_allocator {
+  void *(*malloc_fn)(size_t size, void *ctx);  ///< Allocates a block.
+  void *(*realloc_fn)(void *ptr, size_t size, void *ctx);  ///< Resizes a block.
+  void (*free_fn)(void *ptr, void *ctx);  ///< Frees a block.
+  void *ctx;  ///< Passed to each function.
+};
+
+/**
+ * @brief Header in front of every block.
+ */
+union tray_alloc_header {
+  struct {
+    size_t size;  ///< Requested bytes.
+    unsigned int category;  ///< tray_memory_category the bytes are attributed to.
+    const struct tray_allocator *allocator;  ///< Allocator that owns the block.
+  } block;  ///< Block information.
+  long double align_float;  ///< Keeps the payload aligned like malloc() does.
+  long long align_int;  ///< Keeps the payload aligned like malloc() does.
+  void *align_pointer;  ///< Keeps the payload aligned like malloc() does.
+};
+
+static void *tray_default_malloc(size_t size, void *ctx) {
+  (void) ctx;
+  return malloc(size);
+}
+
+static void *tray_default_realloc(void *ptr, size_t size, void *ctx) {
+  (void) ctx;
+  return realloc(ptr, size);
+}
+
+static void tray_default_free(void *ptr, void *ctx) {
+  (void) ctx;
+  free(ptr);
+}
+
+static tray_mutex_t alloc_mutex = TRAY_MUTEX_INITIALIZER;
+static struct tray_allocator allocators[TRAY_MAX_ALLOCATORS] = {
+  {tray_default_malloc, tray_default_realloc, tray_default_free, NULL},
+};
+static int allocator_count = 1;
+static const struct tray_allocator *current_allocator = &allocators[0];
+static size_t allocated_bytes[TRAY_MEMORY_CATEGORIES];
+
+int tray_set_allocator(void *(*malloc_fn)(size_t size, void *ctx), void *(*realloc_fn)(void *ptr, size_t size, void *ctx), void (*free_fn)(void *ptr, void *ctx), void *ctx) {
+  if (malloc_fn == NULL && realloc_fn == NULL && free_fn == NULL) {
+    tray_mutex_lock(&alloc_mutex);
+    current_allocator = &allocators[0];
+    tray_mutex_unlock(&alloc_mutex);
+    return 0;
+  }
+  if (malloc_fn == NULL || realloc_fn == NULL || free_fn == NULL) {
+    return -1;
+  }
+
+  int result = -1;
+  tray_mutex_lock(&alloc_mutex);
+  // Switching back and forth between the same allocators reuses their slots
+  for (int i = 0; i < allocator_count; ++i) {
+    if (allocators[i].malloc_fn == malloc_fn && allocators[i].realloc_fn == realloc_fn && allocators[i].free_fn == free_fn && allocators[i].ctx == ctx) {
+      current_allocator = &allocators[i];
+      result = 0;
+      break;
+    }
+  }
+  if (result != 0 && allocator_count < TRAY_MAX_ALLOCATORS) {
+    struct tray_allocator *allocator = &allocators[allocator_count++];
+    allocator->malloc_fn = malloc_fn;
+    allocator->realloc_fn = realloc_fn;
+    allocator->free_fn = free_fn;
+    allocator->ctx = ctx;
+    current_allocator = allocator;
+    result = 0;
+  }
+  tray_mutex_unlock(&alloc_mutex);
+  return result;
+}
+
+void *tray_malloc(enum tray_memory_category category, size_t size) {
+  if (size > SIZE_MAX - sizeof(union tray_alloc_header)) {
+    return NULL;
+  }
+  tray_mutex_lock(&alloc_mutex);
+  const struct tray_allocator *allocator = current_allocator;
+  tray_mutex_unlock(&alloc_mutex);
+
+  union tray_alloc_header *header = allocator->malloc_fn(sizeof(*header) + size, allocator->ctx);
+  if (header == NULL) {
+    return NULL;
+  }
+  header->block.size = size;
+  header->block.category = (unsigned int) category;
+  header->block.allocator = allocator;
+
+  tray_mutex_lock(&alloc_mutex);
+  allocated_bytes[category] += size;
+  tray_mutex_unlock(&alloc_mutex);
+  return header + 1;
+}
+
+void *tray_calloc(enum tray_memory_category category, size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void *ptr = tray_malloc(category, count * size);
+  if (ptr != NULL) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+void *tray_realloc(enum tray_memory_category category, void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return tray_malloc(category, size);
+  }
+  if (size > SIZE_MAX - sizeof(union tray_alloc_header)) {
+    return NULL;
+  }
+  union tray_alloc_header *header = (union tray_alloc_header *) ptr - 1;
+  size_t previous = header->block.size;
+  const struct tray_allocator *allocator = header->block.allocator;
+
+  // The block stays with its allocator and its category
+  header = allocator->realloc_fn(header, sizeof(*header) + size, allocator->ctx);
+  if (header == NULL) {
+    return NULL;
+  }
+  header->block.size = size;
+
+  tray_mutex_lock(&alloc_mutex);
+  allocated_bytes[header->block.category] -= previous;
+  allocated_bytes[header->block.category] += size;
+  tray_mutex_unlock(&alloc_mutex);
+  return header + 1;
+}
+
+void tray_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  union tray_alloc_header *header = (union tray_alloc_header *) ptr - 1;
+  size_t size = header->block.size;
+  unsigned int category = header->block.category;
+  const struct tray_allocator *allocator = header->block.allocator;
+  allocator->free_fn(header, allocator->ctx);
+
+  tray_mutex_lock(&alloc_mutex);
+  allocated_bytes[category] -= size;
+  tray_mutex_unlock(&alloc_mutex);
+}
+
+char *tray_strdup(enum tray_memory_category category, const char *value) {
+  size_t len = strlen(value) + 1;
+  char *copy = tray_malloc(category, len);
+  if (copy != NULL) {
+    memcpy(copy, value, len);
+  }
+  return copy;
+}
+
+void tray_alloc_get_bytes(size_t bytes[TRAY_MEMORY_CATEGORIES]) {
+  tray_mutex_lock(&alloc_mutex);
+  memcpy(bytes, allocated_bytes, sizeof(allocated_bytes));
+  tray_mutex_unlock(&alloc_mutex);
+}
@@ -0,0 +1,60 @@
+/**
+ * @file src/tray_alloc.h
+ * @brief Heap allocation of library-owned memory, through the allocator set with tray_set_allocator().
+ *
+ * Every block carries a small header with its size, category and allocator, so
+ * bytes are attributed per tray_memory_category and a block is always freed by
+ * the allocator that made it.
+ */
+#ifndef TRAY_ALLOC_H
+#define TRAY_ALLOC_H
+
+// standard includes
+#include <stddef.h>
+
+// local includes
+#include "tray.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * @brief Allocate size bytes attributed to category.
+   * @return The block, or NULL if out of memory.
+   */
+  void *tray_malloc(enum tray_memory_category category, size_t size);
+
+  /**
+   * @brief Allocate count zeroed elements of size bytes attributed to category.
+   * @return The block, or NULL if out of memory.
+   */
+  void *tray_calloc(enum tray_memory_category category, size_t count, size_t size);
+
+  /**
+   * @brief Resize a block; a NULL ptr allocates a new one attributed to category.
+   * @return The block, or NULL if out of memory, in which case ptr is left alone.
+   */
+  void *tray_realloc(enum tray_memory_category category, void *ptr, size_t size);
+
+  /**
+   * @brief Free a block from tray_malloc(), tray_calloc(), tray_realloc() or tray_strdup(); NULL is ignored.
+   */
+  void tray_free(void *ptr);
+
+  /**
+   * @brief Copy a string attributed to category.
+   * @return The copy, or NULL if out of memory.
+   */
+  char *tray_strdup(enum tray_memory_category category, const char *value);
+
+  /**
+   * @brief Get the bytes currently allocated, by tray_memory_category.
+   */
+  void tray_alloc_get_bytes(size_t bytes[TRAY_MEMORY_CATEGORIES]);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_ALLOC_H */
@@ -0,0 +1,621 @@
+/**
+ * @file src/tray_client.c
+ * @brief Tray backend that forwards the tray to a shared tray daemon.
+ *
+ * The daemon owns GTK, D-Bus and the indicators of all its clients; this side
+ * only keeps a flattened snapshot of the last menu it sent so that updates can
+ * be reduced to per-item deltas.
+ */
+// standard includes
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_internal.h"
+#include "tray_thread.h"
+#include "tray_wire.h"
+
+#define TRAY_CLIENT_RX_INITIAL 8192  ///< Initial size of the receive buffer.
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0  ///< Not available on macOS; SO_NOSIGPIPE is set on the socket instead.
+#endif
+
+/**
+ * @brief A menu item as last sent to the daemon.
+ */
+struct tray_client_item {
+  struct tray_menu *item;  ///< The app's item, used to dispatch activations.
+  unsigned int child_count;  ///< Number of direct submenu items.
+  unsigned int flags;  ///< tray_wire_item_flags of the item.
+  size_t text;  ///< Offset of the item text in the snapshot text pool.
+};
+
+/**
+ * @brief Flattened pre-order copy of a menu.
+ */
+struct tray_client_snapshot {
+  struct tray_client_item *items;  ///< Items in pre-order.
+  size_t count;  ///< Number of items.
+  size_t capacity;  ///< Allocated items.
+  char *text;  ///< Pool of NUL-terminated item texts.
+  size_t text_size;  ///< Used bytes of the text pool.
+  size_t text_capacity;  ///< Allocated bytes of the text pool.
+  int failed;  ///< Non-zero once an allocation failed.
+};
+
+/**
+ * @brief Copy of a string last sent to the daemon, in a buffer reused by the next one.
+ */
+struct tray_client_string {
+  char *data;  ///< The string, if set.
+  size_t capacity;  ///< Allocated bytes of data.
+  bool set;  ///< Whether a string rather than NULL was sent.
+};
+
+static tray_mutex_t client_mutex = TRAY_MUTEX_INITIALIZER;
+static int client_fd = -1;
+static int wake_pipe[2] = {-1, -1};  // written by tray_client_wakeup(), polled by the loop
+static bool exit_requested = false;
+static struct tray_client_snapshot sent;  // menu the daemon currently shows
+static struct tray_client_snapshot pending;  // scratch snapshot, swapped with sent after an update
+static struct tray_client_string sent_icon;
+static struct tray_client_string sent_tooltip;
+static void (*notification_cb)() = NULL;
+static struct tray_wire_writer out;
+
+static unsigned char *rx_data = NULL;
+static size_t rx_size = 0;
+static size_t rx_capacity = 0;
+
+static void tray_client_snapshot_reset(struct tray_client_snapshot *s) {
+  s->count = 0;
+  s->text_size = 0;
+  s->failed = 0;
+}
+
+static int tray_client_snapshot_reserve(struct tray_client_snapshot *s, size_t items, size_t text) {
+  if (items > s->capacity) {
+    struct tray_client_item *grown = tray_realloc(TRAY_MEMORY_MENUS, s->items, items * sizeof(*grown));
+    if (grown == NULL) {
+      s->failed = 1;
+      return -1;
+    }
+    s->items = grown;
+    s->capacity = items;
+  }
+  if (text > s->text_capacity) {
+    char *grown = tray_realloc(TRAY_MEMORY_MENUS, s->text, text);
+    if (grown == NULL) {
+      s->failed = 1;
+      return -1;
+    }
+    s->text = grown;
+    s->text_capacity = text;
+  }
+  return 0;
+}
+
+static size_t tray_client_snapshot_push(struct tray_client_snapshot *s, struct tray_menu *m) {
+  size_t len = strlen(m->text) + 1;
+  size_t capacity = s->capacity;
+  if (s->count == capacity) {
+    capacity = capacity != 0 ? capacity * 2 : 32;
+  }
+  size_t text_capacity = s->text_capacity;
+  if (s->text_size + len > text_capacity) {
+    text_capacity = text_capacity != 0 ? text_capacity : 512;
+    while (text_capacity < s->text_size + len) {
+      text_capacity *= 2;
+    }
+  }
+  if (tray_client_snapshot_reserve(s, capacity, text_capacity) != 0) {
+    return 0;
+  }
+  struct tray_client_item *item = &s->items[s->count];
+  item->item = m;
+  item->child_count = 0;
+  item->flags = tray_wire_item_flags(m);
+  item->text = s->text_size;
+  memcpy(s->text + s->text_size, m->text, len);
+  s->text_size += len;
+  return s->count++;
+}
+
+static unsigned int tray_client_snapshot_build(struct tray_client_snapshot *s, struct tray_menu *m) {
+  unsigned int count = 0;
+  for (; m != NULL && m->text != NULL && !s->failed; m++, count++) {
+    size_t index = tray_client_snapshot_push(s, m);
+    if (m->submenu != NULL && !s->failed) {
+      unsigned int children = tray_client_snapshot_build(s, m->submenu);
+      s->items[index].child_count = children;
+    }
+  }
+  return count;
+}
+
+static const char *tray_client_item_text(const struct tray_client_snapshot *s, size_t index) {
+  return s->text + s->items[index].text;
+}
+
+// Items can be updated in place when the daemon would create the same widgets
+static bool tray_client_same_shape(const struct tray_client_snapshot *a, const struct tray_client_snapshot *b) {
+  const unsigned int shape_flags = TRAY_WIRE_ITEM_CHECKBOX | TRAY_WIRE_ITEM_SUBMENU;
+  if (a->count != b->count) {
+    return false;
+  }
+  for (size_t i = 0; i < a->count; ++i) {
+    bool a_separator = strcmp(tray_client_item_text(a, i), "-") == 0;
+    bool b_separator = strcmp(tray_client_item_text(b, i), "-") == 0;
+    if (a->items[i].child_count != b->items[i].child_count ||
+        (a->items[i].flags & shape_flags) != (b->items[i].flags & shape_flags) ||
+        a_separator != b_separator) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool tray_client_string_changed(const struct tray_client_string *previous, const char *value) {
+  if (!previous->set || value == NULL) {
+    return previous->set != (value != NULL);
+  }
+  return strcmp(previous->data, value) != 0;
+}
+
+static int tray_client_string_reserve(struct tray_client_string *s, size_t size) {
+  if (size > s->capacity) {
+    char *grown = tray_realloc(TRAY_MEMORY_MENUS, s->data, size);
+    if (grown == NULL) {
+      return -1;
+    }
+    s->data = grown;
+    s->capacity = size;
+  }
+  return 0;
+}
+
+static void tray_client_remember_string(struct tray_client_string *slot, const char *value) {
+  // A string that cannot be remembered is sent again by the next update
+  size_t len = value != NULL ? strlen(value) + 1 : 0;
+  slot->set = value != NULL && tray_client_string_reserve(slot, len) == 0;
+  if (slot->set) {
+    memcpy(slot->data, value, len);
+  }
+}
+
+static void tray_client_put_item(const struct tray_client_snapshot *s, size_t index) {
+  tray_wire_put_u8(&out, s->items[index].flags);
+  tray_wire_put_string(&out, tray_client_item_text(s, index));
+}
+
+static int tray_client_send(const unsigned char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = send(client_fd, data, size, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      tray_log(TRAY_LOG_ERROR, "Sending to the tray daemon failed: %s", strerror(errno));
+      return -1;
+    }
+    data += written;
+    size -= (size_t) written;
+  }
+  return 0;
+}
+
+// Appends the menu changes since the last update to out; client_mutex must be held
+static void tray_client_sync_menu(struct tray_menu *menu) {
+  tray_client_snapshot_reset(&pending);
+  tray_client_snapshot_build(&pending, menu);
+  if (pending.failed) {
+    tray_log(TRAY_LOG_ERROR, "Out of memory while snapshotting the tray menu");
+  } else if (tray_client_same_shape(&sent, &pending)) {
+    for (size_t i = 0; i < pending.count; ++i) {
+      if (sent.items[i].flags == pending.items[i].flags &&
+          strcmp(tray_client_item_text(&sent, i), tray_client_item_text(&pending, i)) == 0) {
+        continue;
+      }
+      size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_MENU_ITEM_UPDATE);
+      tray_wire_put_u32(&out, (unsigned int) i);
+      tray_client_put_item(&pending, i);
+      tray_wire_end_frame(&out, frame);
+    }
+    struct tray_client_snapshot swap = sent;
+    sent = pending;
+    pending = swap;
+  } else {
+    size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_MENU_REPLACE);
+    tray_wire_put_u32(&out, (unsigned int) pending.count);
+    for (size_t i = 0; i < pending.count; ++i) {
+      tray_wire_put_u32(&out, pending.items[i].child_count);
+      tray_client_put_item(&pending, i);
+    }
+    tray_wire_end_frame(&out, frame);
+    struct tray_client_snapshot swap = sent;
+    sent = pending;
+    pending = swap;
+  }
+}
+
+// Encodes everything among the tray_update_part pieces that changed since the
+// last update and sends it in one write. Must be called with client_mutex held.
+static void tray_client_sync(struct tray *tray, unsigned int parts) {
+  out.size = 0;
+
+  // The daemon only ever sees the variant for the current color scheme
+  const char *icon = tray_icon_for_scheme(tray->icon);
+  if ((parts & TRAY_PART_ICON) && tray_client_string_changed(&sent_icon, icon)) {
+    size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_SET_ICON);
+    tray_wire_put_string(&out, icon);
+    tray_wire_end_frame(&out, frame);
+    tray_client_remember_string(&sent_icon, icon);
+  }
+  if ((parts & TRAY_PART_TOOLTIP) && tray_client_string_changed(&sent_tooltip, tray->tooltip)) {
+    size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_SET_TOOLTIP);
+    tray_wire_put_string(&out, tray->tooltip);
+    tray_wire_end_frame(&out, frame);
+    tray_client_remember_string(&sent_tooltip, tray->tooltip);
+  }
+
+  if (parts & TRAY_PART_MENU) {
+    tray_client_sync_menu(tray->menu);
+  }
+
+  if (parts & TRAY_PART_NOTIFICATION) {
+    if (tray->notification_text != NULL && tray->notification_text[0] != '\0') {
+      size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_NOTIFY);
+      tray_wire_put_string(&out, tray->notification_title);
+      tray_wire_put_string(&out, tray->notification_text);
+      tray_wire_put_string(&out, tray->notification_icon != NULL ? tray->notification_icon : tray->icon);
+      tray_wire_put_u8(&out, tray->notification_cb != NULL);
+      tray_wire_end_frame(&out, frame);
+    }
+    notification_cb = tray->notification_cb;
+  }
+
+  if (out.failed) {
+    tray_log(TRAY_LOG_ERROR, "Out of memory while encoding the tray update");
+    tray_wire_writer_free(&out);
+    return;
+  }
+  if (out.size > 0 && client_fd >= 0) {
+    tray_client_send(out.data, out.size);
+  }
+}
+
+static void tray_client_disconnect(void) {
+  if (client_fd >= 0) {
+    close(client_fd);
+    client_fd = -1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (wake_pipe[i] >= 0) {
+      close(wake_pipe[i]);
+      wake_pipe[i] = -1;
+    }
+  }
+  rx_size = 0;
+  tray_client_snapshot_reset(&sent);
+  tray_client_remember_string(&sent_icon, NULL);
+  tray_client_remember_string(&sent_tooltip, NULL);
+  notification_cb = NULL;
+}
+
+// Sizes every buffer an update of a menu within the capacity can need, see tray_set_capacity()
+static void tray_client_reserve(const struct tray_capacity *capacity) {
+  size_t items = (size_t) capacity->max_items;
+  size_t text = capacity->max_label_bytes;
+  tray_client_snapshot_reserve(&sent, items, text);
+  tray_client_snapshot_reserve(&pending, items, text);
+  tray_client_string_reserve(&sent_icon, text);
+  tray_client_string_reserve(&sent_tooltip, text);
+  // Every item in a frame of its own with an index, flags and a string length, the strings, and the icon, tooltip and notification frames
+  out.size = 0;
+  tray_wire_reserve(&out, items * (TRAY_WIRE_FRAME_HEADER_SIZE + 9) + text + 64);
+  if (rx_capacity == 0) {
+    rx_data = tray_malloc(TRAY_MEMORY_BUFFERS, TRAY_CLIENT_RX_INITIAL);
+    rx_capacity = rx_data != NULL ? TRAY_CLIENT_RX_INITIAL : 0;
+  }
+}
+
+static int tray_client_available(void) {
+  char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+  struct stat st;
+  return tray_wire_socket_path(path, sizeof(path)) == 0 && stat(path, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+static int tray_client_init(struct tray *tray) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (tray_wire_socket_path(addr.sun_path, sizeof(addr.sun_path)) != 0) {
+    tray_log(TRAY_LOG_ERROR, "No tray daemon socket path (set TRAY_DAEMON_SOCKET or XDG_RUNTIME_DIR)");
+    return -1;
+  }
+
+  tray_mutex_lock(&client_mutex);
+  tray_client_disconnect();
+  exit_requested = false;
+  client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (client_fd < 0) {
+    tray_log(TRAY_LOG_ERROR, "socket(AF_UNIX) failed: %s", strerror(errno));
+    tray_mutex_unlock(&client_mutex);
+    return -1;
+  }
+  fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+  if (pipe(wake_pipe) == 0) {
+    for (int i = 0; i < 2; ++i) {
+      fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+      fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+  }
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(client_fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  if (connect(client_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    tray_log(TRAY_LOG_ERROR, "Connecting to the tray daemon at %s failed: %s", addr.sun_path, strerror(errno));
+    tray_client_disconnect();
+    tray_mutex_unlock(&client_mutex);
+    return -1;
+  }
+
+  const struct tray_capacity *capacity = tray_get_capacity();
+  if (capacity != NULL) {
+    tray_client_reserve(capacity);
+  }
+  out.size = 0;
+  size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_HELLO);
+  tray_wire_put_u32(&out, TRAY_WIRE_VERSION);
+  tray_wire_put_u32(&out, (unsigned int) getpid());
+  tray_wire_end_frame(&out, frame);
+  int result = out.failed ? -1 : tray_client_send(out.data, out.size);
+  if (result == 0) {
+    tray_client_sync(tray, TRAY_PARTS_ALL);
+  }
+  tray_mutex_unlock(&client_mutex);
+
+  if (result == 0) {
+    tray_stats_mark_first_icon();
+    tray_stats_mark_first_menu();
+  }
+  return result;
+}
+
+// The daemon's check item toggled itself on the click; sends back the state it had
+static void tray_client_restore_item(size_t index) {
+  tray_mutex_lock(&client_mutex);
+  if (client_fd >= 0 && !exit_requested && index < sent.count) {
+    out.size = 0;
+    size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_MENU_ITEM_UPDATE);
+    tray_wire_put_u32(&out, (unsigned int) index);
+    tray_client_put_item(&sent, index);
+    tray_wire_end_frame(&out, frame);
+    if (!out.failed) {
+      tray_client_send(out.data, out.size);
+    }
+  }
+  tray_mutex_unlock(&client_mutex);
+}
+
+static void tray_client_dispatch(unsigned int type, struct tray_wire_reader *payload) {
+  if (type == TRAY_MSG_MENU_ACTIVATE) {
+    unsigned int index = tray_wire_get_u32(payload);
+    struct tray_menu *item = NULL;
+    tray_mutex_lock(&client_mutex);
+    if (!payload->failed && index < sent.count) {
+      item = sent.items[index].item;
+    }
+    tray_mutex_unlock(&client_mutex);
+    if (item == NULL || item->cb == NULL) {
+      return;
+    }
+    if (tray_input_debounce(item)) {
+      item->cb(item);
+    } else if (item->checkbox) {
+      tray_client_restore_item(index);
+    }
+  } else if (type == TRAY_MSG_SCROLL) {
+    int dx = (int) tray_wire_get_u32(payload);
+    int dy = (int) tray_wire_get_u32(payload);
+    if (!payload->failed) {
+      tray_input_scroll(dx, dy);
+    }
+  } else if (type == TRAY_MSG_SECONDARY_ACTIVATE) {
+    tray_input_secondary_activate();
+  } else if (type == TRAY_MSG_NOTIFICATION_CLICKED) {
+    tray_mutex_lock(&client_mutex);
+    void (*cb)() = notification_cb;
+    tray_mutex_unlock(&client_mutex);
+    if (cb != NULL) {
+      cb();
+    }
+  }
+}
+
+static int tray_client_receive(void) {
+  if (rx_capacity - rx_size < 4096) {
+    size_t capacity = rx_capacity != 0 ? rx_capacity * 2 : TRAY_CLIENT_RX_INITIAL;
+    unsigned char *data = tray_realloc(TRAY_MEMORY_BUFFERS, rx_data, capacity);
+    if (data == NULL) {
+      return -1;
+    }
+    rx_data = data;
+    rx_capacity = capacity;
+  }
+  ssize_t received = recv(client_fd, rx_data + rx_size, rx_capacity - rx_size, MSG_DONTWAIT);
+  if (received == 0) {
+    tray_log(TRAY_LOG_ERROR, "The tray daemon closed the connection");
+    return -1;
+  }
+  if (received < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  }
+  rx_size += (size_t) received;
+
+  size_t consumed = 0;
+  for (;;) {
+    unsigned int type;
+    struct tray_wire_reader payload;
+    long frame = tray_wire_next_frame(rx_data + consumed, rx_size - consumed, &type, &payload);
+    if (frame < 0) {
+      tray_log(TRAY_LOG_ERROR, "Malformed frame from the tray daemon");
+      return -1;
+    }
+    if (frame == 0) {
+      break;
+    }
+    tray_client_dispatch(type, &payload);
+    consumed += (size_t) frame;
+  }
+  memmove(rx_data, rx_data + consumed, rx_size - consumed);
+  rx_size -= consumed;
+  return 0;
+}
+
+static int tray_client_loop(int blocking) {
+  tray_mutex_lock(&client_mutex);
+  int fd = client_fd;
+  int wake_fd = wake_pipe[0];
+  bool exiting = exit_requested;
+  if (exiting) {
+    tray_client_disconnect();
+  }
+  tray_mutex_unlock(&client_mutex);
+  if (exiting || fd < 0) {
+    return -1;
+  }
+
+  struct pollfd pfd[2] = {
+    {.fd = fd, .events = POLLIN},
+    {.fd = wake_fd, .events = POLLIN},  // ignored by poll() while negative
+  };
+  int ready = poll(pfd, 2, blocking ? -1 : 0);
+  if (ready < 0 && errno != EINTR) {
+    return -1;
+  }
+  if (ready > 0 && (pfd[1].revents & POLLIN)) {
+    char drain[64];
+    while (read(wake_fd, drain, sizeof(drain)) > 0) {}
+  }
+  if (ready > 0 && pfd[0].revents != 0 && tray_client_receive() != 0) {
+    tray_mutex_lock(&client_mutex);
+    tray_client_disconnect();
+    tray_mutex_unlock(&client_mutex);
+    return -1;
+  }
+
+  tray_mutex_lock(&client_mutex);
+  int result = exit_requested ? -1 : 0;
+  tray_mutex_unlock(&client_mutex);
+  return result;
+}
+
+static void tray_client_update_parts(struct tray *tray, unsigned int parts) {
+  tray_mutex_lock(&client_mutex);
+  if (client_fd >= 0 && !exit_requested) {
+    tray_client_sync(tray, parts);
+  }
+  tray_mutex_unlock(&client_mutex);
+}
+
+static void tray_client_update(struct tray *tray) {
+  tray_client_update_parts(tray, TRAY_PARTS_ALL);
+}
+
+static void tray_client_wakeup(void) {
+  tray_mutex_lock(&client_mutex);
+  if (wake_pipe[1] >= 0) {
+    // A full pipe already has a wakeup pending
+    ssize_t written = write(wake_pipe[1], "", 1);
+    (void) written;
+  }
+  tray_mutex_unlock(&client_mutex);
+}
+
+static int tray_client_inject(enum tray_test_event event, const struct tray_test_target *target) {
+  struct tray_wire_writer message;
+  memset(&message, 0, sizeof(message));
+  unsigned int type;
+  if (event == TRAY_TEST_ACTIVATE) {
+    // The daemon refers to items by their pre-order index in the last menu sent
+    tray_mutex_lock(&client_mutex);
+    size_t index = 0;
+    while (index < sent.count && sent.items[index].item != target->item) {
+      index++;
+    }
+    bool found = index < sent.count;
+    tray_mutex_unlock(&client_mutex);
+    if (!found) {
+      return -1;
+    }
+    type = TRAY_MSG_MENU_ACTIVATE;
+    tray_wire_put_u32(&message, (unsigned int) index);
+  } else if (event == TRAY_TEST_NOTIFICATION_CLICK) {
+    tray_mutex_lock(&client_mutex);
+    bool clickable = notification_cb != NULL;
+    tray_mutex_unlock(&client_mutex);
+    if (!clickable) {
+      return -1;
+    }
+    type = TRAY_MSG_NOTIFICATION_CLICKED;
+  } else if (event == TRAY_TEST_SCROLL) {
+    type = TRAY_MSG_SCROLL;
+    tray_wire_put_u32(&message, (unsigned int) target->scroll_dx);
+    tray_wire_put_u32(&message, (unsigned int) target->scroll_dy);
+  } else if (event == TRAY_TEST_SECONDARY_ACTIVATE) {
+    type = TRAY_MSG_SECONDARY_ACTIVATE;
+  } else {
+    // A daemon restart closes the connection, which ends the tray
+    return -1;
+  }
+  if (message.failed) {
+    tray_wire_writer_free(&message);
+    return -1;
+  }
+  struct tray_wire_reader payload = {message.data, message.size, 0, 0};
+  tray_client_dispatch(type, &payload);
+  tray_wire_writer_free(&message);
+  return 0;
+}
+
+static void tray_client_exit(void) {
+  tray_mutex_lock(&client_mutex);
+  if (client_fd >= 0 && !exit_requested) {
+    out.size = 0;
+    size_t frame = tray_wire_begin_frame(&out, TRAY_MSG_EXIT);
+    tray_wire_end_frame(&out, frame);
+    if (!out.failed) {
+      tray_client_send(out.data, out.size);
+    }
+    // Wakes up a tray_loop() blocked in poll(); the descriptor is closed by the loop
+    shutdown(client_fd, SHUT_RDWR);
+  }
+  exit_requested = true;
+  tray_mutex_unlock(&client_mutex);
+}
+
+const struct tray_backend tray_client_backend = {
+  .name = "daemon",
+  .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU | TRAY_CAPABILITY_TOOLTIP | TRAY_CAPABILITY_NOTIFICATIONS | TRAY_CAPABILITY_CROSS_THREAD_UPDATE | TRAY_CAPABILITY_SCROLL | TRAY_CAPABILITY_SECONDARY_ACTIVATE,
+  .available = tray_client_available,
+  .init = tray_client_init,
+  .loop = tray_client_loop,
+  .update = tray_client_update,
+  .exit = tray_client_exit,
+  .wakeup = tray_client_wakeup,
+  .inject = tray_client_inject,
+  .update_parts = tray_client_update_parts,
+};
@@ -0,0 +1,488 @@
+/**
+ * @file src/tray_daemon.c
+ * @brief Tray host daemon that shows the trays of many client processes.
+ *
+ * The daemon is the only process that loads GTK, AppIndicator and libnotify.
+ * Clients link the tray library with the "daemon" backend and talk to it over a
+ * Unix socket (see tray_wire.h). Client messages only update the daemon's model
+ * of that client; the model is applied to the indicators once per frame, so a
+ * burst of updates costs a single menu rebuild.
+ */
+// standard includes
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// lib includes
+#ifdef TRAY_AYATANA_APPINDICATOR
+  #include <libayatana-appindicator/app-indicator.h>
+#elif TRAY_LEGACY_APPINDICATOR
+  #include <libappindicator/app-indicator.h>
+#endif
+#include <glib-unix.h>
+#include <libnotify/notify.h>
+
+// local includes
+#include "tray_wire.h"
+
+#define TRAY_DAEMON_FRAME_MS 16  ///< Client changes are applied at most once per frame.
+
+/**
+ * @brief A menu item of a client, in pre-order.
+ */
+struct daemon_item {
+  unsigned int child_count;  ///< Number of direct submenu items.
+  unsigned int flags;  ///< tray_wire_item_flags.
+  char *text;  ///< Item text.
+  GtkWidget *widget;  ///< Widget currently showing the item, if the menu was built.
+  bool dirty;  ///< Changed since the last frame.
+};
+
+/**
+ * @brief A connected client process.
+ */
+struct daemon_client {
+  int fd;  ///< Client socket.
+  guint source;  ///< GLib source watching fd.
+  unsigned int pid;  ///< Client process id from TRAY_MSG_HELLO.
+  unsigned char *rx;  ///< Received, not yet parsed bytes.
+  size_t rx_size;  ///< Number of bytes in rx.
+  size_t rx_capacity;  ///< Allocated bytes of rx.
+
+  struct daemon_item *items;  ///< Menu model.
+  size_t item_count;  ///< Number of items.
+  char *icon;  ///< Icon name or path.
+  char *tooltip;  ///< Tooltip.
+  char *notification_title;  ///< Title of the pending notification.
+  char *notification_text;  ///< Text of the pending notification; NULL if none is pending.
+  char *notification_icon;  ///< Icon of the pending notification.
+  bool notification_clickable;  ///< Whether the client wants notification clicks.
+
+  bool icon_dirty;  ///< Icon or tooltip changed since the last frame.
+  bool menu_dirty;  ///< Menu structure changed since the last frame.
+  bool items_dirty;  ///< Some item changed since the last frame.
+
+  AppIndicator *indicator;  ///< Indicator of this client, created on the first frame.
+  NotifyNotification *notification;  ///< Last shown notification.
+  struct daemon_client *next;  ///< Next client.
+};
+
+static struct daemon_client *clients = NULL;
+static guint frame_source = 0;
+static unsigned int indicator_serial = 0;
+
+static void daemon_client_free(struct daemon_client *client);
+
+static void daemon_free_items(struct daemon_client *client) {
+  for (size_t i = 0; i < client->item_count; ++i) {
+    g_free(client->items[i].text);
+  }
+  g_free(client->items);
+  client->items = NULL;
+  client->item_count = 0;
+}
+
+static void daemon_send_values(struct daemon_client *client, enum tray_wire_message type, const unsigned int *values, size_t count) {
+  struct tray_wire_writer w = {0};
+  size_t frame = tray_wire_begin_frame(&w, type);
+  for (size_t i = 0; i < count; ++i) {
+    tray_wire_put_u32(&w, values[i]);
+  }
+  tray_wire_end_frame(&w, frame);
+  // Never block the host on a client that stopped reading; dropping a click is preferable
+  if (!w.failed && send(client->fd, w.data, w.size, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) w.size) {
+    fprintf(stderr, "tray-daemon: dropped event for client %u\n", client->pid);
+  }
+  tray_wire_writer_free(&w);
+}
+
+static void daemon_send(struct daemon_client *client, enum tray_wire_message type, int index) {
+  unsigned int value = (unsigned int) index;
+  daemon_send_values(client, type, &value, index >= 0 ? 1 : 0);
+}
+
+static void daemon_item_activated(GtkMenuItem *item, gpointer data) {
+  struct daemon_client *client = data;
+  daemon_send(client, TRAY_MSG_MENU_ACTIVATE, GPOINTER_TO_INT(g_object_get_data(G_OBJECT(item), "tray-index")));
+}
+
+static void daemon_notification_clicked(NotifyNotification *notification, char *action, gpointer data) {
+  (void) notification;
+  (void) action;
+  daemon_send(data, TRAY_MSG_NOTIFICATION_CLICKED, -1);
+}
+
+// Forwarded as they come; the client sums them up per loop iteration
+static void daemon_scrolled(AppIndicator *indicator, gint delta, GdkScrollDirection direction, gpointer data) {
+  (void) indicator;
+  unsigned int steps[2] = {0, 0};  // right, up
+  switch (direction) {
+    case GDK_SCROLL_UP:
+      steps[1] = (unsigned int) delta;
+      break;
+    case GDK_SCROLL_DOWN:
+      steps[1] = (unsigned int) -delta;
+      break;
+    case GDK_SCROLL_LEFT:
+      steps[0] = (unsigned int) -delta;
+      break;
+    case GDK_SCROLL_RIGHT:
+      steps[0] = (unsigned int) delta;
+      break;
+    default:
+      return;
+  }
+  daemon_send_values(data, TRAY_MSG_SCROLL, steps, 2);
+}
+
+static void daemon_secondary_activated(AppIndicator *indicator, guint timestamp, gpointer data) {
+  (void) indicator;
+  (void) timestamp;
+  daemon_send(data, TRAY_MSG_SECONDARY_ACTIVATE, -1);
+}
+
+static void daemon_apply_item_state(struct daemon_client *client, struct daemon_item *item) {
+  if (item->widget == NULL || strcmp(item->text, "-") == 0) {
+    return;
+  }
+  gtk_menu_item_set_label(GTK_MENU_ITEM(item->widget), item->text);
+  gtk_widget_set_sensitive(item->widget, !(item->flags & TRAY_WIRE_ITEM_DISABLED));
+  if (item->flags & TRAY_WIRE_ITEM_CHECKBOX) {
+    // set_active emits "activate", which must not be reported as a click
+    g_signal_handlers_block_by_func(item->widget, G_CALLBACK(daemon_item_activated), client);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item->widget), !!(item->flags & TRAY_WIRE_ITEM_CHECKED));
+    g_signal_handlers_unblock_by_func(item->widget, G_CALLBACK(daemon_item_activated), client);
+  }
+}
+
+static GtkWidget *daemon_build_menu(struct daemon_client *client, size_t *index, unsigned int count) {
+  GtkWidget *menu = gtk_menu_new();
+  for (unsigned int n = 0; n < count && *index < client->item_count; ++n) {
+    size_t i = (*index)++;
+    struct daemon_item *item = &client->items[i];
+    GtkWidget *widget;
+    if (strcmp(item->text, "-") == 0) {
+      widget = gtk_separator_menu_item_new();
+    } else {
+      if (item->flags & TRAY_WIRE_ITEM_SUBMENU) {
+        widget = gtk_menu_item_new_with_label(item->text);
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(widget), daemon_build_menu(client, index, item->child_count));
+      } else if (item->flags & TRAY_WIRE_ITEM_CHECKBOX) {
+        widget = gtk_check_menu_item_new_with_label(item->text);
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(widget), !!(item->flags & TRAY_WIRE_ITEM_CHECKED));
+      } else {
+        widget = gtk_menu_item_new_with_label(item->text);
+      }
+      gtk_widget_set_sensitive(widget, !(item->flags & TRAY_WIRE_ITEM_DISABLED));
+      g_object_set_data(G_OBJECT(widget), "tray-index", GINT_TO_POINTER((int) i));
+      g_signal_connect(widget, "activate", G_CALLBACK(daemon_item_activated), client);
+    }
+    item->widget = widget;
+    item->dirty = false;
+    gtk_widget_show(widget);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), widget);
+  }
+  return menu;
+}
+
+static void daemon_apply_notification(struct daemon_client *client) {
+  if (!notify_is_initted() && !notify_init("tray-daemon")) {
+    fprintf(stderr, "tray-daemon: notify_init() failed\n");
+    return;
+  }
+  if (client->notification != NULL) {
+    notify_notification_close(client->notification, NULL);
+    g_object_unref(G_OBJECT(client->notification));
+  }
+  client->notification = notify_notification_new(client->notification_title, client->notification_text, client->notification_icon);
+  if (client->notification == NULL) {
+    return;
+  }
+  if (client->notification_clickable) {
+    notify_notification_add_action(client->notification, "default", "Default", daemon_notification_clicked, client, NULL);
+  }
+  if (!notify_notification_show(client->notification, NULL)) {
+    fprintf(stderr, "tray-daemon: notify_notification_show() failed\n");
+  }
+}
+
+static void daemon_apply_client(struct daemon_client *client) {
+  if (client->indicator == NULL) {
+    char id[64];
+    snprintf(id, sizeof(id), "tray-daemon-%u-%u", client->pid, ++indicator_serial);
+    client->indicator = app_indicator_new(id, client->icon != NULL ? client->icon : "", APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
+    app_indicator_set_status(client->indicator, APP_INDICATOR_STATUS_ACTIVE);
+    g_signal_connect(client->indicator, "scroll-event", G_CALLBACK(daemon_scrolled), client);
+    g_signal_connect(client->indicator, "secondary-activate", G_CALLBACK(daemon_secondary_activated), client);
+  }
+  if (client->icon_dirty) {
+    app_indicator_set_icon_full(client->indicator, client->icon != NULL ? client->icon : "", client->icon);
+    app_indicator_set_title(client->indicator, client->tooltip);
+  }
+  if (client->menu_dirty) {
+    size_t index = 0;
+    // Everything left after the submenus is top level
+    app_indicator_set_menu(client->indicator, GTK_MENU(daemon_build_menu(client, &index, UINT_MAX)));
+  } else if (client->items_dirty) {
+    for (size_t i = 0; i < client->item_count; ++i) {
+      if (client->items[i].dirty) {
+        daemon_apply_item_state(client, &client->items[i]);
+        client->items[i].dirty = false;
+      }
+    }
+  }
+  if (client->notification_text != NULL) {
+    daemon_apply_notification(client);
+    g_clear_pointer(&client->notification_text, g_free);
+  }
+  client->icon_dirty = client->menu_dirty = client->items_dirty = false;
+}
+
+static gboolean daemon_frame(gpointer data) {
+  (void) data;
+  frame_source = 0;
+  for (struct daemon_client *client = clients; client != NULL; client = client->next) {
+    daemon_apply_client(client);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void daemon_schedule_frame(void) {
+  if (frame_source == 0) {
+    frame_source = g_timeout_add(TRAY_DAEMON_FRAME_MS, daemon_frame, NULL);
+  }
+}
+
+static void daemon_replace_string(char **slot, const char *value) {
+  g_free(*slot);
+  *slot = g_strdup(value);
+}
+
+static bool daemon_handle_message(struct daemon_client *client, unsigned int type, struct tray_wire_reader *r) {
+  switch (type) {
+    case TRAY_MSG_HELLO:
+      if (tray_wire_get_u32(r) != TRAY_WIRE_VERSION) {
+        fprintf(stderr, "tray-daemon: client speaks an unsupported protocol version\n");
+        return false;
+      }
+      client->pid = tray_wire_get_u32(r);
+      break;
+    case TRAY_MSG_SET_ICON:
+      daemon_replace_string(&client->icon, tray_wire_get_string(r));
+      client->icon_dirty = true;
+      break;
+    case TRAY_MSG_SET_TOOLTIP:
+      daemon_replace_string(&client->tooltip, tray_wire_get_string(r));
+      client->icon_dirty = true;
+      break;
+    case TRAY_MSG_MENU_REPLACE: {
+      unsigned int count = tray_wire_get_u32(r);
+      if (r->failed || count > TRAY_WIRE_MAX_FRAME_SIZE / 6) {
+        return false;
+      }
+      daemon_free_items(client);
+      client->items = g_new0(struct daemon_item, count);
+      for (unsigned int i = 0; i < count && !r->failed; ++i, ++client->item_count) {
+        client->items[i].child_count = tray_wire_get_u32(r);
+        client->items[i].flags = tray_wire_get_u8(r);
+        const char *text = tray_wire_get_string(r);
+        client->items[i].text = g_strdup(text != NULL ? text : "");
+      }
+      client->menu_dirty = true;
+      break;
+    }
+    case TRAY_MSG_MENU_ITEM_UPDATE: {
+      unsigned int index = tray_wire_get_u32(r);
+      unsigned int flags = tray_wire_get_u8(r);
+      const char *text = tray_wire_get_string(r);
+      if (r->failed || index >= client->item_count) {
+        return false;
+      }
+      struct daemon_item *item = &client->items[index];
+      item->flags = flags;
+      daemon_replace_string(&item->text, text != NULL ? text : "");
+      item->dirty = true;
+      client->items_dirty = true;
+      break;
+    }
+    case TRAY_MSG_NOTIFY:
+      // Only the latest notification of a frame is shown
+      daemon_replace_string(&client->notification_title, tray_wire_get_string(r));
+      daemon_replace_string(&client->notification_text, tray_wire_get_string(r));
+      daemon_replace_string(&client->notification_icon, tray_wire_get_string(r));
+      client->notification_clickable = tray_wire_get_u8(r) != 0;
+      break;
+    case TRAY_MSG_EXIT:
+      return false;
+    default:
+      fprintf(stderr, "tray-daemon: ignoring unknown message %u\n", type);
+      break;
+  }
+  if (r->failed) {
+    return false;
+  }
+  daemon_schedule_frame();
+  return true;
+}
+
+static gboolean daemon_client_readable(gint fd, GIOCondition condition, gpointer data) {
+  struct daemon_client *client = data;
+  (void) condition;
+
+  if (client->rx_capacity - client->rx_size < 4096) {
+    client->rx_capacity = client->rx_capacity != 0 ? client->rx_capacity * 2 : 8192;
+    client->rx = g_realloc(client->rx, client->rx_capacity);
+  }
+  ssize_t received = recv(fd, client->rx + client->rx_size, client->rx_capacity - client->rx_size, MSG_DONTWAIT);
+  if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return G_SOURCE_CONTINUE;
+  }
+  bool keep = received > 0;
+  if (keep) {
+    client->rx_size += (size_t) received;
+    size_t consumed = 0;
+    while (keep) {
+      unsigned int type;
+      struct tray_wire_reader payload;
+      long frame = tray_wire_next_frame(client->rx + consumed, client->rx_size - consumed, &type, &payload);
+      if (frame <= 0) {
+        keep = frame == 0;
+        break;
+      }
+      keep = daemon_handle_message(client, type, &payload);
+      consumed += (size_t) frame;
+    }
+    memmove(client->rx, client->rx + consumed, client->rx_size - consumed);
+    client->rx_size -= consumed;
+  }
+  if (!keep) {
+    client->source = 0;
+    daemon_client_free(client);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static void daemon_client_free(struct daemon_client *client) {
+  for (struct daemon_client **link = &clients; *link != NULL; link = &(*link)->next) {
+    if (*link == client) {
+      *link = client->next;
+      break;
+    }
+  }
+  if (client->source != 0) {
+    g_source_remove(client->source);
+  }
+  close(client->fd);
+  if (client->indicator != NULL) {
+    app_indicator_set_status(client->indicator, APP_INDICATOR_STATUS_PASSIVE);
+    g_object_unref(G_OBJECT(client->indicator));
+  }
+  if (client->notification != NULL) {
+    notify_notification_close(client->notification, NULL);
+    g_object_unref(G_OBJECT(client->notification));
+  }
+  daemon_free_items(client);
+  g_free(client->rx);
+  g_free(client->icon);
+  g_free(client->tooltip);
+  g_free(client->notification_title);
+  g_free(client->notification_text);
+  g_free(client->notification_icon);
+  g_free(client);
+}
+
+static gboolean daemon_accept(gint listen_fd, GIOCondition condition, gpointer data) {
+  (void) condition;
+  (void) data;
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return G_SOURCE_CONTINUE;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  struct daemon_client *client = g_new0(struct daemon_client, 1);
+  client->fd = fd;
+  client->next = clients;
+  clients = client;
+  client->source = g_unix_fd_add(fd, G_IO_IN | G_IO_HUP | G_IO_ERR, daemon_client_readable, client);
+  return G_SOURCE_CONTINUE;
+}
+
+static int daemon_listen(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "tray-daemon: socket path is too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("tray-daemon: socket");
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  unlink(path);  // stale socket of a previous daemon
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    perror("tray-daemon: bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static gboolean daemon_quit(gpointer data) {
+  (void) data;
+  gtk_main_quit();
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Main entry point.
+ * @param argc Argument count.
+ * @param argv Arguments; `--socket PATH` overrides the socket path.
+ * @return 0 on success, 1 on error.
+ */
+int main(int argc, char **argv) {
+  char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+  if (argc == 3 && strcmp(argv[1], "--socket") == 0) {
+    snprintf(path, sizeof(path), "%s", argv[2]);
+  } else if (tray_wire_socket_path(path, sizeof(path)) != 0) {
+    fprintf(stderr, "usage: %s [--socket PATH] (or set TRAY_DAEMON_SOCKET or XDG_RUNTIME_DIR)\n", argv[0]);
+    return 1;
+  }
+
+  if (!gtk_init_check(&argc, &argv)) {
+    fprintf(stderr, "tray-daemon: gtk_init_check() failed\n");
+    return 1;
+  }
+  int listen_fd = daemon_listen(path);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  g_unix_fd_add(listen_fd, G_IO_IN, daemon_accept, NULL);
+  g_unix_signal_add(SIGINT, daemon_quit, NULL);
+  g_unix_signal_add(SIGTERM, daemon_quit, NULL);
+
+  gtk_main();
+
+  while (clients != NULL) {
+    daemon_client_free(clients);
+  }
+  if (notify_is_initted()) {
+    notify_uninit();
+  }
+  close(listen_fd);
+  unlink(path);
+  return 0;
+}
@@ -6,12 +6,16 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 // lib includes
 #include <Cocoa/Cocoa.h>
 
 // local includes
 #include "tray.h"
+#include "tray_alloc.h"
+#include "tray_icon_cache.h"
+#include "tray_internal.h"
 
 /**
  * @class AppDelegate
@@ -24,41 +28,128 @@
  * @return void
  */
 - (IBAction)menuCallback:(id)sender;
+
+/**
+ * @brief Reads the menu bar appearance into tray_set_color_scheme().
+ * @param notification The AppleInterfaceThemeChangedNotification, or nil.
+ * @return void
+ */
+- (void)themeChanged:(NSNotification *)notification;
+
+/**
+ * @brief Reports screen locks and sleeping displays to tray_set_session_state().
+ * @param notification A screen lock or display sleep notification.
+ * @return void
+ */
+- (void)sessionChanged:(NSNotification *)notification;
 @end
 
 @implementation AppDelegate {
+  BOOL screenLocked;
+  BOOL screensAsleep;
 }
 
 - (IBAction)menuCallback:(id)sender {
   struct tray_menu *m = [[sender representedObject] pointerValue];
-  if (m != NULL && m->cb != NULL) {
+  if (m != NULL && m->cb != NULL && tray_input_debounce(m)) {
     m->cb(m);
   }
 }
 
+- (void)themeChanged:(NSNotification *)notification {
+  NSString *style = [[NSUserDefaults standardUserDefaults] stringForKey:@"AppleInterfaceStyle"];
+  tray_set_color_scheme([style isEqualToString:@"Dark"] ? TRAY_COLOR_SCHEME_DARK : TRAY_COLOR_SCHEME_LIGHT);
+}
+
+- (void)sessionChanged:(NSNotification *)notification {
+  NSString *name = [notification name];
+  if ([name isEqualToString:@"com.apple.screenIsLocked"]) {
+    screenLocked = YES;
+  } else if ([name isEqualToString:@"com.apple.screenIsUnlocked"]) {
+    screenLocked = NO;
+  } else if ([name isEqualToString:NSWorkspaceScreensDidSleepNotification]) {
+    screensAsleep = YES;
+  } else if ([name isEqualToString:NSWorkspaceScreensDidWakeNotification]) {
+    screensAsleep = NO;
+  }
+  tray_set_session_state(screenLocked ? TRAY_SESSION_LOCKED : (screensAsleep ? TRAY_SESSION_IDLE : TRAY_SESSION_ACTIVE));
+}
+
 @end
 
 static NSApplication *app;
 static NSStatusBar *statusBar;
 static NSStatusItem *statusItem;
+static BOOL menuReuse = FALSE;  // update the menu in place when the shape allows, see tray_set_capacity()
+static BOOL sessionWatched = FALSE;  // observing screen locks, see tray_set_session_suspend()
 
-static tray_log_callback g_tray_log_cb = NULL;
+/**
+ * @brief A decoded image and the modification time its file had then.
+ */
+struct tray_image {
+  NSImage *image;  ///< The image, owned.
+  struct timespec mtime;  ///< st_mtimespec of the file when it was decoded.
+};
 
-void tray_set_log_callback(tray_log_callback cb) {
-  g_tray_log_cb = cb;
+static void _tray_release_image(void *data) {
+  struct tray_image *entry = data;
+  [entry->image release];
+  tray_free(entry);
+  tray_stats_object_destroyed(TRAY_OBJECT_ICON);
 }
 
-static void tray_log(enum tray_log_level level, const char *fmt, ...) {
-  if (!g_tray_log_cb || !fmt) {
-    return;
+static struct tray_icon_cache images = {.destroy = _tray_release_image};  // struct tray_image of the tray icon, its variants and menu item icons by path
+
+static NSImage *_tray_decode_image(const char *path) {
+  NSImage *image = [[NSImage alloc] initWithContentsOfFile:[NSString stringWithUTF8String:path]];
+  if (image == nil) {
+    TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to load icon %s", path);
+    return nil;
   }
-  char buffer[1024];
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(buffer, sizeof(buffer), fmt, args);
-  va_end(args);
-  buffer[sizeof(buffer) - 1] = '\0';
-  g_tray_log_cb(level, buffer);
+  [image setSize:NSMakeSize(16, 16)];
+  return image;
+}
+
+// Each path is decoded once, and again once the file has been rewritten; the
+// status item and every menu item showing it refer to the same image
+static NSImage *_tray_image(const char *path) {
+  struct stat st;
+  BOOL found = stat(path, &st) == 0;
+  struct timespec mtime = found ? st.st_mtimespec : (struct timespec) {0, 0};
+  struct tray_image *entry = tray_icon_cache_find(&images, path);
+  if (entry != NULL) {
+    // A file that went away keeps showing what it was
+    if (!found || (entry->mtime.tv_sec == mtime.tv_sec && entry->mtime.tv_nsec == mtime.tv_nsec)) {
+      return entry->image;
+    }
+    // Items still showing the old image keep their own reference to it
+    NSImage *image = _tray_decode_image(path);
+    if (image == nil) {
+      return entry->image;
+    }
+    [entry->image release];
+    entry->image = image;
+    entry->mtime = mtime;
+    return image;
+  }
+  NSImage *image = _tray_decode_image(path);
+  if (image == nil) {
+    return nil;
+  }
+  entry = tray_malloc(TRAY_MEMORY_ICONS, sizeof(*entry));
+  if (entry == NULL) {
+    [image release];
+    return nil;
+  }
+  entry->image = image;
+  entry->mtime = mtime;
+  tray_stats_object_created(TRAY_OBJECT_ICON);
+  if (tray_icon_cache_insert(&images, path, entry) != 0) {
+    TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to cache icon %s", path);
+    _tray_release_image(entry);
+    return nil;
+  }
+  return image;
 }
 
 static NSMenu *_tray_menu(struct tray_menu *m) {
@@ -76,6 +167,9 @@ static NSMenu *_tray_menu(struct tray_menu *m) {
       [menuItem setEnabled:(m->disabled ? FALSE : TRUE)];
       [menuItem setState:(m->checked ? 1 : 0)];
       [menuItem setRepresentedObject:[NSValue valueWithPointer:m]];
+      if (m->icon != NULL) {
+        [menuItem setImage:_tray_image(m->icon)];
+      }
       [menu addItem:menuItem];
       if (m->submenu != NULL) {
         [menu setSubmenu:_tray_menu(m->submenu) forItem:menuItem];
@@ -85,7 +179,51 @@ static NSMenu *_tray_menu(struct tray_menu *m) {
   return menu;
 }
 
-int tray_init(struct tray *tray) {
+// Whether the menu holds the items _tray_menu() would create, separators and submenus alike
+static BOOL _tray_menu_same_shape(NSMenu *menu, struct tray_menu *m) {
+  NSInteger i = 0;
+  for (; m != NULL && m->text != NULL; m++, i++) {
+    if (i >= [menu numberOfItems]) {
+      return FALSE;
+    }
+    NSMenuItem *item = [menu itemAtIndex:i];
+    if ([item isSeparatorItem] != (strcmp(m->text, "-") == 0) || ([item submenu] != nil) != (m->submenu != NULL)) {
+      return FALSE;
+    }
+    if (m->submenu != NULL && !_tray_menu_same_shape([item submenu], m->submenu)) {
+      return FALSE;
+    }
+  }
+  return i == [menu numberOfItems];
+}
+
+static void _tray_menu_reuse(NSMenu *menu, struct tray_menu *m) {
+  NSInteger i = 0;
+  for (; m != NULL && m->text != NULL; m++, i++) {
+    NSMenuItem *item = [menu itemAtIndex:i];
+    if ([item isSeparatorItem]) {
+      continue;
+    }
+    NSString *title = [NSString stringWithUTF8String:m->text];
+    if (![[item title] isEqualToString:title]) {
+      [item setTitle:title];
+    }
+    [item setEnabled:(m->disabled ? FALSE : TRUE)];
+    [item setState:(m->checked ? 1 : 0)];
+    [item setRepresentedObject:[NSValue valueWithPointer:m]];
+    NSImage *image = m->icon != NULL ? _tray_image(m->icon) : nil;
+    if ([item image] != image) {
+      [item setImage:image];
+    }
+    if (m->submenu != NULL) {
+      _tray_menu_reuse([item submenu], m->submenu);
+    }
+  }
+}
+
+static void tray_darwin_update(struct tray *tray);
+
+static int tray_darwin_init(struct tray *tray) {
   AppDelegate *delegate = [[AppDelegate alloc] init];
   app = [NSApplication sharedApplication];
   [app setDelegate:delegate];
@@ -95,12 +233,27 @@ int tray_init(struct tray *tray) {
     tray_log(TRAY_LOG_ERROR, "Failed to initialize NSStatusBar/NSStatusItem");
     return -1;
   }
-  tray_update(tray);
+  menuReuse = tray_get_capacity() != NULL;
+  [delegate themeChanged:nil];
+  [[NSDistributedNotificationCenter defaultCenter] addObserver:delegate
+                                                      selector:@selector(themeChanged:)
+                                                          name:@"AppleInterfaceThemeChangedNotification"
+                                                        object:nil];
+  sessionWatched = tray_session_suspend_enabled();
+  if (sessionWatched) {
+    NSDistributedNotificationCenter *center = [NSDistributedNotificationCenter defaultCenter];
+    [center addObserver:delegate selector:@selector(sessionChanged:) name:@"com.apple.screenIsLocked" object:nil];
+    [center addObserver:delegate selector:@selector(sessionChanged:) name:@"com.apple.screenIsUnlocked" object:nil];
+    NSNotificationCenter *workspace = [[NSWorkspace sharedWorkspace] notificationCenter];
+    [workspace addObserver:delegate selector:@selector(sessionChanged:) name:NSWorkspaceScreensDidSleepNotification object:nil];
+    [workspace addObserver:delegate selector:@selector(sessionChanged:) name:NSWorkspaceScreensDidWakeNotification object:nil];
+  }
+  tray_darwin_update(tray);
   [app activateIgnoringOtherApps:TRUE];
   return 0;
 }
 
-int tray_loop(int blocking) {
+static int tray_darwin_loop(int blocking) {
   NSDate *until = (blocking ? [NSDate distantFuture] : [NSDate distantPast]);
   NSEvent *event = [app nextEventMatchingMask:ULONG_MAX
                                     untilDate:until
@@ -112,18 +265,92 @@ int tray_loop(int blocking) {
   return 0;
 }
 
-void tray_update(struct tray *tray) {
-  NSImage *image = [[NSImage alloc] initWithContentsOfFile:[NSString stringWithUTF8String:tray->icon]];
-  NSSize size = NSMakeSize(16, 16);
-  if (image == nil) {
-    tray_log(TRAY_LOG_WARNING, "Failed to load tray icon image");
-    return;
+// Only TRAY_PART_ICON and TRAY_PART_MENU are shown by this backend
+static void tray_darwin_update_parts(struct tray *tray, unsigned int parts) {
+  if (parts & TRAY_PART_ICON) {
+    NSImage *image = _tray_image(tray_icon_for_scheme(tray->icon));
+    // Decoded now, so a change of the appearance only swaps cached images
+    const char *variants[3];
+    size_t count = tray_icon_variants(tray->icon, variants);
+    for (size_t i = 0; i < count; ++i) {
+      _tray_image(variants[i]);
+    }
+    // A missing icon leaves the previous one, and the menu is still updated
+    if (image != nil) {
+      statusItem.button.image = image;
+      tray_stats_mark_first_icon();
+    }
   }
-  [image setSize:NSMakeSize(16, 16)];
-  statusItem.button.image = image;
-  [statusItem setMenu:_tray_menu(tray->menu)];
+  if (parts & TRAY_PART_MENU) {
+    NSMenu *menu = [statusItem menu];
+    if (menuReuse && menu != nil && _tray_menu_same_shape(menu, tray->menu)) {
+      _tray_menu_reuse(menu, tray->menu);
+    } else {
+      [statusItem setMenu:_tray_menu(tray->menu)];
+    }
+    tray_stats_mark_first_menu();
+  }
+}
+
+static void tray_darwin_update(struct tray *tray) {
+  tray_darwin_update_parts(tray, TRAY_PARTS_ALL);
+}
+
+static void tray_darwin_wakeup(void) {
+  // postEvent:atStart: may be called from any thread
+  NSEvent *event = [NSEvent otherEventWithType:NSEventTypeApplicationDefined
+                                      location:NSZeroPoint
+                                 modifierFlags:0
+                                     timestamp:0
+                                  windowNumber:0
+                                       context:nil
+                                       subtype:0
+                                         data1:0
+                                         data2:0];
+  [app postEvent:event atStart:NO];
+}
+
+static int tray_darwin_inject(enum tray_test_event event, const struct tray_test_target *target) {
+  if (event != TRAY_TEST_ACTIVATE) {
+    return -1;
+  }
+  NSMenu *menu = [statusItem menu];
+  for (int i = 0; i < target->depth; ++i) {
+    if (menu == nil || (NSInteger) target->path[i] >= [menu numberOfItems]) {
+      return -1;
+    }
+    if (i + 1 == target->depth) {
+      // Sends menuCallback: like a click on the item
+      [menu performActionForItemAtIndex:(NSInteger) target->path[i]];
+    } else {
+      menu = [[menu itemAtIndex:(NSInteger) target->path[i]] submenu];
+    }
+  }
+  return 0;
 }
 
-void tray_exit(void) {
+static void tray_darwin_exit(void) {
+  [[NSDistributedNotificationCenter defaultCenter] removeObserver:[app delegate]];
+  if (sessionWatched) {
+    [[[NSWorkspace sharedWorkspace] notificationCenter] removeObserver:[app delegate]];
+    // Nothing reports the unlock from here on
+    tray_set_session_state(TRAY_SESSION_ACTIVE);
+    sessionWatched = FALSE;
+  }
+  // The status item and the menu items keep their own references to the images
+  tray_icon_cache_clear(&images);
   [app terminate:app];
 }
+
+const struct tray_backend tray_darwin_backend = {
+  .name = "appkit",
+  .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU,
+  .available = NULL,
+  .init = tray_darwin_init,
+  .loop = tray_darwin_loop,
+  .update = tray_darwin_update,
+  .exit = tray_darwin_exit,
+  .wakeup = tray_darwin_wakeup,
+  .inject = tray_darwin_inject,
+  .update_parts = tray_darwin_update_parts,
+};
@@ -0,0 +1,158 @@
+/**
+ * @file src/tray_headless.c
+ * @brief Tray backend without any UI, used by tests and benchmarks.
+ *
+ * It keeps the most recent tray state and runs a loop that can be woken from
+ * any thread, so the tray API can be exercised where no desktop session exists.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// local includes
+#include "tray.h"
+#include "tray_internal.h"
+#include "tray_thread.h"
+
+#define TRAY_HEADLESS_MAX_CALLS 8  ///< Functions invoke() can queue before the loop runs them.
+
+static tray_mutex_t headless_mutex = TRAY_MUTEX_INITIALIZER;
+static tray_cond_t headless_cv = TRAY_COND_INITIALIZER;
+
+static struct tray *current_tray = NULL;
+static unsigned long long wakeups = 0;  // bumped whenever a blocking tray_loop() should return
+static unsigned long long wakeups_seen = 0;  // value of wakeups when tray_loop() last returned
+static bool exit_requested = false;
+static tray_thread_id_t loop_thread;  // thread of the last tray_loop(), or of tray_init() before that
+static void (*queued_calls[TRAY_HEADLESS_MAX_CALLS])(void);  // run by the next tray_loop()
+static size_t queued_count = 0;
+
+static int tray_headless_init(struct tray *tray) {
+  tray_mutex_lock(&headless_mutex);
+  current_tray = tray;
+  exit_requested = false;
+  wakeups_seen = wakeups;
+  loop_thread = tray_thread_self();
+  queued_count = 0;
+  tray_mutex_unlock(&headless_mutex);
+  tray_stats_mark_first_icon();
+  tray_stats_mark_first_menu();
+  return 0;
+}
+
+static int tray_headless_loop(int blocking) {
+  tray_mutex_lock(&headless_mutex);
+  loop_thread = tray_thread_self();
+  while (blocking && !exit_requested && wakeups == wakeups_seen && queued_count == 0) {
+    tray_cond_wait(&headless_cv, &headless_mutex);
+  }
+  if (queued_count > 0) {
+    void (*calls[TRAY_HEADLESS_MAX_CALLS])(void);
+    size_t count = queued_count;
+    memcpy(calls, queued_calls, sizeof(calls[0]) * count);
+    queued_count = 0;
+    tray_mutex_unlock(&headless_mutex);
+    TRAY_DELAY_POINT("loop-run");
+    for (size_t i = 0; i < count; ++i) {
+      calls[i]();
+    }
+    tray_mutex_lock(&headless_mutex);
+  }
+  wakeups_seen = wakeups;
+  int result = exit_requested ? -1 : 0;
+  tray_mutex_unlock(&headless_mutex);
+  return result;
+}
+
+static void tray_headless_update(struct tray *tray) {
+  tray_mutex_lock(&headless_mutex);
+  current_tray = tray;
+  tray_mutex_unlock(&headless_mutex);
+}
+
+static void tray_headless_wakeup(void) {
+  tray_mutex_lock(&headless_mutex);
+  ++wakeups;
+  tray_cond_broadcast(&headless_cv);
+  tray_mutex_unlock(&headless_mutex);
+}
+
+static void tray_headless_invoke(void (*func)(void)) {
+  tray_mutex_lock(&headless_mutex);
+  if (tray_thread_is_self(loop_thread)) {
+    tray_mutex_unlock(&headless_mutex);
+    func();
+    return;
+  }
+  for (size_t i = 0; i < queued_count; ++i) {
+    if (queued_calls[i] == func) {
+      tray_mutex_unlock(&headless_mutex);
+      return;
+    }
+  }
+  if (queued_count == TRAY_HEADLESS_MAX_CALLS) {
+    // Nothing here touches a toolkit, running it in place is safe
+    tray_mutex_unlock(&headless_mutex);
+    func();
+    return;
+  }
+  queued_calls[queued_count++] = func;
+  TRAY_DELAY_POINT("invoke-queue");
+  tray_cond_broadcast(&headless_cv);
+  tray_mutex_unlock(&headless_mutex);
+}
+
+static int tray_headless_inject(enum tray_test_event event, const struct tray_test_target *target) {
+  tray_mutex_lock(&headless_mutex);
+  struct tray *tray = current_tray;
+  tray_mutex_unlock(&headless_mutex);
+  if (tray == NULL) {
+    return -1;
+  }
+  // Without a tray host, calling back is all the dispatch there is
+  switch (event) {
+    case TRAY_TEST_ACTIVATE:
+      if (target->item->cb != NULL && tray_input_debounce(target->item)) {
+        target->item->cb(target->item);
+      }
+      return 0;
+    case TRAY_TEST_NOTIFICATION_CLICK:
+      if (tray->notification_cb == NULL) {
+        return -1;
+      }
+      tray->notification_cb();
+      return 0;
+    case TRAY_TEST_HOST_RESTART:
+      // Nothing is registered with a host, so nothing is lost
+      return 0;
+    case TRAY_TEST_SCROLL:
+      tray_input_scroll(target->scroll_dx, target->scroll_dy);
+      return 0;
+    case TRAY_TEST_SECONDARY_ACTIVATE:
+      tray_input_secondary_activate();
+      return 0;
+  }
+  return -1;
+}
+
+static void tray_headless_exit(void) {
+  tray_mutex_lock(&headless_mutex);
+  current_tray = NULL;
+  exit_requested = true;
+  tray_cond_broadcast(&headless_cv);
+  tray_mutex_unlock(&headless_mutex);
+}
+
+const struct tray_backend tray_headless_backend = {
+  .name = "headless",
+  .capabilities = TRAY_CAPABILITY_MENU | TRAY_CAPABILITY_TOOLTIP | TRAY_CAPABILITY_NOTIFICATIONS | TRAY_CAPABILITY_CROSS_THREAD_UPDATE | TRAY_CAPABILITY_SCROLL | TRAY_CAPABILITY_SECONDARY_ACTIVATE,
+  .available = NULL,
+  .init = tray_headless_init,
+  .loop = tray_headless_loop,
+  .update = tray_headless_update,
+  .exit = tray_headless_exit,
+  .wakeup = tray_headless_wakeup,
+  .invoke = tray_headless_invoke,
+  .inject = tray_headless_inject,
+};
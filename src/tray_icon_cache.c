@@ -0,0 +1,104 @@
+/**
+ * @file src/tray_icon_cache.c
+ * @brief Cache of decoded icons, keyed by path.
+ */
+// standard includes
+#include <string.h>
+
+// local includes
+#include "tray_alloc.h"
+#include "tray_icon_cache.h"
+
+#define TRAY_ICON_CACHE_MIN_CAPACITY 16  ///< Slots allocated for the first icon.
+
+static unsigned long long tray_icon_cache_hash(const char *path) {
+  unsigned long long hash = 14695981039346656037ULL;  // FNV-1a
+  for (const unsigned char *p = (const unsigned char *) path; *p != '\0'; ++p) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+void tray_icon_cache_init(struct tray_icon_cache *cache, void (*destroy)(void *data)) {
+  memset(cache, 0, sizeof(*cache));
+  cache->destroy = destroy;
+}
+
+static struct tray_icon_cache_entry *tray_icon_cache_slot(const struct tray_icon_cache *cache, const char *path, unsigned long long hash) {
+  size_t mask = cache->capacity - 1;
+  for (size_t i = (size_t) hash & mask;; i = (i + 1) & mask) {
+    struct tray_icon_cache_entry *slot = &cache->slots[i];
+    if (slot->path == NULL || (slot->hash == hash && strcmp(slot->path, path) == 0)) {
+      return slot;
+    }
+  }
+}
+
+void *tray_icon_cache_find(const struct tray_icon_cache *cache, const char *path) {
+  if (cache->count == 0 || path == NULL) {
+    return NULL;
+  }
+  return tray_icon_cache_slot(cache, path, tray_icon_cache_hash(path))->data;
+}
+
+static int tray_icon_cache_grow(struct tray_icon_cache *cache) {
+  size_t capacity = cache->capacity != 0 ? cache->capacity * 2 : TRAY_ICON_CACHE_MIN_CAPACITY;
+  struct tray_icon_cache_entry *slots = tray_calloc(TRAY_MEMORY_ICONS, capacity, sizeof(*slots));
+  if (slots == NULL) {
+    return -1;
+  }
+  struct tray_icon_cache grown = *cache;
+  grown.slots = slots;
+  grown.capacity = capacity;
+  for (size_t i = 0; i < cache->capacity; ++i) {
+    if (cache->slots[i].path != NULL) {
+      *tray_icon_cache_slot(&grown, cache->slots[i].path, cache->slots[i].hash) = cache->slots[i];
+    }
+  }
+  tray_free(cache->slots);
+  *cache = grown;
+  return 0;
+}
+
+int tray_icon_cache_insert(struct tray_icon_cache *cache, const char *path, void *data) {
+  if (path == NULL) {
+    return -1;
+  }
+  // Keep the load factor below 3/4 so probe sequences stay short
+  if ((cache->count + 1) * 4 > cache->capacity * 3 && tray_icon_cache_grow(cache) != 0) {
+    return -1;
+  }
+  unsigned long long hash = tray_icon_cache_hash(path);
+  struct tray_icon_cache_entry *slot = tray_icon_cache_slot(cache, path, hash);
+  if (slot->path != NULL) {
+    if (cache->destroy != NULL && slot->data != data) {
+      cache->destroy(slot->data);
+    }
+    slot->data = data;
+    return 0;
+  }
+  slot->path = tray_malloc(TRAY_MEMORY_ICONS, strlen(path) + 1);
+  if (slot->path == NULL) {
+    return -1;
+  }
+  strcpy(slot->path, path);
+  slot->hash = hash;
+  slot->data = data;
+  ++cache->count;
+  return 0;
+}
+
+void tray_icon_cache_clear(struct tray_icon_cache *cache) {
+  for (size_t i = 0; i < cache->capacity; ++i) {
+    if (cache->slots[i].path != NULL) {
+      if (cache->destroy != NULL) {
+        cache->destroy(cache->slots[i].data);
+      }
+      tray_free(cache->slots[i].path);
+    }
+  }
+  tray_free(cache->slots);
+  cache->slots = NULL;
+  cache->capacity = 0;
+  cache->count = 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file src/tray_icon_cache.h
+ * @brief Cache of decoded icons, keyed by path.
+ */
+#ifndef TRAY_ICON_CACHE_H
+#define TRAY_ICON_CACHE_H
+
+// standard includes
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /**
+   * @brief A cached icon.
+   */
+  struct tray_icon_cache_entry {
+    char *path;  ///< Icon path, owned by the cache; NULL for an empty slot.
+    unsigned long long hash;  ///< Hash of path.
+    void *data;  ///< Backend-specific decoded icon.
+  };
+
+  /**
+   * @brief Open-addressing hash table of decoded icons.
+   *
+   * Lookups do not allocate, so looking up an icon that is already cached is cheap
+   * enough for every tray_update().
+   */
+  struct tray_icon_cache {
+    struct tray_icon_cache_entry *slots;  ///< Hash table, capacity is a power of two.
+    size_t capacity;  ///< Number of slots.
+    size_t count;  ///< Number of cached icons.
+    void (*destroy)(void *data);  ///< Frees the data of an entry; may be NULL.
+  };
+
+  /**
+   * @brief Initialize an empty cache.
+   * @param cache The cache.
+   * @param destroy Called for each entry's data by tray_icon_cache_clear(); may be NULL.
+   */
+  void tray_icon_cache_init(struct tray_icon_cache *cache, void (*destroy)(void *data));
+
+  /**
+   * @brief Look up an icon.
+   * @return The data stored for path, or NULL if it is not cached.
+   */
+  void *tray_icon_cache_find(const struct tray_icon_cache *cache, const char *path);
+
+  /**
+   * @brief Add an icon. The path is copied.
+   * @return 0 on success, -1 on error, in which case the caller keeps ownership of data.
+   */
+  int tray_icon_cache_insert(struct tray_icon_cache *cache, const char *path, void *data);
+
+  /**
+   * @brief Remove and destroy all icons.
+   */
+  void tray_icon_cache_clear(struct tray_icon_cache *cache);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_ICON_CACHE_H */
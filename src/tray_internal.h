@@ -0,0 +1,285 @@
+/**
+ * @file src/tray_internal.h
+ * @brief Interface between the tray API and its backends.
+ */
+#ifndef TRAY_INTERNAL_H
+#define TRAY_INTERNAL_H
+
+// local includes
+#include "tray.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAY_TEST_MAX_DEPTH 8  ///< Deepest menu item tray_test_activate() can reach.
+#define TRAY_LOG_LIMIT_WINDOW_MS 60000  ///< Default window of a tray_log_limit.
+#define TRAY_LOG_LIMIT_BURST 5  ///< Default number of messages a tray_log_limit lets through per window.
+
+  /**
+   * @brief Pieces of the tray state, applied separately by tray_backend::update_parts.
+   */
+  enum tray_update_part {
+    TRAY_PART_ICON = 1 << 0,  ///< tray::icon, see tray_update_icon().
+    TRAY_PART_TOOLTIP = 1 << 1,  ///< tray::tooltip, see tray_update_tooltip().
+    TRAY_PART_MENU = 1 << 2,  ///< tray::menu, see tray_update_menu().
+    TRAY_PART_NOTIFICATION = 1 << 3,  ///< The notification fields, see tray_notify().
+    TRAY_PARTS_ALL = (1 << 4) - 1  ///< Everything, as tray_update() applies.
+  };
+
+  /**
+   * @brief Host events injected by the tray_test_*() functions.
+   */
+  enum tray_test_event {
+    TRAY_TEST_ACTIVATE,  ///< A menu item was clicked.
+    TRAY_TEST_NOTIFICATION_CLICK,  ///< The last notification was clicked.
+    TRAY_TEST_HOST_RESTART,  ///< The tray host restarted and forgot the icon.
+    TRAY_TEST_SCROLL,  ///< The user scrolled over the icon.
+    TRAY_TEST_SECONDARY_ACTIVATE  ///< The icon was middle-clicked.
+  };
+
+  /**
+   * @brief Menu item to activate, resolved against the last tray applied.
+   */
+  struct tray_test_target {
+    struct tray_menu *item;  ///< The item.
+    unsigned int path[TRAY_TEST_MAX_DEPTH];  ///< Index of the item, and of each parent, in its menu; outermost first.
+    int depth;  ///< Number of indices in path.
+    int scroll_dx;  ///< Steps to the right, for TRAY_TEST_SCROLL.
+    int scroll_dy;  ///< Steps up, for TRAY_TEST_SCROLL.
+  };
+
+  /**
+   * @brief A tray implementation, selected at runtime by tray_init().
+   */
+  struct tray_backend {
+    const char *name;  ///< Name used by tray_set_backend() and TRAY_BACKEND.
+    unsigned int capabilities;  ///< Combination of tray_capability flags.
+    int (*available)(void);  ///< Cheap check whether the backend can work in this session; NULL if it always can.
+    int (*init)(struct tray *tray);  ///< Implements tray_init().
+    int (*loop)(int blocking);  ///< Implements tray_loop().
+    void (*update)(struct tray *tray);  ///< Implements tray_update(); runs on the loop thread when invoke is set.
+    void (*exit)(void);  ///< Implements tray_exit().
+    void (*wakeup)(void);  ///< Makes a blocking loop() return, from any thread; NULL if it cannot.
+    void (*invoke)(void (*func)(void));  ///< Runs func on the loop thread, directly if already there; NULL if update is called in place.
+    int (*inject)(enum tray_test_event event, const struct tray_test_target *target);  ///< Feeds a host event through the backend's own dispatch, on the loop thread; target is NULL unless activating or scrolling. NULL if it cannot.
+    void (*update_parts)(struct tray *tray, unsigned int parts);  ///< Applies only the tray_update_part pieces of the tray, like update otherwise; NULL to apply everything instead.
+  };
+
+#if TRAY_APPINDICATOR
+  extern const struct tray_backend tray_linux_backend;  ///< AppIndicator backend.
+#endif
+#if TRAY_WINAPI
+  extern const struct tray_backend tray_windows_backend;  ///< Windows notification area backend.
+#endif
+#if TRAY_APPKIT
+  extern const struct tray_backend tray_darwin_backend;  ///< macOS status bar backend.
+#endif
+#if TRAY_DAEMON_CLIENT
+  extern const struct tray_backend tray_client_backend;  ///< Client of the shared tray daemon.
+#endif
+  extern const struct tray_backend tray_headless_backend;  ///< Backend without any UI, for tests and benchmarks.
+
+  /**
+   * @brief Make a backend selectable, replacing any backend with the same name.
+   * @param backend The backend; must stay valid for the lifetime of the process.
+   * @return 0 on success, -1 if the registry is full.
+   */
+  int tray_register_backend(const struct tray_backend *backend);
+
+  /**
+   * @brief Log a printf-style message through the callback set with tray_set_log_callback().
+   */
+  void tray_log(enum tray_log_level level, const char *fmt, ...);
+
+  /**
+   * @brief Number of log messages dropped because the async log queue was full, see tray_stats::log_dropped.
+   */
+  unsigned long long tray_log_dropped(void);
+
+  /**
+   * @brief Rate limit of one logging call site; zero-initialized static storage uses the defaults.
+   */
+  struct tray_log_limit {
+    unsigned int window_ms;  ///< Length of a window; 0 for TRAY_LOG_LIMIT_WINDOW_MS.
+    unsigned int burst;  ///< Messages let through per window; 0 for TRAY_LOG_LIMIT_BURST.
+    unsigned long long window_start_us;  ///< tray_now_us() at the start of the current window.
+    unsigned int count;  ///< Messages in the current window.
+  };
+
+  /**
+   * @brief Count a message of a call site and decide whether it is logged.
+   *
+   * The first message of a window after some were suppressed is preceded by an
+   * "N similar messages suppressed" summary. Nothing is counted while no log
+   * callback is set, so a flood costs next to nothing.
+   *
+   * @return Non-zero if the message is to be logged.
+   */
+  int tray_log_limit_check(struct tray_log_limit *limit, enum tray_log_level level);
+
+  /**
+   * @brief tray_log() subject to the rate limit of the call site.
+   */
+  void tray_log_limited(struct tray_log_limit *limit, enum tray_log_level level, const char *fmt, ...);
+
+  /**
+   * @brief tray_log() rate limited with the default limits, keeping the state in the call site.
+   */
+#define TRAY_LOG_LIMITED(level, ...) \
+  do { \
+    static struct tray_log_limit tray_call_site_limit; \
+    tray_log_limited(&tray_call_site_limit, level, __VA_ARGS__); \
+  } while (0)
+
+  /**
+   * @brief Make a blocking tray_loop() return so it can pick up work queued by another thread.
+   */
+  void tray_wakeup(void);
+
+  /**
+   * @brief Apply pieces of a tray the backend put off, on the loop thread, held back like tray_update() would be.
+   * @param tray The tray.
+   * @param parts Combination of tray_update_part pieces.
+   */
+  void tray_apply_deferred(struct tray *tray, unsigned int parts);
+
+  /**
+   * @brief Decide whether an activation starts a new burst, see tray_set_click_debounce().
+   *
+   * Backends call it on the loop thread before calling back, and skip the
+   * callback, and any state change of their own, if it returns 0.
+   *
+   * @param source The activated menu item, or another pointer naming what was clicked.
+   * @return Non-zero if the app is to be called back.
+   */
+  int tray_input_debounce(const void *source);
+
+  /**
+   * @brief Add scroll steps reported by the tray host, delivered by tray_input_flush().
+   */
+  void tray_input_scroll(int dx, int dy);
+
+  /**
+   * @brief Call the scroll callback with the steps added since the last flush, if any.
+   */
+  void tray_input_flush(void);
+
+  /**
+   * @brief Handle a middle click on the icon: debounce it and call the app back.
+   */
+  void tray_input_secondary_activate(void);
+
+  /**
+   * @brief Get the path to show for an icon, see tray_set_icon_variants().
+   * @return The variant of icon for the current color scheme, or icon itself if it has none.
+   */
+  const char *tray_icon_for_scheme(const char *icon);
+
+  /**
+   * @brief Get every variant of an icon, for backends to decode ahead of a color scheme change.
+   * @param icon The icon as set in tray::icon.
+   * @param paths Receives the light, dark and symbolic variants that are set.
+   * @return Number of paths written.
+   */
+  size_t tray_icon_variants(const char *icon, const char *paths[3]);
+
+  /**
+   * @brief Whether tray_set_session_suspend() is on, for backends to start watching the session in init().
+   */
+  int tray_session_suspend_enabled(void);
+
+  /**
+   * @brief Read the power source, see tray_set_power_limits().
+   * @param root Directory listing the power supplies like /sys/class/power_supply; ignored on Windows.
+   * @param source Receives the power source.
+   * @return 0 on success, -1 if the power source cannot be read here.
+   */
+  int tray_power_read(const char *root, enum tray_power_source *source);
+
+  /**
+   * @brief Start reading the power source every few seconds, stopping a previous watch.
+   */
+  void tray_power_watch_start(void);
+
+  /**
+   * @brief Stop the watch started by tray_power_watch_start(), if any.
+   */
+  void tray_power_watch_stop(void);
+
+  /**
+   * @brief Take a change of the power source, on the loop thread.
+   * @param source Receives the power source if it changed.
+   * @return Non-zero if the power source changed since the last call.
+   */
+  int tray_power_watch_poll(enum tray_power_source *source);
+
+  /**
+   * @brief Have the watch wake up the loop by the given time, for updates held back by the battery limits.
+   * @param due_us tray_now_us() at which the loop is to run.
+   */
+  void tray_power_watch_wake_at(unsigned long long due_us);
+
+  /**
+   * @brief Swap in a menu reloaded by tray_menu_watch(), on the loop thread.
+   * @return The tray to update, or NULL if there is nothing to apply.
+   */
+  struct tray *tray_menu_watch_apply(void);
+
+  /**
+   * @brief Get the sizes set with tray_set_capacity(), for backends to reserve in init().
+   * @return The sizes, or NULL if buffers and widgets are not to be kept for reuse.
+   */
+  const struct tray_capacity *tray_get_capacity(void);
+
+  /**
+   * @brief Monotonic clock in microseconds.
+   */
+  unsigned long long tray_now_us(void);
+
+  /**
+   * @brief Record time-to-first-icon, if not recorded since the last tray_init().
+   */
+  void tray_stats_mark_first_icon(void);
+
+  /**
+   * @brief Record time-to-first-menu, if not recorded since the last tray_init().
+   */
+  void tray_stats_mark_first_menu(void);
+
+  /**
+   * @brief Record that the tray host forgot the icon, e.g. because it restarted.
+   */
+  void tray_stats_mark_host_lost(void);
+
+  /**
+   * @brief Record that the icon is registered with the tray host again, see tray_stats::last_recovery_us.
+   */
+  void tray_stats_mark_host_recovered(void);
+
+  /**
+   * @brief Count a toolkit object the backend created, see tray_stats::live_objects.
+   */
+  void tray_stats_object_created(enum tray_object_type type);
+
+  /**
+   * @brief Count a toolkit object that has been freed.
+   */
+  void tray_stats_object_destroyed(enum tray_object_type type);
+
+#if TRAY_DELAY_POINTS
+  /**
+   * @brief Called at each TRAY_DELAY_POINT() with its name; stress tests sleep in it to widen race windows.
+   */
+  extern void (*tray_delay_hook)(const char *point);
+
+  #define TRAY_DELAY_POINT(point) (tray_delay_hook != NULL ? tray_delay_hook(point) : (void) 0)  ///< Marks a point where a thread may be delayed.
+#else
+  #define TRAY_DELAY_POINT(point) ((void) 0)  ///< Marks a point where a thread may be delayed, only active in test builds.
+#endif
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_INTERNAL_H */
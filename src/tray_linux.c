@@ -5,8 +5,7 @@
 // standard includes
 #include <stdbool.h>
 #include <stddef.h>
-#include <stdarg.h>
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // lib includes
@@ -19,178 +18,1124 @@
   #define IS_APP_INDICATOR APP_IS_INDICATOR  ///< Define IS_APP_INDICATOR for app-indicator compatibility.
 #endif
 #include <libnotify/notify.h>
+#ifdef TRAY_DLOPEN
+  #include <dlfcn.h>
+#endif
 #define TRAY_APPINDICATOR_ID "tray-id"  ///< Tray appindicator ID.
+#define TRAY_SNI_WATCHER_NAME "org.kde.StatusNotifierWatcher"  ///< Bus name of the StatusNotifier host registry.
+#define TRAY_HOST_PROBE_TIMEOUT_MS 500  ///< Timeout for asking the session bus whether a tray host exists.
+#define TRAY_HOST_RETRY_INITIAL_MS 250  ///< Time a restarted tray host gets to see the icon before it is registered again.
+#define TRAY_HOST_RETRY_MAX_MS 8000  ///< Longest delay between re-registration attempts.
+#define TRAY_NOTIFY_CLOSE_TIMEOUT_MS 1000  ///< Timeout of the CloseNotification call, which nothing waits for.
+#define TRAY_PORTAL_NAME "org.freedesktop.portal.Desktop"  ///< Bus name of the desktop portal.
+#define TRAY_PORTAL_PATH "/org/freedesktop/portal/desktop"  ///< Object path of the desktop portal.
+#define TRAY_PORTAL_SETTINGS "org.freedesktop.portal.Settings"  ///< Portal interface of the desktop settings.
+#define TRAY_APPEARANCE_NAMESPACE "org.freedesktop.appearance"  ///< Settings namespace of the color-scheme key.
+#define TRAY_SCREENSAVER_NAME "org.freedesktop.ScreenSaver"  ///< Bus name and interface of the screensaver.
+#define TRAY_SCREENSAVER_PATH "/org/freedesktop/ScreenSaver"  ///< Object path of the screensaver.
+#define TRAY_LOGIND_NAME "org.freedesktop.login1"  ///< Bus name of logind on the system bus.
+#define TRAY_LOGIND_PATH "/org/freedesktop/login1"  ///< Object path of the logind manager.
+#define TRAY_LOGIND_SESSION "org.freedesktop.login1.Session"  ///< Interface of a logind session.
 
 // local includes
 #include "tray.h"
+#include "tray_alloc.h"
+#include "tray_icon_cache.h"
+#include "tray_internal.h"
 
-static bool async_update_pending = false;
-static pthread_cond_t async_update_cv = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t async_update_mutex = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * @brief Kinds of menu item widget; items of the same kind can take each other's state.
+ */
+enum tray_linux_item_kind {
+  TRAY_LINUX_ITEM_PLAIN,  ///< GtkMenuItem without a submenu.
+  TRAY_LINUX_ITEM_CHECKBOX,  ///< GtkCheckMenuItem.
+  TRAY_LINUX_ITEM_SUBMENU,  ///< GtkMenuItem with a submenu.
+  TRAY_LINUX_ITEM_SEPARATOR  ///< GtkSeparatorMenuItem.
+};
+
+/**
+ * @brief A widget of currentMenu, kept to be updated in place, see tray_set_capacity().
+ */
+struct tray_linux_item {
+  GtkWidget *widget;  ///< The menu item.
+  struct tray_menu *item;  ///< The app's item; replaced by every update.
+  gulong handler;  ///< "activate" handler; 0 for separators.
+  enum tray_linux_item_kind kind;  ///< Kind of the widget.
+  bool image;  ///< Whether the widget is a GtkImageMenuItem showing tray_menu::icon.
+  size_t child_count;  ///< Number of direct submenu items.
+};
 
 static AppIndicator *indicator = NULL;
+static GtkWidget *currentMenu = NULL;
 static int loop_result = 0;
 static NotifyNotification *currentNotification = NULL;
+static void (*currentNotificationCb)() = NULL;  // action callback of currentNotification
+static guint deferred_init_source = 0;  // idle source that applies the first full update after tray_init()
+static struct tray_linux_item *reusable_items = NULL;  // widgets of currentMenu in pre-order, reserved by tray_set_capacity()
+static size_t reusable_capacity = 0;
+static size_t reusable_count = 0;  // 0 unless currentMenu can be updated in place
+static bool notification_reuse = false;  // update currentNotification instead of replacing it
+static struct tray *last_tray = NULL;  // last state applied, re-applied when the tray host restarts
+static guint watcher_watch = 0;  // g_bus_watch_name() of TRAY_SNI_WATCHER_NAME
+static bool watcher_present = false;
+static bool host_lost = false;  // the tray host went away and the indicator has not registered with a new one yet
+static guint host_retry_source = 0;  // timeout of the next re-registration attempt
+static guint host_retry_delay_ms = 0;  // doubled by every attempt up to TRAY_HOST_RETRY_MAX_MS
+static struct tray_icon_cache menu_icons = {.destroy = g_object_unref};  // GdkPixbuf of menu item icons by path or icon name
+static GCancellable *bus_cancellable = NULL;  // cancels the connections and calls still under way at exit
+static GDBusConnection *session_bus = NULL;  // own connection for the settings portal and the screensaver
+static GDBusConnection *system_bus = NULL;  // own connection for logind
+static guint portal_subscription = 0;  // SettingChanged of TRAY_APPEARANCE_NAMESPACE
+static bool session_watched = false;  // tray_set_session_suspend() was on at tray_init()
+static guint screensaver_subscription = 0;  // ActiveChanged of the screensaver
+static guint logind_subscription = 0;  // PropertiesChanged of the logind session
+static bool screensaver_active = false;
+static bool session_locked = false;  // LockedHint of the logind session
+static bool session_idle = false;  // IdleHint of the logind session
+
+#ifdef TRAY_DLOPEN
+  #ifdef TRAY_AYATANA_APPINDICATOR
+    #define TRAY_APPINDICATOR_SONAME "libayatana-appindicator3.so.1"  ///< AppIndicator library loaded at runtime.
+  #else
+    #define TRAY_APPINDICATOR_SONAME "libappindicator3.so.1"  ///< AppIndicator library loaded at runtime.
+  #endif
+  #define TRAY_LIBNOTIFY_SONAME "libnotify.so.4"  ///< libnotify library loaded at runtime.
+
+  // Every AppIndicator and libnotify function used by this file. Calls are
+  // redirected through tray_dl by the #defines at the end of this block.
+  #define TRAY_DL_APPINDICATOR_SYMBOLS(X) \
+    X(GType, app_indicator_get_type, (void)) \
+    X(AppIndicator *, app_indicator_new, (const gchar *, const gchar *, AppIndicatorCategory)) \
+    X(void, app_indicator_set_status, (AppIndicator *, AppIndicatorStatus)) \
+    X(void, app_indicator_set_icon_full, (AppIndicator *, const gchar *, const gchar *)) \
+    X(void, app_indicator_set_menu, (AppIndicator *, GtkMenu *))
+  #define TRAY_DL_NOTIFY_SYMBOLS(X) \
+    X(gboolean, notify_init, (const char *)) \
+    X(void, notify_uninit, (void)) \
+    X(gboolean, notify_is_initted, (void)) \
+    X(GType, notify_notification_get_type, (void)) \
+    X(NotifyNotification *, notify_notification_new, (const char *, const char *, const char *)) \
+    X(void, notify_notification_add_action, (NotifyNotification *, const char *, const char *, NotifyActionCallback, gpointer, GFreeFunc)) \
+    X(gboolean, notify_notification_update, (NotifyNotification *, const char *, const char *, const char *)) \
+    X(void, notify_notification_clear_actions, (NotifyNotification *)) \
+    X(gboolean, notify_notification_show, (NotifyNotification *, GError **))
+  #define TRAY_DL_DECLARE(ret, name, params) ret(*name) params;
+  #define TRAY_DL_RESOLVE(ret, name, params) \
+    if ((*(void **) &tray_dl.name = dlsym(handle, #name)) == NULL) { \
+      missing = #name; \
+      goto fail; \
+    }
+
+static struct {
+  void *appindicator_handle;
+  void *notify_handle;
+  TRAY_DL_APPINDICATOR_SYMBOLS(TRAY_DL_DECLARE)
+  TRAY_DL_NOTIFY_SYMBOLS(TRAY_DL_DECLARE)
+} tray_dl;
+
+static bool tray_dl_load_appindicator(void) {
+  if (tray_dl.appindicator_handle != NULL) {
+    return true;
+  }
+  const char *missing = NULL;
+  void *handle = dlopen(TRAY_APPINDICATOR_SONAME, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    tray_log(TRAY_LOG_WARNING, "dlopen(" TRAY_APPINDICATOR_SONAME ") failed: %s", dlerror());
+    return false;
+  }
+  TRAY_DL_APPINDICATOR_SYMBOLS(TRAY_DL_RESOLVE)
+  tray_dl.appindicator_handle = handle;
+  return true;
+
+fail:
+  tray_log(TRAY_LOG_WARNING, TRAY_APPINDICATOR_SONAME " is missing %s", missing);
+  dlclose(handle);
+  return false;
+}
+
+static bool tray_dl_load_notify(void) {
+  if (tray_dl.notify_handle != NULL) {
+    return true;
+  }
+  const char *missing = NULL;
+  void *handle = dlopen(TRAY_LIBNOTIFY_SONAME, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    tray_log(TRAY_LOG_WARNING, "dlopen(" TRAY_LIBNOTIFY_SONAME ") failed: %s", dlerror());
+    return false;
+  }
+  TRAY_DL_NOTIFY_SYMBOLS(TRAY_DL_RESOLVE)
+  tray_dl.notify_handle = handle;
+  return true;
+
+fail:
+  tray_log(TRAY_LOG_WARNING, TRAY_LIBNOTIFY_SONAME " is missing %s", missing);
+  dlclose(handle);
+  return false;
+}
 
-static tray_log_callback g_tray_log_cb = NULL;
+  #define app_indicator_get_type tray_dl.app_indicator_get_type
+  #define app_indicator_new tray_dl.app_indicator_new
+  #define app_indicator_set_status tray_dl.app_indicator_set_status
+  #define app_indicator_set_icon_full tray_dl.app_indicator_set_icon_full
+  #define app_indicator_set_menu tray_dl.app_indicator_set_menu
+  #define notify_init tray_dl.notify_init
+  #define notify_uninit tray_dl.notify_uninit
+  #define notify_is_initted tray_dl.notify_is_initted
+  #define notify_notification_get_type tray_dl.notify_notification_get_type
+  #define notify_notification_new tray_dl.notify_notification_new
+  #define notify_notification_add_action tray_dl.notify_notification_add_action
+  #define notify_notification_update tray_dl.notify_notification_update
+  #define notify_notification_clear_actions tray_dl.notify_notification_clear_actions
+  #define notify_notification_show tray_dl.notify_notification_show
 
-void tray_set_log_callback(tray_log_callback cb) {
-  g_tray_log_cb = cb;
+// Asks the session bus whether a StatusNotifier host is running, without
+// touching GTK. Without one there is nowhere to show the icon.
+static bool tray_host_available(void) {
+  GError *error = NULL;
+  GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+  if (bus == NULL) {
+    tray_log(TRAY_LOG_INFO, "No session bus, tray is unavailable: %s", error != NULL ? error->message : "unknown error");
+    g_clear_error(&error);
+    return false;
+  }
+  GVariant *reply = g_dbus_connection_call_sync(
+    bus,
+    "org.freedesktop.DBus",
+    "/org/freedesktop/DBus",
+    "org.freedesktop.DBus",
+    "NameHasOwner",
+    g_variant_new("(s)", TRAY_SNI_WATCHER_NAME),
+    G_VARIANT_TYPE("(b)"),
+    G_DBUS_CALL_FLAGS_NONE,
+    TRAY_HOST_PROBE_TIMEOUT_MS,
+    NULL,
+    &error
+  );
+  g_object_unref(bus);
+  if (reply == NULL) {
+    tray_log(TRAY_LOG_INFO, "NameHasOwner(" TRAY_SNI_WATCHER_NAME ") failed: %s", error != NULL ? error->message : "unknown error");
+    g_clear_error(&error);
+    return false;
+  }
+  gboolean has_owner = FALSE;
+  g_variant_get(reply, "(b)", &has_owner);
+  g_variant_unref(reply);
+  if (!has_owner) {
+    tray_log(TRAY_LOG_INFO, "No " TRAY_SNI_WATCHER_NAME " on the session bus, tray is unavailable");
+  }
+  return has_owner;
 }
+#endif
 
-static void tray_log(enum tray_log_level level, const char *fmt, ...) {
-  if (!g_tray_log_cb || !fmt) {
+static bool tray_notify_initted(void) {
+#ifdef TRAY_DLOPEN
+  if (tray_dl.notify_handle == NULL) {
+    return false;
+  }
+#endif
+  return notify_is_initted();
+}
+
+// notify_init() costs a D-Bus round-trip to the notification server, so it is
+// only paid once the app actually posts a notification.
+static bool tray_notify_ensure_init(void) {
+#ifdef TRAY_DLOPEN
+  if (!tray_dl_load_notify()) {
+    return false;
+  }
+#endif
+  if (notify_is_initted()) {
+    return true;
+  }
+  if (!notify_init("tray-icon")) {
+    tray_log(TRAY_LOG_WARNING, "notify_init() failed");
+    return false;
+  }
+  return true;
+}
+
+// notify_notification_close() blocks until the notification server replies,
+// so a wedged server would stall updates and the shutdown. This sends the same
+// CloseNotification call without waiting for the reply.
+static void tray_close_notification(NotifyNotification *notification) {
+  gint id = 0;
+  g_object_get(G_OBJECT(notification), "id", &id, NULL);
+  if (id == 0) {
+    // Never shown, there is nothing on screen to close
     return;
   }
-  char buffer[1024];
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(buffer, sizeof(buffer), fmt, args);
-  va_end(args);
-  buffer[sizeof(buffer) - 1] = '\0';
-  g_tray_log_cb(level, buffer);
+  // libnotify is connected to the session bus by now, so this does not block
+  GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, NULL);
+  if (bus == NULL) {
+    return;
+  }
+  g_dbus_connection_call(
+    bus,
+    "org.freedesktop.Notifications",
+    "/org/freedesktop/Notifications",
+    "org.freedesktop.Notifications",
+    "CloseNotification",
+    g_variant_new("(u)", (guint32) id),
+    NULL,
+    G_DBUS_CALL_FLAGS_NO_AUTO_START,
+    TRAY_NOTIFY_CLOSE_TIMEOUT_MS,
+    NULL,
+    NULL,
+    NULL
+  );
+  g_object_unref(bus);
+}
+
+static void tray_object_finalized(gpointer data, GObject *object) {
+  (void) object;
+  tray_stats_object_destroyed((enum tray_object_type) GPOINTER_TO_INT(data));
+}
+
+// Counts the object in tray_stats::live_objects until it is finalized
+static void tray_track_object(gpointer object, enum tray_object_type type) {
+  g_object_weak_ref(G_OBJECT(object), tray_object_finalized, GINT_TO_POINTER(type));
+  tray_stats_object_created(type);
+}
+
+// GTK toggled the check item before the "activate" handlers ran; a click that
+// is debounced must not leave it showing a state the app never saw
+static void tray_linux_drop_click(GtkMenuItem *item, struct tray_menu *m, GCallback handler, gpointer data) {
+  if (GTK_IS_CHECK_MENU_ITEM(item)) {
+    g_signal_handlers_block_by_func(item, handler, data);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), !!m->checked);
+    g_signal_handlers_unblock_by_func(item, handler, data);
+  }
 }
 
 static void _tray_menu_cb(GtkMenuItem *item, gpointer data) {
-  (void) item;
   struct tray_menu *m = (struct tray_menu *) data;
+  if (!tray_input_debounce(m)) {
+    tray_linux_drop_click(item, m, G_CALLBACK(_tray_menu_cb), data);
+    return;
+  }
   m->cb(m);
 }
 
-static GtkMenuShell *_tray_menu(struct tray_menu *m) {
+static void _tray_reusable_menu_cb(GtkMenuItem *item, gpointer data) {
+  struct tray_menu *m = ((struct tray_linux_item *) data)->item;
+  if (m->cb == NULL) {
+    return;
+  }
+  if (!tray_input_debounce(m)) {
+    tray_linux_drop_click(item, m, G_CALLBACK(_tray_reusable_menu_cb), data);
+    return;
+  }
+  m->cb(m);
+}
+
+static enum tray_linux_item_kind tray_linux_item_kind(const struct tray_menu *m) {
+  if (strcmp(m->text, "-") == 0) {
+    return TRAY_LINUX_ITEM_SEPARATOR;
+  }
+  if (m->submenu != NULL) {
+    return TRAY_LINUX_ITEM_SUBMENU;
+  }
+  return m->checkbox ? TRAY_LINUX_ITEM_CHECKBOX : TRAY_LINUX_ITEM_PLAIN;
+}
+
+// A check item shows its check mark where the icon would go
+static bool tray_linux_item_image(const struct tray_menu *m) {
+  enum tray_linux_item_kind kind = tray_linux_item_kind(m);
+  return m->icon != NULL && (kind == TRAY_LINUX_ITEM_PLAIN || kind == TRAY_LINUX_ITEM_SUBMENU);
+}
+
+// Each path or icon name is decoded once; every item showing it refers to the same pixbuf
+static GdkPixbuf *tray_linux_menu_icon(const char *icon) {
+  GdkPixbuf *pixbuf = tray_icon_cache_find(&menu_icons, icon);
+  if (pixbuf != NULL) {
+    return pixbuf;
+  }
+  gint size = 16;
+  gtk_icon_size_lookup(GTK_ICON_SIZE_MENU, &size, NULL);
+  GError *error = NULL;
+  if (g_path_is_absolute(icon)) {
+    pixbuf = gdk_pixbuf_new_from_file_at_size(icon, size, size, &error);
+  } else {
+    pixbuf = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), icon, size, 0, &error);
+  }
+  if (pixbuf == NULL) {
+    TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to load menu icon %s: %s", icon, error != NULL ? error->message : "unknown error");
+    g_clear_error(&error);
+    return NULL;
+  }
+  tray_track_object(pixbuf, TRAY_OBJECT_ICON);
+  if (tray_icon_cache_insert(&menu_icons, icon, pixbuf) != 0) {
+    TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to cache menu icon %s", icon);
+    g_object_unref(pixbuf);
+    return NULL;
+  }
+  return pixbuf;
+}
+
+// dbusmenu only exports the icons of GtkImageMenuItem, deprecated or not
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+static void tray_linux_set_item_icon(GtkWidget *item, const char *icon) {
+  GdkPixbuf *pixbuf = tray_linux_menu_icon(icon);
+  GtkWidget *image = gtk_image_menu_item_get_image(GTK_IMAGE_MENU_ITEM(item));
+  if (image != NULL && gtk_image_get_pixbuf(GTK_IMAGE(image)) == pixbuf) {
+    return;
+  }
+  gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), pixbuf != NULL ? gtk_image_new_from_pixbuf(pixbuf) : NULL);
+}
+
+static GtkWidget *tray_linux_new_image_item(const char *text, const char *icon) {
+  GtkWidget *item = gtk_image_menu_item_new_with_label(text);
+  gtk_image_menu_item_set_always_show_image(GTK_IMAGE_MENU_ITEM(item), TRUE);
+  tray_linux_set_item_icon(item, icon);
+  return item;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+static size_t tray_linux_menu_length(const struct tray_menu *m, bool nested) {
+  size_t count = 0;
+  for (; m != NULL && m->text != NULL; m++) {
+    count += 1 + (nested ? tray_linux_menu_length(m->submenu, true) : 0);
+  }
+  return count;
+}
+
+// With reusable set, the widgets are recorded in reusable_items, which must have room for all of them
+static GtkMenuShell *_tray_menu(struct tray_menu *m, bool reusable) {
   GtkMenuShell *menu = (GtkMenuShell *) gtk_menu_new();
   for (; m != NULL && m->text != NULL; m++) {
+    struct tray_linux_item *slot = reusable ? &reusable_items[reusable_count++] : NULL;
     GtkWidget *item;
     if (strcmp(m->text, "-") == 0) {
       item = gtk_separator_menu_item_new();
     } else {
-      if (m->submenu != NULL) {
-        item = gtk_menu_item_new_with_label(m->text);
-        gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), GTK_WIDGET(_tray_menu(m->submenu)));
-      } else if (m->checkbox) {
+      if (tray_linux_item_image(m)) {
+        item = tray_linux_new_image_item(m->text, m->icon);
+      } else if (m->submenu == NULL && m->checkbox) {
         item = gtk_check_menu_item_new_with_label(m->text);
         gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), !!m->checked);
       } else {
         item = gtk_menu_item_new_with_label(m->text);
       }
+      if (m->submenu != NULL) {
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), GTK_WIDGET(_tray_menu(m->submenu, reusable)));
+      }
       gtk_widget_set_sensitive(item, !m->disabled);
-      if (m->cb != NULL) {
+      if (slot != NULL) {
+        // Connected even without a callback, a later update may set one
+        slot->handler = g_signal_connect(item, "activate", G_CALLBACK(_tray_reusable_menu_cb), slot);
+      } else if (m->cb != NULL) {
         g_signal_connect(item, "activate", G_CALLBACK(_tray_menu_cb), m);
       }
     }
+    if (slot != NULL) {
+      slot->widget = item;
+      slot->item = m;
+      slot->kind = tray_linux_item_kind(m);
+      slot->image = tray_linux_item_image(m);
+      slot->child_count = tray_linux_menu_length(m->submenu, false);
+      if (slot->kind == TRAY_LINUX_ITEM_SEPARATOR) {
+        slot->handler = 0;
+      }
+    }
     gtk_widget_show(item);
     gtk_menu_shell_append(menu, item);
   }
   return menu;
 }
 
-int tray_init(struct tray *tray) {
-  if (gtk_init_check(0, NULL) == FALSE) {
-    tray_log(TRAY_LOG_ERROR, "gtk_init_check() failed");
-    return -1;
+// Whether the widgets of currentMenu from *index on match the menu, item for item in pre-order
+static bool tray_linux_same_shape(const struct tray_menu *m, size_t *index) {
+  for (; m != NULL && m->text != NULL; m++) {
+    if (*index >= reusable_count) {
+      return false;
+    }
+    const struct tray_linux_item *slot = &reusable_items[(*index)++];
+    if (slot->kind != tray_linux_item_kind(m) || slot->image != tray_linux_item_image(m) || slot->child_count != tray_linux_menu_length(m->submenu, false)) {
+      return false;
+    }
+    if (m->submenu != NULL && !tray_linux_same_shape(m->submenu, index)) {
+      return false;
+    }
   }
-  if (!notify_init("tray-icon")) {
-    tray_log(TRAY_LOG_WARNING, "notify_init() failed");
+  return true;
+}
+
+static void tray_linux_reuse_menu(struct tray_menu *m, size_t *index) {
+  for (; m != NULL && m->text != NULL; m++) {
+    struct tray_linux_item *slot = &reusable_items[(*index)++];
+    slot->item = m;
+    if (slot->kind != TRAY_LINUX_ITEM_SEPARATOR) {
+      // GTK copies every label it is given, so unchanged ones are left alone
+      const gchar *label = gtk_menu_item_get_label(GTK_MENU_ITEM(slot->widget));
+      if (label == NULL || strcmp(label, m->text) != 0) {
+        gtk_menu_item_set_label(GTK_MENU_ITEM(slot->widget), m->text);
+      }
+      if (slot->image) {
+        tray_linux_set_item_icon(slot->widget, m->icon);
+      }
+      if (slot->kind == TRAY_LINUX_ITEM_CHECKBOX) {
+        // A change of state emits "activate", which is not a click
+        g_signal_handler_block(slot->widget, slot->handler);
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(slot->widget), !!m->checked);
+        g_signal_handler_unblock(slot->widget, slot->handler);
+      }
+      gtk_widget_set_sensitive(slot->widget, !m->disabled);
+    }
+    if (m->submenu != NULL) {
+      tray_linux_reuse_menu(m->submenu, index);
+    }
   }
-  indicator = app_indicator_new(TRAY_APPINDICATOR_ID, tray->icon, APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
+}
+
+static void tray_linux_apply_menu(struct tray_menu *m) {
+  size_t index = 0;
+  if (reusable_count > 0 && tray_linux_same_shape(m, &index) && index == reusable_count) {
+    index = 0;
+    tray_linux_reuse_menu(m, &index);
+    return;
+  }
+
+  // The widgets of the previous menu are not activated again before it is destroyed below
+  reusable_count = 0;
+  bool reusable = reusable_capacity > 0 && tray_linux_menu_length(m, true) <= reusable_capacity;
+  GtkWidget *menu = GTK_WIDGET(_tray_menu(m, reusable));
+  tray_track_object(menu, TRAY_OBJECT_MENU);
+  app_indicator_set_menu(indicator, GTK_MENU(menu));
+  // The indicator drops its reference to the previous menu, but a menu is
+  // also owned by its toplevel window and is only freed once destroyed
+  if (currentMenu != NULL) {
+    gtk_widget_destroy(currentMenu);
+  }
+  currentMenu = menu;
+}
+
+static gboolean tray_init_deferred(gpointer user_data) {
+  (void) user_data;
+  deferred_init_source = 0;
+  // A partial update since tray_init() may have brought a newer tray. Through
+  // tray.c, so that a locked session and the battery limits hold it back too.
+  tray_apply_deferred(last_tray, TRAY_PART_MENU | TRAY_PART_NOTIFICATION);
+  return G_SOURCE_REMOVE;
+}
+
+static void tray_linux_connection_changed(AppIndicator *source, gboolean connected, gpointer user_data) {
+  (void) source;
+  (void) user_data;
+  if (!connected || !host_lost) {
+    return;
+  }
+  host_lost = false;
+  if (host_retry_source != 0) {
+    g_source_remove(host_retry_source);
+    host_retry_source = 0;
+  }
+  tray_stats_mark_host_recovered();
+  tray_log(TRAY_LOG_INFO, "Tray icon registered with the restarted tray host");
+}
+
+static void tray_linux_scroll(AppIndicator *source, gint delta, GdkScrollDirection direction, gpointer user_data) {
+  (void) source;
+  (void) user_data;
+  // Summed up until the current tray_loop() iteration ends
+  switch (direction) {
+    case GDK_SCROLL_UP:
+      tray_input_scroll(0, delta);
+      break;
+    case GDK_SCROLL_DOWN:
+      tray_input_scroll(0, -delta);
+      break;
+    case GDK_SCROLL_LEFT:
+      tray_input_scroll(-delta, 0);
+      break;
+    case GDK_SCROLL_RIGHT:
+      tray_input_scroll(delta, 0);
+      break;
+    default:
+      break;
+  }
+}
+
+static void tray_linux_secondary_activate(AppIndicator *source, guint timestamp, gpointer user_data) {
+  (void) source;
+  (void) timestamp;
+  (void) user_data;
+  tray_input_secondary_activate();
+}
+
+static bool tray_linux_new_indicator(const char *icon) {
+  indicator = app_indicator_new(TRAY_APPINDICATOR_ID, icon, APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
   if (indicator == NULL || !IS_APP_INDICATOR(indicator)) {
     tray_log(TRAY_LOG_ERROR, "app_indicator_new() failed");
+    indicator = NULL;
+    return false;
+  }
+  tray_track_object(indicator, TRAY_OBJECT_ICON);
+  // Emitted once the StatusNotifierWatcher accepted the registration
+  g_signal_connect(indicator, "connection-changed", G_CALLBACK(tray_linux_connection_changed), NULL);
+  g_signal_connect(indicator, "scroll-event", G_CALLBACK(tray_linux_scroll), NULL);
+  g_signal_connect(indicator, "secondary-activate", G_CALLBACK(tray_linux_secondary_activate), NULL);
+  return true;
+}
+
+// Registers a new indicator carrying the last state. The old one is dropped
+// first, its bus path is taken over by the new one. Nothing is replayed but the
+// icon and the menu, in one go, so the host sees a single complete item.
+static void tray_linux_reregister(void) {
+  g_clear_object(&indicator);
+  const char *icon = last_tray != NULL ? tray_icon_for_scheme(last_tray->icon) : NULL;
+  if (last_tray == NULL || !tray_linux_new_indicator(icon)) {
+    return;
+  }
+  app_indicator_set_icon_full(indicator, icon, icon);
+  if (currentMenu != NULL) {
+    app_indicator_set_menu(indicator, GTK_MENU(currentMenu));
+  }
+  app_indicator_set_status(indicator, APP_INDICATOR_STATUS_ACTIVE);
+}
+
+static gboolean tray_linux_host_retry(gpointer user_data) {
+  (void) user_data;
+  host_retry_source = 0;
+  if (!host_lost || !watcher_present) {
+    return G_SOURCE_REMOVE;
+  }
+  // The host did not take the registration the indicator made on its own
+  tray_log(TRAY_LOG_DEBUG, "Registering the tray icon again, next attempt in %u ms", host_retry_delay_ms * 2);
+  tray_linux_reregister();
+  host_retry_delay_ms = host_retry_delay_ms * 2 < TRAY_HOST_RETRY_MAX_MS ? host_retry_delay_ms * 2 : TRAY_HOST_RETRY_MAX_MS;
+  host_retry_source = g_timeout_add(host_retry_delay_ms, tray_linux_host_retry, NULL);
+  return G_SOURCE_REMOVE;
+}
+
+static void tray_linux_host_gone(void) {
+  if (!host_lost) {
+    host_lost = true;
+    tray_stats_mark_host_lost();
+  }
+  if (host_retry_source != 0) {
+    g_source_remove(host_retry_source);
+    host_retry_source = 0;
+  }
+}
+
+static void tray_linux_watcher_appeared(GDBusConnection *connection, const gchar *name, const gchar *owner, gpointer user_data) {
+  (void) connection;
+  (void) name;
+  (void) owner;
+  (void) user_data;
+  watcher_present = true;
+  if (host_lost && host_retry_source == 0) {
+    host_retry_delay_ms = TRAY_HOST_RETRY_INITIAL_MS;
+    host_retry_source = g_timeout_add(host_retry_delay_ms, tray_linux_host_retry, NULL);
+  }
+}
+
+static void tray_linux_watcher_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+  (void) connection;
+  (void) name;
+  (void) user_data;
+  // Also called right away when there is no watcher yet, which is no restart
+  if (watcher_present) {
+    tray_log(TRAY_LOG_INFO, TRAY_SNI_WATCHER_NAME " went away, waiting for the tray host to restart");
+    tray_linux_host_gone();
+  }
+  watcher_present = false;
+}
+
+// Takes the uint32 of the setting, which Read() wraps in one variant more than SettingChanged
+static void tray_linux_apply_color_scheme(GVariant *value) {
+  GVariant *inner = g_variant_ref(value);
+  while (g_variant_is_of_type(inner, G_VARIANT_TYPE_VARIANT)) {
+    GVariant *next = g_variant_get_variant(inner);
+    g_variant_unref(inner);
+    inner = next;
+  }
+  if (g_variant_is_of_type(inner, G_VARIANT_TYPE_UINT32)) {
+    guint32 scheme = g_variant_get_uint32(inner);
+    tray_set_color_scheme(scheme <= TRAY_COLOR_SCHEME_LIGHT ? (enum tray_color_scheme) scheme : TRAY_COLOR_SCHEME_DEFAULT);
+  }
+  g_variant_unref(inner);
+}
+
+static void tray_linux_setting_changed(GDBusConnection *connection, const gchar *sender, const gchar *path, const gchar *interface, const gchar *signal, GVariant *parameters, gpointer user_data) {
+  (void) connection;
+  (void) sender;
+  (void) path;
+  (void) interface;
+  (void) signal;
+  (void) user_data;
+  const gchar *namespace_name = NULL;
+  const gchar *key = NULL;
+  GVariant *value = NULL;
+  g_variant_get(parameters, "(&s&sv)", &namespace_name, &key, &value);
+  if (g_strcmp0(namespace_name, TRAY_APPEARANCE_NAMESPACE) == 0 && g_strcmp0(key, "color-scheme") == 0) {
+    tray_linux_apply_color_scheme(value);
+  }
+  g_variant_unref(value);
+}
+
+// Whether the callback of a call made for the running tray, which passed a
+// reference to bus_cancellable, still has a tray to report to; drops the reference
+static bool tray_linux_bus_current(gpointer user_data) {
+  GCancellable *cancellable = user_data;
+  bool current = cancellable == bus_cancellable && !g_cancellable_is_cancelled(cancellable);
+  g_object_unref(cancellable);
+  return current;
+}
+
+static GVariant *tray_linux_bus_reply(GObject *source, GAsyncResult *result, gpointer user_data, const char *what) {
+  GError *error = NULL;
+  GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+  if (!tray_linux_bus_current(user_data)) {
+    g_clear_error(&error);
+    if (reply != NULL) {
+      g_variant_unref(reply);
+    }
+    return NULL;
+  }
+  if (reply == NULL) {
+    // Nothing owns the name, or it lacks the setting; what it would report keeps its default
+    tray_log(TRAY_LOG_DEBUG, "Reading %s failed: %s", what, error->message);
+    g_clear_error(&error);
+  }
+  return reply;
+}
+
+static void tray_linux_bus_call(GDBusConnection *bus, const char *name, const char *path, const char *interface, const char *method, GVariant *parameters, const char *reply_type, GAsyncReadyCallback done) {
+  g_dbus_connection_call(bus, name, path, interface, method, parameters, G_VARIANT_TYPE(reply_type), G_DBUS_CALL_FLAGS_NONE, -1, bus_cancellable, done, g_object_ref(bus_cancellable));
+}
+
+static void tray_linux_color_scheme_read(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GVariant *reply = tray_linux_bus_reply(source, result, user_data, "the color scheme");
+  if (reply == NULL) {
+    return;
+  }
+  GVariant *value = NULL;
+  g_variant_get(reply, "(v)", &value);
+  tray_linux_apply_color_scheme(value);
+  g_variant_unref(value);
+  g_variant_unref(reply);
+}
+
+static void tray_linux_report_session(void) {
+  enum tray_session_state state = TRAY_SESSION_ACTIVE;
+  if (session_locked) {
+    state = TRAY_SESSION_LOCKED;
+  } else if (session_idle || screensaver_active) {
+    state = TRAY_SESSION_IDLE;
+  }
+  tray_set_session_state(state);
+}
+
+static void tray_linux_screensaver_changed(GDBusConnection *connection, const gchar *sender, const gchar *path, const gchar *interface, const gchar *signal, GVariant *parameters, gpointer user_data) {
+  (void) connection;
+  (void) sender;
+  (void) path;
+  (void) interface;
+  (void) signal;
+  (void) user_data;
+  gboolean active = FALSE;
+  g_variant_get(parameters, "(b)", &active);
+  screensaver_active = active;
+  tray_linux_report_session();
+}
+
+static void tray_linux_screensaver_read(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GVariant *reply = tray_linux_bus_reply(source, result, user_data, "the screensaver state");
+  if (reply == NULL) {
+    return;
+  }
+  gboolean active = FALSE;
+  g_variant_get(reply, "(b)", &active);
+  g_variant_unref(reply);
+  screensaver_active = active;
+  tray_linux_report_session();
+}
+
+// Takes the hints from an a{sv} of session properties; missing ones are left alone
+static void tray_linux_apply_session_properties(GVariant *properties) {
+  gboolean value = FALSE;
+  if (g_variant_lookup(properties, "LockedHint", "b", &value)) {
+    session_locked = value;
+  }
+  if (g_variant_lookup(properties, "IdleHint", "b", &value)) {
+    session_idle = value;
+  }
+  tray_linux_report_session();
+}
+
+static void tray_linux_logind_changed(GDBusConnection *connection, const gchar *sender, const gchar *path, const gchar *interface, const gchar *signal, GVariant *parameters, gpointer user_data) {
+  (void) connection;
+  (void) sender;
+  (void) path;
+  (void) interface;
+  (void) signal;
+  (void) user_data;
+  GVariant *changed = g_variant_get_child_value(parameters, 1);
+  tray_linux_apply_session_properties(changed);
+  g_variant_unref(changed);
+}
+
+static void tray_linux_logind_read(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GVariant *reply = tray_linux_bus_reply(source, result, user_data, "the logind session");
+  if (reply == NULL) {
+    return;
+  }
+  GVariant *properties = g_variant_get_child_value(reply, 0);
+  tray_linux_apply_session_properties(properties);
+  g_variant_unref(properties);
+  g_variant_unref(reply);
+}
+
+static void tray_linux_logind_session_found(GObject *source, GAsyncResult *result, gpointer user_data) {
+  GVariant *reply = tray_linux_bus_reply(source, result, user_data, "the logind session path");
+  if (reply == NULL) {
+    return;
+  }
+  const gchar *path = NULL;
+  g_variant_get(reply, "(&o)", &path);
+  // Subscribed before reading, so that no change falls in between
+  logind_subscription = g_dbus_connection_signal_subscribe(system_bus, TRAY_LOGIND_NAME, "org.freedesktop.DBus.Properties", "PropertiesChanged", path, TRAY_LOGIND_SESSION, G_DBUS_SIGNAL_FLAGS_NONE, tray_linux_logind_changed, NULL, NULL);
+  tray_linux_bus_call(system_bus, TRAY_LOGIND_NAME, path, "org.freedesktop.DBus.Properties", "GetAll", g_variant_new("(s)", TRAY_LOGIND_SESSION), "(a{sv})", tray_linux_logind_read);
+  g_variant_unref(reply);
+}
+
+static GDBusConnection *tray_linux_bus_connected(GAsyncResult *result, gpointer user_data, const char *what) {
+  GError *error = NULL;
+  GDBusConnection *bus = g_dbus_connection_new_for_address_finish(result, &error);
+  if (!tray_linux_bus_current(user_data)) {
+    g_clear_error(&error);
+    g_clear_object(&bus);
+    return NULL;
+  }
+  if (bus == NULL) {
+    tray_log(TRAY_LOG_INFO, "Not following %s: %s", what, error->message);
+    g_clear_error(&error);
+  }
+  return bus;
+}
+
+static void tray_linux_session_bus_ready(GObject *source, GAsyncResult *result, gpointer user_data) {
+  (void) source;
+  session_bus = tray_linux_bus_connected(result, user_data, "the color scheme");
+  if (session_bus == NULL) {
+    return;
+  }
+  // Subscribed before reading, so that no change falls in between
+  portal_subscription = g_dbus_connection_signal_subscribe(session_bus, TRAY_PORTAL_NAME, TRAY_PORTAL_SETTINGS, "SettingChanged", TRAY_PORTAL_PATH, TRAY_APPEARANCE_NAMESPACE, G_DBUS_SIGNAL_FLAGS_NONE, tray_linux_setting_changed, NULL, NULL);
+  tray_linux_bus_call(session_bus, TRAY_PORTAL_NAME, TRAY_PORTAL_PATH, TRAY_PORTAL_SETTINGS, "Read", g_variant_new("(ss)", TRAY_APPEARANCE_NAMESPACE, "color-scheme"), "(v)", tray_linux_color_scheme_read);
+  if (session_watched) {
+    screensaver_subscription = g_dbus_connection_signal_subscribe(session_bus, TRAY_SCREENSAVER_NAME, TRAY_SCREENSAVER_NAME, "ActiveChanged", TRAY_SCREENSAVER_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, tray_linux_screensaver_changed, NULL, NULL);
+    tray_linux_bus_call(session_bus, TRAY_SCREENSAVER_NAME, TRAY_SCREENSAVER_PATH, TRAY_SCREENSAVER_NAME, "GetActive", NULL, "(b)", tray_linux_screensaver_read);
+  }
+}
+
+static void tray_linux_system_bus_ready(GObject *source, GAsyncResult *result, gpointer user_data) {
+  (void) source;
+  system_bus = tray_linux_bus_connected(result, user_data, "the session lock");
+  if (system_bus == NULL) {
+    return;
+  }
+  // "auto" is the session of this process, or else the user's graphical session
+  tray_linux_bus_call(system_bus, TRAY_LOGIND_NAME, TRAY_LOGIND_PATH, "org.freedesktop.login1.Manager", "GetSession", g_variant_new("(s)", "auto"), "(o)", tray_linux_logind_session_found);
+}
+
+static void tray_linux_open_bus(GBusType type, GAsyncReadyCallback ready) {
+  gchar *address = g_dbus_address_get_for_bus_sync(type, NULL, NULL);
+  if (address == NULL) {
+    return;
+  }
+  GDBusConnectionFlags flags = G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION;
+  g_dbus_connection_new_for_address(address, flags, NULL, bus_cancellable, ready, g_object_ref(bus_cancellable));
+  g_free(address);
+}
+
+// The settings portal, the screensaver and logind are asked on connections of
+// their own, opened in the background so that the icon does not wait for them.
+// The addresses are looked up at every tray_init(), so tests can point the
+// buses at a private one.
+static void tray_linux_watch_desktop(void) {
+  bus_cancellable = g_cancellable_new();
+  session_watched = tray_session_suspend_enabled();
+  tray_linux_open_bus(G_BUS_TYPE_SESSION, tray_linux_session_bus_ready);
+  if (session_watched) {
+    tray_linux_open_bus(G_BUS_TYPE_SYSTEM, tray_linux_system_bus_ready);
+  }
+}
+
+static void tray_linux_close_bus(GDBusConnection **bus, guint *subscriptions[], size_t count) {
+  if (*bus == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (*subscriptions[i] != 0) {
+      g_dbus_connection_signal_unsubscribe(*bus, *subscriptions[i]);
+      *subscriptions[i] = 0;
+    }
+  }
+  g_dbus_connection_close(*bus, NULL, NULL, NULL);
+  g_clear_object(bus);
+}
+
+static void tray_linux_unwatch_desktop(void) {
+  if (bus_cancellable != NULL) {
+    g_cancellable_cancel(bus_cancellable);
+    g_clear_object(&bus_cancellable);
+  }
+  guint *session_subscriptions[] = {&portal_subscription, &screensaver_subscription};
+  tray_linux_close_bus(&session_bus, session_subscriptions, 2);
+  guint *system_subscriptions[] = {&logind_subscription};
+  tray_linux_close_bus(&system_bus, system_subscriptions, 1);
+  if (session_watched) {
+    // Nothing reports the user's return once the watches are gone
+    screensaver_active = false;
+    session_locked = false;
+    session_idle = false;
+    tray_set_session_state(TRAY_SESSION_ACTIVE);
+  }
+  session_watched = false;
+}
+
+// GTK needs a display; checking the environment avoids loading anything when there is none.
+static int tray_linux_available(void) {
+  const char *x11 = getenv("DISPLAY");
+  const char *wayland = getenv("WAYLAND_DISPLAY");
+  return (x11 != NULL && x11[0] != '\0') || (wayland != NULL && wayland[0] != '\0');
+}
+
+static int tray_linux_init(struct tray *tray) {
+#ifdef TRAY_DLOPEN
+  if (!tray_host_available() || !tray_dl_load_appindicator()) {
+    return -2;
+  }
+#endif
+  if (gtk_init_check(0, NULL) == FALSE) {
+    tray_log(TRAY_LOG_ERROR, "gtk_init_check() failed");
+    return -1;
+  }
+  // Left at -1 by the tray_exit() of a previous tray
+  loop_result = 0;
+  if (!tray_linux_new_indicator(tray_icon_for_scheme(tray->icon))) {
     return -1;
   }
   app_indicator_set_status(indicator, APP_INDICATOR_STATUS_ACTIVE);
-  tray_update(tray);
+  tray_stats_mark_first_icon();
+  last_tray = tray;
+  // A restarted panel starts a new watcher, which knows nothing of the icon
+  watcher_watch = g_bus_watch_name(G_BUS_TYPE_SESSION, TRAY_SNI_WATCHER_NAME, G_BUS_NAME_WATCHER_FLAGS_NONE, tray_linux_watcher_appeared, tray_linux_watcher_vanished, NULL, NULL);
+  tray_linux_watch_desktop();
+
+  const struct tray_capacity *capacity = tray_get_capacity();
+  notification_reuse = capacity != NULL && capacity->notification_slots > 0;
+  if (capacity != NULL && capacity->max_items > 0) {
+    reusable_items = tray_calloc(TRAY_MEMORY_MENUS, (size_t) capacity->max_items, sizeof(*reusable_items));
+    reusable_capacity = reusable_items != NULL ? (size_t) capacity->max_items : 0;
+  }
+
+  // Get the icon on screen first; the menu and any notification are applied
+  // once the loop goes idle. An explicit tray_update() before then supersedes this.
+  deferred_init_source = g_idle_add(tray_init_deferred, NULL);
   return 0;
 }
 
-int tray_loop(int blocking) {
+static int tray_linux_loop(int blocking) {
   gtk_main_iteration_do(blocking);
   return loop_result;
 }
 
-static gboolean tray_update_internal(gpointer user_data) {
-  struct tray *tray = user_data;
+static void tray_linux_notify(struct tray *tray);
 
+// AppIndicator shows no tooltip, so TRAY_PART_TOOLTIP has nothing to apply
+static void tray_linux_update_parts(struct tray *tray, unsigned int parts) {
+  last_tray = tray;
   if (indicator != NULL && IS_APP_INDICATOR(indicator)) {
-    app_indicator_set_icon_full(indicator, tray->icon, tray->icon);
-    // GTK is all about reference counting, so previous menu should be destroyed
-    // here
-    app_indicator_set_menu(indicator, GTK_MENU(_tray_menu(tray->menu)));
-  }
-  if (tray->notification_text != 0 && strlen(tray->notification_text) > 0 && notify_is_initted()) {
-    if (currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
-      notify_notification_close(currentNotification, NULL);
-      g_object_unref(G_OBJECT(currentNotification));
+    if (parts & TRAY_PART_ICON) {
+      // The host loads the icon by name, there is nothing to decode ahead of a color scheme change
+      const char *icon = tray_icon_for_scheme(tray->icon);
+      app_indicator_set_icon_full(indicator, icon, icon);
+    }
+    if (parts & TRAY_PART_MENU) {
+      tray_linux_apply_menu(tray->menu);
+      tray_stats_mark_first_menu();
     }
+  }
+  if (parts & TRAY_PART_NOTIFICATION) {
+    tray_linux_notify(tray);
+  }
+}
+
+static void tray_apply_update(struct tray *tray) {
+  if (deferred_init_source != 0) {
+    g_source_remove(deferred_init_source);
+    deferred_init_source = 0;
+  }
+  tray_linux_update_parts(tray, TRAY_PARTS_ALL);
+}
+
+static void tray_linux_notify(struct tray *tray) {
+  if (tray->notification_text != 0 && strlen(tray->notification_text) > 0 && tray_notify_ensure_init()) {
     const char *notification_icon = tray->notification_icon != NULL ? tray->notification_icon : tray->icon;
-    currentNotification = notify_notification_new(tray->notification_title, tray->notification_text, notification_icon);
+    if (notification_reuse && currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
+      // Showing it again replaces it on screen, as closing it and showing a new one would
+      notify_notification_update(currentNotification, tray->notification_title, tray->notification_text, notification_icon);
+      notify_notification_clear_actions(currentNotification);
+    } else {
+      if (currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
+        tray_close_notification(currentNotification);
+        g_object_unref(G_OBJECT(currentNotification));
+      }
+      currentNotification = notify_notification_new(tray->notification_title, tray->notification_text, notification_icon);
+      if (currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
+        tray_track_object(currentNotification, TRAY_OBJECT_NOTIFICATION);
+      }
+    }
     if (currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
+      currentNotificationCb = tray->notification_cb;
       if (tray->notification_cb != NULL) {
         notify_notification_add_action(currentNotification, "default", "Default", NOTIFY_ACTION_CALLBACK(tray->notification_cb), NULL, NULL);
       }
       if (!notify_notification_show(currentNotification, NULL)) {
-        tray_log(TRAY_LOG_WARNING, "notify_notification_show() failed");
+        TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "notify_notification_show() failed");
       }
     }
   }
+}
 
-  // Unwait any pending tray_update() calls
-  pthread_mutex_lock(&async_update_mutex);
-  async_update_pending = false;
-  pthread_cond_broadcast(&async_update_cv);
-  pthread_mutex_unlock(&async_update_mutex);
+static gboolean tray_invoke_internal(gpointer user_data) {
+  void (*func)(void) = (void (*)(void)) user_data;
+  TRAY_DELAY_POINT("loop-run");
+  func();
   return G_SOURCE_REMOVE;
 }
 
-void tray_update(struct tray *tray) {
-  // Perform the tray update on the tray loop thread, but block
-  // in this thread to ensure none of the strings stored in the
-  // tray icon struct go out of scope before the callback runs.
-
-  if (g_main_context_is_owner(g_main_context_default())) {
-    // Invoke the callback directly if we're on the loop thread
-    tray_update_internal(tray);
-  } else {
-    // If there's already an update pending, wait for it to complete
-    // and claim the next pending update slot.
-    pthread_mutex_lock(&async_update_mutex);
-    while (async_update_pending) {
-      pthread_cond_wait(&async_update_cv, &async_update_mutex);
-    }
-    async_update_pending = true;
-    pthread_mutex_unlock(&async_update_mutex);
-
-    // Queue the update callback to the tray thread
-    g_main_context_invoke(NULL, tray_update_internal, tray);
-
-    // Wait for the callback to run
-    pthread_mutex_lock(&async_update_mutex);
-    while (async_update_pending) {
-      pthread_cond_wait(&async_update_cv, &async_update_mutex);
-    }
-    pthread_mutex_unlock(&async_update_mutex);
-  }
+static void tray_linux_invoke(void (*func)(void)) {
+  // Runs func right away when this thread owns, or can acquire, the main context
+  g_main_context_invoke(NULL, tray_invoke_internal, (gpointer) func);
 }
 
 static gboolean tray_exit_internal(gpointer user_data) {
+  if (deferred_init_source != 0) {
+    g_source_remove(deferred_init_source);
+    deferred_init_source = 0;
+  }
+  if (watcher_watch != 0) {
+    g_bus_unwatch_name(watcher_watch);
+    watcher_watch = 0;
+  }
+  if (host_retry_source != 0) {
+    g_source_remove(host_retry_source);
+    host_retry_source = 0;
+  }
+  tray_linux_unwatch_desktop();
+  watcher_present = false;
+  host_lost = false;
+  last_tray = NULL;
   if (currentNotification != NULL && NOTIFY_IS_NOTIFICATION(currentNotification)) {
-    int v = notify_notification_close(currentNotification, NULL);
-    if (v == TRUE) {
-      g_object_unref(G_OBJECT(currentNotification));
-    }
+    // Our reference is dropped without waiting to hear whether the server closed it
+    tray_close_notification(currentNotification);
+    g_object_unref(G_OBJECT(currentNotification));
+  }
+  currentNotification = NULL;
+  currentNotificationCb = NULL;
+  g_clear_object(&indicator);
+  if (currentMenu != NULL) {
+    gtk_widget_destroy(currentMenu);
+    currentMenu = NULL;
+  }
+  // The widgets held their own references to the pixbufs
+  tray_icon_cache_clear(&menu_icons);
+  tray_free(reusable_items);
+  reusable_items = NULL;
+  reusable_capacity = 0;
+  reusable_count = 0;
+  notification_reuse = false;
+  if (tray_notify_initted()) {
+    notify_uninit();
   }
-  notify_uninit();
   return G_SOURCE_REMOVE;
 }
 
-void tray_exit(void) {
-  // Wait for any pending callbacks to complete
-  pthread_mutex_lock(&async_update_mutex);
-  while (async_update_pending) {
-    pthread_cond_wait(&async_update_cv, &async_update_mutex);
+static int tray_linux_inject(enum tray_test_event event, const struct tray_test_target *target) {
+  switch (event) {
+    case TRAY_TEST_ACTIVATE: {
+      // The widgets were built from the menu in the same order
+      GtkWidget *widget = NULL;
+      GtkWidget *menu = currentMenu;
+      for (int i = 0; i < target->depth; ++i) {
+        if (menu == NULL) {
+          return -1;
+        }
+        GList *children = gtk_container_get_children(GTK_CONTAINER(menu));
+        widget = g_list_nth_data(children, target->path[i]);
+        g_list_free(children);
+        if (widget == NULL) {
+          return -1;
+        }
+        menu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(widget));
+      }
+      // Emits "activate" like a click forwarded by the dbusmenu exporter
+      gtk_menu_item_activate(GTK_MENU_ITEM(widget));
+      return 0;
+    }
+    case TRAY_TEST_NOTIFICATION_CLICK:
+      if (currentNotification == NULL || currentNotificationCb == NULL) {
+        return -1;
+      }
+      // What libnotify calls when the server reports the default action
+      currentNotificationCb(currentNotification, "default", NULL);
+      return 0;
+    case TRAY_TEST_HOST_RESTART:
+      if (indicator == NULL) {
+        return -1;
+      }
+      // As if the watcher went away and came back without the indicator noticing
+      tray_linux_host_gone();
+      watcher_present = true;
+      host_retry_delay_ms = TRAY_HOST_RETRY_INITIAL_MS;
+      tray_linux_host_retry(NULL);
+      return 0;
+    case TRAY_TEST_SCROLL:
+      if (indicator == NULL) {
+        return -1;
+      }
+      // Emitted like the indicator does for a Scroll call from the tray host, one per axis
+      if (target->scroll_dy != 0) {
+        g_signal_emit_by_name(indicator, "scroll-event", abs(target->scroll_dy), target->scroll_dy > 0 ? GDK_SCROLL_UP : GDK_SCROLL_DOWN);
+      }
+      if (target->scroll_dx != 0) {
+        g_signal_emit_by_name(indicator, "scroll-event", abs(target->scroll_dx), target->scroll_dx > 0 ? GDK_SCROLL_RIGHT : GDK_SCROLL_LEFT);
+      }
+      return 0;
+    case TRAY_TEST_SECONDARY_ACTIVATE:
+      if (indicator == NULL) {
+        return -1;
+      }
+      g_signal_emit_by_name(indicator, "secondary-activate", (guint) 0);
+      return 0;
   }
-  pthread_mutex_unlock(&async_update_mutex);
+  return -1;
+}
+
+static void tray_linux_wakeup(void) {
+  g_main_context_wakeup(NULL);
+}
 
+static void tray_linux_exit(void) {
   // Perform cleanup on the main thread
   loop_result = -1;
   g_main_context_invoke(NULL, tray_exit_internal, NULL);
 }
+
+const struct tray_backend tray_linux_backend = {
+  .name = "appindicator",
+  .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU | TRAY_CAPABILITY_NOTIFICATIONS | TRAY_CAPABILITY_CROSS_THREAD_UPDATE | TRAY_CAPABILITY_SCROLL | TRAY_CAPABILITY_SECONDARY_ACTIVATE,
+  .available = tray_linux_available,
+  .init = tray_linux_init,
+  .loop = tray_linux_loop,
+  .update = tray_apply_update,
+  .exit = tray_linux_exit,
+  .wakeup = tray_linux_wakeup,
+  .invoke = tray_linux_invoke,
+  .inject = tray_linux_inject,
+  .update_parts = tray_linux_update_parts,
+};
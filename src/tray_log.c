@@ -0,0 +1,268 @@
+/**
+ * @file src/tray_log.c
+ * @brief Delivery of log messages to the callback set with tray_set_log_callback().
+ *
+ * In the async modes messages go through a bounded lock-free queue of fixed-size
+ * records, so a slow callback never holds up the thread that logs. Each record
+ * carries a sequence number telling producers and consumers whose turn it is.
+ *
+ * Call sites that can fire on every update go through a tray_log_limit, which
+ * lets a few messages per window through and summarizes the rest.
+ */
+// standard includes
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// local includes
+#include "tray.h"
+#include "tray_internal.h"
+#include "tray_thread.h"
+
+#define TRAY_LOG_QUEUE_SIZE 128  ///< Records in the async queue; a power of two.
+#define TRAY_LOG_RECORD_SIZE 512  ///< Bytes of a queued message, terminator included.
+
+/**
+ * @brief A queued log message.
+ */
+struct tray_log_record {
+  tray_atomic_t turn;  ///< Sequence number minus the record's index, so that the zeroed queue is ready for use.
+  enum tray_log_level level;  ///< Severity.
+  char message[TRAY_LOG_RECORD_SIZE];  ///< The formatted message.
+};
+
+static void *log_cb = NULL;  // tray_log_callback, swapped atomically
+static tray_atomic_t log_mode = TRAY_LOG_SYNC;
+static tray_atomic_t dropped = 0;
+
+static struct tray_log_record queue[TRAY_LOG_QUEUE_SIZE];
+static tray_atomic_t queue_head = 0;  // next position to consume
+static tray_atomic_t queue_tail = 0;  // next position to produce
+
+static tray_mutex_t mode_mutex = TRAY_MUTEX_INITIALIZER;  // serializes tray_set_log_mode()
+static tray_mutex_t drain_mutex = TRAY_MUTEX_INITIALIZER;
+static tray_cond_t drain_cv = TRAY_COND_INITIALIZER;
+static tray_thread_t drain_thread;
+static bool drain_running = false;
+static bool drain_stop = false;
+static tray_atomic_t drain_wanted = 0;  // set by the first record queued since the drain thread last looked
+static tray_mutex_t limit_mutex = TRAY_MUTEX_INITIALIZER;  // guards every struct tray_log_limit
+
+static long long tray_log_record_sequence(long long position) {
+  return tray_atomic_load(&queue[position & (TRAY_LOG_QUEUE_SIZE - 1)].turn) + (position & (TRAY_LOG_QUEUE_SIZE - 1));
+}
+
+static void tray_log_record_set_sequence(long long position, long long sequence) {
+  tray_atomic_store(&queue[position & (TRAY_LOG_QUEUE_SIZE - 1)].turn, sequence - (position & (TRAY_LOG_QUEUE_SIZE - 1)));
+}
+
+// Claims the record at the tail, or returns -1 if the queue is full
+static long long tray_log_claim(void) {
+  long long position = tray_atomic_load(&queue_tail);
+  for (;;) {
+    long long diff = tray_log_record_sequence(position) - position;
+    if (diff == 0) {
+      if (tray_atomic_compare_exchange(&queue_tail, &position, position + 1)) {
+        return position;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      position = tray_atomic_load(&queue_tail);
+    }
+  }
+}
+
+// Claims the record at the head, or returns -1 if the queue is empty
+static long long tray_log_take(void) {
+  long long position = tray_atomic_load(&queue_head);
+  for (;;) {
+    long long diff = tray_log_record_sequence(position) - (position + 1);
+    if (diff == 0) {
+      if (tray_atomic_compare_exchange(&queue_head, &position, position + 1)) {
+        return position;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      position = tray_atomic_load(&queue_head);
+    }
+  }
+}
+
+static void tray_log_wake_drain(void) {
+  // Only the first record after the drain thread last looked pays for the lock
+  if (tray_atomic_exchange(&drain_wanted, 1) == 0) {
+    tray_mutex_lock(&drain_mutex);
+    tray_cond_broadcast(&drain_cv);
+    tray_mutex_unlock(&drain_mutex);
+  }
+}
+
+void tray_set_log_callback(tray_log_callback cb) {
+  tray_atomic_store_ptr(&log_cb, *(void **) &cb);
+}
+
+static void tray_log_va(enum tray_log_level level, const char *fmt, va_list args) {
+  void *cb_pointer = tray_atomic_load_ptr(&log_cb);
+  if (cb_pointer == NULL || fmt == NULL) {
+    return;
+  }
+  long long mode = tray_atomic_load(&log_mode);
+  if (mode != TRAY_LOG_SYNC) {
+    long long position = tray_log_claim();
+    if (position < 0) {
+      tray_atomic_add(&dropped, 1);
+    } else {
+      struct tray_log_record *record = &queue[position & (TRAY_LOG_QUEUE_SIZE - 1)];
+      record->level = level;
+      vsnprintf(record->message, sizeof(record->message), fmt, args);
+      record->message[sizeof(record->message) - 1] = '\0';
+      tray_log_record_set_sequence(position, position + 1);
+      if (mode == TRAY_LOG_ASYNC) {
+        tray_log_wake_drain();
+      }
+    }
+    return;
+  }
+
+  // Messages queued just before a switch to sync mode go first
+  if (tray_atomic_load(&queue_head) != tray_atomic_load(&queue_tail)) {
+    tray_log_drain();
+  }
+  char buffer[1024];
+  vsnprintf(buffer, sizeof(buffer), fmt, args);
+  buffer[sizeof(buffer) - 1] = '\0';
+  tray_log_callback cb;
+  *(void **) &cb = cb_pointer;
+  cb(level, buffer);
+}
+
+void tray_log(enum tray_log_level level, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  tray_log_va(level, fmt, args);
+  va_end(args);
+}
+
+int tray_log_limit_check(struct tray_log_limit *limit, enum tray_log_level level) {
+  if (tray_atomic_load_ptr(&log_cb) == NULL) {
+    return 0;
+  }
+  unsigned long long window_us = (unsigned long long) (limit->window_ms != 0 ? limit->window_ms : TRAY_LOG_LIMIT_WINDOW_MS) * 1000;
+  unsigned int burst = limit->burst != 0 ? limit->burst : TRAY_LOG_LIMIT_BURST;
+  unsigned long long now = tray_now_us();
+  unsigned int suppressed = 0;
+
+  tray_mutex_lock(&limit_mutex);
+  if (limit->count == 0 || now - limit->window_start_us >= window_us) {
+    suppressed = limit->count > burst ? limit->count - burst : 0;
+    limit->window_start_us = now;
+    limit->count = 0;
+  }
+  int allowed = limit->count < burst;
+  if (limit->count < (unsigned int) -1) {
+    limit->count++;
+  }
+  tray_mutex_unlock(&limit_mutex);
+
+  // Reported with the next message let through, as nothing wakes up to report an idle call site
+  if (suppressed > 0) {
+    tray_log(level, "%u similar messages suppressed", suppressed);
+  }
+  return allowed;
+}
+
+void tray_log_limited(struct tray_log_limit *limit, enum tray_log_level level, const char *fmt, ...) {
+  if (!tray_log_limit_check(limit, level)) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  tray_log_va(level, fmt, args);
+  va_end(args);
+}
+
+size_t tray_log_drain(void) {
+  size_t delivered = 0;
+  for (;;) {
+    long long position = tray_log_take();
+    if (position < 0) {
+      return delivered;
+    }
+    // Copied out, so the record is free again while the callback runs
+    struct tray_log_record *record = &queue[position & (TRAY_LOG_QUEUE_SIZE - 1)];
+    enum tray_log_level level = record->level;
+    char message[TRAY_LOG_RECORD_SIZE];
+    memcpy(message, record->message, sizeof(message));
+    tray_log_record_set_sequence(position, position + TRAY_LOG_QUEUE_SIZE);
+
+    void *cb_pointer = tray_atomic_load_ptr(&log_cb);
+    if (cb_pointer != NULL) {
+      tray_log_callback cb;
+      *(void **) &cb = cb_pointer;
+      cb(level, message);
+      delivered++;
+    }
+  }
+}
+
+static TRAY_THREAD_FUNC(tray_log_drain_main) {
+  (void) arg;
+  tray_mutex_lock(&drain_mutex);
+  while (!drain_stop) {
+    if (tray_atomic_load(&drain_wanted) == 0) {
+      tray_cond_wait(&drain_cv, &drain_mutex);
+      continue;
+    }
+    // Records queued from here on wake this thread again
+    tray_atomic_store(&drain_wanted, 0);
+    tray_mutex_unlock(&drain_mutex);
+    tray_log_drain();
+    tray_mutex_lock(&drain_mutex);
+  }
+  tray_mutex_unlock(&drain_mutex);
+  return TRAY_THREAD_RETURN;
+}
+
+static void tray_log_stop_drain(void) {
+  if (!drain_running) {
+    return;
+  }
+  tray_mutex_lock(&drain_mutex);
+  drain_stop = true;
+  tray_cond_broadcast(&drain_cv);
+  tray_mutex_unlock(&drain_mutex);
+  tray_thread_join(drain_thread);
+  drain_running = false;
+}
+
+int tray_set_log_mode(enum tray_log_mode mode) {
+  if (mode != TRAY_LOG_SYNC && mode != TRAY_LOG_ASYNC && mode != TRAY_LOG_ASYNC_MANUAL) {
+    return -1;
+  }
+  tray_mutex_lock(&mode_mutex);
+  tray_log_stop_drain();
+  int result = 0;
+  if (mode == TRAY_LOG_ASYNC) {
+    drain_stop = false;
+    tray_atomic_store(&drain_wanted, 1);  // picks up anything queued before
+    if (tray_thread_create(&drain_thread, tray_log_drain_main, NULL) != 0) {
+      mode = TRAY_LOG_SYNC;
+      result = -1;
+    } else {
+      drain_running = true;
+    }
+  }
+  tray_atomic_store(&log_mode, mode);
+  tray_mutex_unlock(&mode_mutex);
+  if (mode == TRAY_LOG_SYNC) {
+    tray_log_drain();
+  }
+  return result;
+}
+
+unsigned long long tray_log_dropped(void) {
+  return (unsigned long long) tray_atomic_load(&dropped);
+}
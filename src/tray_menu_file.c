@@ -0,0 +1,906 @@
+/**
+ * @file src/tray_menu_file.c
+ * @brief Menus loaded from JSON files, with named actions and hot reload.
+ *
+ * A loaded menu lives in a single allocation: a header, the tray_menu arrays of
+ * all levels (each terminated by an empty item), per-item metadata in the same
+ * order and the string pool. Reloads are parsed on a watcher thread and swapped
+ * in by tray_loop(), which skips the backend update when nothing changed.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_internal.h"
+#include "tray_thread.h"
+
+#define TRAY_MENU_WATCH_INTERVAL_MS 250  ///< How often a watched file is checked for changes.
+#define TRAY_MENU_MAX_DEPTH 32  ///< Deepest nesting accepted in a menu file.
+#define TRAY_MENU_NONE ((size_t) -1)  ///< Marks a missing string or entry while parsing.
+#define TRAY_MENU_HASH_SEED 14695981039346656037ULL  ///< FNV-1a offset basis.
+
+/**
+ * @brief Per-item data that is not part of struct tray_menu.
+ */
+struct tray_menu_meta {
+  const char *action;  ///< Action name, or NULL.
+  int file_checked;  ///< Checked state as written in the file.
+};
+
+/**
+ * @brief Header of a loaded menu.
+ */
+struct tray_menu_file {
+  size_t count;  ///< Number of items, including the terminators.
+  unsigned long long hash;  ///< Hash of the file contents.
+  struct tray_menu_meta *meta;  ///< Metadata, parallel to items.
+  struct tray_menu items[];  ///< Top level items first, then the submenus.
+};
+
+/**
+ * @brief A menu item while parsing, before the final layout is known.
+ */
+struct tray_menu_entry {
+  size_t text;  ///< Offset in the parser string pool.
+  size_t action;  ///< Offset in the parser string pool.
+  size_t icon;  ///< Offset in the parser string pool.
+  int disabled;  ///< Whether the item is disabled.
+  int checked;  ///< Whether the item is checked.
+  int checkbox;  ///< Whether the item is a checkbox.
+  size_t first_child;  ///< First entry of the submenu, or TRAY_MENU_NONE.
+  size_t next;  ///< Next sibling, or TRAY_MENU_NONE.
+};
+
+/**
+ * @brief JSON parser state.
+ */
+struct tray_menu_parser {
+  const char *data;  ///< File contents.
+  size_t size;  ///< Size of the file contents.
+  size_t pos;  ///< Read position.
+  const char *error;  ///< First error, or NULL.
+
+  struct tray_menu_entry *entries;  ///< Parsed items.
+  size_t entry_count;  ///< Number of parsed items.
+  size_t entry_capacity;  ///< Allocated items.
+  size_t list_count;  ///< Number of item arrays, i.e. terminators needed.
+
+  char *strings;  ///< Decoded strings, NUL-terminated.
+  size_t strings_size;  ///< Used bytes of strings.
+  size_t strings_capacity;  ///< Allocated bytes of strings.
+};
+
+/**
+ * @brief A named callback.
+ */
+struct tray_action {
+  char *name;  ///< Action name.
+  void (*cb)(struct tray_menu *);  ///< Callback.
+  void *context;  ///< Context stored in items using the action.
+};
+
+static tray_mutex_t actions_mutex = TRAY_MUTEX_INITIALIZER;
+static struct tray_action *actions = NULL;
+static size_t action_count = 0;
+
+static tray_mutex_t watch_mutex = TRAY_MUTEX_INITIALIZER;
+static tray_cond_t watch_cv = TRAY_COND_INITIALIZER;
+static struct tray *watch_tray = NULL;  // tray whose menu is watched
+static struct tray_menu_file *watch_current = NULL;  // menu set on watch_tray, only touched by the loop thread
+static unsigned long long watch_hash = 0;  // file hash of the initially loaded menu
+static struct stat watch_stat;  // file status taken before the initial load
+static bool watch_have_stat = false;
+static struct tray_menu_file *watch_pending = NULL;  // reloaded menu not yet applied
+static char *watch_path = NULL;
+static bool watch_stop = false;
+static bool watch_running = false;
+static tray_thread_t watch_thread;
+
+static unsigned long long tray_menu_hash(const void *data, size_t size, unsigned long long hash) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;  // FNV-1a
+  }
+  return hash;
+}
+
+int tray_register_action(const char *name, void (*cb)(struct tray_menu *), void *context) {
+  if (name == NULL) {
+    return -1;
+  }
+  tray_mutex_lock(&actions_mutex);
+  for (size_t i = 0; i < action_count; ++i) {
+    if (strcmp(actions[i].name, name) == 0) {
+      actions[i].cb = cb;
+      actions[i].context = context;
+      tray_mutex_unlock(&actions_mutex);
+      return 0;
+    }
+  }
+  struct tray_action *grown = tray_realloc(TRAY_MEMORY_MENUS, actions, (action_count + 1) * sizeof(*actions));
+  char *copy = tray_malloc(TRAY_MEMORY_MENUS, strlen(name) + 1);
+  if (grown == NULL || copy == NULL) {
+    if (grown != NULL) {
+      actions = grown;
+    }
+    tray_free(copy);
+    tray_mutex_unlock(&actions_mutex);
+    return -1;
+  }
+  actions = grown;
+  strcpy(copy, name);
+  actions[action_count].name = copy;
+  actions[action_count].cb = cb;
+  actions[action_count].context = context;
+  ++action_count;
+  tray_mutex_unlock(&actions_mutex);
+  return 0;
+}
+
+static void tray_menu_bind_action(struct tray_menu *item, const char *name) {
+  tray_mutex_lock(&actions_mutex);
+  for (size_t i = 0; i < action_count; ++i) {
+    if (strcmp(actions[i].name, name) == 0) {
+      item->cb = actions[i].cb;
+      item->context = actions[i].context;
+      tray_mutex_unlock(&actions_mutex);
+      return;
+    }
+  }
+  tray_mutex_unlock(&actions_mutex);
+  tray_log(TRAY_LOG_WARNING, "Menu item '%s' refers to unknown action '%s'", item->text, name);
+}
+
+// JSON parsing
+
+static void tray_menu_fail(struct tray_menu_parser *p, const char *error) {
+  if (p->error == NULL) {
+    p->error = error;
+  }
+}
+
+static void tray_menu_skip_space(struct tray_menu_parser *p) {
+  while (p->pos < p->size && (p->data[p->pos] == ' ' || p->data[p->pos] == '\t' || p->data[p->pos] == '\n' || p->data[p->pos] == '\r')) {
+    ++p->pos;
+  }
+}
+
+static bool tray_menu_accept(struct tray_menu_parser *p, char c) {
+  tray_menu_skip_space(p);
+  if (p->pos < p->size && p->data[p->pos] == c) {
+    ++p->pos;
+    return true;
+  }
+  return false;
+}
+
+static bool tray_menu_accept_word(struct tray_menu_parser *p, const char *word) {
+  size_t len = strlen(word);
+  if (p->size - p->pos >= len && memcmp(p->data + p->pos, word, len) == 0) {
+    p->pos += len;
+    return true;
+  }
+  return false;
+}
+
+static void tray_menu_put_char(struct tray_menu_parser *p, char c) {
+  if (p->strings_size == p->strings_capacity) {
+    size_t capacity = p->strings_capacity != 0 ? p->strings_capacity * 2 : 256;
+    char *strings = tray_realloc(TRAY_MEMORY_MENUS, p->strings, capacity);
+    if (strings == NULL) {
+      tray_menu_fail(p, "out of memory");
+      return;
+    }
+    p->strings = strings;
+    p->strings_capacity = capacity;
+  }
+  p->strings[p->strings_size++] = c;
+}
+
+static void tray_menu_put_utf8(struct tray_menu_parser *p, unsigned long cp) {
+  if (cp < 0x80) {
+    tray_menu_put_char(p, (char) cp);
+  } else if (cp < 0x800) {
+    tray_menu_put_char(p, (char) (0xC0 | (cp >> 6)));
+    tray_menu_put_char(p, (char) (0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    tray_menu_put_char(p, (char) (0xE0 | (cp >> 12)));
+    tray_menu_put_char(p, (char) (0x80 | ((cp >> 6) & 0x3F)));
+    tray_menu_put_char(p, (char) (0x80 | (cp & 0x3F)));
+  } else {
+    tray_menu_put_char(p, (char) (0xF0 | (cp >> 18)));
+    tray_menu_put_char(p, (char) (0x80 | ((cp >> 12) & 0x3F)));
+    tray_menu_put_char(p, (char) (0x80 | ((cp >> 6) & 0x3F)));
+    tray_menu_put_char(p, (char) (0x80 | (cp & 0x3F)));
+  }
+}
+
+static unsigned long tray_menu_parse_hex4(struct tray_menu_parser *p) {
+  unsigned long value = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = p->pos < p->size ? p->data[p->pos++] : '\0';
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= (unsigned long) (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= (unsigned long) (c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      value |= (unsigned long) (c - 'A' + 10);
+    } else {
+      tray_menu_fail(p, "invalid \\u escape");
+      return 0;
+    }
+  }
+  return value;
+}
+
+/**
+ * @brief Parse a string into the string pool.
+ * @return Offset of the string, or TRAY_MENU_NONE on error.
+ */
+static size_t tray_menu_parse_string(struct tray_menu_parser *p) {
+  if (!tray_menu_accept(p, '"')) {
+    tray_menu_fail(p, "expected a string");
+    return TRAY_MENU_NONE;
+  }
+  size_t start = p->strings_size;
+  while (p->error == NULL) {
+    if (p->pos >= p->size) {
+      tray_menu_fail(p, "unterminated string");
+      break;
+    }
+    char c = p->data[p->pos++];
+    if (c == '"') {
+      tray_menu_put_char(p, '\0');
+      return p->error == NULL ? start : TRAY_MENU_NONE;
+    }
+    if ((unsigned char) c < 0x20) {
+      tray_menu_fail(p, "control character in string");
+    } else if (c != '\\') {
+      tray_menu_put_char(p, c);
+    } else {
+      c = p->pos < p->size ? p->data[p->pos++] : '\0';
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          tray_menu_put_char(p, c);
+          break;
+        case 'b':
+          tray_menu_put_char(p, '\b');
+          break;
+        case 'f':
+          tray_menu_put_char(p, '\f');
+          break;
+        case 'n':
+          tray_menu_put_char(p, '\n');
+          break;
+        case 'r':
+          tray_menu_put_char(p, '\r');
+          break;
+        case 't':
+          tray_menu_put_char(p, '\t');
+          break;
+        case 'u': {
+          unsigned long cp = tray_menu_parse_hex4(p);
+          if (cp >= 0xD800 && cp <= 0xDBFF && tray_menu_accept_word(p, "\\u")) {
+            unsigned long low = tray_menu_parse_hex4(p);
+            cp = low >= 0xDC00 && low <= 0xDFFF ? 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00) : 0xFFFD;
+          } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = 0xFFFD;
+          }
+          if (cp == 0) {
+            tray_menu_fail(p, "NUL character in string");
+          }
+          tray_menu_put_utf8(p, cp);
+          break;
+        }
+        default:
+          tray_menu_fail(p, "invalid escape");
+          break;
+      }
+    }
+  }
+  return TRAY_MENU_NONE;
+}
+
+static bool tray_menu_parse_bool(struct tray_menu_parser *p) {
+  tray_menu_skip_space(p);
+  if (tray_menu_accept_word(p, "true")) {
+    return true;
+  }
+  if (!tray_menu_accept_word(p, "false")) {
+    tray_menu_fail(p, "expected true or false");
+  }
+  return false;
+}
+
+static void tray_menu_skip_value(struct tray_menu_parser *p, int depth) {
+  tray_menu_skip_space(p);
+  if (depth > TRAY_MENU_MAX_DEPTH) {
+    tray_menu_fail(p, "nested too deeply");
+    return;
+  }
+  if (p->pos >= p->size) {
+    tray_menu_fail(p, "unexpected end of file");
+    return;
+  }
+  char c = p->data[p->pos];
+  if (c == '"') {
+    // Decode and drop the string
+    size_t mark = p->strings_size;
+    tray_menu_parse_string(p);
+    p->strings_size = mark;
+  } else if (c == '{' || c == '[') {
+    char close = c == '{' ? '}' : ']';
+    ++p->pos;
+    if (tray_menu_accept(p, close)) {
+      return;
+    }
+    do {
+      if (c == '{') {
+        size_t mark = p->strings_size;
+        tray_menu_parse_string(p);
+        p->strings_size = mark;
+        if (!tray_menu_accept(p, ':')) {
+          tray_menu_fail(p, "expected ':'");
+        }
+      }
+      tray_menu_skip_value(p, depth + 1);
+    } while (p->error == NULL && tray_menu_accept(p, ','));
+    if (!tray_menu_accept(p, close)) {
+      tray_menu_fail(p, c == '{' ? "expected '}'" : "expected ']'");
+    }
+  } else if (!tray_menu_accept_word(p, "true") && !tray_menu_accept_word(p, "false") && !tray_menu_accept_word(p, "null")) {
+    // Numbers are not used by menu files; accept anything number-like
+    size_t start = p->pos;
+    while (p->pos < p->size && strchr("+-0123456789.eE", p->data[p->pos]) != NULL) {
+      ++p->pos;
+    }
+    if (p->pos == start) {
+      tray_menu_fail(p, "unexpected character");
+    }
+  }
+}
+
+static size_t tray_menu_parse_items(struct tray_menu_parser *p, int depth);
+
+static size_t tray_menu_new_entry(struct tray_menu_parser *p) {
+  if (p->entry_count == p->entry_capacity) {
+    size_t capacity = p->entry_capacity != 0 ? p->entry_capacity * 2 : 32;
+    struct tray_menu_entry *entries = tray_realloc(TRAY_MEMORY_MENUS, p->entries, capacity * sizeof(*entries));
+    if (entries == NULL) {
+      tray_menu_fail(p, "out of memory");
+      return TRAY_MENU_NONE;
+    }
+    p->entries = entries;
+    p->entry_capacity = capacity;
+  }
+  struct tray_menu_entry *entry = &p->entries[p->entry_count];
+  memset(entry, 0, sizeof(*entry));
+  entry->text = TRAY_MENU_NONE;
+  entry->action = TRAY_MENU_NONE;
+  entry->icon = TRAY_MENU_NONE;
+  entry->first_child = TRAY_MENU_NONE;
+  entry->next = TRAY_MENU_NONE;
+  return p->entry_count++;
+}
+
+static size_t tray_menu_parse_item(struct tray_menu_parser *p, int depth) {
+  if (!tray_menu_accept(p, '{')) {
+    tray_menu_fail(p, "expected a menu item object");
+    return TRAY_MENU_NONE;
+  }
+  size_t index = tray_menu_new_entry(p);
+  if (index == TRAY_MENU_NONE || tray_menu_accept(p, '}')) {
+    return index;
+  }
+  do {
+    size_t mark = p->strings_size;
+    size_t key = tray_menu_parse_string(p);
+    if (key == TRAY_MENU_NONE || !tray_menu_accept(p, ':')) {
+      tray_menu_fail(p, "expected a key");
+      break;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%s", p->strings + key);
+    p->strings_size = mark;  // keys are not kept
+
+    // p->entries may move while parsing a submenu, so index it every time
+    if (strcmp(name, "text") == 0) {
+      size_t text = tray_menu_parse_string(p);
+      p->entries[index].text = text;
+    } else if (strcmp(name, "action") == 0) {
+      size_t action = tray_menu_parse_string(p);
+      p->entries[index].action = action;
+    } else if (strcmp(name, "icon") == 0) {
+      size_t icon = tray_menu_parse_string(p);
+      p->entries[index].icon = icon;
+    } else if (strcmp(name, "disabled") == 0) {
+      int value = tray_menu_parse_bool(p);
+      p->entries[index].disabled = value;
+    } else if (strcmp(name, "checked") == 0) {
+      int value = tray_menu_parse_bool(p);
+      p->entries[index].checked = value;
+    } else if (strcmp(name, "checkbox") == 0) {
+      int value = tray_menu_parse_bool(p);
+      p->entries[index].checkbox = value;
+    } else if (strcmp(name, "submenu") == 0) {
+      size_t first = tray_menu_parse_items(p, depth + 1);
+      p->entries[index].first_child = first;
+    } else {
+      tray_menu_skip_value(p, depth + 1);
+    }
+  } while (p->error == NULL && tray_menu_accept(p, ','));
+  if (!tray_menu_accept(p, '}')) {
+    tray_menu_fail(p, "expected '}'");
+  }
+  if (p->error == NULL && p->entries[index].text == TRAY_MENU_NONE) {
+    tray_menu_fail(p, "menu item without \"text\"");
+  }
+  return index;
+}
+
+/**
+ * @brief Parse an array of items.
+ * @return The first entry, or TRAY_MENU_NONE for an empty array.
+ */
+static size_t tray_menu_parse_items(struct tray_menu_parser *p, int depth) {
+  if (depth > TRAY_MENU_MAX_DEPTH) {
+    tray_menu_fail(p, "nested too deeply");
+    return TRAY_MENU_NONE;
+  }
+  if (!tray_menu_accept(p, '[')) {
+    tray_menu_fail(p, "expected an array of menu items");
+    return TRAY_MENU_NONE;
+  }
+  ++p->list_count;
+  size_t first = TRAY_MENU_NONE;
+  size_t last = TRAY_MENU_NONE;
+  if (tray_menu_accept(p, ']')) {
+    return first;
+  }
+  do {
+    size_t index = tray_menu_parse_item(p, depth);
+    if (index == TRAY_MENU_NONE) {
+      break;
+    }
+    if (last == TRAY_MENU_NONE) {
+      first = index;
+    } else {
+      p->entries[last].next = index;
+    }
+    last = index;
+  } while (p->error == NULL && tray_menu_accept(p, ','));
+  if (!tray_menu_accept(p, ']')) {
+    tray_menu_fail(p, "expected ']'");
+  }
+  return first;
+}
+
+static size_t tray_menu_parse_document(struct tray_menu_parser *p) {
+  size_t first = TRAY_MENU_NONE;
+  tray_menu_skip_space(p);
+  if (p->pos < p->size && p->data[p->pos] == '{') {
+    ++p->pos;
+    bool found = false;
+    if (!tray_menu_accept(p, '}')) {
+      do {
+        size_t mark = p->strings_size;
+        size_t key = tray_menu_parse_string(p);
+        if (key == TRAY_MENU_NONE || !tray_menu_accept(p, ':')) {
+          tray_menu_fail(p, "expected a key");
+          break;
+        }
+        bool is_menu = strcmp(p->strings + key, "menu") == 0;
+        p->strings_size = mark;
+        if (is_menu) {
+          first = tray_menu_parse_items(p, 0);
+          found = true;
+        } else {
+          tray_menu_skip_value(p, 1);
+        }
+      } while (p->error == NULL && tray_menu_accept(p, ','));
+      if (!tray_menu_accept(p, '}')) {
+        tray_menu_fail(p, "expected '}'");
+      }
+    }
+    if (!found) {
+      tray_menu_fail(p, "no \"menu\" array");
+    }
+  } else {
+    first = tray_menu_parse_items(p, 0);
+  }
+  tray_menu_skip_space(p);
+  if (p->pos != p->size) {
+    tray_menu_fail(p, "trailing characters");
+  }
+  return first;
+}
+
+// Layout
+
+/**
+ * @brief Copy one item array and, after it, its submenus into the final layout.
+ * @return Index of the first slot used.
+ */
+static size_t tray_menu_layout(const struct tray_menu_parser *p, struct tray_menu_file *file, char *strings, size_t first, size_t *next_slot) {
+  size_t base = *next_slot;
+  size_t n = 0;
+  for (size_t e = first; e != TRAY_MENU_NONE; e = p->entries[e].next) {
+    ++n;
+  }
+  *next_slot += n + 1;  // including the terminator, which is zeroed by tray_calloc()
+
+  size_t slot = base;
+  for (size_t e = first; e != TRAY_MENU_NONE; e = p->entries[e].next, ++slot) {
+    const struct tray_menu_entry *entry = &p->entries[e];
+    struct tray_menu *item = &file->items[slot];
+    item->text = strings + entry->text;
+    item->disabled = entry->disabled;
+    item->checked = entry->checked;
+    item->checkbox = entry->checkbox;
+    if (entry->icon != TRAY_MENU_NONE) {
+      item->icon = strings + entry->icon;
+    }
+    file->meta[slot].file_checked = entry->checked;
+    if (entry->action != TRAY_MENU_NONE) {
+      file->meta[slot].action = strings + entry->action;
+      tray_menu_bind_action(item, file->meta[slot].action);
+    }
+    if (entry->first_child != TRAY_MENU_NONE) {
+      item->submenu = &file->items[tray_menu_layout(p, file, strings, entry->first_child, next_slot)];
+    }
+  }
+  return base;
+}
+
+/**
+ * @brief Parse the contents of a menu file.
+ * @return The menu, or NULL on error.
+ */
+static struct tray_menu_file *tray_menu_parse(const char *data, size_t size, const char *path) {
+  struct tray_menu_parser p;
+  memset(&p, 0, sizeof(p));
+  p.data = data;
+  p.size = size;
+
+  size_t first = tray_menu_parse_document(&p);
+  struct tray_menu_file *file = NULL;
+  if (p.error != NULL) {
+    size_t line = 1;
+    size_t column = 1;
+    for (size_t i = 0; i < p.pos && i < size; ++i) {
+      column = data[i] == '\n' ? 1 : column + 1;
+      line += data[i] == '\n';
+    }
+    tray_log(TRAY_LOG_WARNING, "%s:%zu:%zu: %s", path, line, column, p.error);
+  } else {
+    // An empty top level array still gets its terminator
+    size_t count = p.entry_count + (p.list_count != 0 ? p.list_count : 1);
+    size_t items_size = offsetof(struct tray_menu_file, items) + count * sizeof(struct tray_menu);
+    size_t meta_size = count * sizeof(struct tray_menu_meta);
+    file = tray_calloc(TRAY_MEMORY_MENUS, 1, items_size + meta_size + p.strings_size);
+    if (file == NULL) {
+      tray_log(TRAY_LOG_ERROR, "Out of memory loading %s", path);
+    } else {
+      file->count = count;
+      file->hash = tray_menu_hash(data, size, TRAY_MENU_HASH_SEED);
+      file->meta = (struct tray_menu_meta *) ((char *) file + items_size);
+      char *strings = (char *) file->meta + meta_size;
+      if (p.strings_size != 0) {
+        memcpy(strings, p.strings, p.strings_size);
+      }
+      size_t next_slot = 0;
+      tray_menu_layout(&p, file, strings, first, &next_slot);
+    }
+  }
+  tray_free(p.entries);
+  tray_free(p.strings);
+  return file;
+}
+
+static char *tray_menu_read_file(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  char *data = NULL;
+  long length = -1;
+  if (fseek(f, 0, SEEK_END) == 0 && (length = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    data = tray_malloc(TRAY_MEMORY_MENUS, (size_t) length + 1);
+    if (data != NULL && fread(data, 1, (size_t) length, f) != (size_t) length) {
+      tray_free(data);
+      data = NULL;
+    }
+  }
+  fclose(f);
+  if (data != NULL) {
+    data[length] = '\0';
+    *size = (size_t) length;
+  }
+  return data;
+}
+
+static struct tray_menu_file *tray_menu_file_of(struct tray_menu *menu) {
+  return (struct tray_menu_file *) ((char *) menu - offsetof(struct tray_menu_file, items));
+}
+
+static struct tray_menu_file *tray_menu_load_file(const char *path) {
+  size_t size = 0;
+  char *data = tray_menu_read_file(path, &size);
+  if (data == NULL) {
+    tray_log(TRAY_LOG_WARNING, "Failed to read menu file %s", path);
+    return NULL;
+  }
+  struct tray_menu_file *file = tray_menu_parse(data, size, path);
+  tray_free(data);
+  return file;
+}
+
+struct tray_menu *tray_menu_load(const char *path) {
+  if (path == NULL) {
+    return NULL;
+  }
+  struct tray_menu_file *file = tray_menu_load_file(path);
+  return file != NULL ? file->items : NULL;
+}
+
+void tray_menu_free(struct tray_menu *menu) {
+  if (menu != NULL) {
+    tray_free(tray_menu_file_of(menu));
+  }
+}
+
+// Reload
+
+static size_t tray_menu_submenu_slot(const struct tray_menu_file *file, size_t i) {
+  return file->items[i].submenu != NULL ? (size_t) (file->items[i].submenu - file->items) : TRAY_MENU_NONE;
+}
+
+static bool tray_menu_same_string(const char *a, const char *b) {
+  return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+/**
+ * @brief Whether two menus have the same items in the same places.
+ */
+static bool tray_menu_same_shape(const struct tray_menu_file *a, const struct tray_menu_file *b) {
+  if (a->count != b->count) {
+    return false;
+  }
+  for (size_t i = 0; i < a->count; ++i) {
+    if ((a->items[i].text == NULL) != (b->items[i].text == NULL) || tray_menu_submenu_slot(a, i) != tray_menu_submenu_slot(b, i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Whether two menus were loaded from equivalent files.
+ */
+static bool tray_menu_same_content(const struct tray_menu_file *a, const struct tray_menu_file *b) {
+  if (!tray_menu_same_shape(a, b)) {
+    return false;
+  }
+  for (size_t i = 0; i < a->count; ++i) {
+    const struct tray_menu *x = &a->items[i];
+    const struct tray_menu *y = &b->items[i];
+    if (!tray_menu_same_string(x->text, y->text) || !tray_menu_same_string(a->meta[i].action, b->meta[i].action) || !tray_menu_same_string(x->icon, y->icon) ||
+        x->disabled != y->disabled || x->checkbox != y->checkbox || a->meta[i].file_checked != b->meta[i].file_checked ||
+        x->cb != y->cb || x->context != y->context) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static unsigned long long tray_menu_item_key(const struct tray_menu_file *file, size_t i) {
+  const char *action = file->meta[i].action;
+  unsigned long long hash = tray_menu_hash(file->items[i].text, strlen(file->items[i].text), TRAY_MENU_HASH_SEED);
+  return action != NULL ? tray_menu_hash(action, strlen(action) + 1, hash) : hash;
+}
+
+static bool tray_menu_same_item(const struct tray_menu_file *a, size_t i, const struct tray_menu_file *b, size_t j) {
+  return strcmp(a->items[i].text, b->items[j].text) == 0 && tray_menu_same_string(a->meta[i].action, b->meta[j].action);
+}
+
+static void tray_menu_carry_checked(const struct tray_menu_file *from, size_t i, struct tray_menu_file *to, size_t j) {
+  // Keep what the app toggled at runtime unless the file changed the state itself
+  if (from->items[i].checkbox && to->items[j].checkbox && from->meta[i].file_checked == to->meta[j].file_checked) {
+    to->items[j].checked = from->items[i].checked;
+  }
+}
+
+/**
+ * @brief Carry runtime checkbox states from the current menu into a reloaded one.
+ *
+ * Items keep their index when the shape is unchanged; otherwise they are matched
+ * by text and action through a hash table, so large menus stay linear.
+ */
+static void tray_menu_carry_state(const struct tray_menu_file *from, struct tray_menu_file *to) {
+  if (tray_menu_same_shape(from, to)) {
+    for (size_t i = 0; i < to->count; ++i) {
+      if (to->items[i].text != NULL && tray_menu_same_item(from, i, to, i)) {
+        tray_menu_carry_checked(from, i, to, i);
+      }
+    }
+    return;
+  }
+
+  size_t buckets = 16;
+  while (buckets < from->count * 2) {
+    buckets *= 2;
+  }
+  size_t *table = tray_malloc(TRAY_MEMORY_MENUS, buckets * sizeof(*table));
+  if (table == NULL) {
+    return;
+  }
+  for (size_t b = 0; b < buckets; ++b) {
+    table[b] = TRAY_MENU_NONE;
+  }
+  for (size_t i = 0; i < from->count; ++i) {
+    if (from->items[i].text != NULL && from->items[i].checkbox) {
+      size_t b = (size_t) tray_menu_item_key(from, i) & (buckets - 1);
+      while (table[b] != TRAY_MENU_NONE) {
+        b = (b + 1) & (buckets - 1);
+      }
+      table[b] = i;
+    }
+  }
+  for (size_t j = 0; j < to->count; ++j) {
+    if (to->items[j].text == NULL || !to->items[j].checkbox) {
+      continue;
+    }
+    for (size_t b = (size_t) tray_menu_item_key(to, j) & (buckets - 1); table[b] != TRAY_MENU_NONE; b = (b + 1) & (buckets - 1)) {
+      if (tray_menu_same_item(from, table[b], to, j)) {
+        tray_menu_carry_checked(from, table[b], to, j);
+        break;
+      }
+    }
+  }
+  tray_free(table);
+}
+
+struct tray *tray_menu_watch_apply(void) {
+  tray_mutex_lock(&watch_mutex);
+  struct tray_menu_file *next = watch_pending;
+  struct tray *tray = watch_tray;
+  watch_pending = NULL;
+  tray_mutex_unlock(&watch_mutex);
+  if (next == NULL) {
+    return NULL;
+  }
+
+  struct tray_menu_file *current = watch_current;
+  if (tray == NULL || current == NULL || tray->menu != current->items) {
+    // The app replaced or dropped the watched menu in the meantime
+    tray_free(next);
+    return NULL;
+  }
+  if (tray_menu_same_content(current, next)) {
+    tray_free(next);
+    return NULL;
+  }
+  tray_menu_carry_state(current, next);
+  tray->menu = next->items;
+  watch_current = next;
+  tray_free(current);
+  return tray;
+}
+
+static TRAY_THREAD_FUNC(tray_menu_watch_thread) {
+  char *path = arg;
+
+  tray_mutex_lock(&watch_mutex);
+  struct stat last = watch_stat;
+  bool have_last = watch_have_stat;
+  unsigned long long last_hash = watch_hash;  // contents last parsed, whether or not they were valid
+  while (!watch_stop) {
+    tray_cond_timedwait(&watch_cv, &watch_mutex, TRAY_MENU_WATCH_INTERVAL_MS);
+    if (watch_stop) {
+      break;
+    }
+    tray_mutex_unlock(&watch_mutex);
+
+    struct tray_menu_file *file = NULL;
+    struct stat st;
+    if (stat(path, &st) == 0 && (!have_last || st.st_mtime != last.st_mtime || st.st_size != last.st_size)) {
+      last = st;
+      have_last = true;
+      size_t size = 0;
+      char *data = tray_menu_read_file(path, &size);
+      // Saving without changes only touches the file
+      unsigned long long hash = data != NULL ? tray_menu_hash(data, size, TRAY_MENU_HASH_SEED) : last_hash;
+      if (hash != last_hash) {
+        last_hash = hash;
+        file = tray_menu_parse(data, size, path);
+      }
+      tray_free(data);
+    }
+
+    tray_mutex_lock(&watch_mutex);
+    if (file != NULL) {
+      tray_free(watch_pending);
+      watch_pending = file;
+      tray_mutex_unlock(&watch_mutex);
+      tray_log(TRAY_LOG_INFO, "Reloaded menu file %s", path);
+      tray_wakeup();
+      tray_mutex_lock(&watch_mutex);
+    }
+  }
+  tray_mutex_unlock(&watch_mutex);
+  return TRAY_THREAD_RETURN;
+}
+
+static void tray_menu_watch_stop(void) {
+  tray_mutex_lock(&watch_mutex);
+  bool running = watch_running;
+  watch_stop = true;
+  tray_cond_broadcast(&watch_cv);
+  tray_mutex_unlock(&watch_mutex);
+  if (running) {
+    tray_thread_join(watch_thread);
+  }
+
+  tray_mutex_lock(&watch_mutex);
+  tray_free(watch_pending);
+  watch_pending = NULL;
+  tray_free(watch_path);
+  watch_path = NULL;
+  watch_tray = NULL;
+  watch_current = NULL;
+  watch_running = false;
+  watch_stop = false;
+  tray_mutex_unlock(&watch_mutex);
+}
+
+int tray_menu_watch(struct tray *tray, const char *path) {
+  struct tray_menu_file *previous = watch_current;
+  struct tray *previous_tray = watch_tray;
+  tray_menu_watch_stop();
+  if (path == NULL || tray == NULL) {
+    return path == NULL ? 0 : -1;
+  }
+
+  // Taken before loading, so that a change made while loading is seen by the watcher
+  struct stat st;
+  bool have_stat = stat(path, &st) == 0;
+  struct tray_menu_file *file = tray_menu_load_file(path);
+  char *path_copy = tray_malloc(TRAY_MEMORY_MENUS, strlen(path) + 1);
+  if (file == NULL || path_copy == NULL) {
+    tray_free(file);
+    tray_free(path_copy);
+    return -1;
+  }
+  strcpy(path_copy, path);
+  if (previous != NULL && previous_tray == tray && tray->menu == previous->items) {
+    // Watching a new file for the same tray, the old menu is still ours to free
+    tray_menu_carry_state(previous, file);
+    tray_free(previous);
+  }
+  tray->menu = file->items;
+
+  tray_mutex_lock(&watch_mutex);
+  watch_tray = tray;
+  watch_current = file;
+  watch_hash = file->hash;
+  watch_stat = st;
+  watch_have_stat = have_stat;
+  watch_path = path_copy;
+  watch_running = tray_thread_create(&watch_thread, tray_menu_watch_thread, path_copy) == 0;
+  tray_mutex_unlock(&watch_mutex);
+  if (!watch_running) {
+    tray_log(TRAY_LOG_WARNING, "Failed to start watching %s, it will not be reloaded", path);
+  }
+  return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file src/tray_power.c
+ * @brief Power source watching for the battery limits of tray_set_power_limits().
+ *
+ * A watcher thread reads the power source every few seconds and wakes the loop
+ * when it changes, or when updates held back by the limits are due. tray_loop()
+ * takes the change with tray_power_watch_poll() and applies what is due.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <dirent.h>
+#endif
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_internal.h"
+#include "tray_thread.h"
+
+#define TRAY_POWER_POLL_INTERVAL_MS 2000  ///< How often the power source is read.
+#define TRAY_POWER_SUPPLY_ROOT "/sys/class/power_supply"  ///< Where Linux lists the power supplies.
+
+static tray_mutex_t power_mutex = TRAY_MUTEX_INITIALIZER;
+static tray_cond_t power_cv = TRAY_COND_INITIALIZER;
+static tray_thread_t power_thread;
+static bool power_running = false;
+static bool power_stop = false;
+static char *power_root = NULL;  // directory read by the watcher, owned
+static unsigned long long power_wake_us = 0;  // when to wake the loop for held back updates; 0 for never
+static enum tray_power_source power_source = TRAY_POWER_AC;  // last read
+static bool power_changed = false;  // power_source has not been taken by tray_power_watch_poll() yet
+
+#ifndef _WIN32
+// Reads the first line of root/name/attribute, without the newline
+static bool tray_power_read_attribute(const char *root, const char *name, const char *attribute, char *value, size_t size) {
+  char path[512];
+  int length = snprintf(path, sizeof(path), "%s/%s/%s", root, name, attribute);
+  if (length < 0 || (size_t) length >= sizeof(path)) {
+    return false;
+  }
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return false;
+  }
+  bool read = fgets(value, (int) size, f) != NULL;
+  fclose(f);
+  if (read) {
+    value[strcspn(value, "\n")] = '\0';
+  }
+  return read;
+}
+#endif
+
+int tray_power_read(const char *root, enum tray_power_source *source) {
+#ifdef _WIN32
+  (void) root;
+  SYSTEM_POWER_STATUS status;
+  if (!GetSystemPowerStatus(&status) || status.ACLineStatus == 255) {
+    return -1;
+  }
+  *source = status.ACLineStatus == 0 ? TRAY_POWER_BATTERY : TRAY_POWER_AC;
+  return 0;
+#else
+  DIR *dir = opendir(root);
+  if (dir == NULL) {
+    return -1;
+  }
+  bool found = false;
+  bool adapter_online = false;
+  bool discharging = false;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    char type[32];
+    char value[32];
+    if (entry->d_name[0] == '.' || !tray_power_read_attribute(root, entry->d_name, "type", type, sizeof(type))) {
+      continue;
+    }
+    if (strcmp(type, "Battery") == 0) {
+      // Batteries of mice and headsets have the Device scope, they do not power the machine
+      if (tray_power_read_attribute(root, entry->d_name, "scope", value, sizeof(value)) && strcmp(value, "Device") == 0) {
+        continue;
+      }
+      found = true;
+      if (tray_power_read_attribute(root, entry->d_name, "status", value, sizeof(value)) && strcmp(value, "Discharging") == 0) {
+        discharging = true;
+      }
+    } else if (strcmp(type, "Mains") == 0 || strncmp(type, "USB", 3) == 0) {
+      found = true;
+      if (tray_power_read_attribute(root, entry->d_name, "online", value, sizeof(value)) && strcmp(value, "1") == 0) {
+        adapter_online = true;
+      }
+    }
+  }
+  closedir(dir);
+  if (!found) {
+    return -1;
+  }
+  // A full battery does not discharge, and a charging one has an adapter
+  *source = discharging && !adapter_online ? TRAY_POWER_BATTERY : TRAY_POWER_AC;
+  return 0;
+#endif
+}
+
+static TRAY_THREAD_FUNC(tray_power_watch_thread) {
+  const char *root = arg;
+
+  tray_mutex_lock(&power_mutex);
+  unsigned long long next_read_us = tray_now_us() + TRAY_POWER_POLL_INTERVAL_MS * 1000ULL;
+  while (!power_stop) {
+    unsigned long long now_us = tray_now_us();
+    unsigned long long due_us = power_wake_us != 0 && power_wake_us < next_read_us ? power_wake_us : next_read_us;
+    if (due_us > now_us) {
+      // Woken early by a stop or a new wake-up time, or not; either way it is checked again
+      tray_cond_timedwait(&power_cv, &power_mutex, (unsigned int) ((due_us - now_us + 999) / 1000));
+      continue;
+    }
+
+    bool wake = false;
+    if (power_wake_us != 0 && power_wake_us <= now_us) {
+      power_wake_us = 0;
+      wake = true;
+    }
+    if (next_read_us <= now_us) {
+      next_read_us = now_us + TRAY_POWER_POLL_INTERVAL_MS * 1000ULL;
+      tray_mutex_unlock(&power_mutex);
+      enum tray_power_source source;
+      bool read = tray_power_read(root, &source) == 0;
+      tray_mutex_lock(&power_mutex);
+      if (read && source != power_source) {
+        power_source = source;
+        power_changed = true;
+        wake = true;
+      }
+    }
+    if (wake) {
+      tray_mutex_unlock(&power_mutex);
+      tray_wakeup();
+      tray_mutex_lock(&power_mutex);
+    }
+  }
+  tray_mutex_unlock(&power_mutex);
+  return TRAY_THREAD_RETURN;
+}
+
+void tray_power_watch_stop(void) {
+  tray_mutex_lock(&power_mutex);
+  bool running = power_running;
+  power_stop = true;
+  tray_cond_broadcast(&power_cv);
+  tray_mutex_unlock(&power_mutex);
+  if (running) {
+    tray_thread_join(power_thread);
+  }
+
+  tray_mutex_lock(&power_mutex);
+  tray_free(power_root);
+  power_root = NULL;
+  power_wake_us = 0;
+  power_changed = false;
+  power_running = false;
+  power_stop = false;
+  tray_mutex_unlock(&power_mutex);
+}
+
+void tray_power_watch_start(void) {
+  tray_power_watch_stop();
+
+  const char *root = getenv("TRAY_POWER_SUPPLY_ROOT");
+  if (root == NULL || root[0] == '\0') {
+    root = TRAY_POWER_SUPPLY_ROOT;
+  }
+  char *root_copy = tray_malloc(TRAY_MEMORY_BUFFERS, strlen(root) + 1);
+  if (root_copy == NULL) {
+    tray_log(TRAY_LOG_WARNING, "Failed to start watching the power source, the battery limits do not apply");
+    return;
+  }
+  strcpy(root_copy, root);
+
+  // Read right away, so that the first updates already follow the limits
+  enum tray_power_source source;
+  bool read = tray_power_read(root_copy, &source) == 0;
+
+  tray_mutex_lock(&power_mutex);
+  if (read) {
+    power_source = source;
+    power_changed = true;
+  }
+  power_root = root_copy;
+  power_running = tray_thread_create(&power_thread, tray_power_watch_thread, root_copy) == 0;
+  tray_mutex_unlock(&power_mutex);
+  if (!power_running) {
+    tray_log(TRAY_LOG_WARNING, "Failed to start watching the power source, it is only read at startup");
+  }
+}
+
+int tray_power_watch_poll(enum tray_power_source *source) {
+  tray_mutex_lock(&power_mutex);
+  bool changed = power_changed;
+  power_changed = false;
+  *source = power_source;
+  tray_mutex_unlock(&power_mutex);
+  return changed;
+}
+
+void tray_power_watch_wake_at(unsigned long long due_us) {
+  tray_mutex_lock(&power_mutex);
+  if (power_wake_us == 0 || due_us < power_wake_us) {
+    power_wake_us = due_us;
+    tray_cond_broadcast(&power_cv);
+  }
+  tray_mutex_unlock(&power_mutex);
+}
@@ -0,0 +1,314 @@
+/**
+ * @file src/tray_record.c
+ * @brief Recording of tray API calls to a file, and reading them back for replay.
+ */
+// standard includes
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "tray.h"
+#include "tray_alloc.h"
+#include "tray_internal.h"
+#include "tray_record.h"
+#include "tray_thread.h"
+#include "tray_wire.h"
+
+static tray_mutex_t record_mutex = TRAY_MUTEX_INITIALIZER;
+static FILE *record_file = NULL;  // active recording
+static unsigned long long record_start_us = 0;
+static struct tray_wire_writer record_out;  // reused for every call
+static bool record_env_checked = false;  // TRAY_RECORD is only honored once
+
+static void tray_record_noop_cb(struct tray_menu *item) {
+  (void) item;
+}
+
+static void tray_record_noop_notification_cb() {
+}
+
+static size_t tray_record_count_items(const struct tray_menu *m) {
+  size_t count = 0;
+  for (; m != NULL && m->text != NULL; m++) {
+    count += 1 + tray_record_count_items(m->submenu);
+  }
+  return count;
+}
+
+static void tray_record_put_menu(struct tray_wire_writer *w, const struct tray_menu *m) {
+  unsigned int count = 0;
+  for (const struct tray_menu *item = m; item != NULL && item->text != NULL; item++) {
+    count++;
+  }
+  tray_wire_put_u32(w, count);
+  for (unsigned int i = 0; i < count; ++i) {
+    tray_wire_put_u8(w, tray_wire_item_flags(&m[i]));
+    tray_wire_put_string(w, m[i].text);
+    if (m[i].submenu != NULL) {
+      tray_record_put_menu(w, m[i].submenu);
+    }
+  }
+}
+
+static void tray_record_put_tray(struct tray_wire_writer *w, const struct tray *tray) {
+  tray_wire_put_string(w, tray->icon);
+  tray_wire_put_string(w, tray->tooltip);
+  tray_wire_put_string(w, tray->notification_icon);
+  tray_wire_put_string(w, tray->notification_text);
+  tray_wire_put_string(w, tray->notification_title);
+  tray_wire_put_u8(w, tray->notification_cb != NULL);
+  tray_wire_put_u32(w, (unsigned int) (tray->iconPathCount > 0 ? tray->iconPathCount : 0));
+  for (int i = 0; i < tray->iconPathCount; ++i) {
+    tray_wire_put_string(w, tray->allIconPaths[i]);
+  }
+  tray_wire_put_u32(w, (unsigned int) tray_record_count_items(tray->menu));
+  tray_record_put_menu(w, tray->menu);
+}
+
+// Called with record_mutex held
+static void tray_record_close_file(void) {
+  if (record_file != NULL) {
+    fclose(record_file);
+    record_file = NULL;
+  }
+  tray_wire_writer_free(&record_out);
+}
+
+int tray_record_start(const char *path) {
+  if (path == NULL) {
+    return -1;
+  }
+  tray_mutex_lock(&record_mutex);
+  tray_record_close_file();
+  record_file = fopen(path, "wb");
+  if (record_file == NULL) {
+    tray_mutex_unlock(&record_mutex);
+    tray_log(TRAY_LOG_WARNING, "Cannot create the tray recording %s", path);
+    return -1;
+  }
+  record_start_us = tray_now_us();
+  tray_wire_put_u32(&record_out, TRAY_RECORD_MAGIC);
+  tray_wire_put_u32(&record_out, TRAY_RECORD_VERSION);
+  if (record_out.failed || fwrite(record_out.data, 1, record_out.size, record_file) != record_out.size) {
+    tray_record_close_file();
+    tray_mutex_unlock(&record_mutex);
+    tray_log(TRAY_LOG_WARNING, "Cannot write the tray recording %s", path);
+    return -1;
+  }
+  tray_mutex_unlock(&record_mutex);
+  return 0;
+}
+
+void tray_record_stop(void) {
+  tray_mutex_lock(&record_mutex);
+  tray_record_close_file();
+  tray_mutex_unlock(&record_mutex);
+}
+
+void tray_record_start_from_env(void) {
+  tray_mutex_lock(&record_mutex);
+  bool check = !record_env_checked && record_file == NULL;
+  record_env_checked = true;
+  tray_mutex_unlock(&record_mutex);
+  if (!check) {
+    return;
+  }
+  const char *path = getenv("TRAY_RECORD");
+  if (path != NULL && path[0] != '\0') {
+    tray_record_start(path);
+  }
+}
+
+void tray_record_call(enum tray_record_type type, const struct tray *tray) {
+  tray_mutex_lock(&record_mutex);
+  if (record_file == NULL) {
+    tray_mutex_unlock(&record_mutex);
+    return;
+  }
+  // The time is taken under the lock, so calls from several threads are written in time order
+  record_out.size = 0;
+  size_t frame = tray_wire_begin_frame(&record_out, (enum tray_wire_message) type);
+  tray_wire_put_u64(&record_out, tray_now_us() - record_start_us);
+  if (tray != NULL) {
+    tray_record_put_tray(&record_out, tray);
+  }
+  tray_wire_end_frame(&record_out, frame);
+
+  bool failed = false;
+  if (record_out.failed || record_out.size - frame - TRAY_WIRE_FRAME_HEADER_SIZE > TRAY_WIRE_MAX_FRAME_SIZE) {
+    // Out of memory, or a menu too large to read back; leave this call out
+    tray_wire_writer_free(&record_out);
+  } else if (fwrite(record_out.data, 1, record_out.size, record_file) != record_out.size) {
+    failed = true;
+    tray_record_close_file();
+  } else if (type == TRAY_RECORD_EXIT) {
+    fflush(record_file);
+  }
+  tray_mutex_unlock(&record_mutex);
+
+  if (failed) {
+    tray_log(TRAY_LOG_WARNING, "Writing the tray recording failed, recording stopped");
+  }
+}
+
+int tray_record_open(struct tray_record_reader *reader, const char *path) {
+  memset(reader, 0, sizeof(*reader));
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+  size_t capacity = 0;
+  for (;;) {
+    if (reader->size == capacity) {
+      capacity = capacity != 0 ? capacity * 2 : 65536;
+      unsigned char *data = tray_realloc(TRAY_MEMORY_BUFFERS, reader->data, capacity);
+      if (data == NULL) {
+        break;
+      }
+      reader->data = data;
+    }
+    size_t read = fread(reader->data + reader->size, 1, capacity - reader->size, file);
+    if (read == 0) {
+      break;
+    }
+    reader->size += read;
+  }
+  bool complete = !ferror(file) && feof(file);
+  fclose(file);
+
+  struct tray_wire_reader header = {reader->data, reader->size, 0, 0};
+  unsigned int magic = tray_wire_get_u32(&header);
+  unsigned int version = tray_wire_get_u32(&header);
+  if (!complete || header.failed || magic != TRAY_RECORD_MAGIC || version != TRAY_RECORD_VERSION) {
+    tray_record_close(reader);
+    return -1;
+  }
+  reader->pos = header.pos;
+  return 0;
+}
+
+static bool tray_record_read_menu(struct tray_wire_reader *r, struct tray_menu *slots, size_t capacity, size_t *used, struct tray_menu **menu) {
+  unsigned int count = tray_wire_get_u32(r);
+  // Every list takes its items and a terminator
+  if (r->failed || count >= capacity - *used) {
+    return false;
+  }
+  struct tray_menu *items = slots + *used;
+  *used += (size_t) count + 1;
+  memset(items, 0, ((size_t) count + 1) * sizeof(*items));
+  for (unsigned int i = 0; i < count; ++i) {
+    unsigned int flags = tray_wire_get_u8(r);
+    items[i].text = tray_wire_get_string(r);
+    if (items[i].text == NULL) {
+      return false;
+    }
+    items[i].disabled = (flags & TRAY_WIRE_ITEM_DISABLED) != 0;
+    items[i].checked = (flags & TRAY_WIRE_ITEM_CHECKED) != 0;
+    items[i].checkbox = (flags & TRAY_WIRE_ITEM_CHECKBOX) != 0;
+    items[i].cb = tray_record_noop_cb;
+    if ((flags & TRAY_WIRE_ITEM_SUBMENU) && !tray_record_read_menu(r, slots, capacity, used, &items[i].submenu)) {
+      return false;
+    }
+  }
+  *menu = items;
+  return true;
+}
+
+static struct tray *tray_record_read_tray(struct tray_record_reader *reader, struct tray_wire_reader *r) {
+  int b = reader->current ^ 1;
+  const char *icon = tray_wire_get_string(r);
+  const char *tooltip = tray_wire_get_string(r);
+  const char *notification_icon = tray_wire_get_string(r);
+  const char *notification_text = tray_wire_get_string(r);
+  const char *notification_title = tray_wire_get_string(r);
+  bool notification_cb = tray_wire_get_u8(r) != 0;
+
+  // Counts are checked against the payload before anything is sized by them
+  unsigned int path_count = tray_wire_get_u32(r);
+  if (r->failed || path_count > (r->size - r->pos) / 4) {
+    return NULL;
+  }
+  if (reader->trays[b] == NULL || (unsigned int) reader->tray_paths[b] < path_count) {
+    struct tray *tray = tray_realloc(TRAY_MEMORY_BUFFERS, reader->trays[b], sizeof(struct tray) + path_count * sizeof(const char *));
+    if (tray == NULL) {
+      return NULL;
+    }
+    reader->trays[b] = tray;
+    reader->tray_paths[b] = (int) path_count;
+  }
+  struct tray *tray = reader->trays[b];
+  memset(tray, 0, sizeof(*tray));
+  tray->icon = icon;
+  tray->tooltip = tooltip;
+  tray->notification_icon = notification_icon;
+  tray->notification_text = notification_text;
+  tray->notification_title = notification_title;
+  tray->notification_cb = notification_cb ? tray_record_noop_notification_cb : NULL;
+  *(int *) &tray->iconPathCount = (int) path_count;
+  for (unsigned int i = 0; i < path_count; ++i) {
+    tray->allIconPaths[i] = tray_wire_get_string(r);
+  }
+
+  unsigned int total = tray_wire_get_u32(r);
+  if (r->failed || total > (r->size - r->pos) / 5) {
+    return NULL;
+  }
+  // At most one list per item with a submenu, plus the top-level list
+  size_t capacity = (size_t) total * 2 + 1;
+  if (reader->menu_capacity[b] < capacity) {
+    struct tray_menu *menu = tray_realloc(TRAY_MEMORY_BUFFERS, reader->menus[b], capacity * sizeof(*menu));
+    if (menu == NULL) {
+      return NULL;
+    }
+    reader->menus[b] = menu;
+    reader->menu_capacity[b] = capacity;
+  }
+  size_t used = 0;
+  if (!tray_record_read_menu(r, reader->menus[b], capacity, &used, &tray->menu) || r->failed) {
+    return NULL;
+  }
+  if (total == 0) {
+    tray->menu = NULL;
+  }
+  reader->current = b;
+  return tray;
+}
+
+int tray_record_next(struct tray_record_reader *reader, struct tray_record_event *event) {
+  unsigned int type;
+  struct tray_wire_reader payload;
+  long consumed = tray_wire_next_frame(reader->data + reader->pos, reader->size - reader->pos, &type, &payload);
+  if (consumed == 0) {
+    // The end, or a last call cut off by a crash of the recorded process
+    return 0;
+  }
+  if (consumed < 0) {
+    return -1;
+  }
+  reader->pos += (size_t) consumed;
+
+  event->type = (enum tray_record_type) type;
+  event->time_us = tray_wire_get_u64(&payload);
+  event->tray = NULL;
+  switch (type) {
+    case TRAY_RECORD_INIT:
+    case TRAY_RECORD_UPDATE:
+      event->tray = tray_record_read_tray(reader, &payload);
+      return event->tray != NULL ? 1 : -1;
+    case TRAY_RECORD_EXIT:
+      return payload.failed ? -1 : 1;
+    default:
+      return -1;
+  }
+}
+
+void tray_record_close(struct tray_record_reader *reader) {
+  tray_free(reader->data);
+  for (int i = 0; i < 2; ++i) {
+    tray_free(reader->trays[i]);
+    tray_free(reader->menus[i]);
+  }
+  memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,106 @@
+/**
+ * @file src/tray_record.h
+ * @brief Recording of tray API calls to a file, and reading them back for replay.
+ *
+ * A recording starts with the u32 TRAY_RECORD_MAGIC and the u32 TRAY_RECORD_VERSION,
+ * followed by one tray_wire frame per call. The frame type is a tray_record_type
+ * and the payload starts with the u64 time of the call in microseconds since the
+ * recording started. tray_init() and tray_update() frames continue with a snapshot
+ * of the tray:
+ *
+ * - string icon, string tooltip, string notification icon, text and title
+ * - u8 whether a notification callback is set
+ * - u32 icon path count, then a string per icon path
+ * - u32 total number of menu items, then the menu
+ *
+ * A menu is a u32 item count followed by per item a tray_wire item record and,
+ * if the item has TRAY_WIRE_ITEM_SUBMENU set, its submenu.
+ */
+#ifndef TRAY_RECORD_H
+#define TRAY_RECORD_H
+
+// standard includes
+#include <stddef.h>
+
+// local includes
+#include "tray.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAY_RECORD_MAGIC 0x43455254u  ///< "TREC" in file order.
+#define TRAY_RECORD_VERSION 1  ///< Format version written after the magic.
+
+  /**
+   * @brief Recorded calls.
+   */
+  enum tray_record_type {
+    TRAY_RECORD_INIT = 1,  ///< tray_init(), with a tray snapshot.
+    TRAY_RECORD_UPDATE = 2,  ///< tray_update(), with a tray snapshot; also menus reloaded by tray_menu_watch().
+    TRAY_RECORD_EXIT = 3  ///< tray_exit().
+  };
+
+  /**
+   * @brief A call read back from a recording.
+   */
+  struct tray_record_event {
+    enum tray_record_type type;  ///< The call.
+    unsigned long long time_us;  ///< Time of the call since the recording started.
+    struct tray *tray;  ///< Rebuilt tray for TRAY_RECORD_INIT and TRAY_RECORD_UPDATE, NULL otherwise.
+  };
+
+  /**
+   * @brief A recording loaded into memory.
+   *
+   * Trays are rebuilt in two alternating buffers, so the tray of the previous
+   * event, which a backend may still refer to, stays valid while the next one
+   * is read. Menu items get a callback that does nothing.
+   */
+  struct tray_record_reader {
+    unsigned char *data;  ///< File contents; strings of rebuilt trays point into it.
+    size_t size;  ///< Size of the file.
+    size_t pos;  ///< Offset of the next frame.
+    struct tray *trays[2];  ///< Rebuilt trays.
+    int tray_paths[2];  ///< Icon paths the trays have room for.
+    struct tray_menu *menus[2];  ///< Menu items of the rebuilt trays.
+    size_t menu_capacity[2];  ///< Items the menus have room for.
+    int current;  ///< Buffer of the last rebuilt tray.
+  };
+
+  /**
+   * @brief Write a call to the active recording, if any. Safe to call from any thread.
+   * @param type The call.
+   * @param tray The tray passed to it, NULL for TRAY_RECORD_EXIT.
+   */
+  void tray_record_call(enum tray_record_type type, const struct tray *tray);
+
+  /**
+   * @brief Start recording to the file named by TRAY_RECORD, unless a recording is active or it is not set.
+   */
+  void tray_record_start_from_env(void);
+
+  /**
+   * @brief Load a recording.
+   * @return 0 on success, -1 if the file cannot be read or is not a recording.
+   */
+  int tray_record_open(struct tray_record_reader *reader, const char *path);
+
+  /**
+   * @brief Read the next call.
+   * @param reader The recording.
+   * @param event Receives the call.
+   * @return 1 if a call was read, 0 at the end of the recording, -1 if it is malformed or out of memory.
+   */
+  int tray_record_next(struct tray_record_reader *reader, struct tray_record_event *event);
+
+  /**
+   * @brief Free a recording and every tray read from it.
+   */
+  void tray_record_close(struct tray_record_reader *reader);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_RECORD_H */
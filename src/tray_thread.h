@@ -0,0 +1,244 @@
+/**
+ * @file src/tray_thread.h
+ * @brief Minimal thread, mutex, condition variable and atomic wrappers shared by the tray sources.
+ */
+#ifndef TRAY_THREAD_H
+#define TRAY_THREAD_H
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <pthread.h>
+  #include <time.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _WIN32
+  typedef HANDLE tray_thread_t;  ///< Thread type.
+  typedef DWORD tray_thread_id_t;  ///< Identifies a running thread.
+  typedef LPTHREAD_START_ROUTINE tray_thread_func;  ///< Thread entry point, define it with TRAY_THREAD_FUNC().
+  #define TRAY_THREAD_FUNC(name) DWORD WINAPI name(LPVOID arg)  ///< Define a thread entry point.
+  #define TRAY_THREAD_RETURN 0  ///< Return value of a thread entry point.
+  typedef SRWLOCK tray_mutex_t;  ///< Mutex type.
+  typedef CONDITION_VARIABLE tray_cond_t;  ///< Condition variable type.
+  #define TRAY_MUTEX_INITIALIZER SRWLOCK_INIT  ///< Static mutex initializer.
+  #define TRAY_COND_INITIALIZER CONDITION_VARIABLE_INIT  ///< Static condition variable initializer.
+  typedef volatile LONG64 tray_atomic_t;  ///< Integer only accessed through the tray_atomic_*() functions.
+#else
+  typedef pthread_t tray_thread_t;  ///< Thread type.
+  typedef pthread_t tray_thread_id_t;  ///< Identifies a running thread.
+  typedef void *(*tray_thread_func)(void *);  ///< Thread entry point, define it with TRAY_THREAD_FUNC().
+  #define TRAY_THREAD_FUNC(name) void *name(void *arg)  ///< Define a thread entry point.
+  #define TRAY_THREAD_RETURN NULL  ///< Return value of a thread entry point.
+  typedef pthread_mutex_t tray_mutex_t;  ///< Mutex type.
+  /**
+   * @brief Condition variable type; only used with its mutex held, which also guards the set up on first use.
+   */
+  typedef struct {
+    pthread_cond_t cond;  ///< The condition variable.
+    int monotonic;  ///< Whether cond has been set up to time waits with CLOCK_MONOTONIC.
+  } tray_cond_t;
+  #define TRAY_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER  ///< Static mutex initializer.
+  #define TRAY_COND_INITIALIZER {PTHREAD_COND_INITIALIZER, 0}  ///< Static condition variable initializer.
+  typedef long long tray_atomic_t;  ///< Integer only accessed through the tray_atomic_*() functions.
+#endif
+
+  /**
+   * @brief Start a thread.
+   * @return 0 on success, -1 on error.
+   */
+  static inline int tray_thread_create(tray_thread_t *thread, tray_thread_func func, void *arg) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *thread != NULL ? 0 : -1;
+#else
+    return pthread_create(thread, NULL, func, arg) == 0 ? 0 : -1;
+#endif
+  }
+
+  static inline void tray_thread_join(tray_thread_t thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+  }
+
+  static inline tray_thread_id_t tray_thread_self(void) {
+#ifdef _WIN32
+    return GetCurrentThreadId();
+#else
+    return pthread_self();
+#endif
+  }
+
+  static inline int tray_thread_is_self(tray_thread_id_t id) {
+#ifdef _WIN32
+    return id == GetCurrentThreadId();
+#else
+    return pthread_equal(id, pthread_self());
+#endif
+  }
+
+  static inline void tray_mutex_lock(tray_mutex_t *mutex) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+  }
+
+  static inline void tray_mutex_unlock(tray_mutex_t *mutex) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+  }
+
+#ifndef _WIN32
+  // Timed waits must not stretch when the wall clock is set back, so they follow
+  // CLOCK_MONOTONIC. There is no static initializer for that: the statically
+  // initialized, still unused condition variable is set up again on first use.
+  // macOS has no clock attribute and waits for a relative time instead.
+  static inline pthread_cond_t *tray_cond_get(tray_cond_t *cond) {
+  #ifndef __APPLE__
+    if (!cond->monotonic) {
+      pthread_condattr_t attr;
+      pthread_condattr_init(&attr);
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+      pthread_cond_destroy(&cond->cond);
+      pthread_cond_init(&cond->cond, &attr);
+      pthread_condattr_destroy(&attr);
+      cond->monotonic = 1;
+    }
+  #endif
+    return &cond->cond;
+  }
+#endif
+
+  static inline void tray_cond_wait(tray_cond_t *cond, tray_mutex_t *mutex) {
+#ifdef _WIN32
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(tray_cond_get(cond), mutex);
+#endif
+  }
+
+  /**
+   * @brief Wait on a condition variable for at most timeout_ms milliseconds.
+   * @return 0 if woken, non-zero if the timeout elapsed.
+   */
+  static inline int tray_cond_timedwait(tray_cond_t *cond, tray_mutex_t *mutex, unsigned int timeout_ms) {
+#ifdef _WIN32
+    return SleepConditionVariableSRW(cond, mutex, timeout_ms, 0) ? 0 : 1;
+#elif defined(__APPLE__)
+    struct timespec timeout = {(time_t) (timeout_ms / 1000), (long) (timeout_ms % 1000) * 1000000L};
+    return pthread_cond_timedwait_relative_np(tray_cond_get(cond), mutex, &timeout) == ETIMEDOUT;
+#else
+    pthread_cond_t *monotonic_cond = tray_cond_get(cond);
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(monotonic_cond, mutex, &deadline) == ETIMEDOUT;
+#endif
+  }
+
+  static inline void tray_cond_broadcast(tray_cond_t *cond) {
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(tray_cond_get(cond));
+#endif
+  }
+
+  // The atomics are sequentially consistent, C99 has no <stdatomic.h>
+
+  static inline long long tray_atomic_load(tray_atomic_t *atomic) {
+#ifdef _WIN32
+    return InterlockedCompareExchange64(atomic, 0, 0);
+#else
+    return __atomic_load_n(atomic, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  static inline void tray_atomic_store(tray_atomic_t *atomic, long long value) {
+#ifdef _WIN32
+    InterlockedExchange64(atomic, value);
+#else
+    __atomic_store_n(atomic, value, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  /**
+   * @brief Store a value.
+   * @return The previous value.
+   */
+  static inline long long tray_atomic_exchange(tray_atomic_t *atomic, long long value) {
+#ifdef _WIN32
+    return InterlockedExchange64(atomic, value);
+#else
+    return __atomic_exchange_n(atomic, value, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  /**
+   * @brief Add to a value.
+   * @return The new value.
+   */
+  static inline long long tray_atomic_add(tray_atomic_t *atomic, long long value) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd64(atomic, value) + value;
+#else
+    return __atomic_add_fetch(atomic, value, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  /**
+   * @brief Store desired if the value is *expected.
+   * @return Non-zero if stored; otherwise 0, with the current value in *expected.
+   */
+  static inline int tray_atomic_compare_exchange(tray_atomic_t *atomic, long long *expected, long long desired) {
+#ifdef _WIN32
+    long long previous = InterlockedCompareExchange64(atomic, desired, *expected);
+    if (previous == *expected) {
+      return 1;
+    }
+    *expected = previous;
+    return 0;
+#else
+    return __atomic_compare_exchange_n(atomic, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  static inline void *tray_atomic_load_ptr(void **pointer) {
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer((PVOID volatile *) pointer, NULL, NULL);
+#else
+    return __atomic_load_n(pointer, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+  static inline void tray_atomic_store_ptr(void **pointer, void *value) {
+#ifdef _WIN32
+    InterlockedExchangePointer((PVOID volatile *) pointer, value);
+#else
+    __atomic_store_n(pointer, value, __ATOMIC_SEQ_CST);
+#endif
+  }
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_THREAD_H */
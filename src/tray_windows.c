@@ -8,35 +8,40 @@
 // clang-format off
 // build fails if shellapi.h is included before windows.h
 #include <shellapi.h>
+#include <wtsapi32.h>
 // clang-format on
 #ifndef ARRAYSIZE
 #define ARRAYSIZE(a) (sizeof(a)/sizeof((a)[0]))
 #endif
-// std C
-#include <stdarg.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+// std C
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // local includes
 #include "tray.h"
+#include "tray_alloc.h"
+#include "tray_icon_cache.h"
+#include "tray_internal.h"
 
 #define WM_TRAY_CALLBACK_MESSAGE (WM_USER + 1)  ///< Tray callback message.
+#define WM_TRAY_PREWARM_MESSAGE (WM_USER + 2)  ///< Decode the next not yet cached icon path.
 #define WC_TRAY_CLASS_NAME "TRAY"  ///< Tray window class name.
 #define ID_TRAY_FIRST 1000  ///< First tray identifier.
 #define ID_TRAY_RETRY_TIMER 1  ///< Timer that retries notification icon registration.
 #define TRAY_RETRY_INTERVAL_MS 5000  ///< Interval between icon registration retries.
-#define TRAY_RETRY_LOG_PERIOD 60  ///< Log a retry failure at WARNING once per this many attempts.
+#define TRAY_RETRY_LOG_WINDOW_MS (TRAY_RETRY_INTERVAL_MS * 60)  ///< Log one registration failure per this window, about one per 60 retries.
 #define TRAY_NOTIFICATION_REPLAY_TTL_MS (3 * 60 * 1000)  ///< Replay a remembered notification after re-registration only within this window.
 
 /**
  * @brief Icon information.
  */
 struct icon_info {
-  const char *path;  ///< Path to the icon
   HICON icon;  ///< Regular icon
   HICON large_icon;  ///< Large icon
   HICON notification_icon;  ///< Notification icon
+  HBITMAP menu_bitmap;  ///< 32-bit bitmap of the regular icon for menu items, created on first use
 };
 
 /**
@@ -49,112 +54,127 @@ enum IconType {
 };
 
 static WNDCLASSEXA wc;
-static NOTIFYICONDATAA nid;
-static HWND hwnd;
-static HMENU hmenu = NULL;
-static void (*notification_cb)() = 0;
-static UINT wm_taskbarcreated;
-static struct tray *g_tray = NULL;  // remember last tray so we can re-apply after Explorer restarts
-
+static NOTIFYICONDATAA nid;
+static HWND hwnd;
+static HMENU hmenu = NULL;
+static BOOL menu_reuse = FALSE;  // update hmenu in place when the shape allows, see tray_set_capacity()
+static void (*notification_cb)() = 0;
+static UINT wm_taskbarcreated;
+static struct tray *g_tray = NULL;  // remember last tray so we can re-apply after Explorer restarts
+
 static BOOL icon_added = FALSE;  // whether the shell currently has our notification icon
 static unsigned int icon_add_failures = 0;
 static ULONGLONG notification_posted_ms = 0;  // GetTickCount64() when the app last posted notification text
+static BOOL session_watched = FALSE;  // registered for WM_WTSSESSION_CHANGE, see tray_set_session_suspend()
+
+static const char *const *prewarm_paths = NULL;  // allIconPaths from tray_init(), decoded one per loop iteration
+static int prewarm_count = 0;
+static int prewarm_next = 0;
 
-static struct icon_info *icon_infos;
-static HMENU _tray_menu(struct tray_menu *m, UINT *id);
-static HICON _fetch_icon(const char *path, enum IconType icon_type);
+static void _destroy_icon_info(void *data);
+static struct tray_icon_cache icon_cache = {.destroy = _destroy_icon_info};  // struct icon_info by path
+static HMENU _tray_menu(struct tray_menu *m, UINT *id);
+static HBITMAP _fetch_menu_bitmap(const char *path);
+static HICON _fetch_icon(const char *path, enum IconType icon_type);
 static int tray_try_add_icon(void);
-static void tray_apply_state(struct tray *tray, BOOL is_replay);
-
-static tray_log_callback g_tray_log_cb = NULL;
-
-void tray_set_log_callback(tray_log_callback cb) {
-  g_tray_log_cb = cb;
-}
-
-static void tray_log(enum tray_log_level level, const char *fmt, ...) {
-  if (!g_tray_log_cb || !fmt) {
-    return;
-  }
-  char buffer[1024];
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(buffer, sizeof(buffer), fmt, args);
-  va_end(args);
-  buffer[sizeof(buffer) - 1] = '\0';
-  g_tray_log_cb(level, buffer);
-}
-
-static void tray_log_last_error(enum tray_log_level level, const char *context) {
-  DWORD err = GetLastError();
-  char message[512] = {0};
-  DWORD flags = FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
-  DWORD len = FormatMessageA(flags, NULL, err, 0, message, (DWORD)sizeof(message), NULL);
-  if (len == 0 || message[0] == '\0') {
-    tray_log(level, "%s failed (err=%lu; no extended error message)", context, (unsigned long)err);
-  } else {
-    // Trim trailing newlines from FormatMessageA
-    while (len > 0 && (message[len - 1] == '\n' || message[len - 1] == '\r')) {
-      message[len - 1] = '\0';
-      --len;
-    }
-    tray_log(level, "%s failed (err=%lu): %s", context, (unsigned long)err, message);
-  }
-}
-
-// Safe copy that always NUL-terminates
-static void safe_copy_sz(char *dst, size_t dstcch, const char *src) {
-  if (!dst || dstcch == 0) return;
-  if (!src) { dst[0] = '\0'; return; }
-  StringCchCopyA(dst, dstcch, src);
+static void tray_apply_state(struct tray *tray, unsigned int parts, BOOL is_replay);
+
+// Formats GetLastError() for context; a non-NULL limit rate-limits the call site before any formatting
+static void tray_log_last_error(struct tray_log_limit *limit, enum tray_log_level level, const char *context) {
+  DWORD err = GetLastError();
+  if (limit != NULL && !tray_log_limit_check(limit, level)) {
+    return;
+  }
+  char message[512] = {0};
+  DWORD flags = FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
+  DWORD len = FormatMessageA(flags, NULL, err, 0, message, (DWORD)sizeof(message), NULL);
+  if (len == 0 || message[0] == '\0') {
+    tray_log(level, "%s failed (err=%lu; no extended error message)", context, (unsigned long)err);
+  } else {
+    // Trim trailing newlines from FormatMessageA
+    while (len > 0 && (message[len - 1] == '\n' || message[len - 1] == '\r')) {
+      message[len - 1] = '\0';
+      --len;
+    }
+    tray_log(level, "%s failed (err=%lu): %s", context, (unsigned long)err, message);
+  }
+}
+
+// Safe copy that always NUL-terminates
+static void safe_copy_sz(char *dst, size_t dstcch, const char *src) {
+  if (!dst || dstcch == 0) return;
+  if (!src) { dst[0] = '\0'; return; }
+  StringCchCopyA(dst, dstcch, src);
+}
+
+static DWORD tray_apply_icon(struct tray *tray, DWORD flags) {
+  nid.hIcon = NULL;
+  if (tray != NULL && tray->icon != NULL && tray->icon[0] != '\0') {
+    HICON icon = _fetch_icon(tray_icon_for_scheme(tray->icon), REGULAR);
+    if (icon != NULL) {
+      nid.hIcon = icon;
+      flags |= NIF_ICON;
+    }
+    // Decoded now, so a change of the color scheme only swaps cached icons
+    const char *variants[3];
+    size_t count = tray_icon_variants(tray->icon, variants);
+    for (size_t i = 0; i < count; ++i) {
+      _fetch_icon(variants[i], REGULAR);
+    }
+  }
+  return flags;
+}
+
+// The taskbar follows SystemUsesLightTheme; Windows before 10 has no such value
+static void tray_read_color_scheme(void) {
+  DWORD light = 0;
+  DWORD size = sizeof(light);
+  LSTATUS status = RegGetValueA(HKEY_CURRENT_USER, "Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize", "SystemUsesLightTheme", RRF_RT_REG_DWORD, NULL, &light, &size);
+  if (status == ERROR_SUCCESS) {
+    tray_set_color_scheme(light ? TRAY_COLOR_SCHEME_LIGHT : TRAY_COLOR_SCHEME_DARK);
+  }
+}
+
+static DWORD tray_apply_tip(struct tray *tray, DWORD flags) {
+  if (tray != NULL && tray->tooltip != NULL && tray->tooltip[0] != '\0') {
+    safe_copy_sz(nid.szTip, ARRAYSIZE(nid.szTip), tray->tooltip);
+    flags |= NIF_TIP;
+#ifdef NIF_SHOWTIP
+    flags |= NIF_SHOWTIP;
+#endif
+  } else {
+    nid.szTip[0] = '\0';
+  }
+  return flags;
+}
+
+static DWORD tray_apply_icon_and_tip(struct tray *tray, DWORD flags) {
+  return tray_apply_tip(tray, tray_apply_icon(tray, flags));
 }
 
-static int icon_info_count;
-
-static DWORD tray_apply_icon_and_tip(struct tray *tray, DWORD flags) {
-  nid.hIcon = NULL;
-  if (tray != NULL && tray->icon != NULL && tray->icon[0] != '\0') {
-    HICON icon = _fetch_icon(tray->icon, REGULAR);
-    if (icon != NULL) {
-      nid.hIcon = icon;
-      flags |= NIF_ICON;
-    }
-  }
-
-  if (tray != NULL && tray->tooltip != NULL && tray->tooltip[0] != '\0') {
-    safe_copy_sz(nid.szTip, ARRAYSIZE(nid.szTip), tray->tooltip);
-    flags |= NIF_TIP;
-#ifdef NIF_SHOWTIP
-    flags |= NIF_SHOWTIP;
-#endif
-  } else {
-    nid.szTip[0] = '\0';
-  }
-
-  return flags;
-}
-
-static int tray_add_notify_icon(struct tray *tray, enum tray_log_level failure_level) {
-  nid.uFlags = tray_apply_icon_and_tip(tray, NIF_MESSAGE);
-  nid.uCallbackMessage = WM_TRAY_CALLBACK_MESSAGE;
-  if (!Shell_NotifyIconA(NIM_ADD, &nid)) {
+static int tray_add_notify_icon(struct tray *tray) {
+  static struct tray_log_limit add_limit = {.window_ms = TRAY_RETRY_LOG_WINDOW_MS, .burst = 1};
+  static struct tray_log_limit version_limit;
+  nid.uFlags = tray_apply_icon_and_tip(tray, NIF_MESSAGE);
+  nid.uCallbackMessage = WM_TRAY_CALLBACK_MESSAGE;
+  if (!Shell_NotifyIconA(NIM_ADD, &nid)) {
     // The shell may still be tracking a half-registered icon for this identity
     // (e.g. a previous instance that died mid-update). Clear it and try once more.
     Shell_NotifyIconA(NIM_DELETE, &nid);
     if (!Shell_NotifyIconA(NIM_ADD, &nid)) {
-      tray_log_last_error(failure_level, "Shell_NotifyIconA(NIM_ADD)");
+      tray_log_last_error(&add_limit, TRAY_LOG_WARNING, "Shell_NotifyIconA(NIM_ADD)");
       return -1;
     }
-  }
-
-  nid.uVersion = NOTIFYICON_VERSION_4;
-  if (!Shell_NotifyIconA(NIM_SETVERSION, &nid)) {
-    tray_log_last_error(TRAY_LOG_WARNING, "Shell_NotifyIconA(NIM_SETVERSION)");
-  }
-
-  return 0;
-}
-
+  }
+
+  nid.uVersion = NOTIFYICON_VERSION_4;
+  if (!Shell_NotifyIconA(NIM_SETVERSION, &nid)) {
+    tray_log_last_error(&version_limit, TRAY_LOG_WARNING, "Shell_NotifyIconA(NIM_SETVERSION)");
+  }
+
+  return 0;
+}
+
 static void tray_schedule_icon_retry(void) {
   if (hwnd != NULL) {
     SetTimer(hwnd, ID_TRAY_RETRY_TIMER, TRAY_RETRY_INTERVAL_MS, NULL);
@@ -164,15 +184,14 @@ static void tray_schedule_icon_retry(void) {
 // Try to (re-)register the notification icon. The shell can refuse NIM_ADD for
 // long stretches (around logon, Explorer crashes, installer-driven restarts), so
 // failures are not fatal: a timer keeps retrying until the shell accepts. Failure
-// logs are throttled to one WARNING per TRAY_RETRY_LOG_PERIOD attempts so a
-// persistently broken shell does not flood the log.
+// logs are rate limited to one per TRAY_RETRY_LOG_WINDOW_MS so a persistently
+// broken shell does not flood the log.
 static int tray_try_add_icon(void) {
   if (g_tray == NULL || hwnd == NULL) {
     return -1;
   }
 
-  enum tray_log_level level = (icon_add_failures % TRAY_RETRY_LOG_PERIOD == 0) ? TRAY_LOG_WARNING : TRAY_LOG_DEBUG;
-  if (tray_add_notify_icon(g_tray, level) < 0) {
+  if (tray_add_notify_icon(g_tray) < 0) {
     ++icon_add_failures;
     icon_added = FALSE;
     tray_schedule_icon_retry();
@@ -182,10 +201,12 @@ static int tray_try_add_icon(void) {
   if (icon_add_failures > 0) {
     tray_log(TRAY_LOG_INFO, "Tray icon registered after %u failed attempts", icon_add_failures);
   }
+  tray_stats_mark_first_icon();
+  tray_stats_mark_host_recovered();
   icon_add_failures = 0;
   icon_added = TRUE;
   KillTimer(hwnd, ID_TRAY_RETRY_TIMER);
-  tray_apply_state(g_tray, TRUE);
+  tray_apply_state(g_tray, TRAY_PARTS_ALL, TRUE);
   return 0;
 }
 
@@ -204,11 +225,11 @@ static void tray_allow_taskbar_created(HWND wnd) {
     return;
   }
   if (!change_filter(wnd, wm_taskbarcreated, 1 /* MSGFLT_ALLOW */, NULL)) {
-    tray_log_last_error(TRAY_LOG_WARNING, "ChangeWindowMessageFilterEx(TaskbarCreated)");
+    tray_log_last_error(NULL, TRAY_LOG_WARNING, "ChangeWindowMessageFilterEx(TaskbarCreated)");
   }
 }
 
-static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
   switch (msg) {
     case WM_CLOSE:
       DestroyWindow(hwnd);
@@ -235,6 +256,10 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
         item_info.fMask = MIIM_DATA | MIIM_STATE;
         if (GetMenuItemInfoA(hmenu, cmd_id, FALSE, &item_info) && item_info.dwItemData != 0) {
           struct tray_menu *menu = (struct tray_menu *) item_info.dwItemData;
+          if (!tray_input_debounce(menu)) {
+            // Part of a burst of clicks; the checkbox keeps the state of the first one
+            return 0;
+          }
           if (menu->checkbox) {
             menu->checked = !menu->checked;
             item_info.fMask = MIIM_STATE;
@@ -248,6 +273,28 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
       }
       return 0;
     }
+    case WM_WTSSESSION_CHANGE:
+      if (wparam == WTS_SESSION_LOCK) {
+        tray_set_session_state(TRAY_SESSION_LOCKED);
+      } else if (wparam == WTS_SESSION_UNLOCK) {
+        tray_set_session_state(TRAY_SESSION_ACTIVE);
+      }
+      return 0;
+    case WM_SETTINGCHANGE:
+      // Broadcast to top-level windows when the light/dark theme changes
+      if (lparam != 0 && lstrcmpA((LPCSTR) lparam, "ImmersiveColorSet") == 0) {
+        tray_read_color_scheme();
+      }
+      break;
+    case WM_TRAY_PREWARM_MESSAGE:
+      // Decode one icon per message so prewarming never holds up input handling
+      if (prewarm_next < prewarm_count) {
+        _fetch_icon(prewarm_paths[prewarm_next++], REGULAR);
+        if (prewarm_next < prewarm_count) {
+          PostMessage(hwnd, WM_TRAY_PREWARM_MESSAGE, 0, 0);
+        }
+      }
+      return 0;
     case WM_TRAY_CALLBACK_MESSAGE: {
       switch (LOWORD(lparam)) {
         case WM_LBUTTONUP:
@@ -268,6 +315,10 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
           return 0;
         }
 
+        case WM_MBUTTONUP:
+          tray_input_secondary_activate();
+          return 0;
+
         case NIN_BALLOONUSERCLICK:
           if (notification_cb) {
             notification_cb();
@@ -280,8 +331,9 @@ static LRESULT CALLBACK _tray_wnd_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARA
 
   // Handle Explorer restarts: the old registration is gone, so re-add the icon
   // and re-apply state (tray_try_add_icon keeps retrying on failure).
-  if (msg == wm_taskbarcreated) {
+  if (msg == wm_taskbarcreated) {
     icon_added = FALSE;
+    tray_stats_mark_host_lost();
     tray_try_add_icon();
     return 0;
   }
@@ -298,7 +350,7 @@ static HMENU _tray_menu(struct tray_menu *m, UINT *id) {
       MENUITEMINFOA item;
       memset(&item, 0, sizeof(item));
       item.cbSize = sizeof(MENUITEMINFOA);
-      item.fMask = MIIM_ID | MIIM_TYPE | MIIM_STATE | MIIM_DATA;
+      item.fMask = MIIM_ID | MIIM_FTYPE | MIIM_STRING | MIIM_STATE | MIIM_DATA;  // MIIM_TYPE does not combine with MIIM_BITMAP
       item.fType = 0;
       item.fState = 0;
       if (m->submenu != NULL) {
@@ -311,6 +363,10 @@ static HMENU _tray_menu(struct tray_menu *m, UINT *id) {
       if (m->checked) {
         item.fState |= MFS_CHECKED;
       }
+      if (m->icon != NULL) {
+        item.fMask |= MIIM_BITMAP;
+        item.hbmpItem = _fetch_menu_bitmap(m->icon);
+      }
       item.wID = *id;
       item.dwTypeData = (LPSTR) m->text;
       item.dwItemData = (ULONG_PTR) m;
@@ -321,52 +377,102 @@ static HMENU _tray_menu(struct tray_menu *m, UINT *id) {
   return hmenu;
 }
 
+/**
+ * @brief Check whether a menu holds the items _tray_menu() would create.
+ * @param menu Menu created by _tray_menu().
+ * @param m Menu items.
+ * @return TRUE if separators and submenus are in the same places.
+ */
+static BOOL _tray_menu_same_shape(HMENU menu, struct tray_menu *m) {
+  int count = GetMenuItemCount(menu);
+  int i = 0;
+  for (; m != NULL && m->text != NULL; m++, i++) {
+    MENUITEMINFOA item;
+    memset(&item, 0, sizeof(item));
+    item.cbSize = sizeof(MENUITEMINFOA);
+    item.fMask = MIIM_FTYPE | MIIM_SUBMENU;
+    if (i >= count || !GetMenuItemInfoA(menu, i, TRUE, &item)) {
+      return FALSE;
+    }
+    BOOL separator = strcmp(m->text, "-") == 0;
+    if (((item.fType & MFT_SEPARATOR) != 0) != separator || (item.hSubMenu != NULL) != (m->submenu != NULL)) {
+      return FALSE;
+    }
+    if (m->submenu != NULL && !_tray_menu_same_shape(item.hSubMenu, m->submenu)) {
+      return FALSE;
+    }
+  }
+  return i == count;
+}
+
+/**
+ * @brief Apply texts and states to a menu of the same shape, keeping its command IDs.
+ * @param menu Menu for which _tray_menu_same_shape() holds.
+ * @param m Menu items.
+ */
+static void _tray_menu_reuse(HMENU menu, struct tray_menu *m) {
+  for (int i = 0; m != NULL && m->text != NULL; m++, i++) {
+    if (strcmp(m->text, "-") == 0) {
+      continue;
+    }
+    MENUITEMINFOA item;
+    memset(&item, 0, sizeof(item));
+    item.cbSize = sizeof(MENUITEMINFOA);
+    item.fMask = MIIM_STRING | MIIM_STATE | MIIM_DATA | MIIM_BITMAP;
+    item.fState = (m->disabled ? MFS_DISABLED : 0) | (m->checked ? MFS_CHECKED : 0);
+    item.hbmpItem = m->icon != NULL ? _fetch_menu_bitmap(m->icon) : NULL;
+    item.dwTypeData = (LPSTR) m->text;
+    item.dwItemData = (ULONG_PTR) m;
+    SetMenuItemInfoA(menu, i, TRUE, &item);
+    if (m->submenu != NULL) {
+      _tray_menu_reuse(GetSubMenu(menu, i), m->submenu);
+    }
+  }
+}
+
 /**
  * @brief Create icon information.
  * @param path Path to the icon.
- * @return Icon information.
+ * @return Icon information, or NULL if out of memory.
  */
-struct icon_info _create_icon_info(const char *path) {
-  struct icon_info info;
-  info.path = strdup(path);
+struct icon_info *_create_icon_info(const char *path) {
+  struct icon_info *info = tray_calloc(TRAY_MEMORY_ICONS, 1, sizeof(*info));
+  if (info == NULL) {
+    return NULL;
+  }
 
   // These must be separate invocations otherwise Windows may opt to only return large or small icons.
   // MSDN does not explicitly state this anywhere, but it has been observed on some machines.
-  ExtractIconExA(path, 0, &info.large_icon, NULL, 1);
-  ExtractIconExA(path, 0, NULL, &info.icon, 1);
+  ExtractIconExA(path, 0, &info->large_icon, NULL, 1);
+  ExtractIconExA(path, 0, NULL, &info->icon, 1);
 
-  info.notification_icon = LoadImageA(NULL, path, IMAGE_ICON, GetSystemMetrics(SM_CXICON) * 2, GetSystemMetrics(SM_CYICON) * 2, LR_LOADFROMFILE);
+  info->notification_icon = LoadImageA(NULL, path, IMAGE_ICON, GetSystemMetrics(SM_CXICON) * 2, GetSystemMetrics(SM_CYICON) * 2, LR_LOADFROMFILE);
+  tray_stats_object_created(TRAY_OBJECT_ICON);
   return info;
 }
 
 /**
- * @brief Initialize icon cache.
- * @param paths Paths to the icons.
- * @param count Number of paths.
+ * @brief Destroy icon information.
+ * @param data Icon information created by _create_icon_info().
  */
-void _init_icon_cache(const char **paths, int count) {
-  icon_info_count = count;
-  icon_infos = malloc(sizeof(struct icon_info) * icon_info_count);
-
-  for (int i = 0; i < count; ++i) {
-    icon_infos[i] = _create_icon_info(paths[i]);
-  }
+static void _destroy_icon_info(void *data) {
+  struct icon_info *info = data;
+  if (info->icon) DestroyIcon(info->icon);
+  if (info->large_icon) DestroyIcon(info->large_icon);
+  if (info->notification_icon) DestroyIcon(info->notification_icon);
+  if (info->menu_bitmap) DeleteObject(info->menu_bitmap);
+  tray_free(info);
+  tray_stats_object_destroyed(TRAY_OBJECT_ICON);
 }
 
 /**
  * @brief Destroy icon cache.
  */
 void _destroy_icon_cache() {
-  for (int i = 0; i < icon_info_count; ++i) {
-    if (icon_infos[i].icon) DestroyIcon(icon_infos[i].icon);
-    if (icon_infos[i].large_icon) DestroyIcon(icon_infos[i].large_icon);
-    if (icon_infos[i].notification_icon) DestroyIcon(icon_infos[i].notification_icon);
-    free((void *) icon_infos[i].path);
-  }
-
-  free(icon_infos);
-  icon_infos = NULL;
-  icon_info_count = 0;
+  tray_icon_cache_clear(&icon_cache);
+  prewarm_paths = NULL;
+  prewarm_count = 0;
+  prewarm_next = 0;
 }
 
 /**
@@ -384,85 +490,158 @@ HICON _fetch_cached_icon(struct icon_info *icon_record, enum IconType icon_type)
     case NOTIFICATION:
       return icon_record->notification_icon;
   }
+  return NULL;
 }
 
 /**
  * @brief Fetch icon.
  * @param path Path to the icon.
  * @param icon_type Icon type.
- * @return Icon.
+ * @return Icon owned by the icon cache, or NULL if it cannot be loaded or cached.
  */
 HICON _fetch_icon(const char *path, enum IconType icon_type) {
   // Find a cached icon by path
-  for (int i = 0; i < icon_info_count; ++i) {
-    if (strcmp(icon_infos[i].path, path) == 0) {
-      return _fetch_cached_icon(&icon_infos[i], icon_type);
-    }
+  struct icon_info *info = tray_icon_cache_find(&icon_cache, path);
+  if (info != NULL) {
+    return _fetch_cached_icon(info, icon_type);
+  }
+
+  // Decode and cache
+  info = _create_icon_info(path);
+  if (info == NULL) {
+    return NULL;
   }
+  if (tray_icon_cache_insert(&icon_cache, path, info) != 0) {
+    // Nothing would ever free an icon the cache does not own
+    TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "Failed to cache icon %s", path);
+    _destroy_icon_info(info);
+    return NULL;
+  }
+  return _fetch_cached_icon(info, icon_type);
+}
 
-  // Expand cache, fetch, and retry
-  icon_info_count += 1;
-  icon_infos = realloc(icon_infos, sizeof(struct icon_info) * icon_info_count);
-  icon_infos[icon_info_count - 1] = _create_icon_info(path);
+/**
+ * @brief Draw an icon into a 32-bit top-down DIB, which menus show with its alpha channel.
+ * @param icon The icon.
+ * @return The bitmap, or NULL on error.
+ */
+static HBITMAP _create_menu_bitmap(HICON icon) {
+  int cx = GetSystemMetrics(SM_CXSMICON);
+  int cy = GetSystemMetrics(SM_CYSMICON);
+  BITMAPINFO bmi;
+  memset(&bmi, 0, sizeof(bmi));
+  bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  bmi.bmiHeader.biWidth = cx;
+  bmi.bmiHeader.biHeight = -cy;
+  bmi.bmiHeader.biPlanes = 1;
+  bmi.bmiHeader.biBitCount = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+  HDC dc = CreateCompatibleDC(NULL);
+  if (dc == NULL) {
+    return NULL;
+  }
+  void *bits = NULL;
+  HBITMAP bitmap = CreateDIBSection(dc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+  if (bitmap != NULL) {
+    HGDIOBJ previous = SelectObject(dc, bitmap);
+    DrawIconEx(dc, 0, 0, icon, cx, cy, 0, NULL, DI_NORMAL);
+    SelectObject(dc, previous);
+  }
+  DeleteDC(dc);
+  return bitmap;
+}
 
-  return _fetch_cached_icon(&icon_infos[icon_info_count - 1], icon_type);
+/**
+ * @brief Fetch the menu item bitmap of an icon, shared by every item showing it.
+ * @param path Path to the icon.
+ * @return Bitmap owned by the icon cache, or NULL if the icon cannot be loaded or cached.
+ */
+static HBITMAP _fetch_menu_bitmap(const char *path) {
+  if (_fetch_icon(path, REGULAR) == NULL) {
+    return NULL;
+  }
+  // Fetched icons are always cached, and the bitmap is kept alongside
+  struct icon_info *info = tray_icon_cache_find(&icon_cache, path);
+  if (info == NULL) {
+    return NULL;
+  }
+  if (info->menu_bitmap == NULL) {
+    info->menu_bitmap = _create_menu_bitmap(info->icon);
+  }
+  return info->menu_bitmap;
 }
 
-int tray_init(struct tray *tray) {
-  wm_taskbarcreated = RegisterWindowMessageA("TaskbarCreated");
-
-  _init_icon_cache(tray->allIconPaths, tray->iconPathCount);
-  g_tray = tray;
-
-  memset(&wc, 0, sizeof(wc));
-  wc.cbSize = sizeof(WNDCLASSEXA);
-  wc.lpfnWndProc = _tray_wnd_proc;
-  wc.hInstance = GetModuleHandle(NULL);
-  wc.lpszClassName = WC_TRAY_CLASS_NAME;
-  if (!RegisterClassExA(&wc)) {
-    tray_log_last_error(TRAY_LOG_ERROR, "RegisterClassExA");
-    _destroy_icon_cache();
-    g_tray = NULL;
-    return -1;
-  }
+static int tray_windows_init(struct tray *tray) {
+  wm_taskbarcreated = RegisterWindowMessageA("TaskbarCreated");
+
+  // Only the tray icon itself is decoded up front (by the first NIM_ADD); the
+  // rest of allIconPaths is prewarmed from the message loop after registration.
+  g_tray = tray;
+  menu_reuse = tray_get_capacity() != NULL;
+  tray_read_color_scheme();
+
+  memset(&wc, 0, sizeof(wc));
+  wc.cbSize = sizeof(WNDCLASSEXA);
+  wc.lpfnWndProc = _tray_wnd_proc;
+  wc.hInstance = GetModuleHandle(NULL);
+  wc.lpszClassName = WC_TRAY_CLASS_NAME;
+  if (!RegisterClassExA(&wc)) {
+    tray_log_last_error(NULL, TRAY_LOG_ERROR, "RegisterClassExA");
+    _destroy_icon_cache();
+    g_tray = NULL;
+    return -1;
+  }
 
   // Hidden top-level window (NOT message-only) is safest for Shell_NotifyIcon callbacks.
-  hwnd = CreateWindowExA(0, WC_TRAY_CLASS_NAME, NULL, 0, 0, 0, 0, 0, NULL, NULL, GetModuleHandle(NULL), NULL);
-  if (hwnd == NULL) {
-    tray_log_last_error(TRAY_LOG_ERROR, "CreateWindowExA");
-    _destroy_icon_cache();
-    g_tray = NULL;
-    UnregisterClassA(WC_TRAY_CLASS_NAME, GetModuleHandle(NULL));
-    return -1;
-  }
-  UpdateWindow(hwnd);
+  hwnd = CreateWindowExA(0, WC_TRAY_CLASS_NAME, NULL, 0, 0, 0, 0, 0, NULL, NULL, GetModuleHandle(NULL), NULL);
+  if (hwnd == NULL) {
+    tray_log_last_error(NULL, TRAY_LOG_ERROR, "CreateWindowExA");
+    _destroy_icon_cache();
+    g_tray = NULL;
+    UnregisterClassA(WC_TRAY_CLASS_NAME, GetModuleHandle(NULL));
+    return -1;
+  }
+  UpdateWindow(hwnd);
   tray_allow_taskbar_created(hwnd);
-
-  memset(&nid, 0, sizeof(nid));
-  nid.cbSize = sizeof(NOTIFYICONDATAA);
-  nid.hWnd = hwnd;
-  nid.uID = 1; // non-zero id
-
+  if (tray_session_suspend_enabled()) {
+    session_watched = WTSRegisterSessionNotification(hwnd, NOTIFY_FOR_THIS_SESSION);
+    if (!session_watched) {
+      tray_log_last_error(NULL, TRAY_LOG_WARNING, "WTSRegisterSessionNotification");
+    }
+  }
+
+  memset(&nid, 0, sizeof(nid));
+  nid.cbSize = sizeof(NOTIFYICONDATAA);
+  nid.hWnd = hwnd;
+  nid.uID = 1; // non-zero id
+
   // A rejected NIM_ADD is not fatal: keep the window and message loop alive so
   // the retry timer and TaskbarCreated can register the icon once the shell is
   // willing. Tearing down here would leave the tray permanently missing.
   icon_added = FALSE;
   icon_add_failures = 0;
   tray_try_add_icon();
-  return 0;
-}
 
-int tray_loop(int blocking) {
+  prewarm_paths = tray->allIconPaths;
+  prewarm_count = tray->iconPathCount;
+  prewarm_next = 0;
+  if (prewarm_count > 0) {
+    PostMessage(hwnd, WM_TRAY_PREWARM_MESSAGE, 0, 0);
+  }
+  return 0;
+}
+
+static int tray_windows_loop(int blocking) {
   MSG msg;
-  if (blocking) {
-    // Get thread-wide messages so we receive WM_QUIT too
-    BOOL r = GetMessageA(&msg, NULL, 0, 0);
-    if (r <= 0) {
-      if (r == -1) {
-        tray_log_last_error(TRAY_LOG_ERROR, "GetMessageA");
-      }
-      return -1; // error or WM_QUIT
-    }
+  if (blocking) {
+    // Get thread-wide messages so we receive WM_QUIT too
+    BOOL r = GetMessageA(&msg, NULL, 0, 0);
+    if (r <= 0) {
+      if (r == -1) {
+        tray_log_last_error(NULL, TRAY_LOG_ERROR, "GetMessageA");
+      }
+      return -1; // error or WM_QUIT
+    }
     TranslateMessage(&msg);
     DispatchMessageA(&msg);
     return 0;
@@ -479,65 +658,49 @@ int tray_loop(int blocking) {
   }
 }
 
-void tray_update(struct tray *tray) {
-  tray_apply_state(tray, FALSE);
-}
-
-// Applies the given state to the shell icon. is_replay marks re-registration
-// paths (TaskbarCreated, retry timer, NIM_MODIFY failure) that re-apply the
-// remembered g_tray rather than a fresh update from the app.
-static void tray_apply_state(struct tray *tray, BOOL is_replay) {
-  if (tray == NULL || hwnd == NULL) {
-    return;
-  }
-
-  g_tray = tray; // remember the last state for re-adding after Explorer restarts
-  if (!icon_added) {
-    // No icon registered yet; the retry path re-applies g_tray once NIM_ADD succeeds.
-    return;
-  }
+static void tray_windows_update(struct tray *tray) {
+  tray_apply_state(tray, TRAY_PARTS_ALL, FALSE);
+}
 
-  UINT id = ID_TRAY_FIRST;
-  HMENU prevmenu = hmenu;
-  hmenu = _tray_menu(tray->menu, &id);
-  SendMessage(hwnd, WM_INITMENUPOPUP, (WPARAM) hmenu, 0);
-
-  // Rebuild flags each update to avoid stale bits carrying over
-  DWORD flags = tray_apply_icon_and_tip(tray, NIF_MESSAGE);
-
-  // Balloon/toast (legacy surface mapped to Win10+ toasts)
-  BOOL has_title = (tray->notification_title && tray->notification_title[0]);
-  BOOL has_text  = (tray->notification_text  && tray->notification_text[0]);
-  if (is_replay) {
-    // Re-registration re-applies the remembered state, and NIF_INFO would
-    // re-show the last toast. Taskbar hosts (DisplayFusion multi-monitor
-    // taskbars, Explorer restarts) broadcast TaskbarCreated on every taskbar
-    // rebuild, so an unexpired toast replayed each time reads as notification
-    // spam. Only replay while the toast is still fresh.
-    const BOOL fresh = notification_posted_ms != 0 &&
-                       GetTickCount64() - notification_posted_ms <= TRAY_NOTIFICATION_REPLAY_TTL_MS;
-    if (!fresh) {
-      has_title = FALSE;
-      has_text = FALSE;
-    }
-  } else {
-    notification_posted_ms = (has_title || has_text) ? GetTickCount64() : 0;
-  }
-  if (has_title || has_text) {
+static void tray_windows_update_parts(struct tray *tray, unsigned int parts) {
+  tray_apply_state(tray, parts, FALSE);
+}
+
+// Computes the NIF_INFO part of a modification into nid
+static DWORD tray_apply_notification(struct tray *tray, DWORD flags, BOOL is_replay) {
+  // Balloon/toast (legacy surface mapped to Win10+ toasts)
+  BOOL has_title = (tray->notification_title && tray->notification_title[0]);
+  BOOL has_text  = (tray->notification_text  && tray->notification_text[0]);
+  if (is_replay) {
+    // Re-registration re-applies the remembered state, and NIF_INFO would
+    // re-show the last toast. Taskbar hosts (DisplayFusion multi-monitor
+    // taskbars, Explorer restarts) broadcast TaskbarCreated on every taskbar
+    // rebuild, so an unexpired toast replayed each time reads as notification
+    // spam. Only replay while the toast is still fresh.
+    const BOOL fresh = notification_posted_ms != 0 &&
+                       GetTickCount64() - notification_posted_ms <= TRAY_NOTIFICATION_REPLAY_TTL_MS;
+    if (!fresh) {
+      has_title = FALSE;
+      has_text = FALSE;
+    }
+  } else {
+    notification_posted_ms = (has_title || has_text) ? GetTickCount64() : 0;
+  }
+  if (has_title || has_text) {
     safe_copy_sz(nid.szInfoTitle, ARRAYSIZE(nid.szInfoTitle),
                  has_title ? tray->notification_title : "");
     safe_copy_sz(nid.szInfo, ARRAYSIZE(nid.szInfo),
                  has_text ? tray->notification_text : "");
     nid.dwInfoFlags = NIIF_NONE;
 
-    // Prefer a user-provided notification icon; else fall back to the tray icon.
-    HICON hLarge = NULL;
-    if (tray->notification_icon && tray->notification_icon[0]) {
-      hLarge = _fetch_icon(tray->notification_icon, NOTIFICATION);
-    }
-    if (!hLarge && nid.hIcon) {
-      hLarge = nid.hIcon;
-    }
+    // Prefer a user-provided notification icon; else fall back to the tray icon.
+    HICON hLarge = NULL;
+    if (tray->notification_icon && tray->notification_icon[0]) {
+      hLarge = _fetch_icon(tray->notification_icon, NOTIFICATION);
+    }
+    if (!hLarge && nid.hIcon) {
+      hLarge = nid.hIcon;
+    }
 #if defined(NIIF_LARGE_ICON)
     if (hLarge) {
       nid.hBalloonIcon = hLarge;
@@ -545,25 +708,80 @@ static void tray_apply_state(struct tray *tray, BOOL is_replay) {
     }
 #endif
     flags |= NIF_INFO;
-  } else {
-    // Clear any previous info text to avoid the shell re-showing old balloons
-    nid.szInfoTitle[0] = '\0';
-    nid.szInfo[0]      = '\0';
-    nid.dwInfoFlags    = NIIF_NONE;
-    nid.hBalloonIcon   = NULL;
-  }
-
-  // Keep the callback up-to-date regardless of Focus Assist state
-  notification_cb = tray->notification_cb;
-
-  // Apply the freshly computed flags for this modification (prevents stale NIF_* carry-over)
-  nid.uFlags = flags;
-  if (!Shell_NotifyIconA(NIM_MODIFY, &nid)) {
-    tray_log_last_error(TRAY_LOG_WARNING, "Shell_NotifyIconA(NIM_MODIFY)");
+  } else {
+    // Clear any previous info text to avoid the shell re-showing old balloons
+    nid.szInfoTitle[0] = '\0';
+    nid.szInfo[0]      = '\0';
+    nid.dwInfoFlags    = NIIF_NONE;
+    nid.hBalloonIcon   = NULL;
+  }
+
+  // Keep the callback up-to-date regardless of Focus Assist state
+  notification_cb = tray->notification_cb;
+  return flags;
+}
+
+// Applies the tray_update_part pieces of the given state to the shell icon.
+// is_replay marks re-registration paths (TaskbarCreated, retry timer,
+// NIM_MODIFY failure) that re-apply the remembered g_tray rather than a fresh
+// update from the app.
+static void tray_apply_state(struct tray *tray, unsigned int parts, BOOL is_replay) {
+  if (tray == NULL || hwnd == NULL) {
+    return;
+  }
+
+  g_tray = tray; // remember the last state for re-adding after Explorer restarts
+  if (!icon_added) {
+    // No icon registered yet; the retry path re-applies g_tray once NIM_ADD succeeds.
+    return;
+  }
+
+  HMENU prevmenu = NULL;
+  if (parts & TRAY_PART_MENU) {
+    if (menu_reuse && hmenu != NULL && _tray_menu_same_shape(hmenu, tray->menu)) {
+      _tray_menu_reuse(hmenu, tray->menu);
+    } else {
+      prevmenu = hmenu;
+      UINT id = ID_TRAY_FIRST;
+      hmenu = _tray_menu(tray->menu, &id);
+      tray_stats_object_created(TRAY_OBJECT_MENU);
+    }
+    SendMessage(hwnd, WM_INITMENUPOPUP, (WPARAM) hmenu, 0);
+    tray_stats_mark_first_menu();
+  }
+
+  // Rebuild flags each update to avoid stale bits carrying over; a partial
+  // update sends only its own flags, the shell keeps the rest as they were
+  DWORD flags = parts == TRAY_PARTS_ALL ? NIF_MESSAGE : 0;
+  if (parts & TRAY_PART_ICON) {
+    flags = tray_apply_icon(tray, flags);
+  }
+  if (parts & TRAY_PART_TOOLTIP) {
+    flags = tray_apply_tip(tray, flags);
+  }
+  if (parts & TRAY_PART_NOTIFICATION) {
+    flags = tray_apply_notification(tray, flags, is_replay);
+  }
+  if (flags == 0) {
+    // The menu lives in this process, the shell has nothing to modify
+    if (prevmenu != NULL) {
+      DestroyMenu(prevmenu);
+      tray_stats_object_destroyed(TRAY_OBJECT_MENU);
+    }
+    return;
+  }
+
+  // Apply the freshly computed flags for this modification (prevents stale NIF_* carry-over)
+  nid.uFlags = flags;
+  if (!Shell_NotifyIconA(NIM_MODIFY, &nid)) {
+    static struct tray_log_limit modify_limit;
+    tray_log_last_error(&modify_limit, TRAY_LOG_WARNING, "Shell_NotifyIconA(NIM_MODIFY)");
     // The shell no longer has our icon (e.g. Explorer restarted without us seeing
     // TaskbarCreated). Re-register it and re-apply this update.
     icon_added = FALSE;
-    if (tray_add_notify_icon(tray, TRAY_LOG_WARNING) == 0) {
+    tray_stats_mark_host_lost();
+    if (tray_add_notify_icon(tray) == 0) {
+      tray_stats_mark_host_recovered();
       icon_added = TRUE;
       nid.uFlags = flags;
       Shell_NotifyIconA(NIM_MODIFY, &nid);
@@ -571,30 +789,97 @@ static void tray_apply_state(struct tray *tray, BOOL is_replay) {
       ++icon_add_failures;
       tray_schedule_icon_retry();
     }
-  }
+  }
 
   if (prevmenu != NULL) {
     DestroyMenu(prevmenu);
+    tray_stats_object_destroyed(TRAY_OBJECT_MENU);
+  }
+}
+
+static void tray_windows_wakeup(void) {
+  HWND window = hwnd;
+  if (window != NULL) {
+    // GetMessageA() returns for any message, WM_NULL is simply dispatched and ignored
+    PostMessageA(window, WM_NULL, 0, 0);
+  }
+}
+
+static int tray_windows_inject(enum tray_test_event event, const struct tray_test_target *target) {
+  if (hwnd == NULL) {
+    return -1;
+  }
+  // Each event is sent as the message the shell would post
+  switch (event) {
+    case TRAY_TEST_ACTIVATE: {
+      HMENU menu = hmenu;
+      for (int i = 0; i + 1 < target->depth && menu != NULL; ++i) {
+        menu = GetSubMenu(menu, (int) target->path[i]);
+      }
+      UINT id = menu != NULL ? GetMenuItemID(menu, (int) target->path[target->depth - 1]) : (UINT) -1;
+      if (id == (UINT) -1) {
+        return -1;
+      }
+      SendMessage(hwnd, WM_COMMAND, id, 0);
+      return 0;
+    }
+    case TRAY_TEST_NOTIFICATION_CLICK:
+      if (notification_cb == NULL) {
+        return -1;
+      }
+      SendMessage(hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, NIN_BALLOONUSERCLICK);
+      return 0;
+    case TRAY_TEST_HOST_RESTART:
+      SendMessage(hwnd, wm_taskbarcreated, 0, 0);
+      return 0;
+    case TRAY_TEST_SECONDARY_ACTIVATE:
+      SendMessage(hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_MBUTTONUP);
+      return 0;
+    case TRAY_TEST_SCROLL:
+      // The notification area does not report the mouse wheel
+      return -1;
   }
-}
-
-void tray_exit(void) {
-  g_tray = NULL;
-  Shell_NotifyIconA(NIM_DELETE, &nid);
-  _destroy_icon_cache();
-  if (hwnd != NULL) {
+  return -1;
+}
+
+static void tray_windows_exit(void) {
+  g_tray = NULL;
+  Shell_NotifyIconA(NIM_DELETE, &nid);
+  _destroy_icon_cache();
+  if (hwnd != NULL) {
     KillTimer(hwnd, ID_TRAY_RETRY_TIMER);
-    DestroyWindow(hwnd);
-    hwnd = NULL;
-  }
+    if (session_watched) {
+      WTSUnRegisterSessionNotification(hwnd);
+      // Nothing reports the unlock from here on
+      tray_set_session_state(TRAY_SESSION_ACTIVE);
+      session_watched = FALSE;
+    }
+    DestroyWindow(hwnd);
+    hwnd = NULL;
+  }
   icon_added = FALSE;
   icon_add_failures = 0;
   notification_posted_ms = 0;
-  if (hmenu != 0) {
-    DestroyMenu(hmenu);
-    hmenu = NULL;
-  }
-  notification_cb = NULL;
-  memset(&nid, 0, sizeof(nid));
-  UnregisterClassA(WC_TRAY_CLASS_NAME, GetModuleHandle(NULL));
-}
+  if (hmenu != 0) {
+    DestroyMenu(hmenu);
+    tray_stats_object_destroyed(TRAY_OBJECT_MENU);
+    hmenu = NULL;
+  }
+  notification_cb = NULL;
+  menu_reuse = FALSE;
+  memset(&nid, 0, sizeof(nid));
+  UnregisterClassA(WC_TRAY_CLASS_NAME, GetModuleHandle(NULL));
+}
+
+const struct tray_backend tray_windows_backend = {
+  .name = "winapi",
+  .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU | TRAY_CAPABILITY_TOOLTIP | TRAY_CAPABILITY_NOTIFICATIONS | TRAY_CAPABILITY_SECONDARY_ACTIVATE,
+  .available = NULL,
+  .init = tray_windows_init,
+  .loop = tray_windows_loop,
+  .update = tray_windows_update,
+  .exit = tray_windows_exit,
+  .wakeup = tray_windows_wakeup,
+  .inject = tray_windows_inject,
+  .update_parts = tray_windows_update_parts,
+};
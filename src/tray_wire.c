@@ -0,0 +1,182 @@
+/**
+ * @file src/tray_wire.c
+ * @brief Compact binary encoding of tray state, used by the tray daemon protocol and recordings.
+ */
+// standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "tray_alloc.h"
+#include "tray_wire.h"
+
+int tray_wire_reserve(struct tray_wire_writer *w, size_t extra) {
+  if (w->failed) {
+    return -1;
+  }
+  if (w->size + extra <= w->capacity) {
+    return 0;
+  }
+  size_t capacity = w->capacity != 0 ? w->capacity : 256;
+  while (capacity < w->size + extra) {
+    capacity *= 2;
+  }
+  unsigned char *data = tray_realloc(TRAY_MEMORY_BUFFERS, w->data, capacity);
+  if (data == NULL) {
+    w->failed = 1;
+    return -1;
+  }
+  w->data = data;
+  w->capacity = capacity;
+  return 0;
+}
+
+void tray_wire_writer_free(struct tray_wire_writer *w) {
+  tray_free(w->data);
+  memset(w, 0, sizeof(*w));
+}
+
+static void tray_wire_store_u32(unsigned char *p, unsigned int value) {
+  p[0] = (unsigned char) (value & 0xFF);
+  p[1] = (unsigned char) ((value >> 8) & 0xFF);
+  p[2] = (unsigned char) ((value >> 16) & 0xFF);
+  p[3] = (unsigned char) ((value >> 24) & 0xFF);
+}
+
+void tray_wire_put_u8(struct tray_wire_writer *w, unsigned int value) {
+  if (tray_wire_reserve(w, 1) == 0) {
+    w->data[w->size++] = (unsigned char) value;
+  }
+}
+
+void tray_wire_put_u32(struct tray_wire_writer *w, unsigned int value) {
+  if (tray_wire_reserve(w, 4) == 0) {
+    tray_wire_store_u32(w->data + w->size, value);
+    w->size += 4;
+  }
+}
+
+void tray_wire_put_u64(struct tray_wire_writer *w, unsigned long long value) {
+  tray_wire_put_u32(w, (unsigned int) (value & 0xFFFFFFFFu));
+  tray_wire_put_u32(w, (unsigned int) (value >> 32));
+}
+
+void tray_wire_put_string(struct tray_wire_writer *w, const char *value) {
+  if (value == NULL) {
+    tray_wire_put_u32(w, TRAY_WIRE_NULL_STRING);
+    return;
+  }
+  size_t len = strlen(value);
+  tray_wire_put_u32(w, (unsigned int) len);
+  if (tray_wire_reserve(w, len + 1) == 0) {
+    memcpy(w->data + w->size, value, len + 1);
+    w->size += len + 1;
+  }
+}
+
+size_t tray_wire_begin_frame(struct tray_wire_writer *w, enum tray_wire_message type) {
+  size_t frame = w->size;
+  tray_wire_put_u32(w, 0);
+  tray_wire_put_u8(w, type);
+  return frame;
+}
+
+void tray_wire_end_frame(struct tray_wire_writer *w, size_t frame) {
+  if (!w->failed) {
+    tray_wire_store_u32(w->data + frame, (unsigned int) (w->size - frame - TRAY_WIRE_FRAME_HEADER_SIZE));
+  }
+}
+
+unsigned int tray_wire_item_flags(const struct tray_menu *item) {
+  unsigned int flags = 0;
+  if (item->disabled) {
+    flags |= TRAY_WIRE_ITEM_DISABLED;
+  }
+  if (item->checked) {
+    flags |= TRAY_WIRE_ITEM_CHECKED;
+  }
+  if (item->checkbox) {
+    flags |= TRAY_WIRE_ITEM_CHECKBOX;
+  }
+  if (item->submenu != NULL) {
+    flags |= TRAY_WIRE_ITEM_SUBMENU;
+  }
+  return flags;
+}
+
+static unsigned int tray_wire_load_u32(const unsigned char *p) {
+  return (unsigned int) p[0] | ((unsigned int) p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+unsigned int tray_wire_get_u8(struct tray_wire_reader *r) {
+  if (r->failed || r->pos + 1 > r->size) {
+    r->failed = 1;
+    return 0;
+  }
+  return r->data[r->pos++];
+}
+
+unsigned int tray_wire_get_u32(struct tray_wire_reader *r) {
+  if (r->failed || r->pos + 4 > r->size) {
+    r->failed = 1;
+    return 0;
+  }
+  unsigned int value = tray_wire_load_u32(r->data + r->pos);
+  r->pos += 4;
+  return value;
+}
+
+unsigned long long tray_wire_get_u64(struct tray_wire_reader *r) {
+  unsigned long long low = tray_wire_get_u32(r);
+  unsigned long long high = tray_wire_get_u32(r);
+  return low | (high << 32);
+}
+
+const char *tray_wire_get_string(struct tray_wire_reader *r) {
+  unsigned int len = tray_wire_get_u32(r);
+  if (r->failed || len == TRAY_WIRE_NULL_STRING) {
+    return NULL;
+  }
+  if ((size_t) len + 1 > r->size - r->pos || r->data[r->pos + len] != '\0') {
+    r->failed = 1;
+    return NULL;
+  }
+  const char *value = (const char *) r->data + r->pos;
+  r->pos += (size_t) len + 1;
+  return value;
+}
+
+long tray_wire_next_frame(const unsigned char *data, size_t size, unsigned int *type, struct tray_wire_reader *payload) {
+  if (size < TRAY_WIRE_FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  unsigned int len = tray_wire_load_u32(data);
+  if (len > TRAY_WIRE_MAX_FRAME_SIZE) {
+    return -1;
+  }
+  if (size < TRAY_WIRE_FRAME_HEADER_SIZE + (size_t) len) {
+    return 0;
+  }
+  *type = data[4];
+  payload->data = data + TRAY_WIRE_FRAME_HEADER_SIZE;
+  payload->size = len;
+  payload->pos = 0;
+  payload->failed = 0;
+  return (long) (TRAY_WIRE_FRAME_HEADER_SIZE + len);
+}
+
+int tray_wire_socket_path(char *path, size_t size) {
+  const char *explicit_path = getenv("TRAY_DAEMON_SOCKET");
+  int written;
+  if (explicit_path != NULL && explicit_path[0] != '\0') {
+    written = snprintf(path, size, "%s", explicit_path);
+  } else {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || runtime_dir[0] == '\0') {
+      return -1;
+    }
+    written = snprintf(path, size, "%s/" TRAY_WIRE_SOCKET_NAME, runtime_dir);
+  }
+  return written > 0 && (size_t) written < size ? 0 : -1;
+}
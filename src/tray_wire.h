@@ -0,0 +1,131 @@
+/**
+ * @file src/tray_wire.h
+ * @brief Compact binary encoding of tray state, used by the tray daemon protocol and recordings.
+ *
+ * Values are little-endian. Strings are a u32 byte length (0xFFFFFFFF for NULL)
+ * followed by the bytes and a terminating NUL, so a reader can hand out
+ * pointers into the buffer without copying.
+ *
+ * A daemon connection carries frames of the form [u32 payload length][u8 type][payload].
+ */
+#ifndef TRAY_WIRE_H
+#define TRAY_WIRE_H
+
+// standard includes
+#include <stddef.h>
+
+// local includes
+#include "tray.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAY_WIRE_VERSION 1  ///< Protocol version sent in TRAY_MSG_HELLO.
+#define TRAY_WIRE_FRAME_HEADER_SIZE 5  ///< Size of the frame length and type.
+#define TRAY_WIRE_MAX_FRAME_SIZE (1024 * 1024)  ///< Frames larger than this are treated as a protocol error.
+#define TRAY_WIRE_NULL_STRING 0xFFFFFFFFu  ///< String length marking a NULL string.
+#define TRAY_WIRE_SOCKET_NAME "tray-daemon.sock"  ///< Socket file name inside XDG_RUNTIME_DIR.
+
+  /**
+   * @brief Message types of the daemon protocol.
+   */
+  enum tray_wire_message {
+    TRAY_MSG_HELLO = 1,  ///< Client to daemon: u32 version, u32 pid.
+    TRAY_MSG_SET_ICON = 2,  ///< Client to daemon: string icon name or path.
+    TRAY_MSG_SET_TOOLTIP = 3,  ///< Client to daemon: string tooltip.
+    TRAY_MSG_MENU_REPLACE = 4,  ///< Client to daemon: u32 item count, then per item in pre-order u32 child count and an item record.
+    TRAY_MSG_MENU_ITEM_UPDATE = 5,  ///< Client to daemon: u32 pre-order index and an item record.
+    TRAY_MSG_NOTIFY = 6,  ///< Client to daemon: string title, string text, string icon, u8 clickable.
+    TRAY_MSG_EXIT = 7,  ///< Client to daemon: the client is going away.
+    TRAY_MSG_MENU_ACTIVATE = 64,  ///< Daemon to client: u32 pre-order index of the activated item.
+    TRAY_MSG_NOTIFICATION_CLICKED = 65,  ///< Daemon to client: the last notification was clicked.
+    TRAY_MSG_SCROLL = 66,  ///< Daemon to client: u32 steps right, u32 steps up, both two's complement.
+    TRAY_MSG_SECONDARY_ACTIVATE = 67  ///< Daemon to client: the icon was middle-clicked.
+  };
+
+  /**
+   * @brief Flags of a menu item record. A record is u8 flags followed by string text.
+   */
+  enum tray_wire_item_flags {
+    TRAY_WIRE_ITEM_DISABLED = 1 << 0,  ///< Item is disabled.
+    TRAY_WIRE_ITEM_CHECKED = 1 << 1,  ///< Item is checked.
+    TRAY_WIRE_ITEM_CHECKBOX = 1 << 2,  ///< Item is a checkbox.
+    TRAY_WIRE_ITEM_SUBMENU = 1 << 3  ///< Item has a submenu.
+  };
+
+  /**
+   * @brief Growable output buffer.
+   */
+  struct tray_wire_writer {
+    unsigned char *data;  ///< Encoded bytes.
+    size_t size;  ///< Number of encoded bytes.
+    size_t capacity;  ///< Allocated bytes.
+    int failed;  ///< Non-zero once an allocation failed.
+  };
+
+  /**
+   * @brief Cursor over encoded bytes.
+   */
+  struct tray_wire_reader {
+    const unsigned char *data;  ///< Encoded bytes.
+    size_t size;  ///< Number of encoded bytes.
+    size_t pos;  ///< Read position.
+    int failed;  ///< Non-zero once a read ran past the end.
+  };
+
+  /**
+   * @brief Make room for extra more bytes, so that writing them does not allocate.
+   * @return 0 on success, -1 if out of memory.
+   */
+  int tray_wire_reserve(struct tray_wire_writer *w, size_t extra);
+
+  void tray_wire_writer_free(struct tray_wire_writer *w);
+  void tray_wire_put_u8(struct tray_wire_writer *w, unsigned int value);
+  void tray_wire_put_u32(struct tray_wire_writer *w, unsigned int value);
+  void tray_wire_put_u64(struct tray_wire_writer *w, unsigned long long value);
+  void tray_wire_put_string(struct tray_wire_writer *w, const char *value);
+
+  /**
+   * @brief Start a frame; the length is filled in by tray_wire_end_frame().
+   * @return Offset of the frame, to pass to tray_wire_end_frame().
+   */
+  size_t tray_wire_begin_frame(struct tray_wire_writer *w, enum tray_wire_message type);
+  void tray_wire_end_frame(struct tray_wire_writer *w, size_t frame);
+
+  /**
+   * @brief Get the item flags for a menu item.
+   */
+  unsigned int tray_wire_item_flags(const struct tray_menu *item);
+
+  unsigned int tray_wire_get_u8(struct tray_wire_reader *r);
+  unsigned int tray_wire_get_u32(struct tray_wire_reader *r);
+  unsigned long long tray_wire_get_u64(struct tray_wire_reader *r);
+
+  /**
+   * @brief Read a string.
+   * @return Pointer into the reader's buffer, or NULL for a NULL string or on error.
+   */
+  const char *tray_wire_get_string(struct tray_wire_reader *r);
+
+  /**
+   * @brief Split the next complete frame off a receive buffer.
+   * @param data Received bytes.
+   * @param size Number of received bytes.
+   * @param type Receives the message type.
+   * @param payload Receives a reader over the payload.
+   * @return Bytes consumed, 0 if the frame is incomplete, or -1 if it is malformed.
+   */
+  long tray_wire_next_frame(const unsigned char *data, size_t size, unsigned int *type, struct tray_wire_reader *payload);
+
+  /**
+   * @brief Resolve the daemon socket path from TRAY_DAEMON_SOCKET or XDG_RUNTIME_DIR.
+   * @return 0 on success, -1 if neither is set or the path does not fit.
+   */
+  int tray_wire_socket_path(char *path, size_t size);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif /* TRAY_WIRE_H */
@@ -0,0 +1,109 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <cstdlib>
+#include <fstream>
+
+// local includes
+#include "src/tray.h"
+
+namespace {
+  /**
+   * @brief Allocator context that counts the calls it receives.
+   */
+  struct counting_allocator {
+    int mallocs = 0;
+    int reallocs = 0;
+    int frees = 0;
+  };
+
+  void *counting_malloc(size_t size, void *ctx) {
+    ++static_cast<counting_allocator *>(ctx)->mallocs;
+    return std::malloc(size);
+  }
+
+  void *counting_realloc(void *ptr, size_t size, void *ctx) {
+    ++static_cast<counting_allocator *>(ctx)->reallocs;
+    return std::realloc(ptr, size);
+  }
+
+  void counting_free(void *ptr, void *ctx) {
+    ++static_cast<counting_allocator *>(ctx)->frees;
+    std::free(ptr);
+  }
+}  // namespace
+
+class TrayAllocTest: public BaseTest {
+protected:
+  std::filesystem::path menuPath;
+  counting_allocator first;
+  counting_allocator second;
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    menuPath = testBinaryDir / "test_alloc.json";
+    std::ofstream(menuPath, std::ios::binary | std::ios::trunc) << R"({"menu": [
+      {"text": "Open"},
+      {"text": "Options", "submenu": [{"text": "Dark", "checkbox": true}]},
+      {"text": "Quit"}
+    ]})";
+  }
+
+  void TearDown() override {
+    tray_set_allocator(nullptr, nullptr, nullptr, nullptr);
+    std::filesystem::remove(menuPath);
+    BaseTest::TearDown();
+  }
+
+  static size_t menuBytes() {
+    struct tray_stats stats;
+    tray_get_stats(&stats);
+    return stats.allocated_bytes[TRAY_MEMORY_MENUS];
+  }
+};
+
+TEST_F(TrayAllocTest, LibraryMemoryGoesThroughTheAllocator) {
+  ASSERT_EQ(tray_set_allocator(counting_malloc, counting_realloc, counting_free, &first), 0);
+  size_t baseline = menuBytes();
+
+  struct tray_menu *menu = tray_menu_load(menuPath.string().c_str());
+  ASSERT_NE(menu, nullptr);
+  EXPECT_GT(first.mallocs, 0);
+  EXPECT_GT(menuBytes(), baseline);
+
+  tray_menu_free(menu);
+  EXPECT_EQ(first.frees, first.mallocs);
+  EXPECT_EQ(menuBytes(), baseline);
+}
+
+TEST_F(TrayAllocTest, BlocksAreFreedByTheirOwnAllocator) {
+  ASSERT_EQ(tray_set_allocator(counting_malloc, counting_realloc, counting_free, &first), 0);
+  struct tray_menu *menu = tray_menu_load(menuPath.string().c_str());
+  ASSERT_NE(menu, nullptr);
+  int allocated = first.mallocs;
+
+  // Switching allocators while memory is live must not hand it to the new one
+  ASSERT_EQ(tray_set_allocator(counting_malloc, counting_realloc, counting_free, &second), 0);
+  tray_menu_free(menu);
+  EXPECT_EQ(first.frees, allocated);
+  EXPECT_EQ(second.frees, 0);
+
+  ASSERT_EQ(tray_set_allocator(nullptr, nullptr, nullptr, nullptr), 0);
+  menu = tray_menu_load(menuPath.string().c_str());
+  ASSERT_NE(menu, nullptr);
+  tray_menu_free(menu);
+  EXPECT_EQ(first.mallocs, allocated);
+  EXPECT_EQ(second.mallocs, 0);
+}
+
+TEST_F(TrayAllocTest, RejectsIncompleteAllocators) {
+  EXPECT_EQ(tray_set_allocator(counting_malloc, nullptr, counting_free, &first), -1);
+  EXPECT_EQ(tray_set_allocator(nullptr, counting_realloc, counting_free, &first), -1);
+  EXPECT_EQ(tray_set_allocator(counting_malloc, counting_realloc, nullptr, &first), -1);
+
+  struct tray_menu *menu = tray_menu_load(menuPath.string().c_str());
+  ASSERT_NE(menu, nullptr);
+  tray_menu_free(menu);
+  EXPECT_EQ(first.mallocs, 0);
+}
@@ -0,0 +1,604 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  int mock_init_calls = 0;
+  int mock_update_calls = 0;
+  int mock_exit_calls = 0;
+  bool mock_running = false;  // between init() and exit(), like a real backend
+
+  int mock_init(struct tray *) {
+    ++mock_init_calls;
+    mock_running = true;
+    return 0;
+  }
+
+  int mock_loop(int) {
+    return mock_running ? 0 : -1;
+  }
+
+  void mock_update(struct tray *) {
+    ++mock_update_calls;
+  }
+
+  void mock_exit() {
+    ++mock_exit_calls;
+    mock_running = false;
+  }
+
+  const struct tray_backend mock_backend = {
+    .name = "mock",
+    .capabilities = TRAY_CAPABILITY_MENU,
+    .available = nullptr,
+    .init = mock_init,
+    .loop = mock_loop,
+    .update = mock_update,
+    .exit = mock_exit,
+  };
+
+  std::atomic<void (*)(void)> queued_flush {nullptr};
+  std::atomic<int> queued_twice {0};
+  std::atomic<int> flushed_updates {0};
+  std::atomic<bool> applying {false};  // queue_update() has started
+  std::atomic<bool> wedged {false};  // queue_update() hangs while set, like a stuck tray host
+
+  int queue_loop(int) {
+    void (*func)(void) = queued_flush.exchange(nullptr);
+    if (func != nullptr) {
+      func();
+    }
+    return 0;
+  }
+
+  void queue_update(struct tray *) {
+    applying = true;
+    while (wedged) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ++flushed_updates;
+  }
+
+  void queue_invoke(void (*func)(void)) {
+    if (queued_flush.exchange(func) != nullptr) {
+      ++queued_twice;
+    }
+  }
+
+  const struct tray_backend queue_backend = {
+    .name = "queue",
+    .capabilities = TRAY_CAPABILITY_MENU | TRAY_CAPABILITY_CROSS_THREAD_UPDATE,
+    .available = nullptr,
+    .init = mock_init,
+    .loop = queue_loop,
+    .update = queue_update,
+    .exit = mock_exit,
+    .wakeup = nullptr,
+    .invoke = queue_invoke,
+  };
+
+  int injected_events = 0;
+  enum tray_test_event injected_event;
+  struct tray_test_target injected_target;
+
+  int inject_inject(enum tray_test_event event, const struct tray_test_target *target) {
+    ++injected_events;
+    injected_event = event;
+    injected_target = target != nullptr ? *target : tray_test_target {};
+    return 0;
+  }
+
+  const struct tray_backend inject_backend = {
+    .name = "inject",
+    .capabilities = TRAY_CAPABILITY_MENU,
+    .available = nullptr,
+    .init = mock_init,
+    .loop = mock_loop,
+    .update = mock_update,
+    .exit = mock_exit,
+    .wakeup = nullptr,
+    .invoke = nullptr,
+    .inject = inject_inject,
+  };
+
+  int parts_full_updates = 0;
+  std::vector<unsigned int> parts_applied;  // parts passed to parts_update_parts()
+  std::vector<std::string> parts_icons;  // icon shown by each update of TRAY_PART_ICON
+
+  void parts_update(struct tray *) {
+    ++parts_full_updates;
+  }
+
+  void parts_update_parts(struct tray *tray, unsigned int parts) {
+    parts_applied.push_back(parts);
+    if (parts & TRAY_PART_ICON) {
+      parts_icons.emplace_back(tray_icon_for_scheme(tray->icon));
+    }
+  }
+
+  const struct tray_backend parts_backend = {
+    .name = "parts",
+    .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU,
+    .available = nullptr,
+    .init = mock_init,
+    .loop = mock_loop,
+    .update = parts_update,
+    .exit = mock_exit,
+    .wakeup = nullptr,
+    .invoke = nullptr,
+    .inject = nullptr,
+    .update_parts = parts_update_parts,
+  };
+
+  int clicked_items = 0;
+  struct tray_menu *clicked_item = nullptr;
+  int notification_clicks = 0;
+
+  void click_cb(struct tray_menu *item) {
+    ++clicked_items;
+    clicked_item = item;
+  }
+
+  void notification_click_cb() {
+    ++notification_clicks;
+  }
+
+  int scroll_calls = 0;
+  int scrolled_x = 0;
+  int scrolled_y = 0;
+  int secondary_clicks = 0;
+
+  void scroll_cb(int dx, int dy) {
+    ++scroll_calls;
+    scrolled_x += dx;
+    scrolled_y += dy;
+  }
+
+  void secondary_activate_cb() {
+    ++secondary_clicks;
+  }
+
+  void exit_signal_handler(int) {
+    tray_exit_from_signal();
+  }
+
+  struct tray_menu inject_submenu[3] = {
+    {.text = "Dark", .checkbox = 1, .cb = click_cb},
+    {.text = "Locked", .disabled = 1, .cb = click_cb},
+    {.text = nullptr}
+  };
+  struct tray_menu inject_menu[4] = {
+    {.text = "Open", .cb = click_cb},
+    {.text = "-"},
+    {.text = "Options", .submenu = inject_submenu},
+    {.text = nullptr}
+  };
+}  // namespace
+
+class TrayBackendTest: public BaseTest {
+protected:
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayBackendTest",
+  };
+
+  void TearDown() override {
+    // Leave automatic selection in place for the other test suites
+    tray_set_backend(nullptr);
+    setEnv("TRAY_BACKEND", "");
+    tray_set_scroll_callback(nullptr);
+    tray_set_secondary_activate_callback(nullptr);
+    tray_set_click_debounce(0);
+    tray_set_color_scheme(TRAY_COLOR_SCHEME_DEFAULT);
+    tray_set_session_suspend(0);
+    tray_set_session_state(TRAY_SESSION_ACTIVE);
+    BaseTest::TearDown();
+  }
+};
+
+TEST_F(TrayBackendTest, UnknownBackendIsRejected) {
+  EXPECT_EQ(tray_set_backend("does-not-exist"), -1);
+}
+
+TEST_F(TrayBackendTest, HeadlessBackendRunsThroughPublicApi) {
+  ASSERT_EQ(tray_set_backend("headless"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_STREQ(tray_get_backend(), "headless");
+  EXPECT_FALSE(tray_get_capabilities() & TRAY_CAPABILITY_ICON);
+  EXPECT_TRUE(tray_get_capabilities() & TRAY_CAPABILITY_CROSS_THREAD_UPDATE);
+  EXPECT_EQ(tray_loop(0), 0);
+
+  // A blocking loop iteration returns once another thread updates the tray
+  std::thread updater([this]() {
+    tray_update(&testTray);
+  });
+  EXPECT_EQ(tray_loop(1), 0);
+  updater.join();
+
+  tray_exit();
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayBackendTest, EnvironmentVariableSelectsBackend) {
+  setEnv("TRAY_BACKEND", "headless");
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_STREQ(tray_get_backend(), "headless");
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, RegisteredBackendReceivesCalls) {
+  ASSERT_EQ(tray_register_backend(&mock_backend), 0);
+  ASSERT_EQ(tray_set_backend("mock"), 0);
+
+  ASSERT_EQ(tray_init(&testTray), 0);
+  tray_update(&testTray);
+  EXPECT_EQ(tray_loop(0), 0);
+  tray_exit();
+  EXPECT_EQ(tray_loop(0), -1);
+
+  EXPECT_EQ(mock_init_calls, 1);
+  EXPECT_EQ(mock_update_calls, 1);
+  EXPECT_EQ(mock_exit_calls, 1);
+}
+
+TEST_F(TrayBackendTest, PartialUpdatesReachOnlyTheirPiece) {
+  ASSERT_EQ(tray_register_backend(&parts_backend), 0);
+  ASSERT_EQ(tray_set_backend("parts"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  tray_update_icon(&testTray);
+  tray_update_tooltip(&testTray);
+  tray_update_menu(&testTray);
+  tray_notify(&testTray);
+  const std::vector<unsigned int> expected = {TRAY_PART_ICON, TRAY_PART_TOOLTIP, TRAY_PART_MENU, TRAY_PART_NOTIFICATION};
+  EXPECT_EQ(parts_applied, expected);
+  EXPECT_EQ(parts_full_updates, 0);
+
+  // A full update still goes through update()
+  tray_update(&testTray);
+  EXPECT_EQ(parts_full_updates, 1);
+  EXPECT_EQ(parts_applied.size(), 4u);
+  tray_exit();
+
+  // Backends without update_parts apply everything instead
+  ASSERT_EQ(tray_register_backend(&mock_backend), 0);
+  ASSERT_EQ(tray_set_backend("mock"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  int updates = mock_update_calls;
+  tray_update_icon(&testTray);
+  EXPECT_EQ(mock_update_calls, updates + 1);
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, IconVariantsFollowTheColorScheme) {
+  ASSERT_EQ(tray_register_backend(&parts_backend), 0);
+  ASSERT_EQ(tray_set_backend("parts"), 0);
+  struct tray_icon_variants variants = {};
+  variants.light = "icon-light.png";
+  variants.dark = "icon-dark.png";
+  variants.symbolic = "icon-symbolic.svg";
+  ASSERT_EQ(tray_set_icon_variants("icon", &variants), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_STREQ(tray_icon_for_scheme(testTray.icon), "icon-light.png");
+  const char *paths[3];
+  EXPECT_EQ(tray_icon_variants(testTray.icon, paths), 3u);
+
+  // A change of the scheme swaps the icon with an icon-only update
+  parts_applied.clear();
+  parts_icons.clear();
+  int full_updates = parts_full_updates;
+  tray_set_color_scheme(TRAY_COLOR_SCHEME_DARK);
+  EXPECT_EQ(tray_get_color_scheme(), TRAY_COLOR_SCHEME_DARK);
+  const std::vector<unsigned int> icon_only = {TRAY_PART_ICON};
+  EXPECT_EQ(parts_applied, icon_only);
+  EXPECT_EQ(parts_icons, std::vector<std::string>({"icon-dark.png"}));
+  EXPECT_EQ(parts_full_updates, full_updates);
+  tray_set_color_scheme(TRAY_COLOR_SCHEME_DARK);
+  EXPECT_EQ(parts_applied.size(), 1u);
+
+  // The symbolic variant stands in for a missing one; the strings were copied
+  variants.dark = nullptr;
+  ASSERT_EQ(tray_set_icon_variants("icon", &variants), 0);
+  ASSERT_EQ(parts_icons.size(), 2u);
+  EXPECT_EQ(parts_icons[1], "icon-symbolic.svg");
+  ASSERT_EQ(tray_set_icon_variants("icon", nullptr), 0);
+  EXPECT_EQ(parts_icons.back(), "icon");
+  EXPECT_EQ(tray_icon_variants(testTray.icon, paths), 0u);
+
+  // Icons without variants are left alone
+  struct tray plainTray = {.icon = "plain"};
+  tray_update(&plainTray);
+  size_t applied = parts_applied.size();
+  tray_set_color_scheme(TRAY_COLOR_SCHEME_LIGHT);
+  EXPECT_EQ(parts_applied.size(), applied);
+  EXPECT_STREQ(tray_icon_for_scheme("plain"), "plain");
+  tray_exit();
+
+  // Nor is a backend that exited
+  ASSERT_EQ(tray_set_icon_variants("plain", &variants), 0);
+  tray_set_color_scheme(TRAY_COLOR_SCHEME_DARK);
+  EXPECT_EQ(parts_applied.size(), applied);
+  ASSERT_EQ(tray_set_icon_variants("plain", nullptr), 0);
+}
+
+TEST_F(TrayBackendTest, LockedSessionHoldsUpdatesUntilUnlock) {
+  ASSERT_EQ(tray_register_backend(&parts_backend), 0);
+  ASSERT_EQ(tray_set_backend("parts"), 0);
+  tray_set_session_suspend(1);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  struct tray_stats before;
+  tray_get_stats(&before);
+
+  // Nothing reaches the backend while the session is locked
+  parts_applied.clear();
+  int full_updates = parts_full_updates;
+  tray_set_session_state(TRAY_SESSION_LOCKED);
+  EXPECT_EQ(tray_get_session_state(), TRAY_SESSION_LOCKED);
+  tray_update_icon(&testTray);
+  tray_update_menu(&testTray);
+  tray_update_icon(&testTray);
+  tray_notify(&testTray);
+  EXPECT_TRUE(parts_applied.empty());
+
+  // Except critical notifications, alone
+  struct tray alertTray = testTray;
+  alertTray.notification_text = "Disk full";
+  tray_notify_critical(&alertTray);
+  const std::vector<unsigned int> notification_only = {TRAY_PART_NOTIFICATION};
+  EXPECT_EQ(parts_applied, notification_only);
+
+  // The held strings are copied, the caller may reuse its own once the call returned
+  char icon[] = "held";
+  struct tray heldTray = testTray;
+  heldTray.icon = icon;
+  tray_update_icon(&heldTray);
+  std::strcpy(icon, "gone");
+  struct tray_stats stats;
+  tray_get_stats(&stats);
+  EXPECT_EQ(stats.deferred_updates - before.deferred_updates, 5u);
+
+  // Idle is away too; unlocking applies what was held back once
+  tray_set_session_state(TRAY_SESSION_IDLE);
+  EXPECT_EQ(parts_applied.size(), 1u);
+  parts_applied.clear();
+  parts_icons.clear();
+  tray_set_session_state(TRAY_SESSION_ACTIVE);
+  const std::vector<unsigned int> held = {TRAY_PART_ICON | TRAY_PART_MENU | TRAY_PART_NOTIFICATION};
+  EXPECT_EQ(parts_applied, held);
+  EXPECT_EQ(parts_icons, std::vector<std::string>({"held"}));
+  EXPECT_EQ(parts_full_updates, full_updates);
+  tray_set_session_state(TRAY_SESSION_LOCKED);
+  tray_set_session_state(TRAY_SESSION_ACTIVE);
+  EXPECT_EQ(parts_applied.size(), 1u);
+
+  // Turning suspension off applies a held full update right away
+  tray_set_session_state(TRAY_SESSION_LOCKED);
+  tray_update(&testTray);
+  EXPECT_EQ(parts_full_updates, full_updates);
+  tray_set_session_suspend(0);
+  EXPECT_EQ(parts_full_updates, full_updates + 1);
+
+  // Without suspension the session state changes nothing
+  tray_update_tooltip(&testTray);
+  EXPECT_EQ(parts_applied.size(), 2u);
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, ConcurrentUpdatesShareOneQueuedFlush) {
+  queued_flush = nullptr;
+  queued_twice = 0;
+  flushed_updates = 0;
+  ASSERT_EQ(tray_register_backend(&queue_backend), 0);
+  ASSERT_EQ(tray_set_backend("queue"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  constexpr int producers = 8;
+  constexpr int updates = 200;
+  std::atomic<int> finished {0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < producers; ++i) {
+    threads.emplace_back([this, &finished]() {
+      for (int j = 0; j < updates; ++j) {
+        tray_update(&testTray);
+      }
+      ++finished;
+    });
+  }
+  while (finished < producers) {
+    tray_loop(0);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Every call returned, no flush was queued while another was pending,
+  // and no call needed more than one applied update
+  EXPECT_EQ(queued_twice, 0);
+  EXPECT_GE(flushed_updates, 1);
+  EXPECT_LE(flushed_updates, producers * updates);
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, InjectedClicksResolveMenuPaths) {
+  injected_events = 0;
+  ASSERT_EQ(tray_register_backend(&inject_backend), 0);
+  ASSERT_EQ(tray_set_backend("inject"), 0);
+  testTray.menu = inject_menu;
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  ASSERT_EQ(tray_test_activate("Options/Dark"), 0);
+  EXPECT_EQ(injected_event, TRAY_TEST_ACTIVATE);
+  EXPECT_EQ(injected_target.item, &inject_submenu[0]);
+  ASSERT_EQ(injected_target.depth, 2);
+  EXPECT_EQ(injected_target.path[0], 2u);
+  EXPECT_EQ(injected_target.path[1], 0u);
+
+  // Nothing a tray host would let the user click reaches the backend
+  EXPECT_EQ(tray_test_activate("Options"), -1);
+  EXPECT_EQ(tray_test_activate("Options/Locked"), -1);
+  EXPECT_EQ(tray_test_activate("-"), -1);
+  EXPECT_EQ(tray_test_activate("Options/Dark/Deeper"), -1);
+  EXPECT_EQ(tray_test_activate("Missing"), -1);
+  EXPECT_EQ(tray_test_activate("Open/"), -1);
+  EXPECT_EQ(injected_events, 1);
+
+  EXPECT_EQ(tray_test_notification_click(), 0);
+  EXPECT_EQ(injected_event, TRAY_TEST_NOTIFICATION_CLICK);
+  EXPECT_EQ(tray_test_host_restart(), 0);
+  EXPECT_EQ(injected_event, TRAY_TEST_HOST_RESTART);
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, HeadlessBackendDispatchesInjectedEvents) {
+  clicked_items = 0;
+  clicked_item = nullptr;
+  notification_clicks = 0;
+  ASSERT_EQ(tray_set_backend("headless"), 0);
+  testTray.menu = inject_menu;
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  EXPECT_EQ(tray_test_activate("Open"), 0);
+  EXPECT_EQ(tray_test_activate("Options/Dark"), 0);
+  EXPECT_EQ(clicked_items, 2);
+  EXPECT_EQ(clicked_item, &inject_submenu[0]);
+
+  // Clicks resolve against the tray last applied
+  EXPECT_EQ(tray_test_notification_click(), -1);
+  testTray.notification_cb = notification_click_cb;
+  tray_update(&testTray);
+  EXPECT_EQ(tray_test_notification_click(), 0);
+  EXPECT_EQ(notification_clicks, 1);
+
+  EXPECT_EQ(tray_test_host_restart(), 0);
+  tray_exit();
+  EXPECT_EQ(tray_test_activate("Open"), -1);
+  EXPECT_EQ(clicked_items, 2);
+}
+
+TEST_F(TrayBackendTest, InputBurstsReachTheAppOnce) {
+  clicked_items = 0;
+  scroll_calls = 0;
+  scrolled_x = 0;
+  scrolled_y = 0;
+  secondary_clicks = 0;
+  ASSERT_EQ(tray_set_backend("headless"), 0);
+  testTray.menu = inject_menu;
+  tray_set_scroll_callback(scroll_cb);
+  tray_set_secondary_activate_callback(secondary_activate_cb);
+  tray_set_click_debounce(60000);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_TRUE(tray_get_capabilities() & TRAY_CAPABILITY_SCROLL);
+
+  // Scrolling is summed up until the loop iteration ends
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_EQ(tray_test_scroll(0, 1), 0);
+  }
+  ASSERT_EQ(tray_test_scroll(-2, -1), 0);
+  EXPECT_EQ(scroll_calls, 0);
+  EXPECT_EQ(tray_loop(0), 0);
+  EXPECT_EQ(scroll_calls, 1);
+  EXPECT_EQ(scrolled_x, -2);
+  EXPECT_EQ(scrolled_y, 4);
+  EXPECT_EQ(tray_loop(0), 0);
+  EXPECT_EQ(scroll_calls, 1);
+
+  // Repeated clicks of an item are one burst, a click elsewhere ends it
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(tray_test_activate("Open"), 0);
+  }
+  EXPECT_EQ(clicked_items, 1);
+  EXPECT_EQ(tray_test_activate("Options/Dark"), 0);
+  EXPECT_EQ(tray_test_activate("Open"), 0);
+  EXPECT_EQ(clicked_items, 3);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(tray_test_secondary_activate(), 0);
+  }
+  EXPECT_EQ(secondary_clicks, 1);
+
+  tray_set_click_debounce(0);
+  EXPECT_EQ(tray_test_activate("Open"), 0);
+  EXPECT_EQ(tray_test_activate("Open"), 0);
+  EXPECT_EQ(clicked_items, 5);
+  tray_exit();
+}
+
+TEST_F(TrayBackendTest, ExitTimeoutCancelsUpdatesNotStarted) {
+  queued_flush = nullptr;
+  flushed_updates = 0;
+  mock_exit_calls = 0;
+  ASSERT_EQ(tray_register_backend(&queue_backend), 0);
+  ASSERT_EQ(tray_set_backend("queue"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  // The loop never gets to the queued flush, yet the caller is released
+  std::thread updater([this]() {
+    tray_update(&testTray);
+  });
+  while (queued_flush == nullptr) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(tray_exit_timeout(1000), 0);
+  updater.join();
+  EXPECT_EQ(mock_exit_calls, 1);
+
+  tray_loop(0);
+  EXPECT_EQ(flushed_updates, 0);
+}
+
+TEST_F(TrayBackendTest, ExitTimeoutGivesUpOnAWedgedUpdate) {
+  queued_flush = nullptr;
+  applying = false;
+  wedged = true;
+  mock_exit_calls = 0;
+  ASSERT_EQ(tray_register_backend(&queue_backend), 0);
+  ASSERT_EQ(tray_set_backend("queue"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  std::thread updater([this]() {
+    tray_update(&testTray);
+  });
+  std::thread loop([]() {
+    while (!applying) {
+      tray_loop(0);
+    }
+  });
+  while (!applying) {
+    std::this_thread::yield();
+  }
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(tray_exit_timeout(50), -1);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  EXPECT_EQ(mock_exit_calls, 1);
+
+  // The update the loop was applying still completes, and releases its caller
+  wedged = false;
+  loop.join();
+  updater.join();
+  EXPECT_EQ(flushed_updates, 1);
+}
+
+TEST_F(TrayBackendTest, ExitFromSignalEndsTheLoop) {
+  ASSERT_EQ(tray_set_backend("headless"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_EQ(tray_loop(0), 0);
+
+  std::signal(SIGTERM, exit_signal_handler);
+  std::raise(SIGTERM);
+  std::signal(SIGTERM, SIG_DFL);
+
+  // The blocking iteration is woken up and performs the exit
+  EXPECT_EQ(tray_loop(1), -1);
+  EXPECT_EQ(tray_loop(0), -1);
+}
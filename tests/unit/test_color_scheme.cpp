@@ -0,0 +1,172 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <chrono>
+#include <string>
+
+// lib includes
+#ifdef __linux__
+  #include <gio/gio.h>
+#endif
+
+// local includes
+#include "src/tray.h"
+
+#ifdef __linux__
+namespace {
+  const char *portal_xml = R"(<node>
+    <interface name="org.freedesktop.portal.Settings">
+      <method name="Read">
+        <arg name="namespace" type="s" direction="in"/>
+        <arg name="key" type="s" direction="in"/>
+        <arg name="value" type="v" direction="out"/>
+      </method>
+      <signal name="SettingChanged">
+        <arg name="namespace" type="s"/>
+        <arg name="key" type="s"/>
+        <arg name="value" type="v"/>
+      </signal>
+    </interface>
+  </node>)";
+
+  /**
+   * @brief The settings interface of the desktop portal, answering with a color scheme that can be changed.
+   */
+  class StubPortal {
+  public:
+    guint32 scheme = 0;  ///< Value of org.freedesktop.appearance color-scheme.
+    int reads = 0;  ///< Read calls received.
+
+    ~StubPortal() {
+      if (connection != nullptr) {
+        g_bus_unown_name(name);
+        g_dbus_connection_unregister_object(connection, object);
+        g_dbus_connection_close_sync(connection, nullptr, nullptr);
+        g_object_unref(connection);
+      }
+      if (info != nullptr) {
+        g_dbus_node_info_unref(info);
+      }
+    }
+
+    bool start(const std::string &address) {
+      auto flags = static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+      connection = g_dbus_connection_new_for_address_sync(address.c_str(), flags, nullptr, nullptr, nullptr);
+      if (connection == nullptr) {
+        return false;
+      }
+      info = g_dbus_node_info_new_for_xml(portal_xml, nullptr);
+      static const GDBusInterfaceVTable vtable = {handle_method, nullptr, nullptr, {}};
+      object = g_dbus_connection_register_object(connection, "/org/freedesktop/portal/desktop", info->interfaces[0], &vtable, this, nullptr, nullptr);
+      name = g_bus_own_name_on_connection(connection, "org.freedesktop.portal.Desktop", G_BUS_NAME_OWNER_FLAGS_NONE, on_acquired, on_lost, this, nullptr);
+      return pump([this]() {
+        return owned;
+      }) && acquired;
+    }
+
+    // Changes the setting like the desktop does when the user switches themes
+    void set_scheme(guint32 value) {
+      scheme = value;
+      g_dbus_connection_emit_signal(connection, nullptr, "/org/freedesktop/portal/desktop", "org.freedesktop.portal.Settings", "SettingChanged", g_variant_new("(ssv)", "org.freedesktop.appearance", "color-scheme", g_variant_new_uint32(value)), nullptr);
+      g_dbus_connection_flush_sync(connection, nullptr, nullptr);
+    }
+
+  private:
+    GDBusConnection *connection = nullptr;
+    GDBusNodeInfo *info = nullptr;
+    guint object = 0;
+    guint name = 0;
+    bool owned = false;  // the name request finished
+    bool acquired = false;
+
+    static void on_acquired(GDBusConnection *, const gchar *, gpointer data) {
+      auto *self = static_cast<StubPortal *>(data);
+      self->owned = true;
+      self->acquired = true;
+    }
+
+    static void on_lost(GDBusConnection *, const gchar *, gpointer data) {
+      static_cast<StubPortal *>(data)->owned = true;
+    }
+
+    static void handle_method(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *method, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer data) {
+      auto *self = static_cast<StubPortal *>(data);
+      const gchar *namespace_name = nullptr;
+      const gchar *key = nullptr;
+      g_variant_get(parameters, "(&s&s)", &namespace_name, &key);
+      if (g_strcmp0(method, "Read") != 0 || g_strcmp0(namespace_name, "org.freedesktop.appearance") != 0 || g_strcmp0(key, "color-scheme") != 0) {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.portal.Error.NotFound", "Requested setting not found");
+        return;
+      }
+      ++self->reads;
+      // Read() answers with the value wrapped in a second variant, like the real portal
+      g_dbus_method_invocation_return_value(invocation, g_variant_new("(v)", g_variant_new_variant(g_variant_new_uint32(self->scheme))));
+    }
+  };
+
+  struct tray scheme_tray = {
+    .icon = "mail-message-new",
+  };
+}  // namespace
+#endif
+
+class TrayColorSchemeTest: public LinuxTest {
+protected:
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    tray_set_icon_variants("mail-message-new", nullptr);
+    tray_set_color_scheme(TRAY_COLOR_SCHEME_DEFAULT);
+    LinuxTest::TearDown();
+  }
+};
+
+TEST_F(TrayColorSchemeTest, IconFollowsThePortalColorScheme) {
+#ifdef __linux__
+  if (tray_set_backend("appindicator") != 0) {
+    GTEST_SKIP_("Skipping, needs a display.");
+  }
+  PrivateBus bus;
+  if (!bus.start()) {
+    GTEST_SKIP_("Skipping, needs dbus-daemon.");
+  }
+  StubPortal portal;
+  ASSERT_TRUE(portal.start(bus.address));
+  portal.scheme = TRAY_COLOR_SCHEME_DARK;
+
+  struct tray_icon_variants variants = {};
+  variants.light = "mail-message-new-light";
+  variants.dark = "mail-message-new-dark";
+  ASSERT_EQ(tray_set_icon_variants(scheme_tray.icon, &variants), 0);
+  int result = tray_init(&scheme_tray);
+  if (result == -2) {
+    GTEST_SKIP_("Skipping, the backend wants a tray host on the session bus.");
+  }
+  ASSERT_EQ(result, 0);
+
+  // Read when the tray starts
+  ASSERT_TRUE(pump([]() {
+    return tray_get_color_scheme() == TRAY_COLOR_SCHEME_DARK;
+  }));
+  EXPECT_EQ(portal.reads, 1);
+
+  // Followed when the desktop switches, without another Read()
+  portal.set_scheme(TRAY_COLOR_SCHEME_LIGHT);
+  ASSERT_TRUE(pump([]() {
+    return tray_get_color_scheme() == TRAY_COLOR_SCHEME_LIGHT;
+  }));
+  EXPECT_EQ(portal.reads, 1);
+
+  tray_exit();
+  pump([]() {
+    return tray_loop(0) == -1;
+  });
+
+  // Nothing is watched once the tray is gone
+  portal.set_scheme(TRAY_COLOR_SCHEME_DARK);
+  pump([]() {
+    return false;
+  }, std::chrono::milliseconds(200));
+  EXPECT_EQ(tray_get_color_scheme(), TRAY_COLOR_SCHEME_LIGHT);
+#endif
+}
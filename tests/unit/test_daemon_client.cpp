@@ -0,0 +1,349 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// The daemon client is only built on POSIX platforms
+#if TRAY_DAEMON_CLIENT
+
+// standard includes
+#include <cstdlib>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_wire.h"
+
+namespace {
+  int item_clicks = 0;
+
+  void item_cb(struct tray_menu *) {
+    ++item_clicks;
+  }
+
+  int scrolled_up = 0;  // sum of the steps up reported to scroll_cb()
+
+  void scroll_cb(int, int dy) {
+    scrolled_up += dy;
+  }
+
+  size_t allocations = 0;  // made through counting_malloc() and counting_realloc()
+
+  void *counting_malloc(size_t size, void *) {
+    ++allocations;
+    return std::malloc(size);
+  }
+
+  void *counting_realloc(void *ptr, size_t size, void *) {
+    ++allocations;
+    return std::realloc(ptr, size);
+  }
+
+  void counting_free(void *ptr, void *) {
+    std::free(ptr);
+  }
+
+  /**
+   * @brief A received frame.
+   */
+  struct Frame {
+    unsigned int type;
+    std::vector<unsigned char> payload;
+  };
+}  // namespace
+
+/**
+ * @brief Plays the daemon side of the protocol on a temporary socket.
+ */
+class TrayDaemonClientTest: public BaseTest {
+protected:
+  std::string socketPath;
+  int listenFd = -1;
+  int daemonFd = -1;
+  std::vector<unsigned char> rx;
+
+  struct tray_menu submenu[2] = {
+    {.text = "Nested", .cb = item_cb},
+    {.text = nullptr}
+  };
+  struct tray_menu menu[4] = {
+    {.text = "Hello", .cb = item_cb},
+    {.text = "Toggle", .checked = 0, .checkbox = 1, .cb = item_cb},
+    {.text = "More", .submenu = submenu},
+    {.text = nullptr}
+  };
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayDaemonClientTest",
+    .menu = menu,
+  };  // last, it ends in a flexible array member
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    socketPath = "/tmp/tray-test-" + std::to_string(getpid()) + ".sock";
+    unlink(socketPath.c_str());
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    socketPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_GE(listenFd, 0);
+    ASSERT_EQ(bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listenFd, 1), 0);
+    setEnv("TRAY_DAEMON_SOCKET", socketPath);
+    item_clicks = 0;
+    scrolled_up = 0;
+  }
+
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    tray_set_capacity(nullptr);
+    tray_set_allocator(nullptr, nullptr, nullptr, nullptr);
+    tray_set_scroll_callback(nullptr);
+    tray_set_click_debounce(0);
+    setEnv("TRAY_DAEMON_SOCKET", "");
+    if (daemonFd >= 0) {
+      close(daemonFd);
+    }
+    if (listenFd >= 0) {
+      close(listenFd);
+    }
+    unlink(socketPath.c_str());
+    BaseTest::TearDown();
+  }
+
+  void connectClient() {
+    ASSERT_EQ(tray_set_backend("daemon"), 0);
+    ASSERT_EQ(tray_init(&testTray), 0);
+    EXPECT_STREQ(tray_get_backend(), "daemon");
+    daemonFd = accept(listenFd, nullptr, nullptr);
+    ASSERT_GE(daemonFd, 0);
+  }
+
+  Frame readFrame() {
+    while (true) {
+      unsigned int type = 0;
+      struct tray_wire_reader payload;
+      long consumed = tray_wire_next_frame(rx.data(), rx.size(), &type, &payload);
+      if (consumed > 0) {
+        Frame frame {type, std::vector<unsigned char>(payload.data, payload.data + payload.size)};
+        rx.erase(rx.begin(), rx.begin() + consumed);
+        return frame;
+      }
+      if (consumed < 0) {
+        ADD_FAILURE() << "malformed frame";
+        return {};
+      }
+      unsigned char buffer[4096];
+      ssize_t received = recv(daemonFd, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        ADD_FAILURE() << "connection closed";
+        return {};
+      }
+      rx.insert(rx.end(), buffer, buffer + received);
+    }
+  }
+
+  static struct tray_wire_reader reader(const Frame &frame) {
+    return {frame.payload.data(), frame.payload.size(), 0, 0};
+  }
+
+  void sendFrame(enum tray_wire_message type, int index) {
+    struct tray_wire_writer w = {};
+    size_t frame = tray_wire_begin_frame(&w, type);
+    if (index >= 0) {
+      tray_wire_put_u32(&w, static_cast<unsigned int>(index));
+    }
+    tray_wire_end_frame(&w, frame);
+    ASSERT_EQ(send(daemonFd, w.data, w.size, 0), static_cast<ssize_t>(w.size));
+    tray_wire_writer_free(&w);
+  }
+};
+
+TEST_F(TrayDaemonClientTest, InitSendsFullState) {
+  connectClient();
+
+  Frame hello = readFrame();
+  ASSERT_EQ(hello.type, TRAY_MSG_HELLO);
+  struct tray_wire_reader r = reader(hello);
+  EXPECT_EQ(tray_wire_get_u32(&r), static_cast<unsigned int>(TRAY_WIRE_VERSION));
+  EXPECT_EQ(tray_wire_get_u32(&r), static_cast<unsigned int>(getpid()));
+
+  Frame icon = readFrame();
+  ASSERT_EQ(icon.type, TRAY_MSG_SET_ICON);
+  r = reader(icon);
+  EXPECT_STREQ(tray_wire_get_string(&r), "icon");
+
+  Frame tooltip = readFrame();
+  ASSERT_EQ(tooltip.type, TRAY_MSG_SET_TOOLTIP);
+  r = reader(tooltip);
+  EXPECT_STREQ(tray_wire_get_string(&r), "TrayDaemonClientTest");
+
+  Frame replace = readFrame();
+  ASSERT_EQ(replace.type, TRAY_MSG_MENU_REPLACE);
+  r = reader(replace);
+  ASSERT_EQ(tray_wire_get_u32(&r), 4u);  // pre-order: Hello, Toggle, More, Nested
+  const char *expected[] = {"Hello", "Toggle", "More", "Nested"};
+  const unsigned int children[] = {0, 0, 1, 0};
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(tray_wire_get_u32(&r), children[i]);
+    unsigned int flags = tray_wire_get_u8(&r);
+    EXPECT_EQ((flags & TRAY_WIRE_ITEM_SUBMENU) != 0, i == 2);
+    EXPECT_STREQ(tray_wire_get_string(&r), expected[i]);
+  }
+  EXPECT_FALSE(r.failed);
+
+  tray_exit();
+  EXPECT_EQ(readFrame().type, TRAY_MSG_EXIT);
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayDaemonClientTest, UpdateSendsOnlyChangedItems) {
+  connectClient();
+  for (int i = 0; i < 4; ++i) {
+    readFrame();  // HELLO, SET_ICON, SET_TOOLTIP, MENU_REPLACE
+  }
+
+  menu[1].checked = 1;
+  tray_update(&testTray);
+
+  Frame update = readFrame();
+  ASSERT_EQ(update.type, TRAY_MSG_MENU_ITEM_UPDATE);
+  struct tray_wire_reader r = reader(update);
+  EXPECT_EQ(tray_wire_get_u32(&r), 1u);
+  EXPECT_TRUE(tray_wire_get_u8(&r) & TRAY_WIRE_ITEM_CHECKED);
+  EXPECT_STREQ(tray_wire_get_string(&r), "Toggle");
+
+  tray_exit();
+  // Nothing else changed, so the exit message comes next
+  EXPECT_EQ(readFrame().type, TRAY_MSG_EXIT);
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayDaemonClientTest, PartialUpdateSendsOnlyItsPiece) {
+  connectClient();
+  for (int i = 0; i < 4; ++i) {
+    readFrame();  // HELLO, SET_ICON, SET_TOOLTIP, MENU_REPLACE
+  }
+
+  testTray.icon = "other-icon";
+  testTray.tooltip = "changed";
+  menu[1].checked = 1;
+  tray_update_icon(&testTray);
+
+  Frame icon = readFrame();
+  ASSERT_EQ(icon.type, TRAY_MSG_SET_ICON);
+  struct tray_wire_reader r = reader(icon);
+  EXPECT_STREQ(tray_wire_get_string(&r), "other-icon");
+
+  tray_exit();
+  // The tooltip and the menu are left for a later update
+  EXPECT_EQ(readFrame().type, TRAY_MSG_EXIT);
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayDaemonClientTest, ActivationRunsCallbackOnLoopThread) {
+  connectClient();
+  sendFrame(TRAY_MSG_MENU_ACTIVATE, 3);  // "Nested"
+  EXPECT_EQ(tray_loop(1), 0);
+  EXPECT_EQ(item_clicks, 1);
+
+  // The daemon going away ends the loop
+  close(daemonFd);
+  daemonFd = -1;
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayDaemonClientTest, InputBurstsReachTheAppOnce) {
+  tray_set_scroll_callback(scroll_cb);
+  tray_set_click_debounce(60000);
+  connectClient();
+  for (int i = 0; i < 4; ++i) {
+    readFrame();  // HELLO, SET_ICON, SET_TOOLTIP, MENU_REPLACE
+  }
+
+  // Frames read in one loop iteration make one scroll callback
+  struct tray_wire_writer w = {};
+  for (int i = 0; i < 3; ++i) {
+    size_t frame = tray_wire_begin_frame(&w, TRAY_MSG_SCROLL);
+    tray_wire_put_u32(&w, 0);
+    tray_wire_put_u32(&w, static_cast<unsigned int>(-2));
+    tray_wire_end_frame(&w, frame);
+  }
+  ASSERT_EQ(send(daemonFd, w.data, w.size, 0), static_cast<ssize_t>(w.size));
+  tray_wire_writer_free(&w);
+  EXPECT_EQ(tray_loop(1), 0);
+  EXPECT_EQ(scrolled_up, -6);
+
+  // The daemon toggled its check item on the dropped click, so the state is sent back
+  sendFrame(TRAY_MSG_MENU_ACTIVATE, 1);  // "Toggle"
+  sendFrame(TRAY_MSG_MENU_ACTIVATE, 1);
+  EXPECT_EQ(tray_loop(1), 0);
+  EXPECT_EQ(item_clicks, 1);
+  Frame restore = readFrame();
+  ASSERT_EQ(restore.type, TRAY_MSG_MENU_ITEM_UPDATE);
+  struct tray_wire_reader r = reader(restore);
+  EXPECT_EQ(tray_wire_get_u32(&r), 1u);
+  EXPECT_FALSE(tray_wire_get_u8(&r) & TRAY_WIRE_ITEM_CHECKED);
+
+  tray_exit();
+  EXPECT_EQ(readFrame().type, TRAY_MSG_EXIT);
+  EXPECT_EQ(tray_loop(1), -1);
+}
+
+TEST_F(TrayDaemonClientTest, InjectedClickUsesDaemonDispatch) {
+  connectClient();
+  EXPECT_EQ(tray_test_activate("More/Nested"), 0);
+  EXPECT_EQ(item_clicks, 1);
+  EXPECT_EQ(tray_test_notification_click(), -1);
+  EXPECT_EQ(tray_test_host_restart(), -1);
+  tray_exit();
+  EXPECT_EQ(tray_loop(0), -1);
+}
+
+TEST_F(TrayDaemonClientTest, SteadyStateUpdatesDoNotAllocate) {
+  struct tray_capacity capacity = {.max_items = 8, .max_label_bytes = 256, .notification_slots = 1};
+  capacity.max_items = -1;
+  EXPECT_EQ(tray_set_capacity(&capacity), -1);
+  capacity.max_items = 8;
+  ASSERT_EQ(tray_set_capacity(&capacity), 0);
+  ASSERT_EQ(tray_set_allocator(counting_malloc, counting_realloc, counting_free, nullptr), 0);
+  connectClient();
+
+  // Encoded up front, the writer allocates through the same allocator
+  struct tray_wire_writer click = {};
+  size_t frame = tray_wire_begin_frame(&click, TRAY_MSG_MENU_ACTIVATE);
+  tray_wire_put_u32(&click, 0);  // "Hello"
+  tray_wire_end_frame(&click, frame);
+
+  // Same-shaped menus with changing texts, states, icons and notifications, and clicks coming back
+  const char *icons[] = {"icon", "icon-busy"};
+  const char *labels[] = {"Hello", "Hello again"};
+  const char *notifications[] = {"Working", "Done"};
+  auto cycle = [&](int i) {
+    testTray.icon = icons[i % 2];
+    testTray.notification_title = "TrayDaemonClientTest";
+    testTray.notification_text = notifications[i % 2];
+    menu[0].text = labels[i % 2];
+    menu[1].checked = i % 2;
+    tray_update(&testTray);
+    ASSERT_EQ(send(daemonFd, click.data, click.size, 0), static_cast<ssize_t>(click.size));
+    EXPECT_EQ(tray_loop(1), 0);
+  };
+  cycle(0);
+  cycle(1);
+  size_t warmed_up = allocations;
+  for (int i = 0; i < 100; ++i) {
+    cycle(i);
+  }
+  EXPECT_EQ(allocations, warmed_up);
+  EXPECT_EQ(item_clicks, 102);
+  tray_wire_writer_free(&click);
+
+  tray_exit();
+  EXPECT_EQ(tray_loop(0), -1);
+}
+
+#endif
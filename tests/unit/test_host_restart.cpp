@@ -0,0 +1,180 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <chrono>
+#include <cstdlib>
+
+// lib includes
+#ifdef __linux__
+  #include <gio/gio.h>
+#endif
+
+// local includes
+#include "src/tray.h"
+
+#ifdef __linux__
+namespace {
+  const char *watcher_xml = R"(<node>
+    <interface name="org.kde.StatusNotifierWatcher">
+      <method name="RegisterStatusNotifierItem"><arg name="service" type="s" direction="in"/></method>
+      <method name="RegisterStatusNotifierHost"><arg name="service" type="s" direction="in"/></method>
+      <property name="RegisteredStatusNotifierItems" type="as" access="read"/>
+      <property name="IsStatusNotifierHostRegistered" type="b" access="read"/>
+      <property name="ProtocolVersion" type="i" access="read"/>
+    </interface>
+  </node>)";
+
+  /**
+   * @brief A StatusNotifierWatcher on its own bus connection, which can be killed and started again.
+   */
+  class StubWatcher {
+  public:
+    int registrations = 0;  ///< RegisterStatusNotifierItem calls received.
+
+    ~StubWatcher() {
+      kill();
+      if (info != nullptr) {
+        g_dbus_node_info_unref(info);
+      }
+    }
+
+    bool start() {
+      gchar *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+      if (address == nullptr) {
+        return false;
+      }
+      auto flags = static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+      connection = g_dbus_connection_new_for_address_sync(address, flags, nullptr, nullptr, nullptr);
+      g_free(address);
+      if (connection == nullptr) {
+        return false;
+      }
+      if (info == nullptr) {
+        info = g_dbus_node_info_new_for_xml(watcher_xml, nullptr);
+      }
+      static const GDBusInterfaceVTable vtable = {handle_method, handle_property, nullptr, {}};
+      object = g_dbus_connection_register_object(connection, "/StatusNotifierWatcher", info->interfaces[0], &vtable, this, nullptr, nullptr);
+      owned = false;
+      acquired = false;
+      name = g_bus_own_name_on_connection(connection, "org.kde.StatusNotifierWatcher", G_BUS_NAME_OWNER_FLAGS_NONE, on_acquired, on_lost, this, nullptr);
+      return pump([this]() {
+        return owned;
+      }) && acquired;
+    }
+
+    // Drops off the bus like a crashed panel
+    void kill() {
+      if (connection == nullptr) {
+        return;
+      }
+      g_bus_unown_name(name);
+      g_dbus_connection_unregister_object(connection, object);
+      g_dbus_connection_close_sync(connection, nullptr, nullptr);
+      g_clear_object(&connection);
+    }
+
+  private:
+    GDBusConnection *connection = nullptr;
+    GDBusNodeInfo *info = nullptr;
+    guint object = 0;
+    guint name = 0;
+    bool owned = false;  // the name request finished
+    bool acquired = false;
+
+    static void on_acquired(GDBusConnection *, const gchar *, gpointer data) {
+      auto *self = static_cast<StubWatcher *>(data);
+      self->owned = true;
+      self->acquired = true;
+    }
+
+    static void on_lost(GDBusConnection *, const gchar *, gpointer data) {
+      static_cast<StubWatcher *>(data)->owned = true;
+    }
+
+    static void handle_method(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *method, GVariant *, GDBusMethodInvocation *invocation, gpointer data) {
+      if (g_strcmp0(method, "RegisterStatusNotifierItem") == 0) {
+        ++static_cast<StubWatcher *>(data)->registrations;
+      }
+      g_dbus_method_invocation_return_value(invocation, nullptr);
+    }
+
+    static GVariant *handle_property(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *property, GError **, gpointer) {
+      if (g_strcmp0(property, "RegisteredStatusNotifierItems") == 0) {
+        return g_variant_new_strv(nullptr, 0);
+      }
+      if (g_strcmp0(property, "IsStatusNotifierHostRegistered") == 0) {
+        return g_variant_new_boolean(TRUE);
+      }
+      return g_variant_new_int32(0);
+    }
+  };
+
+  struct tray_menu restart_menu[] = {
+    {.text = "Open"},
+    {.text = nullptr}
+  };
+
+  struct tray restart_tray = {
+    .icon = "mail-message-new",
+    .menu = restart_menu
+  };
+
+  unsigned int host_recoveries() {
+    struct tray_stats stats;
+    tray_get_stats(&stats);
+    return stats.host_recoveries;
+  }
+}  // namespace
+#endif
+
+class TrayHostRestartTest: public LinuxTest {
+protected:
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    LinuxTest::TearDown();
+  }
+};
+
+TEST_F(TrayHostRestartTest, IconIsRegisteredWithARestartedWatcher) {
+#ifdef __linux__
+  if (std::getenv("DBUS_SESSION_BUS_ADDRESS") == nullptr || tray_set_backend("appindicator") != 0) {
+    GTEST_SKIP_("Skipping, needs a session bus and a display.");
+  }
+  StubWatcher watcher;
+  if (!watcher.start()) {
+    GTEST_SKIP_("Skipping, another StatusNotifierWatcher is running.");
+  }
+  ASSERT_EQ(tray_init(&restart_tray), 0);
+  ASSERT_TRUE(pump([&]() {
+    return watcher.registrations > 0;
+  }));
+
+  // The panel crashes and comes back
+  watcher.kill();
+  int registrations = watcher.registrations;
+  pump([]() {
+    return false;
+  }, std::chrono::milliseconds(200));
+  ASSERT_TRUE(watcher.start());
+  ASSERT_TRUE(pump([]() {
+    return host_recoveries() == 1;
+  }));
+  EXPECT_GT(watcher.registrations, registrations);
+
+  struct tray_stats stats;
+  tray_get_stats(&stats);
+  EXPECT_GT(stats.last_recovery_us, 0u);
+
+  // A restart the indicator did not notice is recovered by registering again
+  ASSERT_EQ(tray_test_host_restart(), 0);
+  ASSERT_TRUE(pump([]() {
+    return host_recoveries() == 2;
+  }));
+
+  tray_exit();
+  pump([]() {
+    return tray_loop(0) == -1;
+  });
+#endif
+}
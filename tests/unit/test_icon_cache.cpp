@@ -0,0 +1,46 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <string>
+#include <vector>
+
+// local includes
+#include "src/tray_icon_cache.h"
+
+namespace {
+  int destroyed = 0;
+
+  void count_destroy(void *) {
+    ++destroyed;
+  }
+}  // namespace
+
+TEST(TrayIconCacheTest, FindsInsertedIconsAcrossGrowth) {
+  struct tray_icon_cache cache;
+  tray_icon_cache_init(&cache, count_destroy);
+  destroyed = 0;
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < 100; ++i) {
+    paths.push_back("icons/icon-" + std::to_string(i) + ".ico");
+  }
+  for (auto &path : paths) {
+    ASSERT_EQ(tray_icon_cache_insert(&cache, path.c_str(), &path), 0);
+  }
+  EXPECT_EQ(cache.count, 100u);
+  for (auto &path : paths) {
+    EXPECT_EQ(tray_icon_cache_find(&cache, path.c_str()), &path);
+  }
+  EXPECT_EQ(tray_icon_cache_find(&cache, "icons/missing.ico"), nullptr);
+
+  // Replacing an entry destroys the old data
+  int replacement = 0;
+  ASSERT_EQ(tray_icon_cache_insert(&cache, paths[0].c_str(), &replacement), 0);
+  EXPECT_EQ(destroyed, 1);
+  EXPECT_EQ(tray_icon_cache_find(&cache, paths[0].c_str()), &replacement);
+
+  tray_icon_cache_clear(&cache);
+  EXPECT_EQ(destroyed, 101);
+  EXPECT_EQ(tray_icon_cache_find(&cache, paths[1].c_str()), nullptr);
+}
@@ -0,0 +1,143 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  std::mutex log_mutex;
+  std::condition_variable log_cv;
+  std::vector<std::string> messages;  // delivered to record_log()
+  std::vector<std::thread::id> threads;  // thread of each delivery
+
+  void record_log(enum tray_log_level, const char *message) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    messages.emplace_back(message);
+    threads.push_back(std::this_thread::get_id());
+    log_cv.notify_all();
+  }
+}  // namespace
+
+class TrayLogTest: public BaseTest {
+protected:
+  void SetUp() override {
+    BaseTest::SetUp();
+    std::lock_guard<std::mutex> lock(log_mutex);
+    messages.clear();
+    threads.clear();
+    tray_set_log_callback(record_log);
+  }
+
+  void TearDown() override {
+    tray_set_log_mode(TRAY_LOG_SYNC);
+    tray_set_log_callback(nullptr);
+    BaseTest::TearDown();
+  }
+
+  static size_t delivered() {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    return messages.size();
+  }
+};
+
+TEST_F(TrayLogTest, ManualModeQueuesUntilDrained) {
+  ASSERT_EQ(tray_set_log_mode(TRAY_LOG_ASYNC_MANUAL), 0);
+  for (int i = 0; i < 3; ++i) {
+    tray_log(TRAY_LOG_INFO, "message %d", i);
+  }
+  EXPECT_EQ(delivered(), 0u);
+
+  EXPECT_EQ(tray_log_drain(), 3u);
+  ASSERT_EQ(messages.size(), 3u);
+  EXPECT_EQ(messages[0], "message 0");
+  EXPECT_EQ(messages[2], "message 2");
+  EXPECT_EQ(tray_log_drain(), 0u);
+
+  // Going back to sync mode delivers what is still queued, in order
+  tray_log(TRAY_LOG_INFO, "queued");
+  ASSERT_EQ(tray_set_log_mode(TRAY_LOG_SYNC), 0);
+  tray_log(TRAY_LOG_INFO, "direct");
+  ASSERT_EQ(messages.size(), 5u);
+  EXPECT_EQ(messages[3], "queued");
+  EXPECT_EQ(messages[4], "direct");
+}
+
+TEST_F(TrayLogTest, OverflowIsCountedInsteadOfBlocking) {
+  struct tray_stats before;
+  tray_get_stats(&before);
+  ASSERT_EQ(tray_set_log_mode(TRAY_LOG_ASYNC_MANUAL), 0);
+  for (int i = 0; i < 1000; ++i) {
+    tray_log(TRAY_LOG_DEBUG, "message %d", i);
+  }
+  size_t queued = tray_log_drain();
+  EXPECT_GT(queued, 0u);
+  EXPECT_LT(queued, 1000u);
+
+  struct tray_stats after;
+  tray_get_stats(&after);
+  EXPECT_EQ(after.log_dropped - before.log_dropped, 1000u - queued);
+  EXPECT_EQ(messages.front(), "message 0");
+}
+
+TEST_F(TrayLogTest, BackgroundThreadDeliversMessages) {
+  struct tray_stats before;
+  tray_get_stats(&before);
+  ASSERT_EQ(tray_set_log_mode(TRAY_LOG_ASYNC), 0);
+  std::vector<std::thread> loggers;
+  for (int t = 0; t < 4; ++t) {
+    loggers.emplace_back([t]() {
+      for (int i = 0; i < 50; ++i) {
+        tray_log(TRAY_LOG_INFO, "thread %d message %d", t, i);
+        if (i % 10 == 0) {
+          // Swapping the callback races with deliveries
+          tray_set_log_callback(record_log);
+        }
+      }
+    });
+  }
+  for (auto &logger : loggers) {
+    logger.join();
+  }
+
+  // Every message is either delivered or counted as dropped
+  std::unique_lock<std::mutex> lock(log_mutex);
+  ASSERT_TRUE(log_cv.wait_for(lock, std::chrono::seconds(5), [&]() {
+    struct tray_stats stats;
+    tray_get_stats(&stats);
+    return messages.size() + (stats.log_dropped - before.log_dropped) == 200u;
+  }));
+  for (const auto &thread : threads) {
+    EXPECT_NE(thread, std::this_thread::get_id());
+  }
+}
+
+TEST_F(TrayLogTest, LimiterSummarizesSuppressedRepeats) {
+  struct tray_log_limit limit = {};
+  limit.window_ms = 100;
+  limit.burst = 2;
+  for (int i = 0; i < 10; ++i) {
+    tray_log_limited(&limit, TRAY_LOG_WARNING, "failure %d", i);
+  }
+  ASSERT_EQ(messages.size(), 2u);
+  EXPECT_EQ(messages[1], "failure 1");
+
+  // The next window reports what the previous one held back
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  tray_log_limited(&limit, TRAY_LOG_WARNING, "failure %d", 10);
+  ASSERT_EQ(messages.size(), 4u);
+  EXPECT_EQ(messages[2], "8 similar messages suppressed");
+  EXPECT_EQ(messages[3], "failure 10");
+
+  // Call sites do not share their limits
+  TRAY_LOG_LIMITED(TRAY_LOG_WARNING, "other call site");
+  EXPECT_EQ(messages.size(), 5u);
+}
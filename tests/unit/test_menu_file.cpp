@@ -0,0 +1,214 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  int open_clicks = 0;
+  int open_context = 42;
+
+  void open_cb(struct tray_menu *item) {
+    ++open_clicks;
+    EXPECT_EQ(item->context, &open_context);
+  }
+
+  void toggle_cb(struct tray_menu *item) {
+    item->checked = !item->checked;
+  }
+
+  const char *baseMenu = R"({
+  "menu": [
+    {"text": "Open", "action": "open", "icon": "icons/open.png"},
+    {"text": "-"},
+    {"text": "Options", "submenu": [
+      {"text": "Dark é", "checkbox": true, "action": "toggle"},
+      {"text": "Beta", "checkbox": true, "checked": true, "disabled": true}
+    ]},
+    {"text": "Quit", "comment": {"ignored": [1, 2.5, null]}}
+  ]
+})";
+
+  std::vector<unsigned int> reload_applied;  // parts passed to reload_update_parts(), TRAY_PARTS_ALL for update()
+
+  int reload_init(struct tray *) {
+    return 0;
+  }
+
+  int reload_loop(int) {
+    return 0;
+  }
+
+  void reload_update(struct tray *) {
+    reload_applied.push_back(TRAY_PARTS_ALL);
+  }
+
+  void reload_update_parts(struct tray *, unsigned int parts) {
+    reload_applied.push_back(parts);
+  }
+
+  void reload_exit() {
+  }
+
+  const struct tray_backend reload_backend = {
+    .name = "reload",
+    .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU,
+    .available = nullptr,
+    .init = reload_init,
+    .loop = reload_loop,
+    .update = reload_update,
+    .exit = reload_exit,
+    .wakeup = nullptr,
+    .invoke = nullptr,
+    .inject = nullptr,
+    .update_parts = reload_update_parts,
+  };
+}  // namespace
+
+class TrayMenuFileTest: public BaseTest {
+protected:
+  std::filesystem::path menuPath;
+
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayMenuFileTest",
+  };  // last, it ends in a flexible array member
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    menuPath = testBinaryDir / "test_menu_file.json";
+    open_clicks = 0;
+    ASSERT_EQ(tray_register_action("open", open_cb, &open_context), 0);
+    ASSERT_EQ(tray_register_action("toggle", toggle_cb, nullptr), 0);
+  }
+
+  void TearDown() override {
+    tray_menu_watch(&testTray, nullptr);
+    tray_menu_free(testTray.menu);
+    testTray.menu = nullptr;
+    tray_set_backend(nullptr);
+    std::filesystem::remove(menuPath);
+    BaseTest::TearDown();
+  }
+
+  void writeMenu(const std::string &contents) {
+    std::ofstream(menuPath, std::ios::binary | std::ios::trunc) << contents;
+  }
+
+  /**
+   * @brief Run the tray loop until the menu pointer changes or the timeout elapses.
+   */
+  bool waitForReload(struct tray_menu *previous, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+      tray_loop(0);
+      if (testTray.menu != previous) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+};
+
+TEST_F(TrayMenuFileTest, LoadsNestedMenuAndBindsActions) {
+  writeMenu(baseMenu);
+  struct tray_menu *menu = tray_menu_load(menuPath.string().c_str());
+  ASSERT_NE(menu, nullptr);
+
+  EXPECT_STREQ(menu[0].text, "Open");
+  EXPECT_STREQ(menu[1].text, "-");
+  EXPECT_STREQ(menu[2].text, "Options");
+  EXPECT_STREQ(menu[3].text, "Quit");
+  EXPECT_EQ(menu[4].text, nullptr);
+  EXPECT_STREQ(menu[0].icon, "icons/open.png");
+  EXPECT_EQ(menu[3].icon, nullptr);
+
+  struct tray_menu *options = menu[2].submenu;
+  ASSERT_NE(options, nullptr);
+  EXPECT_STREQ(options[0].text, "Dark \xc3\xa9");
+  EXPECT_TRUE(options[0].checkbox);
+  EXPECT_FALSE(options[0].checked);
+  EXPECT_TRUE(options[1].checked);
+  EXPECT_TRUE(options[1].disabled);
+  EXPECT_EQ(options[1].cb, nullptr);
+  EXPECT_EQ(options[2].text, nullptr);
+
+  ASSERT_NE(menu[0].cb, nullptr);
+  menu[0].cb(&menu[0]);
+  EXPECT_EQ(open_clicks, 1);
+
+  tray_menu_free(menu);
+}
+
+TEST_F(TrayMenuFileTest, MalformedFileIsRejected) {
+  writeMenu(R"([{"text": "Open"}, {"action": "open"}])");
+  EXPECT_EQ(tray_menu_load(menuPath.string().c_str()), nullptr);
+  writeMenu(R"([{"text": "Open"})");
+  EXPECT_EQ(tray_menu_load(menuPath.string().c_str()), nullptr);
+  EXPECT_EQ(tray_menu_load((testBinaryDir / "does-not-exist.json").string().c_str()), nullptr);
+}
+
+TEST_F(TrayMenuFileTest, ReloadAppliesChangesAndKeepsRuntimeState) {
+  writeMenu(baseMenu);
+  ASSERT_EQ(tray_menu_watch(&testTray, menuPath.string().c_str()), 0);
+  ASSERT_EQ(tray_set_backend("headless"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+
+  // The app toggles a checkbox at runtime
+  struct tray_menu *dark = &testTray.menu[2].submenu[0];
+  dark->cb(dark);
+  ASSERT_TRUE(dark->checked);
+
+  // An operator regroups the menu
+  std::string regrouped = R"([
+    {"text": "Options", "submenu": [
+      {"text": "Dark é", "checkbox": true, "action": "toggle"},
+      {"text": "Beta", "checkbox": true, "checked": false}
+    ]},
+    {"text": "Open", "action": "open"},
+    {"text": "Quit"}
+  ])";
+  struct tray_menu *previous = testTray.menu;
+  writeMenu(regrouped);
+  ASSERT_TRUE(waitForReload(previous, std::chrono::seconds(5)));
+
+  EXPECT_STREQ(testTray.menu[0].text, "Options");
+  EXPECT_STREQ(testTray.menu[1].text, "Open");
+  EXPECT_TRUE(testTray.menu[0].submenu[0].checked);  // runtime state survives
+  EXPECT_FALSE(testTray.menu[0].submenu[1].checked);  // the file changed this one
+  EXPECT_EQ(testTray.menu[1].cb, open_cb);
+
+  // Rewriting equivalent contents does not replace the menu
+  previous = testTray.menu;
+  writeMenu(regrouped + "\n\n");
+  EXPECT_FALSE(waitForReload(previous, std::chrono::milliseconds(800)));
+
+  tray_exit();
+}
+
+TEST_F(TrayMenuFileTest, ReloadOnlyUpdatesTheMenu) {
+  writeMenu(baseMenu);
+  ASSERT_EQ(tray_menu_watch(&testTray, menuPath.string().c_str()), 0);
+  ASSERT_EQ(tray_register_backend(&reload_backend), 0);
+  ASSERT_EQ(tray_set_backend("reload"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  reload_applied.clear();
+
+  // The icon and any pending notification are left alone
+  struct tray_menu *previous = testTray.menu;
+  writeMenu(R"([{"text": "Quit"}])");
+  ASSERT_TRUE(waitForReload(previous, std::chrono::seconds(5)));
+  const std::vector<unsigned int> menu_only = {TRAY_PART_MENU};
+  EXPECT_EQ(reload_applied, menu_only);
+
+  tray_exit();
+}
@@ -0,0 +1,205 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  std::vector<unsigned int> power_applied;  // parts passed to power_update_parts()
+  std::vector<std::string> power_icons;  // icon shown by each update of TRAY_PART_ICON
+
+  int power_init(struct tray *) {
+    return 0;
+  }
+
+  int power_loop(int) {
+    return 0;
+  }
+
+  void power_update(struct tray *) {
+    power_applied.push_back(TRAY_PARTS_ALL);
+  }
+
+  void power_update_parts(struct tray *tray, unsigned int parts) {
+    power_applied.push_back(parts);
+    if (parts & TRAY_PART_ICON) {
+      power_icons.emplace_back(tray->icon);
+    }
+  }
+
+  void power_exit() {
+  }
+
+  const struct tray_backend power_backend = {
+    .name = "power",
+    .capabilities = TRAY_CAPABILITY_ICON | TRAY_CAPABILITY_MENU,
+    .available = nullptr,
+    .init = power_init,
+    .loop = power_loop,
+    .update = power_update,
+    .exit = power_exit,
+    .wakeup = nullptr,
+    .invoke = nullptr,
+    .inject = nullptr,
+    .update_parts = power_update_parts,
+  };
+
+  size_t applied_count(unsigned int part) {
+    return static_cast<size_t>(std::count_if(power_applied.begin(), power_applied.end(), [part](unsigned int parts) {
+      return (parts & part) != 0;
+    }));
+  }
+
+  // Runs the loop until done() or the timeout
+  bool run_loop(const std::function<bool()> &done, std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      tray_loop(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+  }
+}  // namespace
+
+class TrayPowerTest: public LinuxTest {
+protected:
+  std::filesystem::path supplyRoot;
+
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayPowerTest",
+  };
+
+  void SetUp() override {
+    LinuxTest::SetUp();
+    supplyRoot = testBinaryDir / "test_power_supply";
+    std::filesystem::remove_all(supplyRoot);
+    std::filesystem::create_directories(supplyRoot);
+    power_applied.clear();
+    power_icons.clear();
+  }
+
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    setEnv("TRAY_POWER_SUPPLY_ROOT", "");
+    tray_set_power_limits(nullptr);
+    tray_set_power_source(TRAY_POWER_AC);
+    std::filesystem::remove_all(supplyRoot);
+    LinuxTest::TearDown();
+  }
+
+  // Adds or changes a power supply the way the kernel lists it
+  void writeSupply(const std::string &name, const std::vector<std::pair<std::string, std::string>> &attributes) {
+    std::filesystem::create_directories(supplyRoot / name);
+    for (const auto &[attribute, value] : attributes) {
+      std::ofstream(supplyRoot / name / attribute, std::ios::trunc) << value << "\n";
+    }
+  }
+
+  int readSource(enum tray_power_source *source) {
+    return tray_power_read(supplyRoot.string().c_str(), source);
+  }
+};
+
+TEST_F(TrayPowerTest, ReadsTheSourceFromPowerSupplies) {
+  enum tray_power_source source = TRAY_POWER_AC;
+  EXPECT_EQ(tray_power_read((supplyRoot / "missing").string().c_str(), &source), -1);
+  EXPECT_EQ(readSource(&source), -1);
+
+  // The battery of a mouse does not power the machine
+  writeSupply("hidpp_battery_0", {{"type", "Battery"}, {"scope", "Device"}, {"status", "Discharging"}});
+  EXPECT_EQ(readSource(&source), -1);
+
+  writeSupply("BAT0", {{"type", "Battery"}, {"status", "Discharging"}});
+  ASSERT_EQ(readSource(&source), 0);
+  EXPECT_EQ(source, TRAY_POWER_BATTERY);
+
+  writeSupply("AC", {{"type", "Mains"}, {"online", "1"}});
+  ASSERT_EQ(readSource(&source), 0);
+  EXPECT_EQ(source, TRAY_POWER_AC);
+
+  writeSupply("AC", {{"online", "0"}});
+  ASSERT_EQ(readSource(&source), 0);
+  EXPECT_EQ(source, TRAY_POWER_BATTERY);
+
+  // USB-C chargers show up as USB supplies
+  writeSupply("ucsi-source-psy-USBC000:001", {{"type", "USB"}, {"online", "1"}});
+  ASSERT_EQ(readSource(&source), 0);
+  EXPECT_EQ(source, TRAY_POWER_AC);
+}
+
+TEST_F(TrayPowerTest, BatteryLimitsSpaceOutUpdates) {
+  writeSupply("AC", {{"type", "Mains"}, {"online", "0"}});
+  writeSupply("BAT0", {{"type", "Battery"}, {"status", "Discharging"}});
+  setEnv("TRAY_POWER_SUPPLY_ROOT", supplyRoot.string());
+  struct tray_power_limits limits = {};
+  limits.icon_interval_ms = 100;
+  limits.menu_interval_ms = 60000;
+  tray_set_power_limits(&limits);
+  ASSERT_EQ(tray_register_backend(&power_backend), 0);
+  ASSERT_EQ(tray_set_backend("power"), 0);
+  ASSERT_EQ(tray_init(&testTray), 0);
+  EXPECT_EQ(tray_get_power_source(), TRAY_POWER_BATTERY);
+
+  // The first update of each piece goes out, the rest waits for the interval
+  power_applied.clear();
+  tray_update_icon(&testTray);
+  tray_update_icon(&testTray);
+  tray_update_icon(&testTray);
+  tray_update_menu(&testTray);
+  tray_update_menu(&testTray);
+  tray_notify(&testTray);
+  tray_notify(&testTray);
+  tray_update_tooltip(&testTray);
+  EXPECT_EQ(applied_count(TRAY_PART_ICON), 1u);
+  EXPECT_EQ(applied_count(TRAY_PART_MENU), 1u);
+  EXPECT_EQ(applied_count(TRAY_PART_NOTIFICATION), 2u);
+  EXPECT_EQ(applied_count(TRAY_PART_TOOLTIP), 1u);
+  struct tray_stats stats;
+  tray_get_stats(&stats);
+  EXPECT_EQ(stats.throttled_updates, 3u);
+  EXPECT_EQ(stats.power_source, TRAY_POWER_BATTERY);
+  EXPECT_EQ(stats.power_limits.icon_interval_ms, 100u);
+  EXPECT_EQ(stats.power_limits.menu_interval_ms, 60000u);
+
+  // The held strings are copied, the caller may reuse its own once the call returned
+  char icon[] = "next";
+  struct tray nextTray = testTray;
+  nextTray.icon = icon;
+  tray_update_icon(&nextTray);
+  std::strcpy(icon, "gone");
+
+  // The held icons go out together once the interval passed
+  ASSERT_TRUE(run_loop([]() {
+    return applied_count(TRAY_PART_ICON) == 2;
+  }));
+  EXPECT_EQ(power_icons.back(), "next");
+  EXPECT_EQ(applied_count(TRAY_PART_MENU), 1u);
+
+  // Plugging in is picked up by the loop, and applies the held menu
+  writeSupply("AC", {{"online", "1"}});
+  ASSERT_TRUE(run_loop([]() {
+    return tray_get_power_source() == TRAY_POWER_AC;
+  }));
+  EXPECT_EQ(applied_count(TRAY_PART_MENU), 2u);
+  tray_get_stats(&stats);
+  EXPECT_EQ(stats.power_limits.menu_interval_ms, 0u);
+  tray_update_menu(&testTray);
+  EXPECT_EQ(applied_count(TRAY_PART_MENU), 3u);
+  tray_exit();
+}
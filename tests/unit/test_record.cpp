@@ -0,0 +1,150 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <fstream>
+#include <string>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_record.h"
+
+namespace {
+  void item_cb(struct tray_menu *) {}
+
+  void notification_cb() {}
+}  // namespace
+
+class TrayRecordTest: public BaseTest {
+protected:
+  std::filesystem::path recordPath;
+  struct tray_record_reader reader {};
+
+  struct tray_menu submenu[3] = {
+    {.text = "Nested", .checked = 1, .checkbox = 1, .cb = item_cb},
+    {.text = "-"},
+    {.text = nullptr}
+  };
+  struct tray_menu menu[4] = {
+    {.text = "Open", .cb = item_cb},
+    {.text = "Disabled", .disabled = 1},
+    {.text = "More", .submenu = submenu},
+    {.text = nullptr}
+  };
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayRecordTest",
+    .menu = menu,
+  };  // last, it ends in a flexible array member
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    recordPath = testBinaryDir / "test_record.trayrec";
+    tray_set_backend("headless");
+  }
+
+  void TearDown() override {
+    tray_record_stop();
+    tray_record_close(&reader);
+    tray_set_backend(nullptr);
+    std::filesystem::remove(recordPath);
+    BaseTest::TearDown();
+  }
+
+  void recordSession() {
+    ASSERT_EQ(tray_record_start(recordPath.string().c_str()), 0);
+    ASSERT_EQ(tray_init(&testTray), 0);
+    submenu[0].checked = 0;
+    testTray.tooltip = "Updated";
+    testTray.notification_title = "Title";
+    testTray.notification_text = "Text";
+    testTray.notification_cb = notification_cb;
+    tray_update(&testTray);
+    testTray.menu = nullptr;
+    tray_update(&testTray);
+    tray_exit();
+    tray_record_stop();
+  }
+};
+
+TEST_F(TrayRecordTest, ReplaysRecordedCalls) {
+  recordSession();
+  ASSERT_EQ(tray_record_open(&reader, recordPath.string().c_str()), 0);
+  struct tray_record_event event;
+
+  ASSERT_EQ(tray_record_next(&reader, &event), 1);
+  EXPECT_EQ(event.type, TRAY_RECORD_INIT);
+  ASSERT_NE(event.tray, nullptr);
+  EXPECT_STREQ(event.tray->icon, "icon");
+  EXPECT_STREQ(event.tray->tooltip, "TrayRecordTest");
+  EXPECT_EQ(event.tray->notification_title, nullptr);
+  EXPECT_EQ(event.tray->notification_cb, nullptr);
+  ASSERT_NE(event.tray->menu, nullptr);
+  EXPECT_STREQ(event.tray->menu[0].text, "Open");
+  EXPECT_NE(event.tray->menu[0].cb, nullptr);
+  EXPECT_TRUE(event.tray->menu[1].disabled);
+  EXPECT_STREQ(event.tray->menu[2].text, "More");
+  ASSERT_NE(event.tray->menu[2].submenu, nullptr);
+  EXPECT_STREQ(event.tray->menu[2].submenu[0].text, "Nested");
+  EXPECT_TRUE(event.tray->menu[2].submenu[0].checkbox);
+  EXPECT_TRUE(event.tray->menu[2].submenu[0].checked);
+  EXPECT_STREQ(event.tray->menu[2].submenu[1].text, "-");
+  EXPECT_EQ(event.tray->menu[2].submenu[2].text, nullptr);
+  EXPECT_EQ(event.tray->menu[3].text, nullptr);
+  struct tray *initTray = event.tray;
+  unsigned long long previousUs = event.time_us;
+
+  ASSERT_EQ(tray_record_next(&reader, &event), 1);
+  EXPECT_EQ(event.type, TRAY_RECORD_UPDATE);
+  EXPECT_GE(event.time_us, previousUs);
+  ASSERT_NE(event.tray, nullptr);
+  EXPECT_STREQ(event.tray->tooltip, "Updated");
+  EXPECT_STREQ(event.tray->notification_title, "Title");
+  EXPECT_STREQ(event.tray->notification_text, "Text");
+  EXPECT_NE(event.tray->notification_cb, nullptr);
+  EXPECT_FALSE(event.tray->menu[2].submenu[0].checked);
+  // The previous tray stays intact while the backend may still use it
+  EXPECT_STREQ(initTray->tooltip, "TrayRecordTest");
+  EXPECT_TRUE(initTray->menu[2].submenu[0].checked);
+
+  ASSERT_EQ(tray_record_next(&reader, &event), 1);
+  EXPECT_EQ(event.type, TRAY_RECORD_UPDATE);
+  ASSERT_NE(event.tray, nullptr);
+  EXPECT_EQ(event.tray->menu, nullptr);
+
+  ASSERT_EQ(tray_record_next(&reader, &event), 1);
+  EXPECT_EQ(event.type, TRAY_RECORD_EXIT);
+  EXPECT_EQ(event.tray, nullptr);
+  EXPECT_EQ(tray_record_next(&reader, &event), 0);
+}
+
+TEST_F(TrayRecordTest, NothingIsRecordedWhenStopped) {
+  ASSERT_EQ(tray_record_start(recordPath.string().c_str()), 0);
+  tray_record_stop();
+  ASSERT_EQ(tray_init(&testTray), 0);
+  tray_update(&testTray);
+  tray_exit();
+
+  ASSERT_EQ(tray_record_open(&reader, recordPath.string().c_str()), 0);
+  struct tray_record_event event;
+  EXPECT_EQ(tray_record_next(&reader, &event), 0);
+}
+
+TEST_F(TrayRecordTest, RejectsMalformedRecordings) {
+  std::ofstream(recordPath, std::ios::binary | std::ios::trunc) << "not a recording";
+  EXPECT_EQ(tray_record_open(&reader, recordPath.string().c_str()), -1);
+
+  // A call cut off at the end, e.g. by a crash, ends the recording early
+  recordSession();
+  auto size = std::filesystem::file_size(recordPath);
+  std::filesystem::resize_file(recordPath, size - 3);
+  ASSERT_EQ(tray_record_open(&reader, recordPath.string().c_str()), 0);
+  struct tray_record_event event;
+  int calls = 0;
+  int result;
+  while ((result = tray_record_next(&reader, &event)) == 1) {
+    ++calls;
+  }
+  EXPECT_EQ(result, 0);
+  EXPECT_EQ(calls, 3);
+}
@@ -0,0 +1,208 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <chrono>
+#include <string>
+
+// lib includes
+#ifdef __linux__
+  #include <gio/gio.h>
+#endif
+
+// local includes
+#include "src/tray.h"
+
+#ifdef __linux__
+namespace {
+  const char *session_xml = R"(<node>
+    <interface name="org.freedesktop.login1.Manager">
+      <method name="GetSession">
+        <arg name="session_id" type="s" direction="in"/>
+        <arg name="object_path" type="o" direction="out"/>
+      </method>
+    </interface>
+    <interface name="org.freedesktop.login1.Session">
+      <property name="LockedHint" type="b" access="read"/>
+      <property name="IdleHint" type="b" access="read"/>
+    </interface>
+    <interface name="org.freedesktop.ScreenSaver">
+      <method name="GetActive">
+        <arg name="active" type="b" direction="out"/>
+      </method>
+      <signal name="ActiveChanged">
+        <arg name="active" type="b"/>
+      </signal>
+    </interface>
+  </node>)";
+
+  const char *session_path = "/org/freedesktop/login1/session/_31";
+
+  /**
+   * @brief logind and the screensaver, reporting lock and idle hints that can be changed.
+   */
+  class StubSession {
+  public:
+    bool locked = false;  ///< LockedHint of the session.
+    bool idle = false;  ///< IdleHint of the session.
+    bool screensaver = false;  ///< Whether the screensaver is active.
+
+    ~StubSession() {
+      if (connection != nullptr) {
+        g_bus_unown_name(logind_name);
+        g_bus_unown_name(screensaver_name);
+        for (guint object : objects) {
+          g_dbus_connection_unregister_object(connection, object);
+        }
+        g_dbus_connection_close_sync(connection, nullptr, nullptr);
+        g_object_unref(connection);
+      }
+      if (info != nullptr) {
+        g_dbus_node_info_unref(info);
+      }
+    }
+
+    bool start(const std::string &address) {
+      auto flags = static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION);
+      connection = g_dbus_connection_new_for_address_sync(address.c_str(), flags, nullptr, nullptr, nullptr);
+      if (connection == nullptr) {
+        return false;
+      }
+      info = g_dbus_node_info_new_for_xml(session_xml, nullptr);
+      static const GDBusInterfaceVTable vtable = {handle_method, handle_get_property, nullptr, {}};
+      objects[0] = g_dbus_connection_register_object(connection, "/org/freedesktop/login1", info->interfaces[0], &vtable, this, nullptr, nullptr);
+      objects[1] = g_dbus_connection_register_object(connection, session_path, info->interfaces[1], &vtable, this, nullptr, nullptr);
+      objects[2] = g_dbus_connection_register_object(connection, "/org/freedesktop/ScreenSaver", info->interfaces[2], &vtable, this, nullptr, nullptr);
+      logind_name = g_bus_own_name_on_connection(connection, "org.freedesktop.login1", G_BUS_NAME_OWNER_FLAGS_NONE, on_acquired, on_lost, this, nullptr);
+      screensaver_name = g_bus_own_name_on_connection(connection, "org.freedesktop.ScreenSaver", G_BUS_NAME_OWNER_FLAGS_NONE, on_acquired, on_lost, this, nullptr);
+      return pump([this]() {
+        return owned == 2;
+      }) && acquired == 2;
+    }
+
+    // Changes a hint like logind does, announcing it with PropertiesChanged
+    void set_hint(const char *name, bool value) {
+      (g_strcmp0(name, "LockedHint") == 0 ? locked : idle) = value;
+      GVariantBuilder changed;
+      g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+      g_variant_builder_add(&changed, "{sv}", name, g_variant_new_boolean(value));
+      g_dbus_connection_emit_signal(connection, nullptr, session_path, "org.freedesktop.DBus.Properties", "PropertiesChanged", g_variant_new("(sa{sv}as)", "org.freedesktop.login1.Session", &changed, nullptr), nullptr);
+      g_dbus_connection_flush_sync(connection, nullptr, nullptr);
+    }
+
+    void set_screensaver(bool value) {
+      screensaver = value;
+      g_dbus_connection_emit_signal(connection, nullptr, "/org/freedesktop/ScreenSaver", "org.freedesktop.ScreenSaver", "ActiveChanged", g_variant_new("(b)", value), nullptr);
+      g_dbus_connection_flush_sync(connection, nullptr, nullptr);
+    }
+
+  private:
+    GDBusConnection *connection = nullptr;
+    GDBusNodeInfo *info = nullptr;
+    guint objects[3] = {};
+    guint logind_name = 0;
+    guint screensaver_name = 0;
+    int owned = 0;  // name requests finished
+    int acquired = 0;
+
+    static void on_acquired(GDBusConnection *, const gchar *, gpointer data) {
+      auto *self = static_cast<StubSession *>(data);
+      ++self->owned;
+      ++self->acquired;
+    }
+
+    static void on_lost(GDBusConnection *, const gchar *, gpointer data) {
+      ++static_cast<StubSession *>(data)->owned;
+    }
+
+    static void handle_method(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *method, GVariant *, GDBusMethodInvocation *invocation, gpointer data) {
+      auto *self = static_cast<StubSession *>(data);
+      if (g_strcmp0(method, "GetSession") == 0) {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", session_path));
+      } else {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(b)", self->screensaver));
+      }
+    }
+
+    static GVariant *handle_get_property(GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *property, GError **, gpointer data) {
+      auto *self = static_cast<StubSession *>(data);
+      return g_variant_new_boolean(g_strcmp0(property, "LockedHint") == 0 ? self->locked : self->idle);
+    }
+  };
+
+  struct tray session_tray = {
+    .icon = "mail-message-new",
+  };
+}  // namespace
+#endif
+
+class TraySessionTest: public LinuxTest {
+protected:
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    tray_set_session_suspend(0);
+    tray_set_session_state(TRAY_SESSION_ACTIVE);
+    LinuxTest::TearDown();
+  }
+};
+
+TEST_F(TraySessionTest, LockAndIdleFollowLogindAndTheScreensaver) {
+#ifdef __linux__
+  if (tray_set_backend("appindicator") != 0) {
+    GTEST_SKIP_("Skipping, needs a display.");
+  }
+  PrivateBus bus;
+  if (!bus.start(true)) {
+    GTEST_SKIP_("Skipping, needs dbus-daemon.");
+  }
+  StubSession session;
+  ASSERT_TRUE(session.start(bus.address));
+  session.locked = true;
+
+  tray_set_session_suspend(1);
+  int result = tray_init(&session_tray);
+  if (result == -2) {
+    GTEST_SKIP_("Skipping, the backend wants a tray host on the session bus.");
+  }
+  ASSERT_EQ(result, 0);
+
+  // Read when the tray starts
+  ASSERT_TRUE(pump([]() {
+    return tray_get_session_state() == TRAY_SESSION_LOCKED;
+  }));
+
+  // Updates wait for the unlock
+  struct tray_stats before;
+  tray_get_stats(&before);
+  tray_update_icon(&session_tray);
+  struct tray_stats stats;
+  tray_get_stats(&stats);
+  EXPECT_EQ(stats.deferred_updates - before.deferred_updates, 1u);
+
+  session.set_hint("LockedHint", false);
+  ASSERT_TRUE(pump([]() {
+    return tray_get_session_state() == TRAY_SESSION_ACTIVE;
+  }));
+
+  // The screensaver and the idle hint both make the session idle
+  session.set_screensaver(true);
+  ASSERT_TRUE(pump([]() {
+    return tray_get_session_state() == TRAY_SESSION_IDLE;
+  }));
+  session.set_screensaver(false);
+  ASSERT_TRUE(pump([]() {
+    return tray_get_session_state() == TRAY_SESSION_ACTIVE;
+  }));
+  session.set_hint("IdleHint", true);
+  ASSERT_TRUE(pump([]() {
+    return tray_get_session_state() == TRAY_SESSION_IDLE;
+  }));
+
+  // Exiting forgets the state, as nothing reports the return any more
+  tray_exit();
+  pump([]() {
+    return tray_loop(0) == -1;
+  });
+  EXPECT_EQ(tray_get_session_state(), TRAY_SESSION_ACTIVE);
+#endif
+}
@@ -0,0 +1,144 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// standard includes
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#if defined(__linux__)
+  #include <filesystem>
+  #include <unistd.h>
+#endif
+
+// local includes
+#include "src/tray.h"
+
+namespace {
+  /**
+   * @brief Resource usage of the test process.
+   */
+  struct Usage {
+    long rssKiB = -1;  ///< Resident set size, -1 where it cannot be read.
+    long fds = -1;  ///< Open file descriptors, -1 where they cannot be counted.
+    long liveObjects[TRAY_OBJECT_TYPES] = {};  ///< From tray_stats.
+  };
+
+  Usage measure() {
+    Usage usage;
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0;
+    long resident = 0;
+    if (statm >> pages >> resident) {
+      usage.rssKiB = resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+    usage.fds = 0;
+    for ([[maybe_unused]] const auto &entry : std::filesystem::directory_iterator("/proc/self/fd")) {
+      ++usage.fds;
+    }
+#endif
+    struct tray_stats stats;
+    tray_get_stats(&stats);
+    for (int i = 0; i < TRAY_OBJECT_TYPES; ++i) {
+      usage.liveObjects[i] = stats.live_objects[i];
+    }
+    return usage;
+  }
+
+  long envOr(const char *name, long fallback) {
+    const char *value = std::getenv(name);
+    return value != nullptr && value[0] != '\0' ? std::strtol(value, nullptr, 10) : fallback;
+  }
+
+  void item_cb(struct tray_menu *) {}
+
+  void notification_cb() {}
+}  // namespace
+
+/**
+ * @brief Accelerated soak of the active backend: updates, notifications and re-inits.
+ *
+ * The defaults keep the test quick; raise TRAY_SOAK_CYCLES and TRAY_SOAK_UPDATES
+ * (e.g. 200 and 10000 for two million updates) for a long run.
+ */
+class TraySoakTest: public BaseTest {
+protected:
+  static constexpr long maxRssGrowthKiB = 8 * 1024;  ///< Allocator and toolkit caches settle well below this.
+
+  struct tray_menu submenu[3] = {
+    {.text = "Nested", .cb = item_cb},
+    {.text = "-"},
+    {.text = nullptr}
+  };
+  struct tray_menu menu[4] = {
+    {.text = "Item", .cb = item_cb},
+    {.text = "Toggle", .checkbox = 1, .cb = item_cb},
+    {.text = "More", .submenu = submenu},
+    {.text = nullptr}
+  };
+  struct tray testTray = {
+    .icon = "mail-message-new",
+    .tooltip = "TraySoakTest",
+    .notification_icon = "mail-message-new",
+    .notification_cb = notification_cb,
+    .menu = menu,
+  };  // last, it ends in a flexible array member
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    // Without a desktop session the shared code paths are still worth soaking
+    if (tray_init(&testTray) == -2) {
+      tray_set_backend("headless");
+    } else {
+      tray_exit();
+      for (int i = 0; i < 100 && tray_loop(0) == 0; ++i) {}
+    }
+  }
+
+  void TearDown() override {
+    tray_set_backend(nullptr);
+    BaseTest::TearDown();
+  }
+
+  void cycle(long updates) {
+    ASSERT_EQ(tray_init(&testTray), 0);
+    for (long i = 0; i < updates; ++i) {
+      menu[1].checked = static_cast<int>(i & 1);
+      // Every eighth update also posts a notification
+      testTray.notification_title = (i % 8) == 0 ? "Soak" : nullptr;
+      testTray.notification_text = (i % 8) == 0 ? "Soak test notification" : nullptr;
+      tray_update(&testTray);
+      ASSERT_EQ(tray_loop(0), 0);
+    }
+    tray_exit();
+    for (int i = 0; i < 100 && tray_loop(0) == 0; ++i) {}
+  }
+};
+
+TEST_F(TraySoakTest, RepeatedUseDoesNotGrow) {
+  const long cycles = envOr("TRAY_SOAK_CYCLES", 20);
+  const long updates = envOr("TRAY_SOAK_UPDATES", 2000);
+
+  // Toolkits and the allocator size their caches during the first cycles
+  cycle(updates);
+  cycle(updates);
+  ASSERT_FALSE(HasFatalFailure());
+  Usage before = measure();
+
+  for (long i = 0; i < cycles && !HasFatalFailure(); ++i) {
+    cycle(updates);
+  }
+  Usage after = measure();
+
+  std::cout << "backend " << tray_get_backend() << ", " << cycles * updates << " updates"
+            << ", RSS " << before.rssKiB << " -> " << after.rssKiB << " KiB"
+            << ", fds " << before.fds << " -> " << after.fds << std::endl;
+  if (before.rssKiB >= 0 && after.rssKiB >= 0) {
+    EXPECT_LE(after.rssKiB - before.rssKiB, maxRssGrowthKiB);
+  }
+  EXPECT_EQ(after.fds, before.fds);
+  for (int i = 0; i < TRAY_OBJECT_TYPES; ++i) {
+    EXPECT_EQ(after.liveObjects[i], before.liveObjects[i]) << "tray_object_type " << i;
+    EXPECT_EQ(after.liveObjects[i], 0) << "tray_object_type " << i;
+  }
+}
@@ -0,0 +1,135 @@
+// test includes
+#include "tests/conftest.cpp"
+
+// Delay points are compiled into the test build only
+#if TRAY_DELAY_POINTS
+
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "src/tray.h"
+#include "src/tray_internal.h"
+
+namespace {
+  constexpr auto maxUpdateLatency = std::chrono::seconds(2);  ///< Generous enough for ThreadSanitizer builds.
+  constexpr auto roundTimeout = std::chrono::seconds(30);  ///< A round still running by then has deadlocked.
+
+  std::minstd_rand &threadRng() {
+    thread_local std::minstd_rand rng(static_cast<unsigned int>(std::hash<std::thread::id> {}(std::this_thread::get_id())));
+    return rng;
+  }
+
+  void randomDelay(const char *) {
+    // Most points pass straight through, so that the interleavings stay varied
+    std::minstd_rand &rng = threadRng();
+    if (rng() % 4 == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+    }
+  }
+
+  long envOr(const char *name, long fallback) {
+    const char *value = std::getenv(name);
+    return value != nullptr && value[0] != '\0' ? std::strtol(value, nullptr, 10) : fallback;
+  }
+}  // namespace
+
+/**
+ * @brief Races tray_update(), tray_wakeup() and tray_exit() against the loop thread.
+ *
+ * Every hand-off step may be delayed at random through tray_delay_hook. Build with
+ * -DTRAY_SANITIZER=thread and raise TRAY_STRESS_ROUNDS for a longer run.
+ */
+class TrayStressTest: public BaseTest {
+protected:
+  struct tray testTray = {
+    .icon = "icon",
+    .tooltip = "TrayStressTest",
+  };  // last, it ends in a flexible array member
+
+  void SetUp() override {
+    BaseTest::SetUp();
+    tray_set_backend("headless");
+    tray_delay_hook = randomDelay;
+  }
+
+  void TearDown() override {
+    tray_delay_hook = nullptr;
+    tray_set_backend(nullptr);
+    BaseTest::TearDown();
+  }
+};
+
+TEST_F(TrayStressTest, UpdateExitAndLoopRaceWithoutDeadlock) {
+  const long rounds = envOr("TRAY_STRESS_ROUNDS", 20);
+  constexpr int producers = 6;
+  constexpr int exiters = 2;
+
+  long long maxLatencyUs = 0;
+  for (long round = 0; round < rounds; ++round) {
+    std::atomic<bool> started {false};
+    std::atomic<bool> loopDone {false};
+    std::atomic<long long> roundMaxUs {0};
+    std::vector<std::thread> threads;
+
+    // The loop thread owns the tray, like an application's UI thread
+    threads.emplace_back([this, &started, &loopDone]() {
+      if (tray_init(&testTray) == 0) {
+        started = true;
+        while (tray_loop(1) == 0) {}
+      }
+      started = true;
+      loopDone = true;
+    });
+    while (!started) {
+      std::this_thread::yield();
+    }
+
+    for (int i = 0; i < producers; ++i) {
+      threads.emplace_back([this, &loopDone, &roundMaxUs]() {
+        while (!loopDone) {
+          auto start = std::chrono::steady_clock::now();
+          if (threadRng()() % 8 == 0) {
+            tray_wakeup();
+          } else {
+            tray_update(&testTray);
+          }
+          long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+          long long seen = roundMaxUs.load();
+          while (us > seen && !roundMaxUs.compare_exchange_weak(seen, us)) {}
+        }
+      });
+    }
+    for (int i = 0; i < exiters; ++i) {
+      threads.emplace_back([]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(threadRng()() % 5000));
+        tray_exit();
+      });
+    }
+
+    // A deadlocked thread can never be joined, so give up on the whole process
+    std::future<void> joined = std::async(std::launch::async, [&threads]() {
+      for (auto &thread : threads) {
+        thread.join();
+      }
+    });
+    if (joined.wait_for(roundTimeout) == std::future_status::timeout) {
+      std::cerr << "TrayStressTest: round " << round << " did not finish, the update hand-off deadlocked" << std::endl;
+      std::abort();
+    }
+    maxLatencyUs = std::max(maxLatencyUs, roundMaxUs.load());
+  }
+
+  std::cout << rounds << " rounds, slowest call " << maxLatencyUs << " us" << std::endl;
+  EXPECT_LT(maxLatencyUs, std::chrono::duration_cast<std::chrono::microseconds>(maxUpdateLatency).count());
+}
+#endif
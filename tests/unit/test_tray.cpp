@@ -1,6 +1,12 @@
 // test includes
 #include "tests/conftest.cpp"
 
+// standard includes
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
 #if defined(_WIN32) || defined(_WIN64)
   #define TRAY_WINAPI 1
 #elif defined(__linux__) || defined(linux) || defined(__linux)
@@ -15,12 +21,15 @@
 #if TRAY_APPINDICATOR
   #define TRAY_ICON1 "mail-message-new"
   #define TRAY_ICON2 "mail-message-new"
+  #define TRAY_ICON_FILE "icon.png"
 #elif TRAY_APPKIT
   #define TRAY_ICON1 "icon.png"
   #define TRAY_ICON2 "icon.png"
+  #define TRAY_ICON_FILE "icon.png"
 #elif TRAY_WINAPI
   #define TRAY_ICON1 "icon.ico"
   #define TRAY_ICON2 "icon.ico"
+  #define TRAY_ICON_FILE "icon.ico"
 #endif
 
 class TrayTest: public BaseTest {
@@ -132,6 +141,50 @@ TEST_F(TrayTest, TestToggleCallback) {
   EXPECT_EQ(testTray.menu[1].checked, !initialCheckedState);
 }
 
+TEST_F(TrayTest, TestMenuIconsShareDecodedImages) {
+  // Five icon files no tray or menu has shown yet
+  std::filesystem::path source = std::filesystem::absolute(TRAY_ICON_FILE);
+  ASSERT_TRUE(std::filesystem::exists(source));
+  std::vector<std::string> icons;
+  for (int i = 0; i < 5; ++i) {
+    std::filesystem::path icon = testBinaryDir / ("test_menu_icon_" + std::to_string(i) + source.extension().string());
+    std::filesystem::copy_file(source, icon, std::filesystem::copy_options::overwrite_existing);
+    icons.push_back(icon.string());
+  }
+  std::vector<struct tray_menu> items(301);  // the last one terminates the menu
+  for (size_t i = 0; i + 1 < items.size(); ++i) {
+    items[i].text = "Item";
+    items[i].icon = icons[i % icons.size()].c_str();
+  }
+  struct tray_stats before;
+  tray_get_stats(&before);
+  testTray.menu = items.data();
+  tray_update(&testTray);
+
+  // One image per file for all 300 items, once the menu is built
+  struct tray_stats after;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  do {
+    tray_loop(0);
+    tray_get_stats(&after);
+  } while (after.live_objects[TRAY_OBJECT_ICON] - before.live_objects[TRAY_OBJECT_ICON] < 5 && std::chrono::steady_clock::now() < deadline);
+  EXPECT_EQ(after.live_objects[TRAY_OBJECT_ICON] - before.live_objects[TRAY_OBJECT_ICON], 5);
+
+  // A rebuild decodes nothing
+  items[0].text = "First";
+  tray_update(&testTray);
+  tray_loop(0);
+  struct tray_stats rebuilt;
+  tray_get_stats(&rebuilt);
+  EXPECT_EQ(rebuilt.live_objects[TRAY_OBJECT_ICON], after.live_objects[TRAY_OBJECT_ICON]);
+
+  testTray.menu = submenu;
+  tray_update(&testTray);
+  for (const std::string &icon : icons) {
+    std::filesystem::remove(icon);
+  }
+}
+
 TEST_F(TrayTest, TestTrayExit) {
   tray_exit();
   // TODO: Check the state after tray_exit
@@ -2,6 +2,10 @@
  * @file utils.cpp
  * @brief Utility functions
  */
+// standard includes
+#include <cstdlib>
+#include <thread>
+
 // test includes
 #include "utils.h"
 
@@ -18,3 +22,73 @@ int setEnv(const std::string &name, const std::string &value) {
   return setenv(name.c_str(), value.c_str(), 1);
 #endif
 }
+
+/**
+ * @brief Remove an environment variable.
+ * @param name Name of the environment variable
+ * @return 0 on success, non-zero error code on failure
+ */
+int unsetEnv(const std::string &name) {
+#ifdef _WIN32
+  return _putenv_s(name.c_str(), "");
+#else
+  return unsetenv(name.c_str());
+#endif
+}
+
+#ifdef __linux__
+bool pump(const std::function<bool()> &done, std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    if (!g_main_context_iteration(nullptr, FALSE)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+  return true;
+}
+
+PrivateBus::~PrivateBus() {
+  if (daemon == nullptr) {
+    return;
+  }
+  for (int i = 0; i < savedCount; ++i) {
+    if (saved[i].set) {
+      setEnv(saved[i].name, saved[i].value);
+    } else {
+      unsetEnv(saved[i].name);
+    }
+  }
+  g_subprocess_force_exit(daemon);
+  g_subprocess_wait(daemon, nullptr, nullptr);
+  g_object_unref(daemon);
+}
+
+bool PrivateBus::start(bool system) {
+  daemon = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, nullptr, "dbus-daemon", "--session", "--nofork", "--print-address", nullptr);
+  if (daemon == nullptr) {
+    return false;
+  }
+  GDataInputStream *out = g_data_input_stream_new(g_subprocess_get_stdout_pipe(daemon));
+  gchar *line = g_data_input_stream_read_line(out, nullptr, nullptr, nullptr);
+  g_object_unref(out);
+  if (line == nullptr) {
+    return false;
+  }
+  address = line;
+  g_free(line);
+
+  const char *names[] = {"DBUS_SESSION_BUS_ADDRESS", "DBUS_SYSTEM_BUS_ADDRESS"};
+  savedCount = system ? 2 : 1;
+  for (int i = 0; i < savedCount; ++i) {
+    const char *current = std::getenv(names[i]);
+    saved[i].name = names[i];
+    saved[i].set = current != nullptr;
+    saved[i].value = current != nullptr ? current : "";
+    setEnv(names[i], address);
+  }
+  return true;
+}
+#endif
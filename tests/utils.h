@@ -5,6 +5,56 @@
 #pragma once
 
 // standard includes
+#include <chrono>
+#include <functional>
 #include <string>
 
+// lib includes
+#ifdef __linux__
+  #include <gio/gio.h>
+#endif
+
 int setEnv(const std::string &name, const std::string &value);
+
+int unsetEnv(const std::string &name);
+
+#ifdef __linux__
+/**
+ * @brief Run the default GLib main context, which also dispatches the tray, until done() or the timeout.
+ * @param done Checked before each iteration.
+ * @param timeout Longest time to wait for done().
+ * @return true if done() returned true in time.
+ */
+bool pump(const std::function<bool()> &done, std::chrono::milliseconds timeout = std::chrono::seconds(10));
+
+/**
+ * @brief A dbus-daemon of its own, made the session bus, and optionally the system bus, of this process while it runs.
+ */
+class PrivateBus {
+public:
+  ~PrivateBus();
+
+  /**
+   * @brief Start the daemon and point the bus address variables at it.
+   * @param system Whether to make it the system bus as well.
+   * @return true on success.
+   */
+  bool start(bool system = false);
+
+  std::string address;  ///< Address printed by the daemon.
+
+private:
+  /**
+   * @brief An environment variable as it was before start().
+   */
+  struct SavedEnv {
+    std::string name;  ///< Name of the variable.
+    bool set = false;  ///< Whether it was set.
+    std::string value;  ///< Its value, if set.
+  };
+
+  GSubprocess *daemon = nullptr;
+  SavedEnv saved[2];
+  int savedCount = 0;
+};
+#endif